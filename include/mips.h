@@ -6,6 +6,8 @@
 
 #include "mips_mem.h"
 #include "mips_cpu.h"
+#include "mips_elf.h"
+#include "mips_trace.h"
 #include "mips_test.h"
 
 #endif
@@ -110,6 +110,114 @@ mips_error mips_cpu_step(
 	mips_cpu_h state	//! Valid (non-empty) handle to a CPU
 );
 
+/*! Advances the processor by up to max_steps instructions.
+
+	This is an extension to the required API. It behaves exactly
+	like calling mips_cpu_step in a loop until it fails, but runs
+	the loop inside the simulator, so it is much faster:
+	
+		uint64_t steps;
+		mips_error err=mips_cpu_run(cpu, 1000000, &steps);
+		// steps instructions completed, and if err!=mips_Success
+		// the pc is on the instruction which raised err
+	
+	Returns mips_Success if all max_steps instructions were executed,
+	otherwise the error of the instruction that failed, with the CPU
+	left as mips_cpu_step would leave it.
+*/
+mips_error mips_cpu_run(
+	mips_cpu_h state,			//!< Valid (non-empty) handle to a CPU
+	uint64_t max_steps,			//!< Maximum number of instructions to execute
+	uint64_t *steps_executed	//!< If non-empty, receives the number of instructions completed
+);
+
+/*! Advances the processor until the pc reaches stop_pc.
+
+	As mips_cpu_run, but also returns mips_Success, without executing
+	it, as soon as the next instruction to execute is at stop_pc. This
+	is useful to run a function until it returns to a sentinel address:
+	
+		mips_cpu_set_register(cpu, 31, sentinelPC);
+		mips_error err=mips_cpu_run_until(cpu, sentinelPC, UINT64_MAX, &steps);
+	
+	Use mips_cpu_get_pc to tell whether stop_pc was reached or the step
+	budget ran out.
+*/
+mips_error mips_cpu_run_until(
+	mips_cpu_h state,			//!< Valid (non-empty) handle to a CPU
+	uint32_t stop_pc,			//!< Address to stop at
+	uint64_t max_steps,			//!< Maximum number of instructions to execute
+	uint64_t *steps_executed	//!< If non-empty, receives the number of instructions completed
+);
+
+/*! One independent program for \ref mips_cpu_run_batch.
+
+	The caller creates and loads the CPU (and its memory) and fills in
+	the first four fields; the batch fills in the last two.
+*/
+typedef struct mips_cpu_job{
+	mips_cpu_h cpu;			//!< CPU to run, in a batch it must not share its memory with another job
+	uint64_t max_steps;		//!< Maximum number of instructions to execute
+	unsigned use_stop_pc;	//!< If non-zero, stop when the PC reaches stop_pc
+	uint32_t stop_pc;		//!< Address to stop at, see mips_cpu_run_until
+	mips_error result;		//!< Receives what mips_cpu_run (or _until) returned
+	uint64_t steps;			//!< Receives the number of instructions completed
+} mips_cpu_job;
+
+/*! Runs many independent CPUs at once, spread over a pool of threads.
+
+	Each job is run with mips_cpu_run or mips_cpu_run_until on one of the
+	threads. Every thread starts with an equal share of the jobs, and a
+	thread that runs out takes jobs from the back of another thread's
+	share, so a few long programs do not leave the other threads idle.
+	The function returns once every job has finished:
+
+		std::vector<mips_cpu_job> jobs(inputs.size());
+		for(unsigned i=0; i<jobs.size(); i++){
+			mips_mem_h mem=mips_mem_create_sparse();
+			jobs[i].cpu=mips_cpu_create(mem);
+			... load the program and inputs[i] ...
+			jobs[i].max_steps=1000000;
+			jobs[i].use_stop_pc=1;
+			jobs[i].stop_pc=sentinelPC;
+		}
+		mips_cpu_run_batch(&jobs[0], jobs.size(), 0);
+
+	Jobs must not share a CPU or a memory.
+
+	\param threads Number of threads to use, or 0 for one per host core.
+*/
+mips_error mips_cpu_run_batch(
+	mips_cpu_job *jobs,		//!< Array of jobs to run
+	unsigned count,			//!< Number of jobs in the array
+	unsigned threads		//!< Number of threads, 0 for the number of cores
+);
+
+/*! Runs several CPUs that share one memory, like a multi-core chip.
+
+	The jobs are filled in as for \ref mips_cpu_run_batch, but here
+	they are expected to share a memory (see mips_mem.h for what
+	is promised about accesses from different CPUs). LL and SC are
+	supported, so the programs can build locks and counters on them.
+
+	With quantum>0 the CPUs take turns on the calling thread: each
+	runs up to quantum instructions, in the order of the jobs, until
+	every job is finished. This is slower, but the interleaving is
+	always the same, so a test gives the same result on every run.
+
+	With quantum=0 every CPU runs on its own thread at full speed,
+	and the interleaving is whatever the host makes of it.
+
+	Each job is finished once its CPU fails, reaches stop_pc (if
+	use_stop_pc is set) or has executed max_steps instructions.
+	A CPU must not be in more than one job.
+*/
+mips_error mips_cpu_run_smp(
+	mips_cpu_job *jobs,		//!< Array of jobs to run, one per CPU
+	unsigned count,			//!< Number of jobs in the array
+	unsigned quantum		//!< Instructions per turn, 0 to run the CPUs on threads
+);
+
 /*! Controls printing of diagnostic and debug messages.
 
 	You are encouraged to include diagnostic and debugging
@@ -184,9 +292,305 @@ mips_error mips_cpu_step(
 	However, you could decide that you want to print something out
 	at the point that mips_cpu_set_debug_level is called with level>0,
 	such as the current PC and registers. Up to you.
+
+	This simulator prints every level to dest, or to stdout when dest
+	is NULL: level 1 prints the instruction and the next PC, level 2
+	adds HI, LO and the registers, and level 3 prints the same in a
+	denser layout.
 */
 mips_error mips_cpu_set_debug_level(mips_cpu_h state, unsigned level, FILE *dest);
 
+/*! Starts or stops a binary trace of every executed instruction.
+
+	This is an extension to the required API. Where the debug levels
+	print text as they go, the trace fills one small record per
+	instruction (pc, instruction word, register written and its new
+	value, memory address and data, error) into a buffer that a
+	background thread compresses into a trace file (see mips_trace.h).
+	This is quick enough to keep a full trace of a long run:
+
+		FILE *trace=fopen("run.trace", "wb");
+		mips_cpu_set_trace(cpu, trace);
+		mips_cpu_run(cpu, 100000000, &steps);
+		mips_cpu_set_trace(cpu, NULL);	// Writes out the rest and the index
+		fclose(trace);
+
+	The file can be read back with mips_trace_reader_open, or printed as
+	the text of any debug level with bin/mips_trace. Like the debug
+	levels, the trace makes mips_cpu_run step one instruction at a time.
+
+	\param dest File opened for binary writing, or NULL to stop the trace.
+	It is not closed by the CPU.
+*/
+mips_error mips_cpu_set_trace(mips_cpu_h state, FILE *dest);
+
+/*! Switches translation of hot code to native code on or off.
+
+	This is an extension to the required API. When it is on, blocks
+	of instructions which are run many times are translated to native
+	code for the host, and everything else is interpreted as before.
+	The state seen through the other functions is identical either way,
+	so runs with and without it can be compared against each other.
+	
+	Only code run several instructions at a time is translated,
+	single steps with mips_cpu_step are always interpreted. The default
+	is off.
+	
+	\param state Valid (non-empty) CPU handle.
+	
+	\param enable Non-zero to turn translation on.
+	
+	Returns mips_ErrorNotImplemented if the host is not supported.
+*/
+mips_error mips_cpu_set_jit(mips_cpu_h state, unsigned enable);
+
+/*! Starts or stops counting the instructions the CPU retires.
+
+	This is an extension to the required API. While the profile is
+	on, every instruction that completes is counted per opcode, per
+	PC and per basic block (a straight run of code entered after a
+	branch or jump and its delay slot). Each conditional branch is
+	counted as taken or not taken, and the bytes moved by loads and
+	stores are added up. Nothing is sampled, so the counts are exact:
+
+		mips_cpu_set_profile(cpu, 1);
+		mips_cpu_run(cpu, 100000000, &steps);
+		mips_cpu_set_profile(cpu, 0);
+		mips_cpu_write_profile(cpu, stdout, mips_profile_Report);
+
+	Like the trace, profiling makes mips_cpu_run step one instruction
+	at a time. When it is off nothing is counted and the CPU runs at
+	full speed.
+
+	\param enable Non-zero starts a new profile, dropping any earlier
+	counts. Zero stops counting and keeps the counts so they can be
+	written out.
+*/
+mips_error mips_cpu_set_profile(mips_cpu_h state, unsigned enable);
+
+/*! Formats mips_cpu_write_profile can write. */
+typedef enum mips_profile_format{
+	mips_profile_Report=0,	//!< Sorted hot spot report to read
+	mips_profile_JSON=1,	//!< Every count as one JSON object
+	mips_profile_CSV=2		//!< Every count as a row of one CSV table
+} mips_profile_format;
+
+/*! Writes the counts of the last profile, which may still be running.
+
+	The report lists the opcodes by use, then the hottest instructions
+	and basic blocks with their share of all instructions. The JSON and
+	CSV dumps hold every opcode, PC and block that was seen, sorted the
+	same way.
+
+	Returns mips_ErrorInvalidArgument if profiling was never started.
+*/
+mips_error mips_cpu_write_profile(mips_cpu_h state, FILE *dest, mips_profile_format format);
+
+/*! A copy of the state of a CPU and of its memory. \struct mips_cpu_snapshot_impl */
+struct mips_cpu_snapshot_impl;
+typedef struct mips_cpu_snapshot_impl *mips_cpu_snapshot_h;
+
+/*! Takes a snapshot of the CPU (pc, registers, hi and lo) and of its memory.
+
+	This is an extension to the required API. A run can be put back to
+	the point the snapshot was taken as often as needed, which is much
+	quicker than running there again:
+
+		mips_cpu_run(cpu, bootSteps, &steps);		// Boot once
+		mips_cpu_snapshot_h booted;
+		mips_cpu_snapshot(cpu, &booted);
+		for(int i=0; i<tests; i++){
+			mips_cpu_restore(cpu, booted);		// Back to just after the boot
+			... run test i ...
+		}
+		mips_cpu_snapshot_free(booted);
+
+	Only the pages of memory written since the previous snapshot are
+	copied, see \ref mips_mem_snapshot. No CPU sharing the memory may be
+	running while a snapshot is taken or restored.
+*/
+mips_error mips_cpu_snapshot(mips_cpu_h state, mips_cpu_snapshot_h *snapshot);
+
+/*! Puts the CPU and its memory back in the state of the snapshot.
+
+	The snapshot may come from another CPU, or from a file, so a run can
+	also be continued on a new CPU and memory. An LL reservation does
+	not survive the restore.
+*/
+mips_error mips_cpu_restore(mips_cpu_h state, mips_cpu_snapshot_h snapshot);
+
+/*! Writes a snapshot to a file opened for binary writing, which is not closed. */
+mips_error mips_cpu_snapshot_save(mips_cpu_snapshot_h snapshot, FILE *dest);
+
+/*! Reads a snapshot written by mips_cpu_snapshot_save. Returns
+	mips_ErrorFileReadError if the file does not hold one. */
+mips_error mips_cpu_snapshot_load(FILE *src, mips_cpu_snapshot_h *snapshot);
+
+/*! Releases a snapshot, releasing an empty (zero) handle is legal. */
+void mips_cpu_snapshot_free(mips_cpu_snapshot_h snapshot);
+
+/*! Starts or stops keeping the history of the CPU, so it can go backwards.
+
+	This is an extension to the required API. While the history is on,
+	a snapshot of the CPU is taken every interval instructions it
+	retires. Going back restores the last one before the target and runs
+	forward from there, so a fault found far into a run can be looked at
+	from just before it happened:
+
+		mips_cpu_set_history(cpu, 1000000);
+		err=mips_cpu_run(cpu, 100000000, &steps);	// Stops on a fault
+		mips_cpu_run_back_to(cpu, 0x80001000, &back);	// Last call of the handler
+		mips_cpu_step_back(cpu, 1);			// The instruction before that
+
+	Going back costs a restore and at most one interval of instructions
+	run again. A long run keeps a bounded number of snapshots by dropping
+	every other one and doubling the interval. Changes made through this
+	API (registers, pc, reset, restore) are kept as snapshots of their
+	own, but changes the host makes to memory directly are not part of
+	the history, and no other CPU may be writing to the memory. Values
+	read from devices (see mips_mem_is_device) and what semihosting
+	calls did are kept too, so going back, and running forward again up
+	to where the run had got to, never reads a device or makes a call
+	twice.
+
+	\param interval Instructions between snapshots, zero drops the history.
+*/
+mips_error mips_cpu_set_history(mips_cpu_h state, uint64_t interval);
+
+/*! Takes the CPU back by a number of retired instructions.
+
+	Returns mips_ErrorInvalidArgument if the history is off or does not
+	go back that far. Running forward again after going back gives the
+	same run, unless something is changed in between.
+*/
+mips_error mips_cpu_step_back(mips_cpu_h state, uint64_t steps);
+
+/*! Takes the CPU back to the last time it was about to run the
+	instruction at pc.
+
+	\param steps_back If not NULL, receives the instructions gone back.
+
+	Returns mips_ErrorInvalidArgument if the history is off or the CPU was
+	not at pc since it started, in which case the CPU stays where it is.
+*/
+mips_error mips_cpu_run_back_to(mips_cpu_h state, uint32_t pc, uint64_t *steps_back);
+
+/*! Starts or stops logging everything the run takes from outside the CPU.
+
+	This is an extension to the required API. A run started in the same
+	state only differs from the last one by what the devices return (see
+	mips_mem_is_device), by what the host changes in between
+	instructions, and by what it answers to semihosting calls. While
+	recording, every value read from a device, every register, pc or
+	reset set through this API, and the registers and memory each call
+	set, are written to dest with the number of instructions retired
+	before it. Replaying the log
+	with mips_cpu_set_replay then gives the same run, bit for bit:
+
+		mips_cpu_set_record(cpu, log);		// Run with the real devices
+		... mips_cpu_run, mips_cpu_set_register, ...
+		mips_cpu_set_record(cpu, NULL);
+
+		... load the program into a new memory and CPU ...
+		mips_cpu_set_replay(cpu2, log);		// log opened again to read
+		mips_cpu_run(cpu2, steps, &steps);	// Same reads, same changes, same run
+
+	The log is written an entry at a time as it happens, and takes a few
+	bytes per entry, so a run of any length can be recorded. Reads of
+	plain memory are not logged. Like the trace, the log makes mips_cpu_run
+	step one instruction at a time, so that each entry has its exact
+	instruction count.
+
+	\param dest File opened for binary writing, which is not closed. NULL
+	stops recording and returns mips_ErrorFileWriteError if some of the
+	log could not be written.
+*/
+mips_error mips_cpu_set_record(mips_cpu_h state, FILE *dest);
+
+/*! Starts or stops replaying a log written by mips_cpu_set_record.
+
+	The CPU and memory have to start as they were when recording
+	started. Device reads and semihosting calls are answered from the
+	log without reading the device or making the call, so nothing is
+	printed or read from a file, and the logged host changes are made
+	again at the same instruction counts, so the host does not have to
+	make them itself. An instruction that reads a device or makes a call
+	the recorded run did not at that point fails with
+	mips_ErrorFileReadError. Once the log runs out the devices are read
+	and the calls made again.
+
+	\param src File opened for binary reading, which is not closed. NULL
+	stops replaying. Returns mips_ErrorFileReadError if it is not a log.
+*/
+mips_error mips_cpu_set_replay(mips_cpu_h state, FILE *src);
+
+/*! Switches semihosting of SYSCALL on or off.
+
+	This is an extension to the required API. While it is on, SYSCALL
+	asks the host for the call numbered in $v0, with the arguments in
+	$a0-$a2 and the result in $v0, using the numbers of the MARS and
+	SPIM simulators:
+
+		 1 print int      4 print string   9 sbrk          10 exit
+		11 print char    13 open          14 read          15 write
+		16 close         17 exit($a0)     30 time
+
+	Descriptors 0, 1 and 2 are in, out and the host's stderr, which
+	close only flushes, and open takes the flags 0 (read), 1 (write)
+	and 9 (append). Files are buffered, and output is flushed when the
+	program exits or reads from descriptor 0. A failed call returns -1 in $v0, and a call
+	number that is not supported stops the run with
+	mips_ErrorNotImplemented.
+
+	When the program exits the run stops with mips_ExceptionBreak, and
+	the PC is left on the SYSCALL. BREAK, and SYSCALL while semihosting
+	is off, stop the run in the same way, so a program can end without
+	jumping to a sentinel PC:
+
+		mips_cpu_set_semihosting(cpu, 1, heapStart, NULL, NULL);
+		mips_error err=mips_cpu_run(cpu, UINT64_MAX, &steps);
+		int32_t code;
+		if(err==mips_ExceptionBreak && !mips_cpu_get_exit_code(cpu, &code))
+			... the program called exit(code) ...
+
+	\param enable Non-zero to start semihosting, zero to stop it and
+	close the files the program opened.
+
+	\param heap The first address sbrk hands out.
+
+	\param in Stream read through descriptor 0, NULL for stdin.
+
+	\param out Stream written through descriptor 1, NULL for stdout.
+*/
+mips_error mips_cpu_set_semihosting(mips_cpu_h state, unsigned enable, uint32_t heap, FILE *in, FILE *out);
+
+/*! Returns the code the program passed to exit while semihosting.
+
+	Returns mips_ErrorInvalidArgument if the program has not exited
+	since semihosting started or the CPU was reset.
+*/
+mips_error mips_cpu_get_exit_code(mips_cpu_h state, int32_t *code);
+
+/*! Names one of the instructions the CPU implements.
+
+	This is an extension to the required API, so that tools and the
+	test framework can find out which mnemonics exist without keeping
+	their own list. Instructions are numbered from 0, and the first
+	index that returns mips_ErrorInvalidArgument is the number of
+	instructions:
+
+		const char *name, *description;
+		for(unsigned i=0; !mips_cpu_get_instruction(i, &name, &description); i++)
+			printf("%s : %s\n", name, description);
+
+	\param index Which instruction.
+
+	\param mnemonic Set to the upper case mnemonic, as used by the tests.
+
+	\param description Set to a short description, may be NULL.
+*/
+mips_error mips_cpu_get_instruction(unsigned index, const char **mnemonic, const char **description);
+
 /*! Free all resources associated with state.
 
 	\param state Either a handle to a valid simulation state, or an empty (NULL) handle.
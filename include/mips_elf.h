@@ -0,0 +1,92 @@
+/*! \file mips_elf.h
+	Defines the functions used to load executables produced by a
+	MIPS toolchain (elf32-tradbigmips) into a simulated memory.
+*/
+#ifndef mips_elf_header
+#define mips_elf_header
+
+#include "mips_mem.h"
+#include "mips_cpu.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*! \defgroup mips_elf ELF Loader
+	\addtogroup mips_elf
+	@{
+*/
+
+/*! Represents a loaded executable, and keeps its symbol table.
+
+	\struct mips_elf_impl
+*/
+struct mips_elf_impl;
+
+/*! An opaque handle to a loaded executable. See \ref mips_mem_h for
+	more commentary on handles. */
+typedef struct mips_elf_impl *mips_elf_h;
+
+/*! Loads a 32-bit big-endian MIPS executable.
+
+	Every PT_LOAD segment is copied into mem at its virtual address,
+	and the part of the segment that is not in the file (.bss) is
+	filled with zeros. The PC of the CPU is set to the entry point, $sp
+	to stackPointer, and $gp to the value of the _gp symbol if the
+	executable defines one.
+
+	If elf is not 0, it receives a handle that can be used to look up
+	symbols, and that has to be released with \ref mips_elf_free:
+
+		mips_elf_h elf;
+		mips_error err=mips_elf_load(cpu, mem, "f_fibonacci-mips", 0x1000, &elf);
+		uint32_t addr;
+		if(!err)
+			err=mips_elf_find_symbol(elf, "f_fibonacci", &addr);
+
+	Returns mips_ErrorFileReadError if the file cannot be read, and
+	mips_ErrorInvalidArgument if it is not a MIPS ELF32 big-endian
+	executable. Memory errors from loading a segment are passed on.
+*/
+mips_error mips_elf_load(
+	mips_cpu_h cpu,			//!< CPU whose PC and registers are set up
+	mips_mem_h mem,			//!< Memory the segments are loaded into
+	const char *fileName,	//!< Executable to load
+	uint32_t stackPointer,	//!< Initial value of $sp
+	mips_elf_h *elf			//!< Receives the loaded executable, or 0
+);
+
+/*! Looks up the value (address) of a symbol by name.
+	Returns mips_ErrorInvalidArgument if there is no such symbol. */
+mips_error mips_elf_find_symbol(
+	mips_elf_h elf,			//!< Loaded executable
+	const char *name,		//!< Name of the symbol
+	uint32_t *value			//!< Receives the value of the symbol
+);
+
+/*! Returns the number of entries in the symbol table. */
+unsigned mips_elf_get_symbol_count(mips_elf_h elf);
+
+/*! Returns one entry of the symbol table, so all of them can be listed.
+	The name stays valid until the executable is freed. */
+mips_error mips_elf_get_symbol(
+	mips_elf_h elf,			//!< Loaded executable
+	unsigned index,			//!< From 0 to mips_elf_get_symbol_count()-1
+	const char **name,		//!< Receives the name of the symbol
+	uint32_t *value,		//!< Receives the value of the symbol
+	uint32_t *size			//!< Receives the size of the symbol, may be 0
+);
+
+/*! Releases the symbol table. The memory the executable was loaded
+	into is not touched. Freeing an empty (zero) handle is legal. */
+void mips_elf_free(mips_elf_h elf);
+
+/*!
+	@}
+*/
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -22,6 +22,13 @@
 
 #include "mips_core.h"
 
+/* The memory devices in this file can be shared by several CPUs, each
+running on its own thread. Every aligned transaction of 1, 2 or 4 bytes
+is atomic, so no CPU ever sees half of a word written by another. Apart
+from that, no order is promised between the accesses of different CPUs.
+Only mips_mem_compare_swap32 is a full barrier, so it is what
+synchronisation between CPUs has to be built on. */
+
 /* This allows the header to be used from both C and C++, so
 programs can be written in either (or both) languages. */
 #ifdef __cplusplus
@@ -162,6 +169,244 @@ mips_error mips_mem_write(
 */
 void mips_mem_free(mips_mem_h mem);
 
+/*! Returns how many pages of \ref MIPS_MEM_PAGE bytes the memory is
+    currently holding on the host. For a RAM this is fixed when it is
+    created, a sparse memory only counts the pages that were touched.
+*/
+mips_error mips_mem_get_resident_pages(
+    mips_mem_h mem,	        //!< Handle to target memory
+    uint32_t *pages	        //!< Where to write the page count to
+);
+
+/*! @} */
+
+
+/*! \defgroup mips_mem_code Cached Instructions
+    \ingroup mips_mem
+    @{
+
+    A CPU may keep decoded copies of the instructions it has fetched, so
+    it needs to know when the memory holding them is written (by itself,
+    by another CPU, or by the host through mips_mem_write).
+
+    The CPU marks each address it caches with mips_mem_watch_code. Any
+    later write to a watched line of memory increments the code generation
+    of the memory space, and stops watching that line. The CPU compares the
+    generation against the one it cached with, and drops its cached
+    instructions when they differ:
+
+        uint32_t gen;
+        mips_mem_get_code_generation(mem, &gen);
+        if(gen!=cachedGen){
+            ... forget everything decoded so far ...
+        }
+*/
+
+/*! Lines of this many bytes are watched as one unit. */
+#define MIPS_MEM_CODE_LINE 256
+
+/*! Start watching the line of memory containing address for writes. */
+mips_error mips_mem_watch_code(
+    mips_mem_h mem,	        //!< Handle to target memory
+    uint32_t address	    //!< Byte address of a cached instruction
+);
+
+/*! Returns the number of writes that have hit watched lines so far. */
+mips_error mips_mem_get_code_generation(
+    mips_mem_h mem,	        //!< Handle to target memory
+    uint32_t *generation	//!< Where to write the generation to
+);
+
+/*! @} */
+
+
+/*! \defgroup mips_mem_fast Word and Block Access
+    \ingroup mips_mem
+    @{
+
+    Convenience transactions that do the big-endian conversion and
+    copying in one call, instead of shuffling bytes through mips_mem_read
+    and mips_mem_write. Words and half words have to be aligned like
+    the transactions of mips_mem_read. Writes through any of these
+    functions are seen by \ref mips_mem_code like any other write.
+*/
+
+/*! Reads the big-endian word at address, and returns it as a host value. */
+mips_error mips_mem_read32(
+    mips_mem_h mem,	        //!< Handle to target memory
+    uint32_t address,	    //!< Byte address of the word, multiple of 4
+    uint32_t *value	        //!< Receives the word
+);
+
+/*! Reads the big-endian half word at address, and returns it as a host value. */
+mips_error mips_mem_read16(
+    mips_mem_h mem,	        //!< Handle to target memory
+    uint32_t address,	    //!< Byte address of the half word, multiple of 2
+    uint16_t *value	        //!< Receives the half word
+);
+
+/*! Stores a host value as a big-endian word at address. */
+mips_error mips_mem_write32(
+    mips_mem_h mem,	        //!< Handle to target memory
+    uint32_t address,	    //!< Byte address of the word, multiple of 4
+    uint32_t value	        //!< Word to store
+);
+
+/*! Stores a host value as a big-endian half word at address. */
+mips_error mips_mem_write16(
+    mips_mem_h mem,	        //!< Handle to target memory
+    uint32_t address,	    //!< Byte address of the half word, multiple of 2
+    uint16_t value	        //!< Half word to store
+);
+
+/*! Atomically replaces the word at address with desired, but only if it
+    currently holds expected. *swapped is set to 1 if the word was
+    replaced and 0 if it was not, in which case the memory is unchanged.
+
+    This is what a CPU uses to implement an atomic read-modify-write
+    (for example LL/SC) when several CPUs share the memory.
+*/
+mips_error mips_mem_compare_swap32(
+    mips_mem_h mem,	        //!< Handle to target memory
+    uint32_t address,	    //!< Byte address of the word, multiple of 4
+    uint32_t expected,	    //!< Value the word has to hold, as a host value
+    uint32_t desired,	    //!< Value to store, as a host value
+    unsigned *swapped	    //!< Receives 1 if desired was stored, 0 otherwise
+);
+
+/*! Copies length bytes starting at address out of the memory, with no
+    alignment requirements. This is meant for loaders and debuggers, so
+    that a whole image does not have to be moved four bytes at a time.
+*/
+mips_error mips_mem_read_block(
+    mips_mem_h mem,	        //!< Handle to target memory
+    uint32_t address,	    //!< Byte address to start at
+    uint32_t length,	    //!< Number of bytes to copy
+    uint8_t *dataOut	    //!< Receives the bytes
+);
+
+/*! Copies length bytes into the memory starting at address, with no
+    alignment requirements. For example, to load a program image:
+
+        mips_mem_write_block(mem, 0, imageLength, imageBytes);
+*/
+mips_error mips_mem_write_block(
+    mips_mem_h mem,	        //!< Handle to target memory
+    uint32_t address,	    //!< Byte address to start at
+    uint32_t length,	    //!< Number of bytes to copy
+    const uint8_t *dataIn	//!< Bytes to copy
+);
+
+/*! If the memory is a single flat RAM, returns its storage so that
+    reads can be done in place. Returns mips_ErrorNotImplemented for
+    any other kind of memory. The storage is only ever read through
+    this pointer, writes still have to go through the functions above.
+*/
+mips_error mips_mem_get_ram(
+    mips_mem_h mem,	        //!< Handle to target memory
+    const uint8_t **data,	//!< Receives the first byte of the RAM
+    uint32_t *length	    //!< Receives the size of the RAM in bytes
+);
+
+/*! Pages of this many bytes are handed out by mips_mem_map_page. */
+#define MIPS_MEM_PAGE 4096
+
+/*! Gives direct access to the page containing address, so that a CPU
+    can keep a translation of guest pages to host pointers and only use
+    the transactions above when there is no translation.
+
+    On success *page points at the first byte of the page; bytes are in
+    memory (big-endian) order. Returns mips_ErrorNotImplemented when the
+    page cannot be accessed directly, for example because it is not backed
+    by plain storage, or because write is set and the page holds watched
+    code (see \ref mips_mem_code). The caller has to fall back to the
+    transactions in that case.
+
+    A page handed out for writing stays valid until code is watched in
+    it. That increments the code generation (see \ref mips_mem_code), and
+    every CPU that sees the generation change has to map its pages again.
+    A CPU that watches code itself has to drop its own mapping of that
+    page straight away.
+*/
+mips_error mips_mem_map_page(
+    mips_mem_h mem,	        //!< Handle to target memory
+    uint32_t address,	    //!< Any byte address inside the page
+    unsigned write,	        //!< Non-zero if the page will be written through the pointer
+    uint8_t **page	        //!< Receives the first byte of the page
+);
+
+/*! Tells whether reads of address are answered by a device rather than
+    by storage, so that reading it again may give another value. A run
+    that reads devices can only be repeated exactly if the values it read
+    are kept (see mips_cpu_set_record). RAM is never a device.
+*/
+mips_error mips_mem_is_device(
+    mips_mem_h mem,	        //!< Handle to target memory
+    uint32_t address,	    //!< Byte address that is read
+    unsigned *device	    //!< Receives non-zero for a device
+);
+
+/*! @} */
+
+
+/*! \defgroup mips_mem_snapshot Snapshots
+    \ingroup mips_mem
+    @{
+
+    A snapshot is a copy of everything a memory holds, which can be put
+    back later, or into another memory, as often as needed. This is meant
+    for runs that share a long prefix, such as a boot followed by many
+    different tests: the prefix is run once, then each test starts from
+    the snapshot.
+
+    Snapshots share the pages that did not change between them, and a
+    memory remembers which pages were written since its last snapshot or
+    restore. So taking a snapshot only copies the pages written since the
+    previous one, and restoring only rewrites the pages that were written
+    since, or that differ between the two snapshots. The first snapshot
+    of a memory has to copy everything it holds.
+
+    Nothing may run on the memory while a snapshot is taken or restored.
+    Both change the code generation (see \ref mips_mem_code), so CPUs drop
+    what they have cached.
+*/
+
+/*! A snapshot of a memory. \struct mips_mem_snapshot_impl */
+struct mips_mem_snapshot_impl;
+typedef struct mips_mem_snapshot_impl *mips_mem_snapshot_h;
+
+/*! Takes a snapshot of everything the memory holds. */
+mips_error mips_mem_snapshot(
+    mips_mem_h mem,	                //!< Handle to target memory
+    mips_mem_snapshot_h *snapshot	//!< Receives the snapshot, released with mips_mem_snapshot_free
+);
+
+/*! Makes the memory hold what the snapshot holds. The snapshot may come
+    from another memory, or from a file, as long as this memory covers
+    every page in it that is not zero. */
+mips_error mips_mem_restore(
+    mips_mem_h mem,	                //!< Handle to target memory
+    mips_mem_snapshot_h snapshot	//!< Snapshot to restore, which is not changed
+);
+
+/*! Writes the snapshot to a file, which mips_mem_snapshot_load reads back.
+    Only the pages that are not zero are written. */
+mips_error mips_mem_snapshot_save(
+    mips_mem_snapshot_h snapshot,	//!< Snapshot to write
+    FILE *dest	                    //!< File opened for binary writing, not closed
+);
+
+/*! Reads a snapshot written by mips_mem_snapshot_save. Returns
+    mips_ErrorFileReadError if the file does not hold one. */
+mips_error mips_mem_snapshot_load(
+    FILE *src,	                    //!< File opened for binary reading, not closed
+    mips_mem_snapshot_h *snapshot	//!< Receives the snapshot
+);
+
+/*! Releases a snapshot. Memories it was taken from or restored to are
+    not affected. Releasing an empty (zero) handle is legal. */
+void mips_mem_snapshot_free(mips_mem_snapshot_h snapshot);
+
 /*! @} */
 
 
@@ -186,6 +431,130 @@ mips_mem_h mips_mem_create_ram(
     uint32_t cbMem	//!< Total number of bytes of ram
 );
 
+/*! Initialise a new RAM holding the contents of an image file.
+
+    The RAM covers cbMem bytes starting at baseAddress, which has to be
+    a multiple of \ref MIPS_MEM_PAGE. The file is placed at baseAddress
+    and the rest of the RAM reads as zero. If cbMem is 0 the RAM is
+    exactly as big as the file. Accesses outside of the RAM fail with
+    mips_ExceptionInvalidAddress, and the alignment rules are the same
+    as for mips_mem_create_ram.
+
+    The file is mapped into memory rather than read, so creating the RAM
+    takes the same time whatever the size of the image, and the pages are
+    only read from disk when they are first used. Writes go to a private
+    copy of the page, and the file itself is never changed. For example:
+
+        mips_mem_h mem=mips_mem_create_file("f_fibonacci-mips.bin", 0, 0x20000);
+        if(mem==0)
+            ... the file could not be opened, or does not fit ...
+
+    Returns 0 if the file cannot be mapped, or is bigger than cbMem.
+*/
+mips_mem_h mips_mem_create_file(
+    const char *fileName,	//!< Image to place in the RAM
+    uint32_t baseAddress,	//!< Address of the first byte of the image
+    uint32_t cbMem	        //!< Total number of bytes of ram, or 0
+);
+
+/*! Initialise a new memory covering the whole 32-bit address space.
+
+    Every address can be read and written, with the same alignment
+    rules as a RAM. Nothing is allocated up front: a page starts out
+    reading as zero, and host memory is only allocated for it the first
+    time it is written. This makes it cheap to give each of many
+    simulated CPUs its own address space, and to place the stack at the
+    top of memory:
+
+        mips_mem_h mem=mips_mem_create_sparse();
+        mips_cpu_h cpu=mips_cpu_create(mem);
+        mips_cpu_set_register(cpu, 29, 0x7FFFFFF0);
+
+    Use mips_mem_get_resident_pages to see how much has been touched.
+*/
+mips_mem_h mips_mem_create_sparse(void);
+
+/*! Initialise a new, empty bus that other memories and devices are
+    placed on.
+
+    The bus is a memory like any other, so a CPU can be created on it.
+    Each address belongs to at most one region, added with
+    mips_mem_bus_add_memory or mips_mem_bus_add_device, and finding the
+    region of an address is a binary search. Accesses to addresses that
+    are in no region fail with mips_ExceptionInvalidAddress. A board with
+    RAM, a boot ROM and a UART looks like:
+
+        mips_mem_h ram=mips_mem_create_ram(0x100000);
+        mips_mem_h rom=mips_mem_create_file("boot.bin", 0, 0x10000);
+        mips_mem_h bus=mips_mem_create_bus();
+        mips_mem_bus_add_memory(bus, 0x00000000, 0x100000, ram, 0);
+        mips_mem_bus_add_memory(bus, 0x1FC00000, 0x10000, rom, 1);
+        mips_mem_bus_add_device(bus, 0xFFFF0000, MIPS_MEM_PAGE, &uart);
+        mips_cpu_h cpu=mips_cpu_create(bus);
+
+    Pages of memory regions are handed to the CPU with mips_mem_map_page,
+    so loads and stores to RAM do not go through the bus at all once the
+    page is mapped. The regions have to be added before anything uses
+    the bus, and the memories placed on it are not owned by it, so they
+    are freed separately after the bus.
+*/
+mips_mem_h mips_mem_create_bus(void);
+
+/*! Places a memory on the bus. An address in the region is passed to
+    the memory as its offset from base, so the memory should answer
+    addresses from 0 to length-1. Writes to a read only region (a ROM)
+    fail with mips_ExceptionAccessViolation; it can still be filled
+    through its own handle.
+
+    base and length have to be multiples of \ref MIPS_MEM_PAGE, and the
+    region must not overlap another one, otherwise
+    mips_ErrorInvalidArgument is returned.
+*/
+mips_error mips_mem_bus_add_memory(
+    mips_mem_h bus,	        //!< Handle returned by mips_mem_create_bus
+    uint32_t base,	        //!< First address of the region
+    uint32_t length,	    //!< Size of the region in bytes
+    mips_mem_h target,	    //!< Memory answering the region
+    unsigned readOnly	    //!< Non-zero for a ROM
+);
+
+/*! Callbacks of a device placed on a bus. The offset is from the start
+    of the region, and the bytes are in memory (big-endian) order. Either
+    callback may be NULL, accesses it would answer then fail with
+    mips_ExceptionAccessViolation. */
+typedef struct mips_mem_device
+{
+    void *context;	//!< Passed to both callbacks
+    mips_error (*read)(void *context, uint32_t offset, uint32_t length, uint8_t *dataOut);
+    mips_error (*write)(void *context, uint32_t offset, uint32_t length, const uint8_t *dataIn);
+} mips_mem_device;
+
+/*! Places a device on the bus, the callbacks are copied. Reads of a
+    device are reported by mips_mem_is_device, and its pages are left out
+    of snapshots. The same rules for base and length apply as for
+    mips_mem_bus_add_memory.
+*/
+mips_error mips_mem_bus_add_device(
+    mips_mem_h bus,	                //!< Handle returned by mips_mem_create_bus
+    uint32_t base,	                //!< First address of the region
+    uint32_t length,	            //!< Size of the region in bytes
+    const mips_mem_device *device	//!< Callbacks answering the region
+);
+
+/*! Returns how often the region holding address was used: the reads
+    and writes that went through the bus, and the pages handed out by
+    mips_mem_map_page, which are then accessed without being counted.
+    Any of the pointers may be NULL. Returns mips_ExceptionInvalidAddress
+    if no region holds address.
+*/
+mips_error mips_mem_bus_get_counters(
+    mips_mem_h bus,	        //!< Handle returned by mips_mem_create_bus
+    uint32_t address,	    //!< Any address in the region
+    uint64_t *reads,	    //!< Receives the number of reads
+    uint64_t *writes,	    //!< Receives the number of writes
+    uint64_t *mapped	    //!< Receives the number of pages handed out
+);
+
 /*!
     @}
     @}
@@ -0,0 +1,136 @@
+/*! \file mips_trace.h
+	Defines the trace files written by mips_cpu_set_trace, and the
+	functions used to write and read them.
+
+	A trace file is a sequence of compressed blocks, each holding up
+	to MIPS_TRACE_BLOCK records, followed by an index giving the
+	position of every block. Inside a block the registers are stored
+	once at the start, and each record only holds what changed: the
+	PC as a difference from the expected one, the register written as
+	a difference from its old value, and so on, as variable length
+	integers. The block is then compressed with a small LZ77 coder.
+
+	Because every block starts from a full copy of the registers, a
+	reader can jump to any instruction by decoding a single block.
+	All values in the file are little-endian, whatever the host is.
+*/
+#ifndef mips_trace_header
+#define mips_trace_header
+
+#include "mips_core.h"
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*! \defgroup mips_trace Trace Files
+	\addtogroup mips_trace
+	@{
+*/
+
+/*! Number of records in each block of a trace file, which is
+	how far a seek has to decode at most. */
+#define MIPS_TRACE_BLOCK 4096
+
+/*! One executed instruction. */
+typedef struct mips_trace_record{
+	uint32_t pc;			//!< Address of the instruction
+	uint32_t next_pc;		//!< PC after it, equal to pc when it failed
+	uint32_t word;			//!< Instruction as stored in memory
+	uint32_t rd_value;		//!< Value written to register rd
+	uint32_t mem_address;	//!< Address of a load or store, 0 otherwise
+	uint32_t mem_data;		//!< Value loaded or stored
+	uint32_t hi;			//!< HI after the instruction
+	uint32_t lo;			//!< LO after the instruction
+	uint8_t op;				//!< Handler of the simulator that ran it
+	uint8_t rd;				//!< Register written, 0 for none
+	uint16_t error;			//!< mips_error of the step
+} mips_trace_record;
+
+/*! Writes a trace file. \struct mips_trace_writer_impl */
+struct mips_trace_writer_impl;
+typedef struct mips_trace_writer_impl *mips_trace_writer_h;
+
+/*! Reads a trace file. \struct mips_trace_reader_impl */
+struct mips_trace_reader_impl;
+typedef struct mips_trace_reader_impl *mips_trace_reader_h;
+
+/*! Starts a trace file at the current position of dest.
+
+	The registers (pc, hi, lo and regs[0..31]) are those of the CPU
+	before the first record. The file is not closed by the writer.
+*/
+mips_error mips_trace_writer_open(
+	FILE *dest,						//!< File opened for binary writing
+	uint32_t pc,					//!< PC of the first instruction
+	uint32_t hi,					//!< HI before the first instruction
+	uint32_t lo,					//!< LO before the first instruction
+	const uint32_t *regs,			//!< The 32 registers before the first instruction
+	mips_trace_writer_h *writer		//!< Receives the writer
+);
+
+/*! Appends records to the trace. Full blocks are compressed and
+	written out, the rest is kept until more records arrive. */
+mips_error mips_trace_writer_write(
+	mips_trace_writer_h writer,
+	const mips_trace_record *records,	//!< Records in execution order
+	uint32_t count						//!< Number of records
+);
+
+/*! Writes out the last block and the index, then releases the writer.
+	Returns the first error the writer ran into, if any. */
+mips_error mips_trace_writer_close(mips_trace_writer_h writer);
+
+/*! Opens a trace file for reading, positioned on the first record.
+
+	The index at the end of the file is used to find the blocks. A
+	trace that was never closed (for example the program crashed)
+	has no index; its blocks are found by walking through them, and a
+	partly written last block is ignored.
+
+	Returns mips_ErrorFileReadError if src is not a trace file.
+*/
+mips_error mips_trace_reader_open(
+	FILE *src,						//!< File opened for binary reading, not closed by the reader
+	mips_trace_reader_h *reader		//!< Receives the reader
+);
+
+/*! Returns the number of records in the trace. */
+uint64_t mips_trace_reader_get_count(mips_trace_reader_h reader);
+
+/*! Moves to record index (0 is the first), decoding at most one block. */
+mips_error mips_trace_reader_seek(
+	mips_trace_reader_h reader,
+	uint64_t index					//!< Record to read next, up to the count
+);
+
+/*! Reads the next records, like fread: got is less than count at
+	the end of the trace. */
+mips_error mips_trace_reader_read(
+	mips_trace_reader_h reader,
+	mips_trace_record *records,		//!< Receives the records
+	uint32_t count,					//!< Maximum number of records
+	uint32_t *got					//!< Receives the number of records read
+);
+
+/*! Returns the 32 registers as they are after the last record read
+	(or before the next one, which is the same thing). */
+mips_error mips_trace_reader_get_registers(
+	mips_trace_reader_h reader,
+	uint32_t *regs					//!< Receives the 32 registers
+);
+
+/*! Releases the reader. Closing an empty (zero) handle is legal. */
+void mips_trace_reader_close(mips_trace_reader_h reader);
+
+/*!
+	@}
+*/
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -0,0 +1,581 @@
+/*
+BENCHMARK
+Runs a set of guest kernels through the simulator and reports how fast it went
+
+	mips_bench [-s steps] [-b baseline file] [-f fibonacci binary] [-w]
+
+Every kernel is run in each way the CPU can run code: one mips_cpu_step at a
+time, mips_cpu_run with the block interpreter, and mips_cpu_run with the JIT.
+A kernel is a small program ending in jr ra, which is started again until
+at least steps instructions (10000000 by default) have been run, so the
+same kernels measure anything from start-up costs (-s 1000) to long runs
+(-s 2000000000). Only the time spent inside the CPU is measured, and the
+result of every run is checked so that a fast wrong answer does not count.
+
+For each run it prints the simulated instructions per second, the time per
+instruction, the heap allocations per instruction, and the peak resident
+memory of the process so far. Each speed is compared with the one stored
+in the baseline file (mips_bench_baseline.txt next to the program by default),
+and -w writes the speeds of this run there as the new baseline.
+
+The fibonacci kernel is the compiled f_fibonacci from fragments/ (or the
+binary given with -f), the others are assembled below
+*/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+#include "mips.h"
+
+using namespace std;
+
+//Counts every heap allocation, as the test bench does
+static atomic<unsigned long> allocation_count(0);
+void* operator new(size_t size){
+	++allocation_count;
+	void* p = malloc(size ? size : 1);
+	if (p == 0)
+		throw bad_alloc();
+	return p;
+}
+void operator delete(void* p) noexcept{
+	free(p);
+}
+
+//Return address of every kernel, the run stops when the PC gets there
+#define MIPS_BENCH_SENTINEL 0x10000000
+//Memory of the assembled kernels: code at 0, then three 64KB data areas and the stack
+#define MIPS_BENCH_RAM 0x100000
+#define MIPS_BENCH_A 0x10000
+#define MIPS_BENCH_B 0x20000
+#define MIPS_BENCH_C 0x30000
+#define MIPS_BENCH_STACK 0x80000
+
+//Sizes of the kernels, each run is between about ten and a hundred thousand instructions
+#define MIPS_BENCH_FIB_N 20
+#define MIPS_BENCH_MEMCPY_WORDS 4096
+#define MIPS_BENCH_SORT_WORDS 256
+#define MIPS_BENCH_CRC_BYTES 1024
+#define MIPS_BENCH_MATRIX_N 16
+#define MIPS_BENCH_DIVIDE_LOOPS 10000
+
+//ASSEMBLER - just enough to write the kernels, branches go to labels
+struct mips_bench_code{
+	vector<uint32_t> words;
+	map<string, size_t> labels;
+	vector<pair<size_t, string> > branches;
+};
+
+enum{ zero = 0, v0 = 2, a0 = 4, a1 = 5, a2 = 6, a3 = 7, t0 = 8, t1, t2, t3, t4, t5, t6, t7, t8 = 24, t9 = 25, sp = 29, ra = 31 };
+
+static void R(mips_bench_code& c, uint32_t funct, uint32_t rd, uint32_t rs, uint32_t rt, uint32_t shift = 0){
+	c.words.push_back((rs << 21) | (rt << 16) | (rd << 11) | (shift << 6) | funct);
+}
+static void I(mips_bench_code& c, uint32_t opcode, uint32_t rt, uint32_t rs, int32_t immediate){
+	c.words.push_back((opcode << 26) | (rs << 21) | (rt << 16) | (uint32_t(immediate) & 0xFFFF));
+}
+static void B(mips_bench_code& c, uint32_t opcode, uint32_t rs, uint32_t rt, const char* label){
+	c.branches.push_back(make_pair(c.words.size(), string(label)));
+	I(c, opcode, rt, rs, 0);
+}
+static void L(mips_bench_code& c, const char* label){
+	c.labels[label] = c.words.size();
+}
+
+static void addu(mips_bench_code& c, uint32_t rd, uint32_t rs, uint32_t rt){ R(c, 0x21, rd, rs, rt); }
+static void subu(mips_bench_code& c, uint32_t rd, uint32_t rs, uint32_t rt){ R(c, 0x23, rd, rs, rt); }
+static void and_(mips_bench_code& c, uint32_t rd, uint32_t rs, uint32_t rt){ R(c, 0x24, rd, rs, rt); }
+static void or_(mips_bench_code& c, uint32_t rd, uint32_t rs, uint32_t rt){ R(c, 0x25, rd, rs, rt); }
+static void xor_(mips_bench_code& c, uint32_t rd, uint32_t rs, uint32_t rt){ R(c, 0x26, rd, rs, rt); }
+static void slt(mips_bench_code& c, uint32_t rd, uint32_t rs, uint32_t rt){ R(c, 0x2A, rd, rs, rt); }
+static void sll(mips_bench_code& c, uint32_t rd, uint32_t rt, uint32_t shift){ R(c, 0x00, rd, 0, rt, shift); }
+static void srl(mips_bench_code& c, uint32_t rd, uint32_t rt, uint32_t shift){ R(c, 0x02, rd, 0, rt, shift); }
+static void jr(mips_bench_code& c, uint32_t rs){ R(c, 0x08, 0, rs, 0); }
+static void mfhi(mips_bench_code& c, uint32_t rd){ R(c, 0x10, rd, 0, 0); }
+static void mflo(mips_bench_code& c, uint32_t rd){ R(c, 0x12, rd, 0, 0); }
+static void multu(mips_bench_code& c, uint32_t rs, uint32_t rt){ R(c, 0x19, 0, rs, rt); }
+static void div_(mips_bench_code& c, uint32_t rs, uint32_t rt){ R(c, 0x1A, 0, rs, rt); }
+static void divu(mips_bench_code& c, uint32_t rs, uint32_t rt){ R(c, 0x1B, 0, rs, rt); }
+static void nop(mips_bench_code& c){ c.words.push_back(0); }
+static void addiu(mips_bench_code& c, uint32_t rt, uint32_t rs, int32_t immediate){ I(c, 0x09, rt, rs, immediate); }
+static void andi(mips_bench_code& c, uint32_t rt, uint32_t rs, int32_t immediate){ I(c, 0x0C, rt, rs, immediate); }
+static void ori(mips_bench_code& c, uint32_t rt, uint32_t rs, int32_t immediate){ I(c, 0x0D, rt, rs, immediate); }
+static void lui(mips_bench_code& c, uint32_t rt, int32_t immediate){ I(c, 0x0F, rt, 0, immediate); }
+static void lbu(mips_bench_code& c, uint32_t rt, int32_t offset, uint32_t base){ I(c, 0x24, rt, base, offset); }
+static void lw(mips_bench_code& c, uint32_t rt, int32_t offset, uint32_t base){ I(c, 0x23, rt, base, offset); }
+static void sw(mips_bench_code& c, uint32_t rt, int32_t offset, uint32_t base){ I(c, 0x2B, rt, base, offset); }
+static void beq(mips_bench_code& c, uint32_t rs, uint32_t rt, const char* label){ B(c, 0x04, rs, rt, label); }
+static void bne(mips_bench_code& c, uint32_t rs, uint32_t rt, const char* label){ B(c, 0x05, rs, rt, label); }
+
+//Fills in the branch offsets and writes the code at address 0
+static mips_error mips_bench_load(mips_mem_h mem, mips_bench_code& c){
+	for (size_t i = 0; i < c.branches.size(); ++i){
+		size_t at = c.branches[i].first;
+		c.words[at] |= uint32_t(c.labels[c.branches[i].second] - (at + 1)) & 0xFFFF;
+	}
+	for (size_t i = 0; i < c.words.size(); ++i){
+		mips_error err = mips_mem_write32(mem, 4 * i, c.words[i]);
+		if (err != mips_Success)
+			return err;
+	}
+	return mips_Success;
+}
+
+//Same numbers on every run, so that the results can be checked
+static uint32_t mips_bench_random(uint32_t& seed){
+	seed = seed * 1664525 + 1013904223;
+	return seed;
+}
+
+//Starts a kernel at 0, returning to the sentinel
+static void mips_bench_call(mips_cpu_h cpu, uint32_t arg0, uint32_t arg1, uint32_t arg2, uint32_t arg3){
+	mips_cpu_reset(cpu);
+	mips_cpu_set_register(cpu, a0, arg0);
+	mips_cpu_set_register(cpu, a1, arg1);
+	mips_cpu_set_register(cpu, a2, arg2);
+	mips_cpu_set_register(cpu, a3, arg3);
+	mips_cpu_set_register(cpu, sp, MIPS_BENCH_STACK);
+	mips_cpu_set_register(cpu, ra, MIPS_BENCH_SENTINEL);
+}
+
+static uint32_t mips_bench_v0(mips_cpu_h cpu){
+	uint32_t value = 0;
+	mips_cpu_get_register(cpu, v0, &value);
+	return value;
+}
+
+//KERNELS - create builds the memory, start sets up one run and check looks at its result
+
+//FIBONACCI - recursive f_fibonacci from fragments/, compiled by gcc
+static string sg_fibonacci_file = "../fragments/f_fibonacci-mips.bin";
+
+static mips_mem_h mips_bench_fibonacci_create(){
+	return mips_mem_create_file(sg_fibonacci_file.c_str(), 0, 0x20000);
+}
+static void mips_bench_fibonacci_start(mips_cpu_h cpu, mips_mem_h){
+	mips_bench_call(cpu, MIPS_BENCH_FIB_N, 0, 0, 0);
+	mips_cpu_set_register(cpu, sp, 0x1000);
+}
+static bool mips_bench_fibonacci_check(mips_cpu_h cpu, mips_mem_h){
+	uint32_t a = 0, b = 1;
+	for (unsigned i = 0; i < MIPS_BENCH_FIB_N; ++i){
+		uint32_t next = a + b;
+		a = b;
+		b = next;
+	}
+	return mips_bench_v0(cpu) == a;
+}
+
+//MEMCPY - copies a0 words from a1 to a2
+static mips_mem_h mips_bench_memcpy_create(){
+	mips_bench_code c;
+	L(c, "loop");
+	lw(c, t0, 0, a1);
+	addiu(c, a1, a1, 4);
+	sw(c, t0, 0, a2);
+	addiu(c, a0, a0, -1);
+	bne(c, a0, zero, "loop");
+	addiu(c, a2, a2, 4);
+	jr(c, ra);
+	nop(c);
+
+	mips_mem_h mem = mips_mem_create_ram(MIPS_BENCH_RAM);
+	uint32_t seed = 1;
+	for (unsigned i = 0; i < MIPS_BENCH_MEMCPY_WORDS; ++i)
+		mips_mem_write32(mem, MIPS_BENCH_A + 4 * i, mips_bench_random(seed));
+	mips_bench_load(mem, c);
+	return mem;
+}
+static void mips_bench_memcpy_start(mips_cpu_h cpu, mips_mem_h mem){
+	for (unsigned i = 0; i < MIPS_BENCH_MEMCPY_WORDS; ++i)
+		mips_mem_write32(mem, MIPS_BENCH_B + 4 * i, 0);
+	mips_bench_call(cpu, MIPS_BENCH_MEMCPY_WORDS, MIPS_BENCH_A, MIPS_BENCH_B, 0);
+}
+static bool mips_bench_memcpy_check(mips_cpu_h, mips_mem_h mem){
+	for (unsigned i = 0; i < MIPS_BENCH_MEMCPY_WORDS; ++i){
+		uint32_t src = 0, dst = 1;
+		mips_mem_read32(mem, MIPS_BENCH_A + 4 * i, &src);
+		mips_mem_read32(mem, MIPS_BENCH_B + 4 * i, &dst);
+		if (src != dst)
+			return false;
+	}
+	return true;
+}
+
+//SORT - insertion sort of a1 signed words at a0
+static mips_mem_h mips_bench_sort_create(){
+	mips_bench_code c;
+	sll(c, t9, a1, 2);
+	addu(c, t9, a0, t9);
+	addiu(c, t0, a0, 4);
+	L(c, "outer");
+	beq(c, t0, t9, "done");
+	nop(c);
+	lw(c, t1, 0, t0);
+	or_(c, t2, t0, zero);
+	L(c, "inner");
+	beq(c, t2, a0, "place");
+	nop(c);
+	lw(c, t3, -4, t2);
+	slt(c, t4, t1, t3);
+	beq(c, t4, zero, "place");
+	nop(c);
+	sw(c, t3, 0, t2);
+	beq(c, zero, zero, "inner");
+	addiu(c, t2, t2, -4);
+	L(c, "place");
+	sw(c, t1, 0, t2);
+	beq(c, zero, zero, "outer");
+	addiu(c, t0, t0, 4);
+	L(c, "done");
+	jr(c, ra);
+	nop(c);
+
+	mips_mem_h mem = mips_mem_create_ram(MIPS_BENCH_RAM);
+	mips_bench_load(mem, c);
+	return mem;
+}
+static void mips_bench_sort_start(mips_cpu_h cpu, mips_mem_h mem){
+	uint32_t seed = 2;
+	for (unsigned i = 0; i < MIPS_BENCH_SORT_WORDS; ++i)
+		mips_mem_write32(mem, MIPS_BENCH_A + 4 * i, mips_bench_random(seed));
+	mips_bench_call(cpu, MIPS_BENCH_A, MIPS_BENCH_SORT_WORDS, 0, 0);
+}
+static bool mips_bench_sort_check(mips_cpu_h, mips_mem_h mem){
+	uint32_t seed = 2, sum = 0, check = 0;
+	int32_t last = INT32_MIN;
+	for (unsigned i = 0; i < MIPS_BENCH_SORT_WORDS; ++i){
+		uint32_t value = 0;
+		mips_mem_read32(mem, MIPS_BENCH_A + 4 * i, &value);
+		if (int32_t(value) < last)
+			return false;
+		last = value;
+		sum += value;
+		check += mips_bench_random(seed);
+	}
+	return sum == check;
+}
+
+//CRC - bitwise CRC-32 of a1 bytes at a0
+static mips_mem_h mips_bench_crc_create(){
+	mips_bench_code c;
+	lui(c, t9, 0xEDB8);
+	ori(c, t9, t9, 0x8320);
+	addiu(c, v0, zero, -1);
+	L(c, "byte");
+	lbu(c, t0, 0, a0);
+	addiu(c, a0, a0, 1);
+	xor_(c, v0, v0, t0);
+	addiu(c, t1, zero, 8);
+	L(c, "bit");
+	andi(c, t2, v0, 1);
+	srl(c, v0, v0, 1);
+	subu(c, t3, zero, t2);
+	and_(c, t3, t3, t9);
+	addiu(c, t1, t1, -1);
+	bne(c, t1, zero, "bit");
+	xor_(c, v0, v0, t3);
+	addiu(c, a1, a1, -1);
+	bne(c, a1, zero, "byte");
+	addiu(c, t4, zero, -1);
+	jr(c, ra);
+	xor_(c, v0, v0, t4);
+
+	mips_mem_h mem = mips_mem_create_ram(MIPS_BENCH_RAM);
+	uint32_t seed = 3;
+	for (unsigned i = 0; i < MIPS_BENCH_CRC_BYTES; i += 4)
+		mips_mem_write32(mem, MIPS_BENCH_A + i, mips_bench_random(seed));
+	mips_bench_load(mem, c);
+	return mem;
+}
+static void mips_bench_crc_start(mips_cpu_h cpu, mips_mem_h){
+	mips_bench_call(cpu, MIPS_BENCH_A, MIPS_BENCH_CRC_BYTES, 0, 0);
+}
+static bool mips_bench_crc_check(mips_cpu_h cpu, mips_mem_h mem){
+	uint32_t crc = 0xFFFFFFFF;
+	for (unsigned i = 0; i < MIPS_BENCH_CRC_BYTES; ++i){
+		uint8_t byte = 0;
+		mips_mem_read_block(mem, MIPS_BENCH_A + i, 1, &byte);
+		crc ^= byte;
+		for (unsigned bit = 0; bit < 8; ++bit)
+			crc = (crc >> 1) ^ ((0 - (crc & 1)) & 0xEDB88320);
+	}
+	return mips_bench_v0(cpu) == ~crc;
+}
+
+//MATRIX - C (a2) = A (a0) x B (a1), all a3 x a3 words
+static mips_mem_h mips_bench_matrix_create(){
+	mips_bench_code c;
+	sll(c, t8, a3, 2);
+	or_(c, t0, zero, zero);
+	L(c, "row");
+	or_(c, t1, zero, zero);
+	L(c, "column");
+	or_(c, v0, zero, zero);
+	multu(c, t0, t8);
+	mflo(c, t7);
+	addu(c, t4, a0, t7);
+	sll(c, t5, t1, 2);
+	addu(c, t5, a1, t5);
+	or_(c, t2, a3, zero);
+	L(c, "dot");
+	lw(c, t6, 0, t4);
+	lw(c, t3, 0, t5);
+	multu(c, t6, t3);
+	mflo(c, t6);
+	addu(c, v0, v0, t6);
+	addiu(c, t4, t4, 4);
+	addiu(c, t2, t2, -1);
+	bne(c, t2, zero, "dot");
+	addu(c, t5, t5, t8);
+	addu(c, t4, a2, t7);
+	sll(c, t5, t1, 2);
+	addu(c, t4, t4, t5);
+	sw(c, v0, 0, t4);
+	addiu(c, t1, t1, 1);
+	bne(c, t1, a3, "column");
+	nop(c);
+	addiu(c, t0, t0, 1);
+	bne(c, t0, a3, "row");
+	nop(c);
+	jr(c, ra);
+	nop(c);
+
+	mips_mem_h mem = mips_mem_create_ram(MIPS_BENCH_RAM);
+	uint32_t seed = 4;
+	for (unsigned i = 0; i < MIPS_BENCH_MATRIX_N * MIPS_BENCH_MATRIX_N; ++i){
+		mips_mem_write32(mem, MIPS_BENCH_A + 4 * i, mips_bench_random(seed) >> 16);
+		mips_mem_write32(mem, MIPS_BENCH_B + 4 * i, mips_bench_random(seed) >> 16);
+	}
+	mips_bench_load(mem, c);
+	return mem;
+}
+static void mips_bench_matrix_start(mips_cpu_h cpu, mips_mem_h){
+	mips_bench_call(cpu, MIPS_BENCH_A, MIPS_BENCH_B, MIPS_BENCH_C, MIPS_BENCH_MATRIX_N);
+}
+static bool mips_bench_matrix_check(mips_cpu_h, mips_mem_h mem){
+	const unsigned n = MIPS_BENCH_MATRIX_N;
+	for (unsigned i = 0; i < n; ++i){
+		for (unsigned j = 0; j < n; ++j){
+			uint32_t sum = 0, a = 0, b = 0, got = 0;
+			for (unsigned k = 0; k < n; ++k){
+				mips_mem_read32(mem, MIPS_BENCH_A + 4 * (i * n + k), &a);
+				mips_mem_read32(mem, MIPS_BENCH_B + 4 * (k * n + j), &b);
+				sum += a * b;
+			}
+			mips_mem_read32(mem, MIPS_BENCH_C + 4 * (i * n + j), &got);
+			if (got != sum)
+				return false;
+		}
+	}
+	return true;
+}
+
+//DIVIDE - a0 rounds of unsigned and signed division, folding quotients and remainders into v0
+static mips_mem_h mips_bench_divide_create(){
+	mips_bench_code c;
+	or_(c, v0, zero, zero);
+	lui(c, t0, 0x7FFF);
+	ori(c, t0, t0, 0xFFFF);
+	addiu(c, t1, zero, 7);
+	L(c, "loop");
+	divu(c, t0, t1);
+	mflo(c, t2);
+	mfhi(c, t3);
+	addu(c, v0, v0, t2);
+	xor_(c, v0, v0, t3);
+	subu(c, t4, zero, t0);
+	div_(c, t4, t1);
+	mflo(c, t2);
+	mfhi(c, t3);
+	subu(c, v0, v0, t2);
+	xor_(c, v0, v0, t3);
+	addiu(c, t0, t0, -12345);
+	addiu(c, a0, a0, -1);
+	bne(c, a0, zero, "loop");
+	addiu(c, t1, t1, 2);
+	jr(c, ra);
+	nop(c);
+
+	mips_mem_h mem = mips_mem_create_ram(MIPS_BENCH_RAM);
+	mips_bench_load(mem, c);
+	return mem;
+}
+static void mips_bench_divide_start(mips_cpu_h cpu, mips_mem_h){
+	mips_bench_call(cpu, MIPS_BENCH_DIVIDE_LOOPS, 0, 0, 0);
+}
+static bool mips_bench_divide_check(mips_cpu_h cpu, mips_mem_h){
+	uint32_t result = 0, x = 0x7FFFFFFF, d = 7;
+	for (unsigned i = 0; i < MIPS_BENCH_DIVIDE_LOOPS; ++i){
+		result += x / d;
+		result ^= x % d;
+		int32_t negative = -int32_t(x);
+		result -= uint32_t(negative / int32_t(d));
+		result ^= uint32_t(negative % int32_t(d));
+		x -= 12345;
+		d += 2;
+	}
+	return mips_bench_v0(cpu) == result;
+}
+
+struct mips_bench_kernel{
+	const char* name;
+	mips_mem_h (*create)();
+	void (*start)(mips_cpu_h cpu, mips_mem_h mem);
+	bool (*check)(mips_cpu_h cpu, mips_mem_h mem);
+};
+
+static const mips_bench_kernel sg_kernels[] = {
+	{"fibonacci", mips_bench_fibonacci_create, mips_bench_fibonacci_start, mips_bench_fibonacci_check},
+	{"memcpy",    mips_bench_memcpy_create,    mips_bench_memcpy_start,    mips_bench_memcpy_check},
+	{"sort",      mips_bench_sort_create,      mips_bench_sort_start,      mips_bench_sort_check},
+	{"crc",       mips_bench_crc_create,       mips_bench_crc_start,       mips_bench_crc_check},
+	{"matrix",    mips_bench_matrix_create,    mips_bench_matrix_start,    mips_bench_matrix_check},
+	{"divide",    mips_bench_divide_create,    mips_bench_divide_start,    mips_bench_divide_check}
+};
+
+//MODES - the ways of running code that are measured
+enum mips_bench_mode{ mips_bench_STEP, mips_bench_RUN, mips_bench_JIT, mips_bench_MODES };
+static const char* const sg_modes[mips_bench_MODES] = {"step", "run", "jit"};
+
+static mips_error mips_bench_run(mips_cpu_h cpu, mips_bench_mode mode, uint64_t* steps){
+	if (mode != mips_bench_STEP)
+		return mips_cpu_run_until(cpu, MIPS_BENCH_SENTINEL, UINT64_MAX, steps);
+
+	mips_error err = mips_Success;
+	uint32_t pc = 0;
+	*steps = 0;
+	for (mips_cpu_get_pc(cpu, &pc); pc != MIPS_BENCH_SENTINEL; mips_cpu_get_pc(cpu, &pc)){
+		err = mips_cpu_step(cpu);
+		if (err != mips_Success)
+			break;
+		++*steps;
+	}
+	return err;
+}
+
+struct mips_bench_result{
+	uint64_t steps;
+	double seconds;
+	unsigned long allocations;
+	bool ok;
+};
+
+//Runs one kernel again and again until it has run at least min_steps instructions
+static mips_bench_result mips_bench_measure(const mips_bench_kernel& kernel, mips_bench_mode mode, uint64_t min_steps){
+	mips_bench_result result = {0, 0.0, 0, false};
+	mips_mem_h mem = kernel.create();
+	if (mem == 0)
+		return result;
+	mips_cpu_h cpu = mips_cpu_create(mem);
+	if ((mode == mips_bench_JIT) && (mips_cpu_set_jit(cpu, 1) != mips_Success)){
+		mips_cpu_free(cpu);
+		mips_mem_free(mem);
+		return result;
+	}
+
+	result.ok = true;
+	while (result.ok && (result.steps < min_steps)){
+		kernel.start(cpu, mem);
+		uint64_t steps = 0;
+		unsigned long allocations = allocation_count.load();
+		chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+		mips_error err = mips_bench_run(cpu, mode, &steps);
+		chrono::steady_clock::time_point end = chrono::steady_clock::now();
+		result.allocations += allocation_count.load() - allocations;
+		result.seconds += chrono::duration<double>(end - begin).count();
+		result.steps += steps;
+		result.ok = (err == mips_Success) && (steps != 0) && kernel.check(cpu, mem);
+	}
+	mips_cpu_free(cpu);
+	mips_mem_free(mem);
+	return result;
+}
+
+//BASELINE - one "kernel mode mips" line per measurement
+static map<string, double> mips_bench_read_baseline(const string& name){
+	map<string, double> baseline;
+	FILE* src = fopen(name.c_str(), "r");
+	if (src == NULL)
+		return baseline;
+	char kernel[64], mode[16];
+	double mips;
+	while (fscanf(src, "%63s %15s %lf", kernel, mode, &mips) == 3)
+		baseline[string(kernel) + " " + mode] = mips;
+	fclose(src);
+	return baseline;
+}
+
+int main(int argc, char* argv[]){
+	uint64_t min_steps = 10000000;
+	string baseline_file = "mips_bench_baseline.txt";
+	bool write_baseline = false;
+	for (int i = 1; i < argc; ++i){
+		if ((strcmp(argv[i], "-s") == 0) && (i + 1 < argc))
+			min_steps = strtoull(argv[++i], NULL, 0);
+		else if ((strcmp(argv[i], "-b") == 0) && (i + 1 < argc))
+			baseline_file = argv[++i];
+		else if ((strcmp(argv[i], "-f") == 0) && (i + 1 < argc))
+			sg_fibonacci_file = argv[++i];
+		else if (strcmp(argv[i], "-w") == 0)
+			write_baseline = true;
+		else {
+			fprintf(stderr, "Usage: %s [-s steps] [-b baseline file] [-f fibonacci binary] [-w]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	map<string, double> baseline = mips_bench_read_baseline(baseline_file);
+	FILE* out = NULL;
+	if (write_baseline && ((out = fopen(baseline_file.c_str(), "w")) == NULL)){
+		fprintf(stderr, "Cannot write %s\n", baseline_file.c_str());
+		return 1;
+	}
+
+	printf("%-10s %-4s %12s %9s %9s %9s %12s %10s %10s %8s\n",
+		"Kernel", "Mode", "Steps", "Seconds", "MIPS", "ns/instr", "Allocs/step", "Peak RSS", "Baseline", "Change");
+	int failed = 0;
+	double log_sum = 0;
+	unsigned compared = 0;
+	for (unsigned k = 0; k < sizeof(sg_kernels) / sizeof(sg_kernels[0]); ++k){
+		for (unsigned m = 0; m < mips_bench_MODES; ++m){
+			const mips_bench_kernel& kernel = sg_kernels[k];
+			mips_bench_result result = mips_bench_measure(kernel, mips_bench_mode(m), min_steps);
+			if (!result.ok){
+				printf("%-10s %-4s FAILED\n", kernel.name, sg_modes[m]);
+				++failed;
+				continue;
+			}
+
+			double mips = result.steps / result.seconds / 1e6;
+			struct rusage usage;
+			getrusage(RUSAGE_SELF, &usage);
+			printf("%-10s %-4s %12llu %9.3f %9.2f %9.2f %12.6f %8ldKB",
+				kernel.name, sg_modes[m], (unsigned long long)result.steps, result.seconds, mips,
+				1e9 * result.seconds / result.steps, double(result.allocations) / result.steps, usage.ru_maxrss);
+			map<string, double>::const_iterator old = baseline.find(string(kernel.name) + " " + sg_modes[m]);
+			if (old != baseline.end()){
+				printf(" %10.2f %+7.1f%%", old->second, 100.0 * (mips / old->second - 1.0));
+				log_sum += log(mips / old->second);
+				++compared;
+			}
+			printf("\n");
+			if (out != NULL)
+				fprintf(out, "%s %s %.2f\n", kernel.name, sg_modes[m], mips);
+		}
+	}
+	if (compared != 0)
+		printf("Geometric mean against the baseline: %+.1f%%\n", 100.0 * (exp(log_sum / compared) - 1.0));
+	if (out != NULL){
+		fclose(out);
+		printf("Baseline written to %s\n", baseline_file.c_str());
+	}
+	return failed ? 1 : 0;
+}
@@ -2,31 +2,22 @@
 #include <assert.h>
 #include <stdio.h>
 #include "mips.h"
-#include "mips_cpu_decode.hpp"
 #include "mips_cpu_execute.hpp"
+#include "mips_cpu_icache.hpp"
+#include "mips_cpu_block.hpp"
+#include "mips_cpu_jit.hpp"
+#include "mips_cpu_tlb.hpp"
+#include "mips_cpu_trace.hpp"
+#include "mips_cpu_profile.hpp"
+#include "mips_cpu_history.hpp"
+#include "mips_cpu_record.hpp"
+#include "mips_cpu_syscall.hpp"
+#include "mips_cpu_impl.hpp"
 
 #define NDEBUG
 
 using namespace std;
 
-//Debug functions
-void debug_level_1(const mips_cpu_h& state, const string& instruction);
-void debug_level_2(const mips_cpu_h& state, const string& instruction);
-void debug_level_3(const mips_cpu_h& state, const string& instruction, FILE* file);
-
-//CPU IMPLEMENT - registers, program counter, program counter new, debug level, debug destination, memory, hi, lo
-struct mips_cpu_impl{
-	uint32_t pc;
-	uint32_t hi;
-	uint32_t lo;
-	uint32_t pcN;
-	uint32_t regs[32];
-	unsigned level;
-	FILE* dest;
-	mips_mem_h mem;
-};
-
-
 //CPU CREATE - creates the CPU
 mips_cpu_h mips_cpu_create(mips_mem_h mem){
 	if (mem==0)
@@ -38,8 +29,25 @@ mips_cpu_h mips_cpu_create(mips_mem_h mem){
 	state->pc = 0;
 	state->pcN = 4;
 	state->mem=mem;
+	state->level = 0;
+	state->dest = NULL;
 	for (unsigned i = 0; i < 32; ++i)
 		state->regs[i]=0;
+	mips_icache_flush(state);
+	state->blocks = new mips_block[MIPS_BLOCK_CACHE_SIZE];
+	state->block_generation = 0;
+	state->jit = 0;
+	mips_block_flush(state);
+	mips_tlb_flush(state);
+	state->tlb_generation = 0;
+	state->ll_valid = false;
+	state->trace = 0;
+	state->profile = 0;
+	state->profiling = false;
+	state->history = 0;
+	state->record = 0;
+	state->history_log = 0;
+	state->syscall = 0;
 
 	return state;
 }
@@ -54,7 +62,14 @@ mips_error mips_cpu_reset(mips_cpu_h state){
 	state->lo = 0;
 	for (unsigned i = 0; i < 32; ++i)
 		state->regs[i]=0;
+	state->ll_valid = false;
+	if (state->syscall)
+		mips_syscall_reset(state->syscall);
 
+	if (state->record)
+		mips_record_reset(state);
+	if (state->history)
+		return mips_history_changed(state);
 	return mips_Success;
 }
 //CPU GET - fetches a value from a register
@@ -80,6 +95,10 @@ mips_error mips_cpu_set_register(mips_cpu_h state, unsigned index, uint32_t valu
 	if(index!=0)
 		state->regs[index]=value;
 
+	if (state->record && (index!=0))
+		mips_record_register(state, index, value);
+	if (state->history)
+		return mips_history_changed(state);
 	return mips_Success;
 }
 //CPU SET PC - sets the program counter
@@ -89,6 +108,10 @@ mips_error mips_cpu_set_pc(mips_cpu_h state, uint32_t pc){
 
 	state->pc = pc;
 	state->pcN = pc + 4;
+	if (state->record)
+		mips_record_register(state, 32, pc);
+	if (state->history)
+		return mips_history_changed(state);
 	return mips_Success;
 }
 //CPU GET PC - sets the program counter
@@ -105,57 +128,88 @@ mips_error mips_cpu_step(mips_cpu_h state){
 	if(state==0)
 		return mips_ErrorInvalidHandle;
 
-	uint32_t* instruction_data = new uint32_t[8];
-	string instruction;
-	mips_error err;
-	uint32_t mem_value;
-	uint8_t dataOut[4];
+	const mips_icache_entry* entry = NULL;
 
-	//FETCH
-	if (state->pc % 4 == 0){
-		err = mips_mem_read(state->mem, state->pc, 4, dataOut);
-		mem_value = dataOut[0] | (uint32_t(dataOut[1]) << 8) | (uint32_t(dataOut[2]) << 16) | (uint32_t(dataOut[3]) << 24);
-	} else {
-		err = mips_ExceptionInvalidAlignment;
-	}
+	//REPLAY - changes the host made before this instruction in the recorded run
+	if (state->record)
+		mips_record_step(state);
 
-	//DECODE
-	if (err == mips_Success)
-		err = mips_decode(mem_value, instruction_data);
+	//FETCH and DECODE - served from the decoded instruction cache
+	mips_error err = mips_icache_fetch(state, state->pc, &entry);
+
+	//Operands of the record have to be taken before the instruction changes them
+	bool traced = (state->level != 0) || (state->trace != 0) || state->profiling;
+	mips_trace_record record;
+	if (traced)
+		mips_trace_begin(state, (err == mips_Success) ? entry : NULL, record);
 
-	//EXECUTE
+	//EXECUTE - the handler moves PC and PCN on, branches and jumps included, or leaves them on an exception
 	if (err == mips_Success)
-		err = mips_execute(state, state->mem, state->hi, state->lo, instruction_data, instruction, state->pcN, state->pc);
+		err = mips_execute(state, entry->op, entry->instruction_data);
+
+	//DEBUG, TRACE and PROFILE - the record is only filled when someone looks at it
+	if (traced)
+		mips_trace_end(state, entry, err, record);
+	if (state->profiling)
+		mips_profile_count(state->profile, record, state->pcN);
+	if (state->record && (err == mips_Success))
+		mips_record_retired(state->record);
+	if (state->history && (err == mips_Success))
+		mips_history_retired(state, 1);
+
+	return err;
+}
+//CPU RUN - steps the program counter many times
+static mips_error mips_cpu_run_internal(mips_cpu_h state, uint64_t max_steps, const uint32_t* stop_pc, uint64_t* steps_executed){
+	if(state==0)
+		return mips_ErrorInvalidHandle;
 
-	//IF SUCCESS increase PC to new value and not JUMP or BRANCH
-	if (err == mips_Success){
-		state->pc = state->pcN;
-		state->pcN = state->pcN + 4;
+	//History - runs up to each checkpoint with the history put aside, so steps are not counted twice
+	if (state->history){
+		mips_history* history = state->history;
+		mips_error err = mips_Success;
+		uint64_t steps = 0;
+		while ((err == mips_Success) && (steps < max_steps)){
+			uint64_t chunk = mips_history_left(history);
+			if (chunk > max_steps - steps)
+				chunk = max_steps - steps;
+			uint64_t done = 0;
+			state->history = 0;
+			err = mips_cpu_run_internal(state, chunk, stop_pc, &done);
+			state->history = history;
+			steps += done;
+			mips_history_retired(state, done);
+			if (done < chunk)
+				break;
+		}
+		if (steps_executed)
+			*steps_executed = steps;
+		return err;
 	}
-	//IF JUMP/BRANCH - PC, PCN adjusted in execution
-	if (err == mips_ExceptionBreak)
-		err = mips_Success;
-
-	//DEBUG
-	switch(state->level){
-		case 1:
-			debug_level_1(state, instruction);
-		break;
-
-		case 2:
-			debug_level_2(state, instruction);
-		break;
-
-		case 3:
-			debug_level_3(state, instruction, state->dest);
-		break;
-
-		default:
-		break;
+
+	//Debug output, the trace, the profile and the log are produced per instruction by mips_cpu_step
+	if ((state->level != 0) || (state->trace != 0) || state->profiling || (state->record != 0)){
+		mips_error err = mips_Success;
+		uint64_t steps = 0;
+		while ((steps < max_steps) && !(stop_pc && (state->pc == *stop_pc))){
+			err = mips_cpu_step(state);
+			if (err != mips_Success)
+				break;
+			++steps;
+		}
+		if (steps_executed)
+			*steps_executed = steps;
+		return err;
 	}
 
-	delete [] instruction_data;
-	return err;
+	return mips_block_run(state, max_steps, stop_pc, steps_executed);
+}
+mips_error mips_cpu_run(mips_cpu_h state, uint64_t max_steps, uint64_t* steps_executed){
+	return mips_cpu_run_internal(state, max_steps, NULL, steps_executed);
+}
+//CPU RUN UNTIL - steps the program counter until it reaches stop_pc
+mips_error mips_cpu_run_until(mips_cpu_h state, uint32_t stop_pc, uint64_t max_steps, uint64_t* steps_executed){
+	return mips_cpu_run_internal(state, max_steps, &stop_pc, steps_executed);
 }
 //CPU - SET DEBUG LEVEL
 mips_error mips_cpu_set_debug_level(mips_cpu_h state, unsigned level, FILE *dest){
@@ -165,35 +219,132 @@ mips_error mips_cpu_set_debug_level(mips_cpu_h state, unsigned level, FILE *dest
 	state->dest = dest;
 	return mips_Success;
 }
-void debug_level_1(const mips_cpu_h& state, const string& instruction){
-	cout<<endl<<"Executed instruction: "<<instruction<<endl;
-	cout<<"Next PC:="<<state->pc<<endl;
-}
-void debug_level_2(const mips_cpu_h& state, const string& instruction){
-	cout<<endl<<"Executed instruction: "<<instruction<<endl;
-	cout<<"Next PC:="<<state->pc<<endl;
-	cout<<"HI: "<<state->hi<<" LO: "<<state->lo<<endl;
-	for (int i = 0; i < 32; ++i){
-		if (i % 4 == 0)
-			cout<<endl;
-		cout<<"R["<<i<<"]"<<":= "<<state->regs[i]<<"\t";
+//CPU - SET TRACE, a null destination stops the trace and finishes the file
+mips_error mips_cpu_set_trace(mips_cpu_h state, FILE* dest){
+	if (state==0)
+		return mips_ErrorInvalidHandle;
+	if (dest==0)
+		return mips_trace_stop(state);
+	return mips_trace_start(state, dest);
+}
+//CPU - SET PROFILE, starting again drops the old counts and stopping keeps them
+mips_error mips_cpu_set_profile(mips_cpu_h state, unsigned enable){
+	if (state==0)
+		return mips_ErrorInvalidHandle;
+	if (enable)
+		return mips_profile_start(state);
+	mips_profile_stop(state);
+	return mips_Success;
+}
+//CPU - WRITE PROFILE
+mips_error mips_cpu_write_profile(mips_cpu_h state, FILE* dest, mips_profile_format format){
+	if (state==0)
+		return mips_ErrorInvalidHandle;
+	if ((dest==0) || (state->profile==0))
+		return mips_ErrorInvalidArgument;
+	return mips_profile_write(state->profile, dest, format);
+}
+//CPU - SET RECORD, a null destination stops recording and flushes the log
+mips_error mips_cpu_set_record(mips_cpu_h state, FILE* dest){
+	if (state==0)
+		return mips_ErrorInvalidHandle;
+	if (dest==0)
+		return mips_record_stop(state);
+	return mips_record_start(state, dest, false);
+}
+//CPU - SET REPLAY, a null source stops replaying
+mips_error mips_cpu_set_replay(mips_cpu_h state, FILE* src){
+	if (state==0)
+		return mips_ErrorInvalidHandle;
+	if (src==0)
+		return mips_record_stop(state);
+	return mips_record_start(state, src, true);
+}
+//CPU - SET SEMIHOSTING, stopping closes the files the program left open
+mips_error mips_cpu_set_semihosting(mips_cpu_h state, unsigned enable, uint32_t heap, FILE* in, FILE* out){
+	if (state==0)
+		return mips_ErrorInvalidHandle;
+	if (enable){
+		mips_error err = mips_syscall_start(state, heap, in, out);
+		if ((err == mips_Success) && state->history)
+			return mips_history_changed(state);
+		return err;
+	}
+	mips_syscall_stop(state);
+	if (state->history)
+		return mips_history_changed(state);
+	return mips_Success;
+}
+//CPU - GET EXIT CODE
+mips_error mips_cpu_get_exit_code(mips_cpu_h state, int32_t* code){
+	if (state==0)
+		return mips_ErrorInvalidHandle;
+	if ((code==0) || (state->syscall==0) || !mips_syscall_exit_code(state->syscall, code))
+		return mips_ErrorInvalidArgument;
+	return mips_Success;
+}
+//CPU - GET INSTRUCTION, straight from the instruction set table, INVALID is not one
+mips_error mips_cpu_get_instruction(unsigned index, const char** mnemonic, const char** description){
+	if ((mnemonic==0) || (index + 1 >= mips_op_COUNT))
+		return mips_ErrorInvalidArgument;
+	*mnemonic = mips_op_table[index + 1].name;
+	if (description)
+		*description = mips_op_table[index + 1].description;
+	return mips_Success;
+}
+//CPU - SET JIT, native code is only used when running blocks
+mips_error mips_cpu_set_jit(mips_cpu_h state, unsigned enable){
+	if (state==0)
+		return mips_ErrorInvalidHandle;
+
+	if (enable && (state->jit==0)){
+		state->jit = mips_jit_create();
+		if (state->jit==0)
+			return mips_ErrorNotImplemented;
 	}
-	cout<<endl;
-}
-void debug_level_3(const mips_cpu_h& state, const string& instruction, FILE* file){
-	if (file == NULL) perror ("Error opening file");
-	fprintf(state->dest,"Executed instruction: %s", instruction.c_str());
-	fprintf(state->dest,"Next PC:= %i \n", state->pc);
-	for (int i = 0; i < 32; ++i){
-		if (i % 4 == 0)
-			fprintf(state->dest,"\n");
-		fprintf(state->dest,"R[%i]:= %i \t",i, state->regs[i]);
+	if (!enable && (state->jit!=0)){
+		mips_block_flush(state);
+		mips_jit_free(state->jit);
+		state->jit = 0;
+	}
+	return mips_Success;
+}
+//CPU - SET HISTORY, an interval of zero drops the checkpoints
+mips_error mips_cpu_set_history(mips_cpu_h state, uint64_t interval){
+	if (state==0)
+		return mips_ErrorInvalidHandle;
+	if (interval==0){
+		mips_history_free(state);
+		return mips_Success;
 	}
-	cout<<endl;
+	return mips_history_start(state, interval);
+}
+//CPU - STEP BACK
+mips_error mips_cpu_step_back(mips_cpu_h state, uint64_t steps){
+	if (state==0)
+		return mips_ErrorInvalidHandle;
+	if (state->history==0)
+		return mips_ErrorInvalidArgument;
+	return mips_history_step_back(state, steps);
+}
+//CPU - RUN BACK TO, the last earlier time the CPU was about to run pc
+mips_error mips_cpu_run_back_to(mips_cpu_h state, uint32_t pc, uint64_t* steps_back){
+	if (state==0)
+		return mips_ErrorInvalidHandle;
+	if (state->history==0)
+		return mips_ErrorInvalidArgument;
+	return mips_history_run_back_to(state, pc, steps_back);
 }
 //CPU FREE - releases the CPU
 void mips_cpu_free(mips_cpu_h state){
 	if(state==0)
 		return;
-	free(state);
+	mips_trace_stop(state);
+	mips_profile_free(state);
+	mips_history_free(state);
+	mips_record_stop(state);
+	mips_syscall_stop(state);
+	mips_jit_free(state->jit);
+	delete [] state->blocks;
+	delete state;
 }
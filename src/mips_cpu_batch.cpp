@@ -0,0 +1,101 @@
+/*
+BATCH
+Runs independent CPUs on a pool of threads
+
+Each worker owns a deque of job indices, filled with an equal share up front.
+A worker takes jobs from the front of its own deque, and when it is empty
+steals from the back of the others, so the jobs stay spread out even when
+some programs run much longer than the rest
+*/
+#include "mips.h"
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+struct mips_batch_queue{
+	mutex lock;
+	deque<unsigned> jobs;
+};
+
+static bool mips_batch_take(mips_batch_queue& queue, bool front, unsigned* job){
+	lock_guard<mutex> guard(queue.lock);
+	if (queue.jobs.empty())
+		return false;
+	if (front){
+		*job = queue.jobs.front();
+		queue.jobs.pop_front();
+	} else {
+		*job = queue.jobs.back();
+		queue.jobs.pop_back();
+	}
+	return true;
+}
+
+static void mips_batch_run_job(mips_cpu_job& job){
+	job.steps = 0;
+	if (job.use_stop_pc)
+		job.result = mips_cpu_run_until(job.cpu, job.stop_pc, job.max_steps, &job.steps);
+	else
+		job.result = mips_cpu_run(job.cpu, job.max_steps, &job.steps);
+}
+
+static void mips_batch_worker(mips_cpu_job* jobs, vector<mips_batch_queue>* queues, unsigned self){
+	unsigned count = queues->size();
+	unsigned job;
+	for (;;){
+		if (mips_batch_take((*queues)[self], true, &job)){
+			mips_batch_run_job(jobs[job]);
+			continue;
+		}
+		//Own share is done, look for work starting with the next worker
+		bool stolen = false;
+		for (unsigned i = 1; (i < count) && !stolen; ++i)
+			stolen = mips_batch_take((*queues)[(self + i) % count], false, &job);
+		if (!stolen)
+			return;
+		mips_batch_run_job(jobs[job]);
+	}
+}
+
+//CPU RUN BATCH - runs every job, returns when all of them are finished
+mips_error mips_cpu_run_batch(mips_cpu_job* jobs, unsigned count, unsigned threads){
+	if ((jobs == 0) && (count != 0))
+		return mips_ErrorInvalidArgument;
+	for (unsigned i = 0; i < count; ++i)
+		if (jobs[i].cpu == 0)
+			return mips_ErrorInvalidHandle;
+
+	if (threads == 0)
+		threads = thread::hardware_concurrency();
+	if (threads == 0)
+		threads = 1;
+	if (threads > count)
+		threads = count;
+	if (threads <= 1){
+		for (unsigned i = 0; i < count; ++i)
+			mips_batch_run_job(jobs[i]);
+		return mips_Success;
+	}
+
+	//Contiguous shares, so neighbouring (often similar) jobs start on the same worker
+	vector<mips_batch_queue> queues(threads);
+	for (unsigned i = 0; i < count; ++i)
+		queues[uint64_t(i) * threads / count].jobs.push_back(i);
+
+	vector<thread> workers;
+	try {
+		for (unsigned i = 1; i < threads; ++i)
+			workers.push_back(thread(mips_batch_worker, jobs, &queues, i));
+	} catch (const system_error&){
+		//Fewer threads than asked for, the others steal the remaining shares
+	}
+	mips_batch_worker(jobs, &queues, 0);
+	for (unsigned i = 0; i < workers.size(); ++i)
+		workers[i].join();
+
+	return mips_Success;
+}
@@ -0,0 +1,177 @@
+/*
+BLOCK
+Runs the CPU a block at a time until an exception, until the PC reaches the
+stop PC (if there is one), or until the step budget is used up. The architectural state is kept exact after every micro-op, so
+the run can stop in the middle of a block and resume with mips_cpu_step
+
+A block can only be entered when PC and PCN are sequential. When they are not
+(the CPU stopped in a delay slot) or the PC cannot be translated (invalid
+instruction, bad address) the instruction is executed by mips_cpu_step, which
+also reports the exception
+*/
+#include "mips_cpu_block.hpp"
+#include "mips_cpu_icache.hpp"
+#include "mips_cpu_jit.hpp"
+#include "mips_cpu_tlb.hpp"
+#include "mips_cpu_impl.hpp"
+
+//Translates the block starting at pc, leaves it empty if pc cannot be decoded
+static void mips_block_translate(mips_cpu_h state, uint32_t pc, mips_block* block){
+	block->pc = pc;
+	block->ops.clear();
+	block->next[0] = 0;
+	block->next[1] = 0;
+	block->count = 0;
+	block->native = 0;
+
+	bool delay_slot = false;
+	uint32_t address = pc;
+	while ((block->ops.size() < MIPS_BLOCK_MAX_LENGTH) || delay_slot){
+		const mips_icache_entry* entry;
+		if (mips_icache_fetch(state, address, &entry) != mips_Success)
+			break;
+		if (entry->op == mips_op_INVALID)
+			break;
+
+		mips_block_op op;
+		op.op = entry->op;
+		op.handler = mips_op_table[entry->op].handler;
+		op.flags = mips_op_table[entry->op].flags;
+		for (unsigned i = 0; i < 8; ++i)
+			op.instruction_data[i] = entry->instruction_data[i];
+		block->ops.push_back(op);
+		address += 4;
+
+		if (delay_slot){
+			delay_slot = false;
+			break;
+		}
+		if (op.flags & MIPS_OP_CONTROL)
+			delay_slot = true;
+		//The host may have changed any memory, the next block is looked up again
+		else if (op.flags & MIPS_OP_SYSTEM)
+			break;
+	}
+	//A branch without its delay slot cannot run as part of a block
+	if (delay_slot){
+		block->ops.pop_back();
+		address -= 4;
+	}
+	block->end = address;
+}
+
+static mips_block* mips_block_lookup(mips_cpu_h state, uint32_t pc){
+	mips_block* block = &state->blocks[(pc >> 2) % MIPS_BLOCK_CACHE_SIZE];
+	if (block->pc != pc)
+		mips_block_translate(state, pc, block);
+	return block;
+}
+
+void mips_block_flush(mips_cpu_h state){
+	for (unsigned i = 0; i < MIPS_BLOCK_CACHE_SIZE; ++i){
+		state->blocks[i].pc = 1;
+		state->blocks[i].ops.clear();
+		state->blocks[i].next[0] = 0;
+		state->blocks[i].next[1] = 0;
+		state->blocks[i].count = 0;
+		state->blocks[i].native = 0;
+	}
+	if (state->jit)
+		mips_jit_reset(state->jit);
+}
+
+mips_error mips_block_run(mips_cpu_h state, uint64_t max_steps, const uint32_t* stop_pc, uint64_t* steps_executed){
+	mips_error err = mips_Success;
+	uint64_t steps = 0;
+	mips_block* block = 0;
+
+	while ((err == mips_Success) && (steps < max_steps)){
+		if (stop_pc && (state->pc == *stop_pc))
+			break;
+
+		uint32_t generation;
+		err = mips_mem_get_code_generation(state->mem, &generation);
+		if (err != mips_Success)
+			break;
+		if (generation != state->block_generation){
+			mips_block_flush(state);
+			state->block_generation = generation;
+			block = 0;
+		}
+		if (generation != state->tlb_generation){
+			mips_tlb_flush(state);
+			state->tlb_generation = generation;
+		}
+
+		//Follow the chain from the previous block, or look the PC up
+		uint32_t pc = state->pc;
+		mips_block* next = 0;
+		if (block){
+			unsigned edge = (pc == block->end) ? 0 : 1;
+			next = block->next[edge];
+			if ((next == 0) || (next->pc != pc)){
+				next = (state->pcN == pc + 4) ? mips_block_lookup(state, pc) : 0;
+				block->next[edge] = next;
+			}
+		} else if (state->pcN == pc + 4){
+			next = mips_block_lookup(state, pc);
+		}
+		if ((next != 0) && (next->ops.empty()))
+			next = 0;
+
+		if ((next == 0) || (state->pcN != pc + 4)){
+			err = mips_cpu_step(state);
+			if (err == mips_Success)
+				++steps;
+			block = 0;
+			continue;
+		}
+		block = next;
+		uint64_t length = block->ops.size();
+
+		//Run the native code of the block if it has been compiled, and does not contain the stop PC
+		bool stops_inside = stop_pc && (*stop_pc > block->pc) && (*stop_pc < block->end);
+		if ((state->jit != 0) && (length <= max_steps - steps) && !stops_inside){
+			if ((block->native == 0) && (++block->count == MIPS_JIT_THRESHOLD))
+				block->native = mips_jit_compile(state, block);
+			if (block->native){
+				err = block->native(state);
+				if (err == mips_Success){
+					steps += length;
+					continue;
+				}
+				steps += (state->pc - block->pc) / 4;
+				if (err == mips_jit_Exit)
+					err = mips_Success;
+				block = 0;
+				continue;
+			}
+		}
+
+		//Run the micro-ops back to back
+		if (length > max_steps - steps)
+			length = max_steps - steps;
+		const mips_block_op* op = &block->ops[0];
+		for (uint64_t i = 0; i < length; ++i, ++op){
+			if (stops_inside && (state->pc == *stop_pc))
+				break;
+			err = op->handler(state, op->instruction_data);
+			if (err != mips_Success)
+				break;
+			++steps;
+
+			//A store may have rewritten the rest of this block
+			if (op->flags & MIPS_OP_STORE){
+				mips_mem_get_code_generation(state->mem, &generation);
+				if (generation != state->block_generation){
+					block = 0;
+					break;
+				}
+			}
+		}
+	}
+
+	if (steps_executed)
+		*steps_executed = steps;
+	return err;
+}
@@ -0,0 +1,46 @@
+/*
+BLOCK
+Basic block translation cache
+A block is a straight-line run of instructions starting at some PC and ending
+after the delay slot of the first branch or jump. It is translated once into
+a list of micro-ops with pre-bound handlers, which then run back to back
+
+Blocks are chained: each remembers the block it last continued into on its
+fall-through and on its taken edge, so a hot loop does not look up the cache
+
+All blocks are dropped when the code generation of the memory changes
+Blocks that are entered often are compiled to native code when the JIT is on
+*/
+#ifndef mips_cpu_block_header
+#define mips_cpu_block_header
+
+#include <vector>
+#include "mips.h"
+#include "mips_cpu_execute.hpp"
+
+#define MIPS_BLOCK_CACHE_SIZE 512
+#define MIPS_BLOCK_MAX_LENGTH 64
+
+//Native code for a whole block, see mips_cpu_jit.hpp
+typedef mips_error (*mips_native)(mips_cpu_h state);
+
+struct mips_block_op{
+	mips_op op;
+	mips_handler handler;
+	unsigned flags;               //MIPS_OP_ flags of the instruction
+	uint32_t instruction_data[8]; //Decoded fields, see mips_cpu_decode.hpp
+};
+
+struct mips_block{
+	uint32_t pc;                  //Address of the first instruction, unaligned when empty
+	uint32_t end;                 //Address following the last instruction (fall-through edge)
+	vector<mips_block_op> ops;
+	mips_block* next[2];          //Chained successors: [0] fall-through, [1] taken
+	uint32_t count;               //Times entered, the block is compiled when it gets hot
+	mips_native native;           //Compiled block, 0 if not compiled
+};
+
+mips_error mips_block_run(mips_cpu_h state, uint64_t max_steps, const uint32_t* stop_pc, uint64_t* steps_executed);
+void mips_block_flush(mips_cpu_h state);
+
+#endif
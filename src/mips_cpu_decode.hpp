@@ -4,6 +4,8 @@ This set of functions perform the DECODE operation
 They accept the instruction, decode the internals
 and separate the bits into individual fields, agreed beforehand
 3 functions - 3 types: R, I, J
+The instruction is the word as the CPU sees it, which instruction it is
+comes from mips_resolve
 
 Stores the result int the array of uint32_ts
 padds if no value to be stored
@@ -1,651 +1,633 @@
 #include "mips_cpu_execute.hpp"
+#include "mips_cpu_impl.hpp"
+#include <cstring>
 /*
 EXECUTE
 This is a set of functions that executes decoded instructions
-Instructions are split according to type and then according to function
-They are also tested for invalid instruction formats
+Instructions are resolved through tables generated from mips_op_table,
+which also rejects the encodings that set a field required to be zero
 
-1. Test right formatting -> 2. Execute them -> 3. Return cascaded error/success
+1. Resolve and test right formatting -> 2. Execute the handler -> 3. Return cascaded error/success
 */
 
-mips_error mips_execute(mips_cpu_h state, mips_mem_h mem, uint32_t& hi, uint32_t& lo, const uint32_t* instruction_data, string& instruction, uint32_t& pcN, uint32_t& pc){
-	uint32_t type = instruction_data[7];
-	switch (type) {
-		case 0: return mips_execute_R(state, hi, lo, instruction_data, instruction, pcN, pc);
-		case 1: return mips_execute_I(state, mem, instruction_data, instruction, pcN, pc);
-		case 2: return mips_execute_J(state, instruction_data, instruction, pcN, pc);
-	}
-	return mips_InternalError;
+mips_error mips_execute(mips_cpu_h state, mips_op op, const uint32_t* instruction_data){
+	if (op == mips_op_INVALID)
+		return mips_ExceptionInvalidInstruction;
+
+	return mips_op_table[op].handler(state, instruction_data);
 }
 
-mips_error mips_execute_R(mips_cpu_h state, uint32_t& hi, uint32_t& lo, const uint32_t* instruction_data, string& instruction, uint32_t& pcN, uint32_t& pc){
-	uint32_t source1 = instruction_data[1];
-	uint32_t source2 = instruction_data[2];
-	uint32_t destination = instruction_data[3];
-	uint32_t shift = instruction_data[4];
-	uint32_t function = instruction_data[5];
+/*
+HANDLERS
+One handler per instruction, selected through mips_op_table
+Operands go straight to the register file, the decoder already masked the indices to 5 bits
 
-	switch(function){
-		case 0b100001:
-		if (shift==0)
-			return mips_execute_R_X(state, hi, lo, instruction_data,"ADDU", instruction, pcN, pc);
-		break;
-		case 0b100101:
-		if (shift==0)
-			return mips_execute_R_X(state, hi, lo, instruction_data,"OR", instruction, pcN, pc);
-		break;
-		case 0b100100:
-		if (shift==0)
-			return mips_execute_R_X(state, hi, lo, instruction_data, "AND", instruction, pcN, pc);
-		break;
-		case 0b100110:
-		if (shift==0)
-			return mips_execute_R_X(state, hi, lo, instruction_data, "XOR", instruction, pcN, pc);
-		break;
-		case 0b100011:
-		if (shift==0)
-			return mips_execute_R_X(state, hi, lo, instruction_data, "SUBU", instruction, pcN, pc);
-		break;
-		case 0b100010:
-		if (shift==0)
-			return mips_execute_R_X(state, hi, lo, instruction_data, "SUB", instruction, pcN, pc);
-		break;
-		case 0b100000:
-		if (shift==0)
-			return mips_execute_R_X(state, hi, lo, instruction_data, "ADD", instruction, pcN, pc);
-		break;
-		case 0b000010:
-		if ((source1==0) && (shift<=31))
-			return mips_execute_R_X(state, hi, lo, instruction_data, "SRL", instruction, pcN, pc);
-		break;
-		case 0b000011:
-		if ((source1==0) && (shift<=31))
-			return mips_execute_R_X(state, hi, lo, instruction_data, "SRA", instruction, pcN, pc);
-		break;
-		case 0b000111:
-		if (shift==0)
-			return mips_execute_R_X(state, hi, lo, instruction_data, "SRAV", instruction,pcN, pc);
-		break;
-		case 0b000110:
-		if (shift==0)
-			return mips_execute_R_X(state, hi, lo, instruction_data, "SRLV", instruction, pcN, pc);
-		break;
-		case 0b000000:
-		if (source1==0)
-			return mips_execute_R_X(state, hi, lo, instruction_data, "SLL", instruction, pcN, pc);
-		break;
-		case 0b101011:
-		if (shift==0)
-			return mips_execute_R_X(state, hi, lo, instruction_data, "SLTU", instruction, pcN, pc);
-		break;
-		case 0b101010:
-		if (shift==0)
-			return mips_execute_R_X(state, hi, lo, instruction_data, "SLT", instruction, pcN, pc);
-		break;
-		case 0b000100:
-		if (shift==0)
-			return mips_execute_R_X(state, hi, lo, instruction_data, "SLLV", instruction, pcN, pc);
-		break;
-		case 0b010010:
-		if ((source1==0) && (source2==0) && (shift==0))
-			return mips_execute_R_X(state, hi, lo, instruction_data, "MFLO", instruction, pcN, pc);
-		break;
-		case 0b010000:
-		if ((source1==0) && (source2==0) && (shift==0))
-			return mips_execute_R_X(state, hi, lo, instruction_data, "MFHI", instruction, pcN, pc);
-		break;
-		case 0b010011:
-		if ((source2==0) && (destination==0) && (shift==0))
-			return mips_execute_R_X(state, hi, lo, instruction_data, "MTLO", instruction, pcN, pc);
-		break;
-		case 0b010001:
-		if ((source2==0) && (destination==0) && (shift==0))
-			return mips_execute_R_X(state, hi, lo, instruction_data, "MTHI", instruction, pcN, pc);
-		break;
-		case 0b011010:
-		if ((shift==0) && (destination==0))
-			return mips_execute_R_X(state, hi, lo, instruction_data, "DIV", instruction, pcN, pc);
-		break;
-		case 0b011011:
-		if ((shift==0) && (destination==0))
-			return mips_execute_R_X(state, hi, lo, instruction_data, "DIVU", instruction, pcN, pc);
-		break;
-		case 0b011001:
-		if ((shift==0) && (destination==0))
-			return mips_execute_R_X(state, hi, lo, instruction_data, "MULTU", instruction, pcN, pc);
-		break;
-		case 0b011000:
-		if ((shift==0) && (destination==0))
-			return mips_execute_R_X(state, hi, lo, instruction_data, "MULT", instruction, pcN, pc);
-		break;
-		case 0b001001:
-		if ((source2==0) && (shift==0))
-			return mips_execute_R_X(state, hi, lo, instruction_data, "JALR", instruction, pcN, pc);
-		break;
-		case 0b001000:
-		if ((source2==0) && (shift==0) && (destination==0))
-			return mips_execute_R_X(state, hi, lo, instruction_data, "JR", instruction, pcN, pc);
-		break;
-		default:
-		break;
-	}
-	instruction = "Invalid instruction format";
-	return mips_ExceptionInvalidInstruction;
+A handler that succeeds leaves PC and PCN on the next instruction and the one after it,
+so the loops never look at what kind of instruction ran. One that fails leaves them alone
+*/
+//Moves on to the next instruction, the delay slot of a branch moves on to its target
+static mips_error mips_advance(mips_cpu_h state){
+	state->pc = state->pcN;
+	state->pcN = state->pcN + 4;
+	return mips_Success;
 }
-mips_error mips_execute_I(mips_cpu_h state, mips_mem_h mem, const uint32_t* instruction_data, string& instruction, uint32_t& pcN, uint32_t& pc ){
-	uint32_t source1 = instruction_data[1];
-	uint32_t destination = instruction_data[2];
-
-	switch(instruction_data[0]){
-		case 0b001001:
-			return mips_execute_I_X(state, mem, instruction_data,"ADDIU", instruction, pcN, pc);
-		case 0b001000:
-			return mips_execute_I_X(state, mem, instruction_data,"ADDI", instruction, pcN, pc);
-		case 0b001100:
-			return mips_execute_I_X(state, mem, instruction_data,"ANDI", instruction, pcN, pc);
-		case 0b001101:
-			return mips_execute_I_X(state, mem, instruction_data,"ORI", instruction, pcN, pc);
-		case 0b001110:
-			return mips_execute_I_X(state, mem, instruction_data,"XORI", instruction, pcN, pc);
-		case 0b001011:
-			return mips_execute_I_X(state, mem, instruction_data,"SLTIU", instruction, pcN, pc);
-		case 0b001010:
-			return mips_execute_I_X(state, mem, instruction_data,"SLTI", instruction, pcN, pc);
-		case 0b000100:
-			return mips_execute_I_X(state, mem, instruction_data,"BEQ", instruction, pcN, pc);
-		case 0b000101:
-			return mips_execute_I_X(state, mem, instruction_data,"BNE", instruction, pcN, pc);
-		case 0b000001:
-			if (destination==0b00001)
-				return mips_execute_I_X(state, mem, instruction_data,"BGEZ", instruction, pcN, pc);
-			if (destination==0b00000)
-				return mips_execute_I_X(state, mem, instruction_data,"BLTZ", instruction, pcN, pc);
-			if (destination==0b10000)
-				return mips_execute_I_X(state, mem, instruction_data,"BLTZAL", instruction, pcN, pc);
-			if (destination==0b10001)
-				return mips_execute_I_X(state, mem, instruction_data,"BGEZAL", instruction, pcN, pc);
-		break;
-		case 0b000111:
-		if (destination==0)
-			return mips_execute_I_X(state, mem, instruction_data,"BGTZ", instruction, pcN, pc);
-		break;
-		case 0b000110:
-		if (destination==0)
-			return mips_execute_I_X(state, mem, instruction_data,"BLEZ", instruction, pcN, pc);
-		break;
-		case 0b100011:
-			return mips_execute_I_X(state, mem, instruction_data,"LW", instruction, pcN, pc);
-		case 0b101011:
-			return mips_execute_I_X(state, mem, instruction_data,"SW", instruction, pcN, pc);
-		case 0b100100:
-			return mips_execute_I_X(state, mem, instruction_data,"LBU", instruction, pcN, pc);
-		case 0b101000:
-			return mips_execute_I_X(state, mem, instruction_data,"SB", instruction, pcN, pc);
-		case 0b100000:
-			return mips_execute_I_X(state, mem, instruction_data,"LB", instruction, pcN, pc);
-		case 0b101001:
-			return mips_execute_I_X(state, mem, instruction_data,"SH", instruction, pcN, pc);
-		case 0b100001:
-			return mips_execute_I_X(state, mem, instruction_data,"LH", instruction, pcN, pc);
-		case 0b100101:
-			return mips_execute_I_X(state, mem, instruction_data,"LHU", instruction, pcN, pc);
-		case 0b001111:
-		if (source1==0)
-			return mips_execute_I_X(state, mem, instruction_data,"LUI", instruction, pcN, pc);
-		break;
-		case 0b100010:
-			return mips_execute_I_X(state, mem, instruction_data,"LWL", instruction, pcN, pc);
-		case 0b100110:
-			return mips_execute_I_X(state, mem, instruction_data,"LWR", instruction, pcN, pc);
-		default:
-		break;
-	}
-	instruction = "Invalid instruction format";
-	return mips_ExceptionInvalidInstruction;
+//Moves on only if the instruction did not raise an exception
+static mips_error mips_advance_if(mips_cpu_h state, mips_error err){
+	if (err != mips_Success)
+		return err;
+	return mips_advance(state);
+}
+//Writes the result of an instruction and moves on, the common end of a handler
+static mips_error mips_retire(mips_cpu_h state, uint32_t index, uint32_t value){
+	state->regs[index] = value;
+	state->regs[0] = 0;
+	state->pc = state->pcN;
+	state->pcN = state->pcN + 4;
+	return mips_Success;
+}
+//Takes a branch: the delay slot executes next, then the target
+static mips_error mips_branch(mips_cpu_h state, int32_t imm_signed){
+	state->pc = state->pcN;
+	state->pcN = int32_t(state->pcN) + (imm_signed << 2);
+	return mips_Success;
+}
+//Takes a jump to an absolute address after the delay slot
+static mips_error mips_jump(mips_cpu_h state, uint32_t target){
+	state->pc = state->pcN;
+	state->pcN = target;
+	return mips_Success;
+}
+static int32_t mips_imm_signed(const uint32_t* d){
+	return int32_t(int16_t(d[3]));
+}
+static uint32_t mips_address(mips_cpu_h state, const uint32_t* d){
+	return mips_imm_signed(d) + mips_reg(state, d[1]);
 }
-mips_error mips_execute_J(mips_cpu_h state, const uint32_t* instruction_data, string& instruction, uint32_t& pcN, uint32_t& pc){
 
-	switch(instruction_data[0]){
-		case 0b000010:
-			return mips_execute_J_X(state, instruction_data, "JUMP", instruction, pcN, pc);
-		case 0b000011:
-			return mips_execute_J_X(state, instruction_data, "JAL", instruction, pcN, pc);
-		default:
-		break;
+//MEMORY - pages in the TLB are accessed in place, anything else goes through the memory API
+//The offset of an aligned access never crosses the end of its page, and an aligned access is
+//a single relaxed atomic so another CPU sharing the memory never sees half of it
+static uint8_t* mips_tlb_read(mips_cpu_h state, uint32_t address){
+	const mips_tlb_entry& entry = state->tlb[(address >> MIPS_TLB_PAGE_BITS) % MIPS_TLB_SIZE];
+	if (entry.page == (address >> MIPS_TLB_PAGE_BITS))
+		return entry.host + (address & ((1 << MIPS_TLB_PAGE_BITS) - 1));
+	return mips_tlb_fill(state, address, false);
+}
+static uint8_t* mips_tlb_write(mips_cpu_h state, uint32_t address){
+	const mips_tlb_entry& entry = state->tlb[(address >> MIPS_TLB_PAGE_BITS) % MIPS_TLB_SIZE];
+	if ((entry.page == (address >> MIPS_TLB_PAGE_BITS)) && entry.writable)
+		return entry.host + (address & ((1 << MIPS_TLB_PAGE_BITS) - 1));
+	return mips_tlb_fill(state, address, true);
+}
+static mips_error mips_load32(mips_cpu_h state, uint32_t address, uint32_t* value){
+	uint8_t* host;
+	if (((address & 3) == 0) && ((host = mips_tlb_read(state, address)) != 0)){
+		uint32_t raw = __atomic_load_n((uint32_t*)host, __ATOMIC_RELAXED);
+		*value = endian32(raw);
+		return mips_Success;
+	}
+	if (state->record || state->history_log)
+		return mips_record_load(state, address, 4, value);
+	return mips_mem_read32(state->mem, address, value);
+}
+static mips_error mips_load16(mips_cpu_h state, uint32_t address, uint16_t* value){
+	uint8_t* host;
+	if (((address & 1) == 0) && ((host = mips_tlb_read(state, address)) != 0)){
+		uint16_t raw = __atomic_load_n((uint16_t*)host, __ATOMIC_RELAXED);
+		*value = endian16(raw);
+		return mips_Success;
+	}
+	if (state->record || state->history_log){
+		uint32_t logged = 0;
+		mips_error err = mips_record_load(state, address, 2, &logged);
+		*value = uint16_t(logged);
+		return err;
+	}
+	return mips_mem_read16(state->mem, address, value);
+}
+static mips_error mips_load8(mips_cpu_h state, uint32_t address, uint8_t* value){
+	uint8_t* host = mips_tlb_read(state, address);
+	if (host != 0){
+		*value = __atomic_load_n(host, __ATOMIC_RELAXED);
+		return mips_Success;
+	}
+	if (state->record || state->history_log){
+		uint32_t logged = 0;
+		mips_error err = mips_record_load(state, address, 1, &logged);
+		*value = uint8_t(logged);
+		return err;
+	}
+	return mips_mem_read(state->mem, address, 1, value);
+}
+static mips_error mips_store32(mips_cpu_h state, uint32_t address, uint32_t value){
+	uint8_t* host;
+	if (((address & 3) == 0) && ((host = mips_tlb_write(state, address)) != 0)){
+		uint32_t raw = endian32(value);
+		__atomic_store_n((uint32_t*)host, raw, __ATOMIC_RELAXED);
+		return mips_Success;
+	}
+	return mips_mem_write32(state->mem, address, value);
+}
+static mips_error mips_store16(mips_cpu_h state, uint32_t address, uint16_t value){
+	uint8_t* host;
+	if (((address & 1) == 0) && ((host = mips_tlb_write(state, address)) != 0)){
+		uint16_t raw = endian16(value);
+		__atomic_store_n((uint16_t*)host, raw, __ATOMIC_RELAXED);
+		return mips_Success;
+	}
+	return mips_mem_write16(state->mem, address, value);
+}
+static mips_error mips_store8(mips_cpu_h state, uint32_t address, uint8_t value){
+	uint8_t* host = mips_tlb_write(state, address);
+	if (host != 0){
+		__atomic_store_n(host, value, __ATOMIC_RELAXED);
+		return mips_Success;
 	}
-
-	instruction = "Invalid instruction format";
-	return mips_ExceptionInvalidInstruction;
+	return mips_mem_write(state->mem, address, 1, &value);
 }
-mips_error mips_execute_R_X(mips_cpu_h state, uint32_t& hi, uint32_t& lo, const uint32_t* instruction_data, const string& op, string& instruction, uint32_t& pcN, uint32_t& pc){
-
-	stringstream ss;
 
-	mips_error err = mips_ExceptionInvalidInstruction;;
-	uint32_t* source1 = new uint32_t;
-	uint32_t* source2 = new uint32_t;
-	uint32_t destination = instruction_data[3];
-	uint32_t shift = instruction_data[4];
+//R TYPE
+static mips_error mips_execute_ADDU(mips_cpu_h state, const uint32_t* d){
+	return mips_retire(state, d[3], mips_reg(state, d[1]) + mips_reg(state, d[2]));
+}
+static mips_error mips_execute_SRL(mips_cpu_h state, const uint32_t* d){
+	return mips_retire(state, d[3], uint32_t(mips_reg(state, d[2])) >> d[4]);
+}
+static mips_error mips_execute_SRA(mips_cpu_h state, const uint32_t* d){
+	return mips_retire(state, d[3], int32_t(mips_reg(state, d[2])) >> d[4]);
+}
+static mips_error mips_execute_SRAV(mips_cpu_h state, const uint32_t* d){
+	return mips_retire(state, d[3], int32_t(mips_reg(state, d[2])) >> (mips_reg(state, d[1]) & 0x1F));
+}
+static mips_error mips_execute_SRLV(mips_cpu_h state, const uint32_t* d){
+	return mips_retire(state, d[3], uint32_t(mips_reg(state, d[2])) >> (mips_reg(state, d[1]) & 0x1F));
+}
+static mips_error mips_execute_SLL(mips_cpu_h state, const uint32_t* d){
+	return mips_retire(state, d[3], mips_reg(state, d[2]) << d[4]);
+}
+static mips_error mips_execute_SLLV(mips_cpu_h state, const uint32_t* d){
+	return mips_retire(state, d[3], mips_reg(state, d[2]) << (mips_reg(state, d[1]) & 0x1F));
+}
+static mips_error mips_execute_SUBU(mips_cpu_h state, const uint32_t* d){
+	return mips_retire(state, d[3], mips_reg(state, d[1]) - mips_reg(state, d[2]));
+}
+static mips_error mips_execute_SUB(mips_cpu_h state, const uint32_t* d){
+	uint32_t source1 = mips_reg(state, d[1]);
+	uint32_t source2 = mips_reg(state, d[2]);
+	if (subtraction_overflow(source1, source2))
+		return mips_ExceptionArithmeticOverflow;
+	return mips_retire(state, d[3], int32_t(source1) - int32_t(source2));
+}
+static mips_error mips_execute_AND(mips_cpu_h state, const uint32_t* d){
+	return mips_retire(state, d[3], mips_reg(state, d[1]) & mips_reg(state, d[2]));
+}
+static mips_error mips_execute_OR(mips_cpu_h state, const uint32_t* d){
+	return mips_retire(state, d[3], mips_reg(state, d[1]) | mips_reg(state, d[2]));
+}
+static mips_error mips_execute_XOR(mips_cpu_h state, const uint32_t* d){
+	return mips_retire(state, d[3], mips_reg(state, d[1]) ^ mips_reg(state, d[2]));
+}
+static mips_error mips_execute_SLT(mips_cpu_h state, const uint32_t* d){
+	return mips_retire(state, d[3], int(int32_t(mips_reg(state, d[1])) < int32_t(mips_reg(state, d[2]))));
+}
+static mips_error mips_execute_SLTU(mips_cpu_h state, const uint32_t* d){
+	return mips_retire(state, d[3], int(mips_reg(state, d[1]) < mips_reg(state, d[2])));
+}
+static mips_error mips_execute_ADD(mips_cpu_h state, const uint32_t* d){
+	uint32_t source1 = mips_reg(state, d[1]);
+	uint32_t source2 = mips_reg(state, d[2]);
+	if (addition_overflow(source1, source2))
+		return mips_ExceptionArithmeticOverflow;
+	return mips_retire(state, d[3], source1 + source2);
+}
+static mips_error mips_execute_MFLO(mips_cpu_h state, const uint32_t* d){
+	return mips_retire(state, d[3], state->lo);
+}
+static mips_error mips_execute_MTLO(mips_cpu_h state, const uint32_t* d){
+	state->lo = mips_reg(state, d[1]);
+	return mips_advance(state);
+}
+static mips_error mips_execute_MFHI(mips_cpu_h state, const uint32_t* d){
+	return mips_retire(state, d[3], state->hi);
+}
+static mips_error mips_execute_MTHI(mips_cpu_h state, const uint32_t* d){
+	state->hi = mips_reg(state, d[1]);
+	return mips_advance(state);
+}
+static mips_error mips_execute_MULT(mips_cpu_h state, const uint32_t* d){
+	int64_t result = int64_t(mips_reg(state, d[1])) * int64_t(mips_reg(state, d[2]));
+	state->lo = uint32_t(result & 0xFFFFFFFF);
+	state->hi = int32_t((result & 0xFFFFFFFF00000000) >> 32);
+	return mips_advance(state);
+}
+static mips_error mips_execute_MULTU(mips_cpu_h state, const uint32_t* d){
+	uint64_t result = uint64_t(mips_reg(state, d[1])) * uint64_t(mips_reg(state, d[2]));
+	state->lo = uint32_t(result & 0xFFFFFFFF);
+	state->hi = uint32_t(result >> 32);
+	return mips_advance(state);
+}
+static mips_error mips_execute_DIV(mips_cpu_h state, const uint32_t* d){
+	uint32_t source1 = mips_reg(state, d[1]);
+	uint32_t source2 = mips_reg(state, d[2]);
+	if (source2==0)
+		return mips_ExceptionInvalidInstruction;
+	state->lo = int32_t(source1) / int32_t(source2);
+	state->hi = int32_t(source1) % int32_t(source2);
+	return mips_advance(state);
+}
+static mips_error mips_execute_DIVU(mips_cpu_h state, const uint32_t* d){
+	uint32_t source1 = mips_reg(state, d[1]);
+	uint32_t source2 = mips_reg(state, d[2]);
+	if (source2==0)
+		return mips_ExceptionInvalidInstruction;
+	state->lo = source1 / source2;
+	state->hi = source1 % source2;
+	return mips_advance(state);
+}
+static mips_error mips_execute_JR(mips_cpu_h state, const uint32_t* d){
+	return mips_jump(state, mips_reg(state, d[1]));
+}
+static mips_error mips_execute_JALR(mips_cpu_h state, const uint32_t* d){
+	uint32_t target = mips_reg(state, d[1]);
+	mips_reg_write(state, d[3], state->pc + 8);
+	return mips_jump(state, target);
+}
 
-	err = mips_cpu_get_register(state, (unsigned)instruction_data[1], source1);
-	if (err==mips_Success)
-		err = mips_cpu_get_register(state, (unsigned)instruction_data[2], source2);
+//I TYPE
+static mips_error mips_execute_ADDIU(mips_cpu_h state, const uint32_t* d){
+	return mips_retire(state, d[2], mips_reg(state, d[1]) + mips_imm_signed(d));
+}
+static mips_error mips_execute_ADDI(mips_cpu_h state, const uint32_t* d){
+	uint32_t source1 = mips_reg(state, d[1]);
+	if (addition_overflow(mips_imm_signed(d), source1))
+		return mips_ExceptionArithmeticOverflow;
+	return mips_retire(state, d[2], source1 + mips_imm_signed(d));
+}
+static mips_error mips_execute_ORI(mips_cpu_h state, const uint32_t* d){
+	return mips_retire(state, d[2], d[3] | mips_reg(state, d[1]));
+}
+static mips_error mips_execute_XORI(mips_cpu_h state, const uint32_t* d){
+	return mips_retire(state, d[2], d[3] ^ mips_reg(state, d[1]));
+}
+static mips_error mips_execute_ANDI(mips_cpu_h state, const uint32_t* d){
+	return mips_retire(state, d[2], d[3] & mips_reg(state, d[1]));
+}
+static mips_error mips_execute_SLTIU(mips_cpu_h state, const uint32_t* d){
+	return mips_retire(state, d[2], int(mips_reg(state, d[1]) < uint32_t(mips_imm_signed(d))));
+}
+static mips_error mips_execute_SLTI(mips_cpu_h state, const uint32_t* d){
+	return mips_retire(state, d[2], int(int32_t(mips_reg(state, d[1])) < mips_imm_signed(d)));
+}
+static mips_error mips_execute_LUI(mips_cpu_h state, const uint32_t* d){
+	return mips_retire(state, d[2], d[3] << 16);
+}
+static mips_error mips_execute_BEQ(mips_cpu_h state, const uint32_t* d){
+	if (mips_reg(state, d[1]) == mips_reg(state, d[2]))
+		return mips_branch(state, mips_imm_signed(d));
+	return mips_advance(state);
+}
+static mips_error mips_execute_BNE(mips_cpu_h state, const uint32_t* d){
+	if (mips_reg(state, d[1]) != mips_reg(state, d[2]))
+		return mips_branch(state, mips_imm_signed(d));
+	return mips_advance(state);
+}
+static mips_error mips_execute_BGEZ(mips_cpu_h state, const uint32_t* d){
+	if (int32_t(mips_reg(state, d[1])) >= 0)
+		return mips_branch(state, mips_imm_signed(d));
+	return mips_advance(state);
+}
+static mips_error mips_execute_BLEZ(mips_cpu_h state, const uint32_t* d){
+	if (int32_t(mips_reg(state, d[1])) <= 0)
+		return mips_branch(state, mips_imm_signed(d));
+	return mips_advance(state);
+}
+static mips_error mips_execute_BGTZ(mips_cpu_h state, const uint32_t* d){
+	if (int32_t(mips_reg(state, d[1])) > 0)
+		return mips_branch(state, mips_imm_signed(d));
+	return mips_advance(state);
+}
+static mips_error mips_execute_BLTZ(mips_cpu_h state, const uint32_t* d){
+	if (int32_t(mips_reg(state, d[1])) < 0)
+		return mips_branch(state, mips_imm_signed(d));
+	return mips_advance(state);
+}
+static mips_error mips_execute_BLTZAL(mips_cpu_h state, const uint32_t* d){
+	if (d[1]==31)
+		return mips_ErrorInvalidArgument;
+	if (int32_t(mips_reg(state, d[1])) < 0){
+		mips_reg_write(state, 31, state->pc + 8);
+		return mips_branch(state, mips_imm_signed(d));
+	}
+	return mips_advance(state);
+}
+static mips_error mips_execute_BGEZAL(mips_cpu_h state, const uint32_t* d){
+	if (d[1]==31)
+		return mips_ErrorInvalidArgument;
+	if (int32_t(mips_reg(state, d[1])) >= 0){
+		mips_reg_write(state, 31, state->pc + 8);
+		return mips_branch(state, mips_imm_signed(d));
+	}
+	return mips_advance(state);
+}
+static mips_error mips_execute_LW(mips_cpu_h state, const uint32_t* d){
+	uint32_t address = mips_address(state, d);
+	if (address%4!=0)
+		return mips_ExceptionInvalidAlignment;
+	uint32_t mem_value;
+	mips_error err = mips_load32(state, address, &mem_value);
 	if (err!=mips_Success)
-		return mips_ExceptionAccessViolation;
-
-	if (op.compare("ADDU")==0)
-		err = mips_cpu_set_register(state, destination, *source1 + *source2);
-
-	if (op.compare("SRL")==0)
-		err = mips_cpu_set_register(state, destination, uint32_t(*source2) >> shift);
-
-	if (op.compare("SRA")==0)
-		err = mips_cpu_set_register(state, destination, int32_t(*source2) >> shift);
-
-	if (op.compare("SRAV")==0)
-		err = mips_cpu_set_register(state, destination, int32_t(*source2) >> (*source1 & 0x1F));
-
-	if (op.compare("SRLV")==0)
-		err = mips_cpu_set_register(state, destination, uint32_t(*source2) >> (*source1 & 0x1F));
-
-	if (op.compare("SLL")==0)
-		err = mips_cpu_set_register(state, destination, *source2 << shift);
-
-	if (op.compare("SLLV")==0)
-		err = mips_cpu_set_register(state, destination, *source2 << (*source1 & 0x1F));
-
-	if (op.compare("SUBU")==0)
-		err = mips_cpu_set_register(state, destination, *source1 - *source2);
-
-	if (op.compare("SUB")==0){
-		if (!subtraction_overflow(*source1,*source2))
-			err = mips_cpu_set_register(state, destination, int32_t(*source1) - int32_t(*source2));
-		else
-			err = mips_ExceptionArithmeticOverflow;
-	}
-
-	if (op.compare("AND")==0)
-		err = mips_cpu_set_register(state, destination, *source1 & *source2);
-
-	if (op.compare("OR")==0)
-		err = mips_cpu_set_register(state, destination, *source1 | *source2);
-
-	if (op.compare("XOR")==0)
-		err = mips_cpu_set_register(state, destination, uint32_t(*source1 ^ *source2));
-
-	if(op.compare("SLT")==0)
-		err = mips_cpu_set_register(state, destination, int((int32_t(*source1) < int32_t(*source2))));
-
-	if (op.compare("SLTU")==0)
-		err = mips_cpu_set_register(state, destination, int(*source1 < *source2));
-
-	if (op.compare("ADD")==0){
-		if (!addition_overflow(*source1 ,*source2))
-			err = mips_cpu_set_register(state, destination, *source1 + *source2);
-		else
-			err = mips_ExceptionArithmeticOverflow;
-	}
-	if (op.compare("MFLO")==0)
-		err = mips_cpu_set_register(state, destination, lo);
-
-	if (op.compare("MTLO")==0){
-		lo = *source1;
-		err = mips_Success;
-	}
-	if (op.compare("MFHI")==0)
-		err = mips_cpu_set_register(state, destination, hi);
-
-	if (op.compare("MTHI")==0){
-		hi = *source1;
-		err = mips_Success;
-	}
-	if (op.compare("MULT")==0){
-		int64_t result =  int64_t(*source1) * int64_t(*source2);
-		lo = uint32_t(result & 0xFFFFFFFF);
-		hi = int32_t((result & 0xFFFFFFFF00000000) >> 32);
-		err = mips_Success;
-	}
-	if (op.compare("MULTU")==0){
-		uint64_t result =  uint64_t(*source1) * uint64_t(*source2);
-		lo = uint32_t(result & 0xFFFFFFFF);
-		hi = (uint32_t(result >> 32 ) & 0xFFFFFFFF);
-		err = mips_Success;
-	}
-
-	if (op.compare("DIV")==0){
-		if (*source2!=0) {
-			lo = (int32_t(*source1) / int32_t(*source2));
-			hi = (int32_t(*source1) % int32_t(*source2));
-			err = mips_Success;
-		} else {
-			err = mips_ExceptionInvalidInstruction;
-		}
-	}
-
-	if (op.compare("DIVU")==0){
-		if (*source2!=0){
-			lo = (uint32_t(*source1) / uint32_t(*source2));
-			hi = (uint32_t(*source1) % uint32_t(*source2));
-			err = mips_Success;
-		} else {
-			err = mips_ExceptionInvalidInstruction;
-		}
-	}
-
-	if (op.compare("JR")==0){
-		pc = pcN;
-		pcN = *source1;
-		err = mips_ExceptionBreak;
-	}
-
-	if (op.compare("JALR")==0){
-		mips_cpu_set_register(state, destination, pc + 8 );
-		pc = pcN;
-		pcN = *source1;
-		err = mips_ExceptionBreak;
-	}
-
-
-	//COUT OUTPUT
-	if ((err==mips_Success) || (err == mips_ExceptionBreak)) {
-		if ((op.compare("MTHI")==0) || (op.compare("MTLO")==0) || (op.compare("JR")==0))
-		ss <<op<<" R["<<instruction_data[1]<<"]";
-		if (op.compare("JALR")==0)
-		ss <<op<<" R["<<instruction_data[3]<<"] , R["<<instruction_data[1]<<"]";
-		if ((op.compare("MFHI")==0) || (op.compare("MFLO")==0))
-		ss <<op<<" R["<<instruction_data[3]<<"]";
-		if ((op.compare("SLL")==0)  || (op.compare("SRL")==0) || (op.compare("SRA")==0))
-		ss <<op<<" R["<<instruction_data[3]<<"] , R["<<instruction_data[2]<<"], #"<<instruction_data[4];
-		if ((op.compare("SLLV")==0) || (op.compare("SRAV")==0) || (op.compare("SRLV")==0))
-		ss <<op<<" R["<<instruction_data[3]<<"] , R["<<instruction_data[2]<<"] , R["<<instruction_data[1]<<"]";
-		if ((op.compare("SLT")==0) || (op.compare("SLTU")==0))
-		ss <<op<<" R["<<instruction_data[3]<<"] , R["<<instruction_data[1]<<"] , R["<<instruction_data[2]<<"]";
-		if ((op.compare("MULT")==0) || (op.compare("MULTU")==0) || (op.compare("DIV")==0) || (op.compare("DIVU")==0))
-		ss <<op<<" R["<<instruction_data[1]<<"] , R["<<instruction_data[2]<<"]";
-		if (ss.str().empty())
-		ss <<op<<" R["<<instruction_data[3]<<"] , R["<<instruction_data[1]<<"] , R["<<instruction_data[2]<<"]";
-		instruction = ss.str();
-	} else
-		instruction = "Invalid instruction";
-
-
-	delete source1; delete source2;
-	return err;
+		return err;
+	return mips_retire(state, d[2], mem_value);
 }
-mips_error mips_execute_I_X(mips_cpu_h state, mips_mem_h mem, const uint32_t* instruction_data, const string& op, string& instruction, uint32_t& pcN, uint32_t& pc){
-	stringstream ss;
-	mips_error err = mips_ExceptionInvalidInstruction;
-
-	uint32_t* source2 = new uint32_t;
-	uint32_t* source1 = new uint32_t;
-	uint32_t destination = instruction_data[2];
-	int32_t imm_signed =  int32_t(int16_t(instruction_data[3]));
-	uint32_t imm_unsigned = uint32_t(instruction_data[3]);
-
-
-	err = mips_cpu_get_register(state, (unsigned)instruction_data[1], source1);
-	if (err==mips_Success)
-	err = mips_cpu_get_register(state, (unsigned)instruction_data[2], source2);
+static mips_error mips_execute_LBU(mips_cpu_h state, const uint32_t* d){
+	uint8_t dataOut;
+	mips_error err = mips_load8(state, mips_address(state, d), &dataOut);
 	if (err!=mips_Success)
-	return mips_ExceptionAccessViolation;
-
-	if (op.compare("ADDIU")==0)
-		err = mips_cpu_set_register(state, destination, *source1 + imm_signed);
-
-	if (op.compare("ADDI")==0){
-		if (!addition_overflow(imm_signed,*source1))
-			err = mips_cpu_set_register(state, destination, *source1 + imm_signed);
-		else
-			err = mips_ExceptionArithmeticOverflow;
-	}
-	if (op.compare("ORI")==0)
-	err = mips_cpu_set_register(state, destination, imm_unsigned | *source1);
-
-	if (op.compare("XORI")==0)
-	err = mips_cpu_set_register(state, destination, uint32_t(*source1 ^ imm_unsigned));
-
-	if (op.compare("ANDI")==0)
-		err = mips_cpu_set_register(state, destination, imm_unsigned & *source1);
-
-	if (op.compare("SLTIU")==0)
-	err = mips_cpu_set_register(state, destination, int(uint32_t(*source1) < uint32_t(imm_signed)));
-
-	if (op.compare("SLTI")==0)
-	err = mips_cpu_set_register(state, destination, int((int32_t(*source1) < imm_signed)));
-
-	if (op.compare("BEQ")==0){
-		if (*source1 == *source2){
-			pc = pcN;
-			pcN = int32_t(pcN) + (imm_signed << 2);
-			err = mips_ExceptionBreak;
-		} else {
-			err = mips_Success;
-		}
-	}
-	if (op.compare("BNE")==0){
-		if (*source1 != *source2){
-			pc = pcN;
-			pcN = int32_t(pcN) + (imm_signed << 2);
-			err = mips_ExceptionBreak;
-		} else {
-			err = mips_Success;
-		}
-	}
-	if (op.compare("BGEZ")==0){
-		if (int32_t(*source1) >= 0){
-			pc = pcN;
-			pcN = int32_t(pcN) + (imm_signed << 2);
-			err = mips_ExceptionBreak;
-		} else {
-			err = mips_Success;
-		}
-	}
-
-	if (op.compare("BLEZ")==0){
-		if (int32_t(*source1) <= 0){
-			pc = pcN;
-			pcN = int32_t(pcN) + (imm_signed << 2);
-			err = mips_ExceptionBreak;
-		} else {
-			err = mips_Success;
-		}
-	}
-
-	if (op.compare("BGTZ")==0){
-		if (int32_t(*source1) > 0){
-			pc = pcN;
-			pcN = int32_t(pcN) + (imm_signed << 2);
-			err = mips_ExceptionBreak;
-		} else {
-			err = mips_Success;
-		}
-	}
-
-	if (op.compare("BLTZ")==0){
-		if (int32_t(*source1) < 0){
-			pc = pcN;
-			pcN = int32_t(pcN) + (imm_signed << 2);
-			err = mips_ExceptionBreak;
-		} else {
-			err = mips_Success;
-		}
-	}
-
-	if (op.compare("BLTZAL")==0){
-		if (instruction_data[1]==31) {
-			err = mips_ErrorInvalidArgument;
-		} else {
-			if (int32_t(*source1) < 0){
-				mips_cpu_set_register(state, 31, pc + 8);
-				pc = pcN;
-				pcN = int32_t(pcN) + (imm_signed << 2);
-				err = mips_ExceptionBreak;
-			} else {
-				err = mips_Success;
-			}
-		}
-	}
-	if (op.compare("BGEZAL")==0){
-		if (instruction_data[1]==31) {
-			err = mips_ErrorInvalidArgument;
-		} else {
-			if (int32_t(*source1) >= 0){
-				mips_cpu_set_register(state, 31, pc + 8);
-				pc = pcN;
-				pcN = int32_t(pcN) + (imm_signed << 2);
-				err = mips_ExceptionBreak;
-			} else {
-				err = mips_Success;
-			}
-		}
-	}
-
-	if (op.compare("LW")==0){
-		if ((imm_signed + *source1)%4!=0) {
-			err = mips_ExceptionInvalidAlignment;
-		} else {
-			uint8_t dataOut[4];
-			err = mips_mem_read(mem, imm_signed + *source1, 4, dataOut);
-			uint32_t mem_value =  dataOut[3] | (uint32_t(dataOut[2]) << 8) | (uint32_t(dataOut[1]) << 16) | (uint32_t(dataOut[0]) << 24);
-			err = mips_cpu_set_register(state, destination, mem_value);
-		}
-	}
-
-	if (op.compare("LBU")==0){
-		uint8_t dataOut;
-		err = mips_mem_read(mem, imm_signed + *source1, 1, (uint8_t*)&dataOut);
-		uint32_t mem_value = uint32_t(dataOut);
-		err = mips_cpu_set_register(state, destination, mem_value);
-	}
-
-	if (op.compare("LB")==0){
-		uint8_t dataOut;
-		err= mips_mem_read(mem, imm_signed + *source1, 1, (uint8_t*)&dataOut);
-		int32_t mem_value = int8_t(dataOut);
-		err = mips_cpu_set_register(state, destination, mem_value);
-	}
-
-	if (op.compare("LHU")==0){
-		if ((imm_signed + *source1)%2!=0) {
-			err = mips_ExceptionInvalidAlignment;
-		} else {
-			uint16_t dataOut;
-			err = mips_mem_read(mem, imm_signed + *source1, 2, (uint8_t*)&dataOut);
-			uint32_t mem_value = uint32_t(endian16(dataOut));
-			err = mips_cpu_set_register(state, destination, mem_value);
-		}
-	}
-
-	if (op.compare("LH")==0){
-		if ((imm_signed + *source1)%2!=0) {
-			err = mips_ExceptionInvalidAlignment;
-		} else {
-			uint16_t dataOut;
-			err = mips_mem_read(mem, imm_signed + *source1, 2, (uint8_t*)&dataOut);
-			int32_t mem_value = int32_t(int16_t(endian16(dataOut)));
-			err = mips_cpu_set_register(state, destination, mem_value);
-		}
-	}
-
-	if (op.compare("SW")==0){
-		if ((imm_signed + *source1)%4!=0) {
-			err = mips_ExceptionInvalidAlignment;
-		} else {
-			uint32_t value = uint32_t(endian32(*source2));
-			err = mips_mem_write(mem, imm_signed + *source1 ,4, (uint8_t*)&value);
-		}
-	}
-
+		return err;
+	return mips_retire(state, d[2], uint32_t(dataOut));
+}
+static mips_error mips_execute_LB(mips_cpu_h state, const uint32_t* d){
+	uint8_t dataOut;
+	mips_error err = mips_load8(state, mips_address(state, d), &dataOut);
+	if (err!=mips_Success)
+		return err;
+	return mips_retire(state, d[2], int32_t(int8_t(dataOut)));
+}
+static mips_error mips_execute_LHU(mips_cpu_h state, const uint32_t* d){
+	uint32_t address = mips_address(state, d);
+	if (address%2!=0)
+		return mips_ExceptionInvalidAlignment;
+	uint16_t dataOut;
+	mips_error err = mips_load16(state, address, &dataOut);
+	if (err!=mips_Success)
+		return err;
+	return mips_retire(state, d[2], uint32_t(dataOut));
+}
+static mips_error mips_execute_LH(mips_cpu_h state, const uint32_t* d){
+	uint32_t address = mips_address(state, d);
+	if (address%2!=0)
+		return mips_ExceptionInvalidAlignment;
+	uint16_t dataOut;
+	mips_error err = mips_load16(state, address, &dataOut);
+	if (err!=mips_Success)
+		return err;
+	return mips_retire(state, d[2], int32_t(int16_t(dataOut)));
+}
+static mips_error mips_execute_SW(mips_cpu_h state, const uint32_t* d){
+	uint32_t address = mips_address(state, d);
+	if (address%4!=0)
+		return mips_ExceptionInvalidAlignment;
+	return mips_advance_if(state, mips_store32(state, address, mips_reg(state, d[2])));
+}
+static mips_error mips_execute_SB(mips_cpu_h state, const uint32_t* d){
+	return mips_advance_if(state, mips_store8(state, mips_address(state, d), mips_reg(state, d[2]) & 0xFF));
+}
+static mips_error mips_execute_SH(mips_cpu_h state, const uint32_t* d){
+	uint32_t address = mips_address(state, d);
+	if (address%2!=0)
+		return mips_ExceptionInvalidAlignment;
+	return mips_advance_if(state, mips_store16(state, address, uint16_t(mips_reg(state, d[2]) & 0x0000FFFF)));
+}
+//LL remembers the word it loaded, SC only stores if the word still holds it.
+//Any other CPU changing the word in between makes the compare and swap fail
+static mips_error mips_execute_LL(mips_cpu_h state, const uint32_t* d){
+	uint32_t address = mips_address(state, d);
+	if (address%4!=0)
+		return mips_ExceptionInvalidAlignment;
+	uint32_t mem_value;
+	mips_error err = mips_load32(state, address, &mem_value);
+	if (err!=mips_Success)
+		return err;
+	state->ll_address = address;
+	state->ll_value = mem_value;
+	state->ll_valid = true;
+	return mips_retire(state, d[2], mem_value);
+}
+static mips_error mips_execute_SC(mips_cpu_h state, const uint32_t* d){
+	uint32_t address = mips_address(state, d);
+	if (address%4!=0)
+		return mips_ExceptionInvalidAlignment;
+	unsigned swapped = 0;
+	if (state->ll_valid && (state->ll_address == address)){
+		mips_error err = mips_mem_compare_swap32(state->mem, address, state->ll_value, mips_reg(state, d[2]), &swapped);
+		if (err!=mips_Success)
+			return err;
+	}
+	state->ll_valid = false;
+	return mips_retire(state, d[2], swapped);
+}
+static mips_error mips_execute_LWL(mips_cpu_h state, const uint32_t* d){
+	uint32_t address = mips_address(state, d);
+	uint32_t length = 4 - (address % 4);
+	uint32_t mem_value;
+	mips_error err = mips_load32(state, address - (address % 4), &mem_value);
+	if (err!=mips_Success)
+		return err;
+	mem_value = mem_value << (4-length)*8;
+	uint32_t source2 = mips_reg(state, d[2]) & (uint32_t(0xFFFFFFFF) >> length*8);
+	return mips_retire(state, d[2], mem_value | source2);
+}
+static mips_error mips_execute_LWR(mips_cpu_h state, const uint32_t* d){
+	uint32_t address = mips_address(state, d);
+	uint32_t length = (address % 4) + 1;
+	uint32_t mem_value;
+	mips_error err = mips_load32(state, address - (address % 4), &mem_value);
+	if (err!=mips_Success)
+		return err;
+	mem_value = mem_value >> (4-length)*8;
+	uint32_t source2 = mips_reg(state, d[2]) & (uint32_t(0xFFFFFFFF) << length*8);
+	return mips_retire(state, d[2], mem_value | source2);
+}
 
-	if (op.compare("SB")==0){
-		uint8_t mem_value = *source2 & 0xFF;
-		err = mips_mem_write(mem, imm_signed + *source1 ,1, (uint8_t*)&mem_value);
-	}
+//J TYPE
+static mips_error mips_execute_J(mips_cpu_h state, const uint32_t* d){
+	return mips_jump(state, (state->pcN & 0xF0000000) | (d[1] << 2));
+}
+static mips_error mips_execute_JAL(mips_cpu_h state, const uint32_t* d){
+	mips_reg_write(state, 31, state->pc + 8);
+	return mips_jump(state, (state->pcN & 0xF0000000) | (d[1] << 2));
+}
 
-	if (op.compare("SH")==0){
-		if ((imm_signed + *source1)%2!=0) {
-			err = mips_ExceptionInvalidAlignment;
-		} else {
-			uint16_t mem_value = endian16(uint16_t(*source2 & 0x0000FFFF));
-			uint16_t value = uint16_t(mem_value);
-			err = mips_mem_write(mem, imm_signed + *source1 ,2, (uint8_t*)&value);
-		}
-	}
+//SYSTEM - the run stops on the instruction unless semihosting does the call, see mips_cpu_syscall.hpp
+static mips_error mips_execute_SYSCALL(mips_cpu_h state, const uint32_t*){
+	if (state->syscall == 0)
+		return mips_ExceptionBreak;
+	return mips_advance_if(state, mips_syscall_call(state));
+}
+static mips_error mips_execute_BREAK(mips_cpu_h, const uint32_t*){
+	return mips_ExceptionBreak;
+}
 
-	if (op.compare("LUI")==0)
-		err = mips_cpu_set_register(state, destination, imm_signed << 16);
+//INSTRUCTION SET - mnemonic, encoding, operand format, properties, handler and description of every instruction
+//Fields of an instruction that have to be zero for a valid encoding
+#define MIPS_RS    0x03E00000
+#define MIPS_RT    0x001F0000
+#define MIPS_RD    0x0000F800
+#define MIPS_SHAMT 0x000007C0
 
-	if (op.compare("LWL")==0){
-		uint32_t address = imm_signed + *source1;
-		uint8_t length = 4 - int(address % 4);
-		uint8_t dataOut[4];
-		mips_error err= mips_mem_read(mem, address - int(address % 4), 4, dataOut);
-		uint32_t mem_value = uint32_t(dataOut[3]) | (uint32_t(dataOut[2]) << 8) | (uint32_t(dataOut[1]) << 16) | (uint32_t(dataOut[0]) << 24);
-		mem_value = uint32_t(mem_value) << (4-length)*8;
-		*source2 = *source2 & (uint32_t(0xFFFFFFFF) >> length*8);
-		*source2 = (uint32_t(mem_value)) | uint32_t(*source2);
-		err = mips_cpu_set_register(state, destination, *source2);
-	}
+//SPECIAL (opcode 0) selected by function
+static constexpr mips_encoding mips_R(uint32_t function, uint32_t zero){
+	return mips_encoding{0xFC00003F | zero, function};
+}
+//Selected by opcode alone
+static constexpr mips_encoding mips_I(uint32_t opcode, uint32_t zero){
+	return mips_encoding{0xFC000000 | zero, opcode << 26};
+}
+//REGIMM (opcode 1) selected by rt
+static constexpr mips_encoding mips_REGIMM(uint32_t rt){
+	return mips_encoding{0xFC000000 | MIPS_RT, (1 << 26) | (rt << 16)};
+}
 
-	if (op.compare("LWR")==0){
-		uint32_t address = imm_signed + *source1;
-		uint8_t length = int(address % 4) + 1;
-		uint8_t dataOut[4];
-		mips_error err= mips_mem_read(mem, address - int(address % 4), 4, dataOut);
-		uint32_t mem_value = uint32_t(dataOut[3]) | (uint32_t(dataOut[2]) << 8) | (uint32_t(dataOut[1]) << 16) | (uint32_t(dataOut[0]) << 24);
-		mem_value = uint32_t(mem_value) >> (4-length)*8;
-		*source2 = *source2 & (uint32_t(0xFFFFFFFF) << length*8);
-		*source2 = (uint32_t(mem_value)) | uint32_t(*source2);
-		err = mips_cpu_set_register(state, destination, *source2);
-	}
+constexpr mips_op_info mips_op_table[mips_op_COUNT] = {
+	{"INVALID", mips_encoding{0, 0},                          mips_format_NONE,            0,               0,                    0},
+	{"ADD",     mips_R(0x20, MIPS_SHAMT),                     mips_format_R_DST_S1_S2,     0,               mips_execute_ADD,     "Add (with overflow)"},
+	{"ADDI",    mips_I(0x08, 0),                              mips_format_I_DST_S1_IMM,    0,               mips_execute_ADDI,    "Add immediate (with overflow)"},
+	{"ADDIU",   mips_I(0x09, 0),                              mips_format_I_DST_S1_IMM,    0,               mips_execute_ADDIU,   "Add immediate unsigned (no overflow)"},
+	{"ADDU",    mips_R(0x21, MIPS_SHAMT),                     mips_format_R_DST_S1_S2,     0,               mips_execute_ADDU,    "Add unsigned (no overflow)"},
+	{"AND",     mips_R(0x24, MIPS_SHAMT),                     mips_format_R_DST_S1_S2,     0,               mips_execute_AND,     "Bitwise and"},
+	{"ANDI",    mips_I(0x0C, 0),                              mips_format_I_DST_S1_IMM,    0,               mips_execute_ANDI,    "Bitwise and immediate"},
+	{"BEQ",     mips_I(0x04, 0),                              mips_format_I_S1_S2_IMM,     MIPS_OP_CONTROL, mips_execute_BEQ,     "Branch on equal"},
+	{"BGEZ",    mips_REGIMM(0x01),                            mips_format_I_S1_IMM,        MIPS_OP_CONTROL, mips_execute_BGEZ,    "Branch on greater than or equal to zero"},
+	{"BGEZAL",  mips_REGIMM(0x11),                            mips_format_I_S1_IMM,        MIPS_OP_CONTROL, mips_execute_BGEZAL,  "Branch on greater than or equal to zero and link"},
+	{"BGTZ",    mips_I(0x07, MIPS_RT),                        mips_format_I_S1_IMM,        MIPS_OP_CONTROL, mips_execute_BGTZ,    "Branch on greater than zero"},
+	{"BLEZ",    mips_I(0x06, MIPS_RT),                        mips_format_I_S1_IMM,        MIPS_OP_CONTROL, mips_execute_BLEZ,    "Branch on less than or equal to zero"},
+	{"BLTZ",    mips_REGIMM(0x00),                            mips_format_I_S1_IMM,        MIPS_OP_CONTROL, mips_execute_BLTZ,    "Branch on less than zero"},
+	{"BLTZAL",  mips_REGIMM(0x10),                            mips_format_I_S1_IMM,        MIPS_OP_CONTROL, mips_execute_BLTZAL,  "Branch on less than zero and link"},
+	{"BNE",     mips_I(0x05, 0),                              mips_format_I_S1_S2_IMM,     MIPS_OP_CONTROL, mips_execute_BNE,     "Branch on not equal"},
+	{"BREAK",   mips_R(0x0D, 0),                              mips_format_NONE,            MIPS_OP_SYSTEM,  mips_execute_BREAK,   "Breakpoint"},
+	{"DIV",     mips_R(0x1A, MIPS_RD | MIPS_SHAMT),           mips_format_R_S1_S2,         0,               mips_execute_DIV,     "Divide"},
+	{"DIVU",    mips_R(0x1B, MIPS_RD | MIPS_SHAMT),           mips_format_R_S1_S2,         0,               mips_execute_DIVU,    "Divide unsigned"},
+	{"J",       mips_I(0x02, 0),                              mips_format_J,               MIPS_OP_CONTROL, mips_execute_J,       "Jump"},
+	{"JAL",     mips_I(0x03, 0),                              mips_format_J,               MIPS_OP_CONTROL, mips_execute_JAL,     "Jump and link"},
+	{"JALR",    mips_R(0x09, MIPS_RT | MIPS_SHAMT),           mips_format_R_DST_S1,        MIPS_OP_CONTROL, mips_execute_JALR,    "Jump and link register"},
+	{"JR",      mips_R(0x08, MIPS_RT | MIPS_RD | MIPS_SHAMT), mips_format_R_S1,            MIPS_OP_CONTROL, mips_execute_JR,      "Jump register"},
+	{"LB",      mips_I(0x20, 0),                              mips_format_I_MEMORY,        MIPS_OP_LOAD,    mips_execute_LB,      "Load byte"},
+	{"LBU",     mips_I(0x24, 0),                              mips_format_I_MEMORY,        MIPS_OP_LOAD,    mips_execute_LBU,     "Load byte unsigned"},
+	{"LH",      mips_I(0x21, 0),                              mips_format_I_MEMORY,        MIPS_OP_LOAD,    mips_execute_LH,      "Load half-word"},
+	{"LHU",     mips_I(0x25, 0),                              mips_format_I_MEMORY,        MIPS_OP_LOAD,    mips_execute_LHU,     "Load half-word unsigned"},
+	{"LL",      mips_I(0x30, 0),                              mips_format_I_MEMORY,        MIPS_OP_LOAD,    mips_execute_LL,      "Load linked"},
+	{"LUI",     mips_I(0x0F, MIPS_RS),                        mips_format_I_DST_IMM,       0,               mips_execute_LUI,     "Load upper immediate"},
+	{"LW",      mips_I(0x23, 0),                              mips_format_I_MEMORY,        MIPS_OP_LOAD,    mips_execute_LW,      "Load word"},
+	{"LWL",     mips_I(0x22, 0),                              mips_format_I_DST_S1_IMM,    MIPS_OP_LOAD,    mips_execute_LWL,     "Load word left"},
+	{"LWR",     mips_I(0x26, 0),                              mips_format_I_DST_S1_IMM,    MIPS_OP_LOAD,    mips_execute_LWR,     "Load word right"},
+	{"MFHI",    mips_R(0x10, MIPS_RS | MIPS_RT | MIPS_SHAMT), mips_format_R_DST,           0,               mips_execute_MFHI,    "Move from HI"},
+	{"MFLO",    mips_R(0x12, MIPS_RS | MIPS_RT | MIPS_SHAMT), mips_format_R_DST,           0,               mips_execute_MFLO,    "Move from LO"},
+	{"MTHI",    mips_R(0x11, MIPS_RT | MIPS_RD | MIPS_SHAMT), mips_format_R_S1,            0,               mips_execute_MTHI,    "Move to HI"},
+	{"MTLO",    mips_R(0x13, MIPS_RT | MIPS_RD | MIPS_SHAMT), mips_format_R_S1,            0,               mips_execute_MTLO,    "Move to LO"},
+	{"MULT",    mips_R(0x18, MIPS_RD | MIPS_SHAMT),           mips_format_R_S1_S2,         0,               mips_execute_MULT,    "Multiply"},
+	{"MULTU",   mips_R(0x19, MIPS_RD | MIPS_SHAMT),           mips_format_R_S1_S2,         0,               mips_execute_MULTU,   "Multiply unsigned"},
+	{"OR",      mips_R(0x25, MIPS_SHAMT),                     mips_format_R_DST_S1_S2,     0,               mips_execute_OR,      "Bitwise or"},
+	{"ORI",     mips_I(0x0D, 0),                              mips_format_I_DST_S1_IMM,    0,               mips_execute_ORI,     "Bitwise or immediate"},
+	{"SB",      mips_I(0x28, 0),                              mips_format_I_MEMORY,        MIPS_OP_STORE,   mips_execute_SB,      "Store byte"},
+	{"SC",      mips_I(0x38, 0),                              mips_format_I_MEMORY,        MIPS_OP_STORE,   mips_execute_SC,      "Store conditional"},
+	{"SH",      mips_I(0x29, 0),                              mips_format_I_MEMORY,        MIPS_OP_STORE,   mips_execute_SH,      "Store half-word"},
+	{"SLL",     mips_R(0x00, MIPS_RS),                        mips_format_R_DST_S2_SHIFT,  0,               mips_execute_SLL,     "Shift left logical"},
+	{"SLLV",    mips_R(0x04, MIPS_SHAMT),                     mips_format_R_DST_S2_S1,     0,               mips_execute_SLLV,    "Shift left logical variable"},
+	{"SLT",     mips_R(0x2A, MIPS_SHAMT),                     mips_format_R_DST_S1_S2,     0,               mips_execute_SLT,     "Set on less than (signed)"},
+	{"SLTI",    mips_I(0x0A, 0),                              mips_format_I_DST_S1_IMM,    0,               mips_execute_SLTI,    "Set on less than immediate (signed)"},
+	{"SLTIU",   mips_I(0x0B, 0),                              mips_format_I_DST_S1_IMM,    0,               mips_execute_SLTIU,   "Set on less than immediate unsigned"},
+	{"SLTU",    mips_R(0x2B, MIPS_SHAMT),                     mips_format_R_DST_S1_S2,     0,               mips_execute_SLTU,    "Set on less than unsigned"},
+	{"SRA",     mips_R(0x03, MIPS_RS),                        mips_format_R_DST_S2_SHIFT,  0,               mips_execute_SRA,     "Shift right arithmetic"},
+	{"SRAV",    mips_R(0x07, MIPS_SHAMT),                     mips_format_R_DST_S2_S1,     0,               mips_execute_SRAV,    "Shift right arithmetic variable"},
+	{"SRL",     mips_R(0x02, MIPS_RS),                        mips_format_R_DST_S2_SHIFT,  0,               mips_execute_SRL,     "Shift right logical"},
+	{"SRLV",    mips_R(0x06, MIPS_SHAMT),                     mips_format_R_DST_S2_S1,     0,               mips_execute_SRLV,    "Shift right logical variable"},
+	{"SUB",     mips_R(0x22, MIPS_SHAMT),                     mips_format_R_DST_S1_S2,     0,               mips_execute_SUB,     "Subtract"},
+	{"SUBU",    mips_R(0x23, MIPS_SHAMT),                     mips_format_R_DST_S1_S2,     0,               mips_execute_SUBU,    "Subtract unsigned"},
+	{"SW",      mips_I(0x2B, 0),                              mips_format_I_MEMORY,        MIPS_OP_STORE,   mips_execute_SW,      "Store word"},
+	{"SYSCALL", mips_R(0x0C, 0),                              mips_format_NONE,            MIPS_OP_SYSTEM,  mips_execute_SYSCALL, "System call"},
+	{"XOR",     mips_R(0x26, MIPS_SHAMT),                     mips_format_R_DST_S1_S2,     0,               mips_execute_XOR,     "Bitwise exclusive or"},
+	{"XORI",    mips_I(0x0E, 0),                              mips_format_I_DST_S1_IMM,    0,               mips_execute_XORI,    "Bitwise exclusive or immediate"}
+};
+
+//DECODER TABLES - generated from mips_op_table by the compiler, indexed by the field that selects the instruction:
+//the opcode, the function of SPECIAL and the rt of REGIMM
+template<unsigned... I> struct mips_indices{};
+template<unsigned N, unsigned... I> struct mips_make_indices : mips_make_indices<N - 1, N - 1, I...>{};
+template<unsigned... I> struct mips_make_indices<0, I...>{
+	typedef mips_indices<I...> type;
+};
+
+struct mips_decode_table{
+	mips_op ops[64];
+};
+
+//First instruction that fixes the bits of select to those of key
+static constexpr mips_op mips_find(uint32_t select, uint32_t key, unsigned op){
+	return (op == mips_op_COUNT) ? mips_op_INVALID :
+		(((mips_op_table[op].encoding.mask & select) == select) && ((mips_op_table[op].encoding.match & select) == key)) ? mips_op(op) :
+		mips_find(select, key, op + 1);
+}
+template<unsigned... I>
+static constexpr mips_decode_table mips_generate(uint32_t select, uint32_t base, unsigned shift, mips_indices<I...>){
+	return mips_decode_table{{mips_find(select, base | (I << shift), 1)...}};
+}
 
-	//COUT OUTPUT
-	if ((err==mips_Success) || (err==mips_ExceptionBreak)) {
-		if ((op.compare("SB")==0) || (op.compare("SW")==0) || (op.compare("LBU")==0) || (op.compare("LW")==0)
-		|| (op.compare("SH")==0) || (op.compare("LH")==0) || (op.compare("LHU")==0) || (op.compare("LB")==0))
-		ss <<op<<" R["<<instruction_data[2]<<"],"<<" #"<<instruction_data[3]<<", R["<<instruction_data[1]<<"] ";
+static constexpr mips_decode_table mips_primary = mips_generate(0xFC000000, 0, 26, mips_make_indices<64>::type());
+static constexpr mips_decode_table mips_special = mips_generate(0xFC00003F, 0, 0, mips_make_indices<64>::type());
+static constexpr mips_decode_table mips_regimm = mips_generate(0xFC1F0000, 1 << 26, 16, mips_make_indices<32>::type());
 
-		if ((op.compare("BGEZ")==0) || (op.compare("BGEZAL")==0) || (op.compare("BGTZ")==0) || (op.compare("BLEZ")==0) ||
-		(op.compare("BLTZAL")==0))
-		ss <<op<<" R["<<instruction_data[1]<<"],"<<" #"<<instruction_data[3];
+static constexpr mips_op mips_lookup(uint32_t word){
+	return ((word >> 26) == 0) ? mips_special.ops[word & 0x3F] :
+		((word >> 26) == 1) ? mips_regimm.ops[(word >> 16) & 0x1F] :
+		mips_primary.ops[word >> 26];
+}
+//The fields the lookup did not look at still have to match, INVALID matches every word
+static constexpr mips_op mips_check(mips_op op, uint32_t word){
+	return ((word & mips_op_table[op].encoding.mask) == mips_op_table[op].encoding.match) ? op : mips_op_INVALID;
+}
 
-		if((op.compare("LUI")==0))
-		ss <<op<<" R["<<instruction_data[2]<<"],"<<" #"<<instruction_data[3];
+//Every entry has to be reachable, with a handler and no match bits outside its mask
+static constexpr bool mips_table_consistent(unsigned op){
+	return (op == mips_op_COUNT) || (
+		(mips_op_table[op].handler != 0) &&
+		((mips_op_table[op].encoding.match & ~mips_op_table[op].encoding.mask) == 0) &&
+		(mips_check(mips_lookup(mips_op_table[op].encoding.match), mips_op_table[op].encoding.match) == mips_op(op)) &&
+		mips_table_consistent(op + 1));
+}
+static_assert(mips_table_consistent(1), "an instruction in mips_op_table does not decode back to itself");
 
-		if ((op.compare("BEQ")==0) || (op.compare("BNE")==0))
-		ss <<op<<" R["<<instruction_data[1]<<"] , R["<<instruction_data[2]<<"], "<<"#"<<instruction_data[3];
+mips_op mips_resolve(uint32_t instruction){
+	return mips_check(mips_lookup(instruction), instruction);
+}
 
-		if (ss.str().empty())
-		ss <<op<<" R["<<instruction_data[2]<<"] , R["<<instruction_data[1]<<"], "<<"#"<<instruction_data[3];
-		instruction = ss.str();
-	} else {
+//DISASSEMBLE - prints the instruction in the same format for every handler,
+//only called when the text is actually going to be shown
+void mips_disassemble(mips_op op, const uint32_t* d, string& instruction){
+	if (op == mips_op_INVALID){
 		instruction = "Invalid instruction format";
+		return;
 	}
-
-	delete source1;
-	return err;
-}
-mips_error mips_execute_J_X(mips_cpu_h state, const uint32_t* instruction_data, const string& op, string& instruction, uint32_t& pcN, uint32_t& pc){
-
 	stringstream ss;
-	mips_error err = mips_ExceptionInvalidInstruction;
-	uint32_t imm_unsigned = uint32_t(instruction_data[1]);
-
-	if (op.compare("JUMP")==0){
-		pc = pcN;
-		pcN = (pc & 0xF0000000) | (imm_unsigned << 2);
-		err = mips_ExceptionBreak;
-	}
-
-	if (op.compare("JAL")==0){
-		mips_cpu_set_register(state, 31, pc + 8);
-		pc = pcN;
-		pcN = (pc & 0xF0000000) | (imm_unsigned << 2);
-		err = mips_ExceptionBreak;
+	ss<<mips_op_table[op].name;
+	switch (mips_op_table[op].format) {
+		case mips_format_R_DST_S1_S2:
+			ss<<" R["<<d[3]<<"] , R["<<d[1]<<"] , R["<<d[2]<<"]"; break;
+		case mips_format_R_DST_S2_SHIFT:
+			ss<<" R["<<d[3]<<"] , R["<<d[2]<<"], #"<<d[4]; break;
+		case mips_format_R_DST_S2_S1:
+			ss<<" R["<<d[3]<<"] , R["<<d[2]<<"] , R["<<d[1]<<"]"; break;
+		case mips_format_R_S1_S2:
+			ss<<" R["<<d[1]<<"] , R["<<d[2]<<"]"; break;
+		case mips_format_R_S1:
+			ss<<" R["<<d[1]<<"]"; break;
+		case mips_format_R_DST:
+			ss<<" R["<<d[3]<<"]"; break;
+		case mips_format_R_DST_S1:
+			ss<<" R["<<d[3]<<"] , R["<<d[1]<<"]"; break;
+		case mips_format_I_DST_S1_IMM:
+			ss<<" R["<<d[2]<<"] , R["<<d[1]<<"], #"<<d[3]; break;
+		case mips_format_I_S1_S2_IMM:
+			ss<<" R["<<d[1]<<"] , R["<<d[2]<<"], #"<<d[3]; break;
+		case mips_format_I_S1_IMM:
+			ss<<" R["<<d[1]<<"], #"<<d[3]; break;
+		case mips_format_I_DST_IMM:
+			ss<<" R["<<d[2]<<"], #"<<d[3]; break;
+		case mips_format_I_MEMORY:
+			ss<<" R["<<d[2]<<"], #"<<d[3]<<", R["<<d[1]<<"] "; break;
+		case mips_format_J:
+			ss<<" #"<<d[1]; break;
+		default:
+		break;
 	}
-
-	ss <<op<<" "<<"#"<<instruction_data[1];
-
 	instruction = ss.str();
-	return err;
 }
@@ -1,3 +1,6 @@
+#ifndef mips_cpu_execute_header
+#define mips_cpu_execute_header
+
 #include <iostream>
 #include "mips.h"
 #include "mips_cpu_execute_help.hpp"
@@ -11,7 +14,13 @@ using namespace std;
 /*
 EXECUTE
 This is a set of functions that executes decoded instructions
-Instructions are split according to type and then according to function
+An instruction word is resolved once into a dense handler index (mips_op),
+which then selects the handler from mips_op_table
+
+mips_op_table is the one description of the instruction set: the encoding,
+operand format, properties and handler of every instruction. The decoder
+tables, the encoding checks and the mnemonics the CPU reports are all
+generated from it when the simulator is compiled
 
 instruction_data organization according to index instruction_data[index]
 ----------------------------------------------------------------------------------------------------------------------------
@@ -22,11 +31,73 @@ J TYPE: [OPCODE[0] | IMMEDIATE[1] | EMPTY[2]              | EMPTY[3]       | EMP
 
 */
 
-mips_error mips_execute(mips_cpu_h state, mips_mem_h mem, uint32_t& hi, uint32_t& lo, const uint32_t* instruction_data, string& instruction, uint32_t& pcN, uint32_t& pc);
-mips_error mips_execute_R(mips_cpu_h state, uint32_t& hi, uint32_t& lo, const uint32_t* instruction_data, string& instruction, uint32_t& pcN, uint32_t& pc);
-mips_error mips_execute_I(mips_cpu_h state, mips_mem_h mem, const uint32_t* instruction_data, string& instruction, uint32_t& pcN, uint32_t& pc);
-mips_error mips_execute_J(mips_cpu_h state, const uint32_t* instruction_data, string& instruction, uint32_t& pcN, uint32_t& pc);
+//Handler index, one per instruction in alphabetical order, the order of mips_op_table
+//(LL and SC come from MIPS II, BREAK and SYSCALL only stop or call the host)
+enum mips_op{
+	mips_op_INVALID = 0,
+	mips_op_ADD, mips_op_ADDI, mips_op_ADDIU, mips_op_ADDU, mips_op_AND, mips_op_ANDI,
+	mips_op_BEQ, mips_op_BGEZ, mips_op_BGEZAL, mips_op_BGTZ, mips_op_BLEZ, mips_op_BLTZ, mips_op_BLTZAL, mips_op_BNE, mips_op_BREAK,
+	mips_op_DIV, mips_op_DIVU,
+	mips_op_J, mips_op_JAL, mips_op_JALR, mips_op_JR,
+	mips_op_LB, mips_op_LBU, mips_op_LH, mips_op_LHU, mips_op_LL, mips_op_LUI, mips_op_LW, mips_op_LWL, mips_op_LWR,
+	mips_op_MFHI, mips_op_MFLO, mips_op_MTHI, mips_op_MTLO, mips_op_MULT, mips_op_MULTU,
+	mips_op_OR, mips_op_ORI,
+	mips_op_SB, mips_op_SC, mips_op_SH, mips_op_SLL, mips_op_SLLV, mips_op_SLT, mips_op_SLTI, mips_op_SLTIU, mips_op_SLTU,
+	mips_op_SRA, mips_op_SRAV, mips_op_SRL, mips_op_SRLV, mips_op_SUB, mips_op_SUBU, mips_op_SW, mips_op_SYSCALL,
+	mips_op_XOR, mips_op_XORI,
+	mips_op_COUNT
+};
+
+//Operand layout used when printing an instruction
+enum mips_format{
+	mips_format_NONE,
+	mips_format_R_DST_S1_S2,
+	mips_format_R_DST_S2_SHIFT,
+	mips_format_R_DST_S2_S1,
+	mips_format_R_S1_S2,
+	mips_format_R_S1,
+	mips_format_R_DST,
+	mips_format_R_DST_S1,
+	mips_format_I_DST_S1_IMM,
+	mips_format_I_S1_S2_IMM,
+	mips_format_I_S1_IMM,
+	mips_format_I_DST_IMM,
+	mips_format_I_MEMORY,
+	mips_format_J
+};
+
+//Runs one instruction, on success PC and PCN have moved on to whatever follows it, branches included
+typedef mips_error (*mips_handler)(mips_cpu_h state, const uint32_t* instruction_data);
+
+//Properties of an instruction the execution loops need to know about
+#define MIPS_OP_CONTROL 0x1 //Branch or jump, followed by a delay slot
+#define MIPS_OP_STORE   0x2 //Writes memory, may modify cached instructions
+#define MIPS_OP_LOAD    0x4 //Reads memory
+#define MIPS_OP_SYSTEM  0x8 //Calls the host, may read or write any memory, ends a block
+
+//A word is the instruction when (word & mask) == match, the mask also covers
+//the fields the instruction requires to be zero
+struct mips_encoding{
+	uint32_t mask;
+	uint32_t match;
+};
+
+struct mips_op_info{
+	const char* name;
+	mips_encoding encoding;
+	mips_format format;
+	unsigned flags;
+	mips_handler handler;
+	const char* description;
+};
+
+//Indexed by mips_op
+extern const mips_op_info mips_op_table[mips_op_COUNT];
+
+//Takes the word as the CPU sees it, mips_op_INVALID if no instruction is encoded that way
+mips_op mips_resolve(uint32_t instruction);
+
+mips_error mips_execute(mips_cpu_h state, mips_op op, const uint32_t* instruction_data);
+void mips_disassemble(mips_op op, const uint32_t* instruction_data, string& instruction);
 
-mips_error mips_execute_R_X(mips_cpu_h state, uint32_t& hi, uint32_t& lo, const uint32_t* instruction_data, const string& op, string& instruction, uint32_t& pcN, uint32_t& pc);
-mips_error mips_execute_I_X(mips_cpu_h state, mips_mem_h mem, const uint32_t* instruction_data, const string& op, string& instruction, uint32_t& pcN, uint32_t& pc);
-mips_error mips_execute_J_X(mips_cpu_h state, const uint32_t* instruction_data, const string& op, string& instruction, uint32_t& pcN, uint32_t& pc);
+#endif
@@ -36,9 +36,17 @@ bool addition_overflow(uint32_t a, uint32_t b) {
 }
 
 uint32_t endian32(const uint32_t& v){
+#if defined(__GNUC__)
+  return __builtin_bswap32(v);
+#else
   return (((v<<24)&0xFF000000) | ((v<<8)&0x00FF0000) | ((v>>8)&0x0000FF00) | ((v>>24)&0x000000FF));
+#endif
 }
 
 uint16_t endian16(const uint16_t& v){
+#if defined(__GNUC__)
+  return __builtin_bswap16(v);
+#else
   return (((v<<8)&0xFF00) | ((v>>8)&0x00FF));
+#endif
 }
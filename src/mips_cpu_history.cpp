@@ -0,0 +1,224 @@
+#include <vector>
+#include "mips.h"
+#include "mips_cpu_impl.hpp"
+#include "mips_cpu_history.hpp"
+
+using namespace std;
+
+//Checkpoints kept before every other one is dropped and the interval doubled
+#define MIPS_HISTORY_CHECKPOINTS 64
+
+struct mips_history_checkpoint{
+	uint64_t count;					//Instructions retired when it was taken
+	mips_cpu_snapshot_h snapshot;
+	uint32_t ll_address;			//The reservation is not part of a snapshot, but a replay needs it
+	uint32_t ll_value;
+	bool ll_valid;
+	bool pinned;					//Holds a change made by the host, so it is never dropped
+	size_t log;						//Where the log of device reads and calls was when it was taken
+	mips_syscall_state syscall;
+};
+
+struct mips_history{
+	vector<mips_history_checkpoint> checkpoints;	//Oldest first, the first is where the history started
+	uint64_t interval;
+	uint64_t now;					//Instructions retired since the history started
+	uint64_t next;					//When the next checkpoint is due
+};
+
+//CHECKPOINT - taken at the current count, replacing any at or after it
+static mips_error mips_history_checkpoint_take(mips_cpu_h state, bool pinned){
+	mips_history* h = state->history;
+	while (!h->checkpoints.empty() && (h->checkpoints.back().count >= h->now)){
+		pinned = pinned || h->checkpoints.back().pinned;
+		mips_cpu_snapshot_free(h->checkpoints.back().snapshot);
+		h->checkpoints.pop_back();
+	}
+	h->next = h->now + h->interval;
+
+	mips_history_checkpoint checkpoint;
+	checkpoint.count = h->now;
+	checkpoint.ll_address = state->ll_address;
+	checkpoint.ll_value = state->ll_value;
+	checkpoint.ll_valid = state->ll_valid;
+	checkpoint.pinned = pinned;
+	checkpoint.log = mips_record_tell(state->history_log);
+	mips_syscall_save(state, checkpoint.syscall);
+	mips_error err = mips_cpu_snapshot(state, &checkpoint.snapshot);
+	if (err != mips_Success)
+		return err;
+	h->checkpoints.push_back(checkpoint);
+
+	//Thinned out so that a long run keeps a bounded number of evenly spread checkpoints
+	if (h->checkpoints.size() > MIPS_HISTORY_CHECKPOINTS){
+		size_t kept = 0;
+		for (size_t i = 0; i < h->checkpoints.size(); ++i){
+			bool keep = (i % 2 == 0) || (i + 1 == h->checkpoints.size()) || h->checkpoints[i].pinned;
+			if (keep)
+				h->checkpoints[kept++] = h->checkpoints[i];
+			else
+				mips_cpu_snapshot_free(h->checkpoints[i].snapshot);
+		}
+		h->checkpoints.resize(kept);
+		h->interval *= 2;
+	}
+	return mips_Success;
+}
+
+//FIND - the last checkpoint taken at or before count
+static size_t mips_history_find(mips_history* h, uint64_t count){
+	size_t i = h->checkpoints.size() - 1;
+	while ((i > 0) && (h->checkpoints[i].count > count))
+		--i;
+	return i;
+}
+
+//LOAD - puts the CPU back to a checkpoint, without it counting as a change by the host,
+//the device reads and calls made after it come from the log for as long as the run matches it
+static mips_error mips_history_load(mips_cpu_h state, size_t index){
+	mips_history* h = state->history;
+	const mips_history_checkpoint& checkpoint = h->checkpoints[index];
+	state->history = 0;
+	mips_error err = mips_cpu_restore(state, checkpoint.snapshot);
+	state->history = h;
+	state->ll_address = checkpoint.ll_address;
+	state->ll_value = checkpoint.ll_value;
+	state->ll_valid = checkpoint.ll_valid;
+	mips_syscall_restore(state, checkpoint.syscall);
+	mips_record_replay_from(state->history_log, checkpoint.log);
+	h->now = checkpoint.count;
+	h->next = checkpoint.count + h->interval;
+	return err;
+}
+
+//RUN - runs forward again, without checkpoints, debug output, trace, profile or the host's log seeing it twice
+static mips_error mips_history_run(mips_cpu_h state, uint64_t steps, const uint32_t* stop_pc){
+	mips_history* h = state->history;
+	unsigned level = state->level;
+	mips_trace* trace = state->trace;
+	bool profiling = state->profiling;
+	mips_record* record = state->record;
+	state->history = 0;
+	state->record = 0;
+	state->level = 0;
+	state->trace = 0;
+	state->profiling = false;
+
+	uint64_t done = 0;
+	mips_error err;
+	if (stop_pc)
+		err = mips_cpu_run_until(state, *stop_pc, steps, &done);
+	else
+		err = mips_cpu_run(state, steps, &done);
+
+	state->history = h;
+	state->level = level;
+	state->trace = trace;
+	state->profiling = profiling;
+	state->record = record;
+	h->now += done;
+	return err;
+}
+
+//GO TO - back to an earlier count, the checkpoints after it belong to a future that is gone
+static mips_error mips_history_go_to(mips_cpu_h state, uint64_t count){
+	mips_history* h = state->history;
+	size_t index = mips_history_find(h, count);
+	for (size_t i = index + 1; i < h->checkpoints.size(); ++i)
+		mips_cpu_snapshot_free(h->checkpoints[i].snapshot);
+	h->checkpoints.resize(index + 1);
+
+	mips_error err = mips_history_load(state, index);
+	if (err == mips_Success)
+		err = mips_history_run(state, count - h->now, NULL);
+	return err;
+}
+
+mips_error mips_history_start(mips_cpu_h state, uint64_t interval){
+	mips_history_free(state);
+
+	mips_history* h = new mips_history;
+	h->interval = interval;
+	h->now = 0;
+	h->next = interval;
+	state->history = h;
+	state->history_log = mips_record_create();
+	mips_error err = mips_history_checkpoint_take(state, false);
+	if (err != mips_Success)
+		mips_history_free(state);
+	return err;
+}
+
+void mips_history_free(mips_cpu_h state){
+	mips_history* h = state->history;
+	if (h==0)
+		return;
+	for (size_t i = 0; i < h->checkpoints.size(); ++i)
+		mips_cpu_snapshot_free(h->checkpoints[i].snapshot);
+	delete h;
+	state->history = 0;
+	mips_record_free(state->history_log);
+	state->history_log = 0;
+}
+
+uint64_t mips_history_left(mips_history* h){
+	return (h->next > h->now) ? h->next - h->now : 1;
+}
+
+void mips_history_retired(mips_cpu_h state, uint64_t steps){
+	mips_history* h = state->history;
+	h->now += steps;
+	//A checkpoint that cannot be taken leaves a longer stretch to replay, the run itself is fine
+	if (h->now >= h->next)
+		mips_history_checkpoint_take(state, false);
+}
+
+mips_error mips_history_changed(mips_cpu_h state){
+	//What the log holds past now was read by a run that will not happen
+	mips_record_resume(state->history_log);
+	return mips_history_checkpoint_take(state, true);
+}
+
+mips_error mips_history_step_back(mips_cpu_h state, uint64_t steps){
+	mips_history* h = state->history;
+	if (steps > h->now - h->checkpoints.front().count)
+		return mips_ErrorInvalidArgument;
+	return mips_history_go_to(state, h->now - steps);
+}
+
+mips_error mips_history_run_back_to(mips_cpu_h state, uint32_t pc, uint64_t* steps_back){
+	mips_history* h = state->history;
+	uint64_t now = h->now;
+	if (now == h->checkpoints.front().count)
+		return mips_ErrorInvalidArgument;
+
+	//Each stretch between two checkpoints is run again, the latest first, until one reaches pc
+	mips_error err = mips_Success;
+	size_t index = mips_history_find(h, now - 1) + 1;
+	while ((err == mips_Success) && (index-- > 0)){
+		uint64_t end = now;
+		if ((index + 1 < h->checkpoints.size()) && (h->checkpoints[index + 1].count < end))
+			end = h->checkpoints[index + 1].count;
+
+		bool found = false;
+		uint64_t last = 0;
+		err = mips_history_load(state, index);
+		while ((err == mips_Success) && (h->now < end)){
+			err = mips_history_run(state, end - h->now, &pc);
+			if ((err != mips_Success) || (h->now >= end))
+				break;
+			found = true;
+			last = h->now;
+			err = mips_history_run(state, 1, NULL);
+		}
+		if (found){
+			if (steps_back)
+				*steps_back = now - last;
+			return mips_history_go_to(state, last);
+		}
+	}
+
+	//Never there, so the CPU is put back where it was
+	mips_error back = mips_history_go_to(state, now);
+	return (err != mips_Success) ? err : ((back != mips_Success) ? back : mips_ErrorInvalidArgument);
+}
@@ -0,0 +1,42 @@
+/*
+HISTORY
+Checkpoints of a run, so that it can be stepped backwards
+
+While the history is on, every retired instruction is counted and a snapshot
+of the CPU is taken each interval instructions. The snapshots share the pages
+nothing wrote to (see mips_mem_snapshot.cpp), so between them they hold the
+memory writes of the run a page at a time. Going back restores the last
+checkpoint before the target and runs forward to it, which is the same run
+again because the CPU is deterministic. Changes made by the host through the
+CPU API take a checkpoint of their own so that replays see them too, and the
+values read from devices and what semihosting calls did are logged in memory
+as they would be by mips_cpu_set_record, so that replays take them from there
+and never read a device or make a call twice. Running forward after going
+back takes them from the log as well, until the host changes something or
+the log runs out
+*/
+#ifndef mips_cpu_history_header
+#define mips_cpu_history_header
+
+#include "mips.h"
+
+struct mips_history;
+
+//Starts a history at the current state with a checkpoint every interval instructions
+mips_error mips_history_start(mips_cpu_h state, uint64_t interval);
+//Drops the history and its checkpoints
+void mips_history_free(mips_cpu_h state);
+
+//Instructions left until the next checkpoint is due
+uint64_t mips_history_left(mips_history* history);
+//Counts retired instructions, taking a checkpoint when one is due
+void mips_history_retired(mips_cpu_h state, uint64_t steps);
+//Called when the host changes the CPU, the change becomes a checkpoint
+mips_error mips_history_changed(mips_cpu_h state);
+
+//Goes back steps instructions
+mips_error mips_history_step_back(mips_cpu_h state, uint64_t steps);
+//Goes back to the last time the CPU was about to run pc
+mips_error mips_history_run_back_to(mips_cpu_h state, uint32_t pc, uint64_t* steps_back);
+
+#endif
@@ -0,0 +1,68 @@
+/*
+ICACHE
+Looks up the instruction at an address, on a miss it is
+fetched, decoded, resolved and the memory is told to watch it
+
+The line is watched before it is read: if another CPU writes it after
+that, the generation changes and the decoded copy is thrown away
+*/
+#include "mips_cpu_icache.hpp"
+#include "mips_cpu_decode.hpp"
+#include "mips_cpu_execute_help.hpp"
+#include "mips_cpu_impl.hpp"
+
+mips_error mips_icache_fetch(mips_cpu_h state, uint32_t pc, const mips_icache_entry** entry){
+	if (pc % 4 != 0)
+		return mips_ExceptionInvalidAlignment;
+
+	uint32_t generation;
+	mips_error err = mips_mem_get_code_generation(state->mem, &generation);
+	if (err != mips_Success)
+		return err;
+
+	//Another CPU sharing the memory may have started watching a page this one writes directly
+	if (generation != state->tlb_generation){
+		mips_tlb_flush(state);
+		state->tlb_generation = generation;
+	}
+
+	mips_icache_entry* line = &state->icache[(pc >> 2) % MIPS_ICACHE_SIZE];
+	if ((line->pc == pc) && (line->generation == generation)){
+		*entry = line;
+		return mips_Success;
+	}
+
+	//MISS - watch the line before reading it, so a write from now on changes the generation
+	err = mips_mem_watch_code(state->mem, pc);
+	if (err != mips_Success){
+		line->pc = 1;
+		return err;
+	}
+	//Stores to this page have to be seen by the memory from now on
+	mips_tlb_invalidate(state, pc);
+
+	uint32_t mem_value;
+	err = mips_mem_read32(state->mem, pc, &mem_value);
+	if (err != mips_Success){
+		line->pc = 1;
+		return err;
+	}
+	line->word = mem_value;
+
+	err = mips_decode(mem_value, line->instruction_data);
+	if (err != mips_Success){
+		line->pc = 1;
+		return err;
+	}
+	line->op = mips_resolve(mem_value);
+	line->pc = pc;
+	line->generation = generation;
+
+	*entry = line;
+	return mips_Success;
+}
+
+void mips_icache_flush(mips_cpu_h state){
+	for (unsigned i = 0; i < MIPS_ICACHE_SIZE; ++i)
+		state->icache[i].pc = 1;
+}
@@ -0,0 +1,30 @@
+/*
+ICACHE
+Direct mapped cache of decoded instructions, keyed by PC
+Each entry holds the decoded fields and the resolved handler, so a hit
+skips both the memory transaction and the decode
+
+Entries are tagged with the code generation of the memory they were
+decoded from, any write to a cached line changes the generation and
+every entry becomes stale at once
+*/
+#ifndef mips_cpu_icache_header
+#define mips_cpu_icache_header
+
+#include "mips.h"
+#include "mips_cpu_execute.hpp"
+
+#define MIPS_ICACHE_SIZE 1024
+
+struct mips_icache_entry{
+	uint32_t pc;                  //Address of the instruction, unaligned when empty
+	uint32_t generation;          //Code generation of the memory when decoded
+	mips_op op;                   //Resolved handler
+	uint32_t word;                //Instruction as stored in memory, for the trace
+	uint32_t instruction_data[8]; //Decoded fields, see mips_cpu_decode.hpp
+};
+
+mips_error mips_icache_fetch(mips_cpu_h state, uint32_t pc, const mips_icache_entry** entry);
+void mips_icache_flush(mips_cpu_h state);
+
+#endif
@@ -0,0 +1,70 @@
+/*
+CPU IMPLEMENT
+The state of the CPU, shared by the CPU and its execute stage so that the
+instruction handlers can all have one signature
+
+registers, program counter, program counter new, debug level, debug destination, memory, hi, lo,
+decoded instruction cache, translated blocks and the code generation they were translated at,
+native code for hot blocks (0 when the JIT is off),
+host pointers of recently used guest pages and the code generation they were mapped at,
+the reservation of the last LL (address and the value it loaded),
+the binary trace being written (0 when off),
+the profile counts (kept after profiling stops) and whether they are being counted,
+the checkpoints of the run for stepping backwards and its log of device reads (0 when off),
+the log of device reads and host changes being recorded or replayed (0 when off),
+the files and heap of the program when semihosting (0 when off)
+*/
+#ifndef mips_cpu_impl_header
+#define mips_cpu_impl_header
+
+#include "mips.h"
+#include "mips_cpu_icache.hpp"
+#include "mips_cpu_block.hpp"
+#include "mips_cpu_jit.hpp"
+#include "mips_cpu_tlb.hpp"
+#include "mips_cpu_trace.hpp"
+#include "mips_cpu_profile.hpp"
+#include "mips_cpu_history.hpp"
+#include "mips_cpu_record.hpp"
+#include "mips_cpu_syscall.hpp"
+
+struct mips_cpu_impl{
+	uint32_t pc;
+	uint32_t hi;
+	uint32_t lo;
+	uint32_t pcN;
+	uint32_t regs[32];
+	unsigned level;
+	FILE* dest;
+	mips_mem_h mem;
+	mips_icache_entry icache[MIPS_ICACHE_SIZE];
+	mips_block* blocks;
+	uint32_t block_generation;
+	mips_jit* jit;
+	mips_tlb_entry tlb[MIPS_TLB_SIZE];
+	uint32_t tlb_generation;
+	uint32_t ll_address;
+	uint32_t ll_value;
+	bool ll_valid;
+	mips_trace* trace;
+	mips_profile* profile;
+	bool profiling;
+	mips_history* history;
+	mips_record* record;
+	mips_record* history_log;
+	mips_syscall* syscall;
+};
+
+//REGISTER FILE - used by the execute stage in place of the checked CPU API,
+//indices come from the decoder and are always below 32
+inline uint32_t mips_reg(mips_cpu_h state, uint32_t index){
+	return state->regs[index];
+}
+//Writing $zero is allowed and undone straight away, so no branch is needed
+inline mips_error mips_reg_write(mips_cpu_h state, uint32_t index, uint32_t value){
+	state->regs[index] = value;
+	state->regs[0] = 0;
+	return mips_Success;
+}
+
+#endif
@@ -0,0 +1,456 @@
+/*
+JIT
+x86-64 code generation for translated blocks
+
+Register use inside a compiled block (System V calling convention):
+rbx - pointer to the CPU state, preserved over calls to handlers
+ebp - address executed after the delay slot, set by the branch or jump
+eax, ecx, edx - scratch
+*/
+#include "mips_cpu_jit.hpp"
+#include "mips_cpu_impl.hpp"
+#include <cstddef>
+#include <cstring>
+
+#ifdef MIPS_JIT_AVAILABLE
+#include <sys/mman.h>
+
+//The buffer is never writable and executable at once, it is only made writable to emit a block
+struct mips_jit{
+	uint8_t* buffer;
+	size_t used;
+};
+
+mips_jit* mips_jit_create(){
+	void* buffer = mmap(0, MIPS_JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+	if (buffer == MAP_FAILED)
+		return 0;
+	//A host that does not allow code to be made executable has no JIT
+	if (mprotect(buffer, MIPS_JIT_BUFFER_SIZE, PROT_READ | PROT_EXEC) != 0){
+		munmap(buffer, MIPS_JIT_BUFFER_SIZE);
+		return 0;
+	}
+	mips_jit* jit = new mips_jit;
+	jit->buffer = (uint8_t*)buffer;
+	jit->used = 0;
+	return jit;
+}
+
+void mips_jit_free(mips_jit* jit){
+	if (jit == 0)
+		return;
+	munmap(jit->buffer, MIPS_JIT_BUFFER_SIZE);
+	delete jit;
+}
+
+void mips_jit_reset(mips_jit* jit){
+	jit->used = 0;
+}
+
+static bool mips_jit_writable(mips_jit* jit, bool writable){
+	int prot = writable ? (PROT_READ | PROT_WRITE) : (PROT_READ | PROT_EXEC);
+	return mprotect(jit->buffer, MIPS_JIT_BUFFER_SIZE, prot) == 0;
+}
+
+/*
+EMIT
+Appends machine code to the free part of the buffer, overflow is only
+checked once the whole block has been emitted
+*/
+struct mips_emitter{
+	uint8_t* code;
+	size_t size;
+	size_t at;
+	vector<size_t> exits; //rel32 fields of jumps to the epilogue
+};
+
+//Reserve for the largest sequence emitted for one instruction
+#define MIPS_JIT_MAX_OP 64
+
+static void emit8(mips_emitter& e, uint8_t v){
+	if (e.at < e.size)
+		e.code[e.at] = v;
+	e.at++;
+}
+static void emit32(mips_emitter& e, uint32_t v){
+	for (unsigned i = 0; i < 4; ++i)
+		emit8(e, uint8_t(v >> (8*i)));
+}
+static void emit64(mips_emitter& e, uint64_t v){
+	emit32(e, uint32_t(v));
+	emit32(e, uint32_t(v >> 32));
+}
+
+//x86 register numbers
+#define EAX 0
+#define ECX 1
+#define EDX 2
+#define EBX 3
+#define EBP 5
+
+static uint32_t reg_offset(uint32_t index){
+	return offsetof(mips_cpu_impl, regs) + 4*index;
+}
+#define OFFSET_PC  offsetof(mips_cpu_impl, pc)
+#define OFFSET_PCN offsetof(mips_cpu_impl, pcN)
+#define OFFSET_HI  offsetof(mips_cpu_impl, hi)
+#define OFFSET_LO  offsetof(mips_cpu_impl, lo)
+
+//<opcode> r32, [rbx+offset] (or the reverse direction, depending on the opcode)
+static void emit_mem(mips_emitter& e, uint8_t opcode, unsigned reg, uint32_t offset){
+	emit8(e, opcode);
+	emit8(e, 0x80 | (reg << 3) | EBX);
+	emit32(e, offset);
+}
+static void emit_load(mips_emitter& e, unsigned reg, uint32_t offset){
+	emit_mem(e, 0x8B, reg, offset);
+}
+static void emit_store(mips_emitter& e, unsigned reg, uint32_t offset){
+	emit_mem(e, 0x89, reg, offset);
+}
+//mov dword [rbx+offset], imm32
+static void emit_store_imm(mips_emitter& e, uint32_t offset, uint32_t value){
+	emit_mem(e, 0xC7, 0, offset);
+	emit32(e, value);
+}
+//mov r32, imm32
+static void emit_mov_imm(mips_emitter& e, unsigned reg, uint32_t value){
+	emit8(e, 0xB8 + reg);
+	emit32(e, value);
+}
+//<op> eax, imm32
+static void emit_alu_imm(mips_emitter& e, uint8_t opcode, uint32_t value){
+	emit8(e, opcode);
+	emit32(e, value);
+}
+//setcc al; movzx eax, al
+static void emit_setcc(mips_emitter& e, uint8_t cc){
+	emit8(e, 0x0F); emit8(e, cc); emit8(e, 0xC0);
+	emit8(e, 0x0F); emit8(e, 0xB6); emit8(e, 0xC0);
+}
+//jnz epilogue
+static void emit_exit_if_error(mips_emitter& e){
+	emit8(e, 0x85); emit8(e, 0xC0); //test eax, eax
+	emit8(e, 0x0F); emit8(e, 0x85);
+	e.exits.push_back(e.at);
+	emit32(e, 0);
+}
+//Calls fn(state, arg) where arg is a pointer or a 32 bit value
+static void emit_call(mips_emitter& e, const void* fn, uint64_t arg){
+	emit8(e, 0x48); emit8(e, 0x89); emit8(e, 0xDF); //mov rdi, rbx
+	emit8(e, 0x48); emit8(e, 0xBE); emit64(e, arg); //mov rsi, imm64
+	emit8(e, 0x48); emit8(e, 0xB8); emit64(e, (uint64_t)(uintptr_t)fn); //mov rax, imm64
+	emit8(e, 0xFF); emit8(e, 0xD0); //call rax
+}
+
+//Called after a store, leaves the block if it changed the code generation
+static mips_error mips_jit_store_check(mips_cpu_h state, uint64_t next_pc){
+	uint32_t generation;
+	mips_mem_get_code_generation(state->mem, &generation);
+	if (generation == state->block_generation)
+		return mips_Success;
+	state->pc = uint32_t(next_pc);
+	state->pcN = uint32_t(next_pc) + 4;
+	return mips_jit_Exit;
+}
+
+//Register to register and register to immediate instructions, false if not handled inline
+static bool emit_alu(mips_emitter& e, mips_op op, const uint32_t* d){
+	uint32_t s1 = reg_offset(d[1]);
+	uint32_t s2 = reg_offset(d[2]);
+	uint32_t rd = d[3];
+	uint32_t rt = d[2];
+	uint32_t imm_unsigned = d[3];
+	uint32_t imm_signed = uint32_t(int32_t(int16_t(d[3])));
+
+	switch (op){
+		//R TYPE: eax = s1 <op> s2
+		case mips_op_ADDU: case mips_op_SUBU: case mips_op_AND: case mips_op_OR: case mips_op_XOR:
+		if (rd == 0)
+			return true;
+		emit_load(e, EAX, s1);
+		switch (op){
+			case mips_op_ADDU: emit_mem(e, 0x03, EAX, s2); break;
+			case mips_op_SUBU: emit_mem(e, 0x2B, EAX, s2); break;
+			case mips_op_AND:  emit_mem(e, 0x23, EAX, s2); break;
+			case mips_op_OR:   emit_mem(e, 0x0B, EAX, s2); break;
+			default:           emit_mem(e, 0x33, EAX, s2); break;
+		}
+		emit_store(e, EAX, reg_offset(rd));
+		return true;
+
+		case mips_op_SLT: case mips_op_SLTU:
+		if (rd == 0)
+			return true;
+		emit_load(e, EAX, s1);
+		emit_mem(e, 0x3B, EAX, s2); //cmp eax, s2
+		emit_setcc(e, (op == mips_op_SLT) ? 0x9C : 0x92);
+		emit_store(e, EAX, reg_offset(rd));
+		return true;
+
+		//Shifts by a constant: eax = s2 <shift> d[4]
+		case mips_op_SLL: case mips_op_SRL: case mips_op_SRA:
+		if (rd == 0)
+			return true;
+		emit_load(e, EAX, s2);
+		if (d[4] != 0){
+			emit8(e, 0xC1);
+			emit8(e, (op == mips_op_SLL) ? 0xE0 : (op == mips_op_SRL) ? 0xE8 : 0xF8);
+			emit8(e, uint8_t(d[4]));
+		}
+		emit_store(e, EAX, reg_offset(rd));
+		return true;
+
+		//Shifts by a register, x86 masks the count to 5 bits like MIPS
+		case mips_op_SLLV: case mips_op_SRLV: case mips_op_SRAV:
+		if (rd == 0)
+			return true;
+		emit_load(e, EAX, s2);
+		emit_load(e, ECX, s1);
+		emit8(e, 0xD3);
+		emit8(e, (op == mips_op_SLLV) ? 0xE0 : (op == mips_op_SRLV) ? 0xE8 : 0xF8);
+		emit_store(e, EAX, reg_offset(rd));
+		return true;
+
+		//MULT uses the same zero extended product as MULTU in the interpreter
+		case mips_op_MULT: case mips_op_MULTU:
+		emit_load(e, EAX, s1);
+		emit_mem(e, 0xF7, 4, s2); //mul dword s2
+		emit_store(e, EAX, OFFSET_LO);
+		emit_store(e, EDX, OFFSET_HI);
+		return true;
+
+		case mips_op_MFHI: case mips_op_MFLO:
+		if (rd == 0)
+			return true;
+		emit_load(e, EAX, (op == mips_op_MFHI) ? OFFSET_HI : OFFSET_LO);
+		emit_store(e, EAX, reg_offset(rd));
+		return true;
+
+		case mips_op_MTHI: case mips_op_MTLO:
+		emit_load(e, EAX, s1);
+		emit_store(e, EAX, (op == mips_op_MTHI) ? OFFSET_HI : OFFSET_LO);
+		return true;
+
+		//I TYPE: rt = s1 <op> imm
+		case mips_op_ADDIU: case mips_op_ANDI: case mips_op_ORI: case mips_op_XORI:
+		if (rt == 0)
+			return true;
+		emit_load(e, EAX, s1);
+		switch (op){
+			case mips_op_ADDIU: emit_alu_imm(e, 0x05, imm_signed); break;
+			case mips_op_ANDI:  emit_alu_imm(e, 0x25, imm_unsigned); break;
+			case mips_op_ORI:   emit_alu_imm(e, 0x0D, imm_unsigned); break;
+			default:            emit_alu_imm(e, 0x35, imm_unsigned); break;
+		}
+		emit_store(e, EAX, reg_offset(rt));
+		return true;
+
+		case mips_op_SLTI: case mips_op_SLTIU:
+		if (rt == 0)
+			return true;
+		emit_load(e, EAX, s1);
+		emit_alu_imm(e, 0x3D, imm_signed); //cmp eax, imm32
+		emit_setcc(e, (op == mips_op_SLTI) ? 0x9C : 0x92);
+		emit_store(e, EAX, reg_offset(rt));
+		return true;
+
+		case mips_op_LUI:
+		if (rt == 0)
+			return true;
+		emit_store_imm(e, reg_offset(rt), imm_unsigned << 16);
+		return true;
+
+		default:
+		break;
+	}
+	return false;
+}
+
+//Branches and jumps at address pc: leave the address after the delay slot in ebp
+static bool emit_control(mips_emitter& e, mips_op op, const uint32_t* d, uint32_t pc){
+	uint32_t s1 = reg_offset(d[1]);
+	uint32_t branch_target = (pc + 4) + (uint32_t(int32_t(int16_t(d[3]))) << 2);
+	uint32_t jump_target = ((pc + 4) & 0xF0000000) | (d[1] << 2);
+	uint8_t cmov = 0;
+
+	switch (op){
+		case mips_op_BEQ: case mips_op_BNE:
+		emit_load(e, EAX, s1);
+		emit_mem(e, 0x3B, EAX, reg_offset(d[2])); //cmp eax, s2
+		cmov = (op == mips_op_BEQ) ? 0x44 : 0x45;
+		break;
+
+		case mips_op_BGEZ: case mips_op_BLTZ: case mips_op_BGTZ: case mips_op_BLEZ:
+		emit_mem(e, 0x83, 7, s1); emit8(e, 0); //cmp dword s1, 0
+		cmov = (op == mips_op_BGEZ) ? 0x4D : (op == mips_op_BLTZ) ? 0x4C : (op == mips_op_BGTZ) ? 0x4F : 0x4E;
+		break;
+
+		//Links only when taken, as the interpreter does
+		case mips_op_BGEZAL: case mips_op_BLTZAL:
+		if (d[1] == 31)
+			return false;
+		emit_mov_imm(e, EBP, pc + 8);
+		emit_mem(e, 0x83, 7, s1); emit8(e, 0); //cmp dword s1, 0
+		emit8(e, (op == mips_op_BGEZAL) ? 0x7C : 0x7D); //jl/jge over the link
+		emit8(e, 10 + 5);
+		emit_store_imm(e, reg_offset(31), pc + 8);
+		emit_mov_imm(e, EBP, branch_target);
+		return true;
+
+		case mips_op_J:
+		emit_mov_imm(e, EBP, jump_target);
+		return true;
+
+		case mips_op_JAL:
+		emit_store_imm(e, reg_offset(31), pc + 8);
+		emit_mov_imm(e, EBP, jump_target);
+		return true;
+
+		case mips_op_JR:
+		emit_load(e, EBP, s1);
+		return true;
+
+		case mips_op_JALR:
+		emit_load(e, EBP, s1);
+		if (d[3] != 0)
+			emit_store_imm(e, reg_offset(d[3]), pc + 8);
+		return true;
+
+		default:
+		return false;
+	}
+
+	//ebp = taken ? branch_target : pc + 8
+	emit_mov_imm(e, EBP, pc + 8);
+	emit_mov_imm(e, ECX, branch_target);
+	emit8(e, 0x0F); emit8(e, cmov); emit8(e, 0xE9); //cmovcc ebp, ecx
+	return true;
+}
+
+static void emit_epilogue(mips_emitter& e){
+	emit8(e, 0x48); emit8(e, 0x83); emit8(e, 0xC4); emit8(e, 0x08); //add rsp, 8
+	emit8(e, 0x5D); //pop rbp
+	emit8(e, 0x5B); //pop rbx
+	emit8(e, 0xC3); //ret
+}
+
+//Emits the whole block, returns false if some instruction cannot be compiled
+static bool emit_block(mips_emitter& e, const mips_block* block){
+	emit8(e, 0x53); //push rbx
+	emit8(e, 0x55); //push rbp
+	emit8(e, 0x48); emit8(e, 0x83); emit8(e, 0xEC); emit8(e, 0x08); //sub rsp, 8
+	emit8(e, 0x48); emit8(e, 0x89); emit8(e, 0xFB); //mov rbx, rdi
+
+	bool delay_slot = false;
+	for (size_t i = 0; i < block->ops.size(); ++i){
+		const mips_block_op& op = block->ops[i];
+		uint32_t pc = block->pc + 4*i;
+		bool last = (i + 1 == block->ops.size());
+
+		if (op.flags & MIPS_OP_CONTROL){
+			if (delay_slot)
+				return false;
+			if (!emit_control(e, op.op, op.instruction_data, pc))
+				return false;
+			delay_slot = true;
+			continue;
+		}
+
+		if (!emit_alu(e, op.op, op.instruction_data)){
+			//Through the interpreter, with PC and PCN as it expects them
+			emit_store_imm(e, OFFSET_PC, pc);
+			if (delay_slot)
+				emit_store(e, EBP, OFFSET_PCN);
+			else
+				emit_store_imm(e, OFFSET_PCN, pc + 4);
+			emit_call(e, (const void*)op.handler, (uint64_t)(uintptr_t)op.instruction_data);
+			emit_exit_if_error(e);
+
+			if ((op.flags & MIPS_OP_STORE) && !last && !delay_slot){
+				emit_call(e, (const void*)mips_jit_store_check, pc + 4);
+				emit_exit_if_error(e);
+			}
+		}
+		delay_slot = false;
+	}
+
+	//Leave PC and PCN as the interpreter would after the last instruction
+	if (block->ops.back().flags & MIPS_OP_CONTROL){
+		return false;
+	} else if ((block->ops.size() >= 2) && (block->ops[block->ops.size()-2].flags & MIPS_OP_CONTROL)){
+		emit_store(e, EBP, OFFSET_PC);
+		emit8(e, 0x8D); emit8(e, 0x45); emit8(e, 0x04); //lea eax, [rbp+4]
+		emit_store(e, EAX, OFFSET_PCN);
+	} else {
+		emit_store_imm(e, OFFSET_PC, block->end);
+		emit_store_imm(e, OFFSET_PCN, block->end + 4);
+	}
+	emit8(e, 0x31); emit8(e, 0xC0); //xor eax, eax
+
+	size_t epilogue = e.at;
+	emit_epilogue(e);
+	for (size_t i = 0; i < e.exits.size(); ++i){
+		uint32_t rel = uint32_t(epilogue - (e.exits[i] + 4));
+		for (unsigned b = 0; b < 4; ++b)
+			if (e.exits[i] + b < e.size)
+				e.code[e.exits[i] + b] = uint8_t(rel >> (8*b));
+	}
+	return true;
+}
+
+//Blocks are interpreted again until they are hot enough to be compiled anew
+static void mips_jit_drop(mips_cpu_h state){
+	mips_jit_reset(state->jit);
+	for (unsigned i = 0; i < MIPS_BLOCK_CACHE_SIZE; ++i){
+		state->blocks[i].native = 0;
+		state->blocks[i].count = 0;
+	}
+}
+
+mips_native mips_jit_compile(mips_cpu_h state, mips_block* block){
+	mips_jit* jit = state->jit;
+	if ((jit == 0) || block->ops.empty())
+		return 0;
+
+	for (unsigned attempt = 0; attempt < 2; ++attempt){
+		mips_emitter e;
+		e.code = jit->buffer + jit->used;
+		e.size = MIPS_JIT_BUFFER_SIZE - jit->used;
+		e.at = 0;
+
+		if (!mips_jit_writable(jit, true))
+			return 0;
+		bool emitted = emit_block(e, block);
+		//Code that cannot be made executable again is not run, nor is any compiled before
+		if (!mips_jit_writable(jit, false)){
+			mips_jit_drop(state);
+			return 0;
+		}
+		if (!emitted)
+			return 0;
+		if (e.at <= e.size){
+			jit->used += (e.at + 15) & ~size_t(15);
+			return (mips_native)(void*)e.code;
+		}
+
+		//Out of space, drop all native code and try again in an empty buffer
+		mips_jit_drop(state);
+	}
+	return 0;
+}
+
+#else
+
+mips_jit* mips_jit_create(){
+	return 0;
+}
+void mips_jit_free(mips_jit*){
+}
+void mips_jit_reset(mips_jit*){
+}
+mips_native mips_jit_compile(mips_cpu_h, mips_block*){
+	return 0;
+}
+
+#endif
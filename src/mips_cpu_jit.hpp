@@ -0,0 +1,44 @@
+/*
+JIT
+Translates hot blocks into native x86-64 code
+
+The generated code works directly on the CPU state (regs, hi, lo, pc, pcN)
+at the offsets of mips_cpu_impl. Integer ALU, shift, multiply and HI/LO
+instructions and all branches and jumps are emitted inline, everything else
+(loads, stores, instructions that can raise exceptions) calls the handler
+of the interpreter. A block that cannot be compiled keeps being interpreted
+
+A compiled block returns mips_Success when it ran to the end. Otherwise PC is
+left on the instruction that stopped it, and it returns either the exception
+or mips_jit_Exit when a store changed the code generation
+
+The code buffer is executable or writable, never both: it is made writable
+only while a block is emitted. A host that refuses to make it executable has
+no JIT, and mips_cpu_set_jit returns mips_ErrorNotImplemented
+*/
+#ifndef mips_cpu_jit_header
+#define mips_cpu_jit_header
+
+#include "mips.h"
+#include "mips_cpu_block.hpp"
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define MIPS_JIT_AVAILABLE 1
+#endif
+
+//Number of times a block is entered before it is compiled
+#define MIPS_JIT_THRESHOLD 16
+//Size of the native code buffer of each CPU
+#define MIPS_JIT_BUFFER_SIZE (1 << 20)
+
+const mips_error mips_jit_Exit = mips_error(mips_InternalError + 1);
+
+struct mips_jit;
+
+mips_jit* mips_jit_create();
+void mips_jit_free(mips_jit* jit);
+//Throws away all native code, all blocks have to be flushed too
+void mips_jit_reset(mips_jit* jit);
+mips_native mips_jit_compile(mips_cpu_h state, mips_block* block);
+
+#endif
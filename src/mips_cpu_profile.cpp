@@ -0,0 +1,297 @@
+#include <stdio.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "mips.h"
+#include "mips_cpu_decode.hpp"
+#include "mips_cpu_execute.hpp"
+#include "mips_cpu_execute_help.hpp"
+#include "mips_cpu_impl.hpp"
+#include "mips_cpu_profile.hpp"
+
+using namespace std;
+
+//Lines of the hot spot report given to the hottest instructions and blocks
+#define MIPS_PROFILE_TOP 20
+
+//Counts of one PC, and of the block starting there if one does
+struct mips_profile_pc{
+	uint32_t pc;
+	uint32_t word;					//Instruction first seen there
+	uint8_t op;
+	uint64_t count;					//0 marks a free slot of the table
+	uint64_t taken;
+	uint64_t not_taken;
+	uint64_t block_count;			//Times a block was entered here
+	uint64_t block_instructions;	//Instructions run in those blocks
+};
+
+struct mips_profile{
+	uint64_t ops[mips_op_COUNT];
+	vector<mips_profile_pc> pcs;	//Open addressing, the size is a power of two
+	size_t used;
+	uint64_t instructions;
+	uint64_t taken;
+	uint64_t not_taken;
+	uint64_t loaded;
+	uint64_t stored;
+	uint32_t expected_pc;			//Where the previous instruction said to go next
+	uint32_t block_start;
+	uint64_t block_length;			//Instructions of the current block not yet added to it
+	bool block_next;				//The next instruction starts a block
+	bool in_delay;					//The next instruction is a delay slot
+};
+
+//TABLE - finds the slot of a PC, adding it when it is new
+static mips_profile_pc& mips_profile_find(mips_profile* p, uint32_t pc){
+	size_t mask = p->pcs.size() - 1;
+	size_t i = ((pc >> 2) * 2654435761u) & mask;
+	while ((p->pcs[i].count != 0) && (p->pcs[i].pc != pc))
+		i = (i + 1) & mask;
+	if (p->pcs[i].count != 0)
+		return p->pcs[i];
+
+	//Kept at most half full so that probes stay short
+	if (2 * (p->used + 1) > p->pcs.size()){
+		vector<mips_profile_pc> old(2 * p->pcs.size());
+		old.swap(p->pcs);
+		mask = p->pcs.size() - 1;
+		for (size_t j = 0; j < old.size(); ++j){
+			if (old[j].count == 0)
+				continue;
+			size_t k = ((old[j].pc >> 2) * 2654435761u) & mask;
+			while (p->pcs[k].count != 0)
+				k = (k + 1) & mask;
+			p->pcs[k] = old[j];
+		}
+		i = ((pc >> 2) * 2654435761u) & mask;
+		while (p->pcs[i].count != 0)
+			i = (i + 1) & mask;
+	}
+	++p->used;
+	p->pcs[i].pc = pc;
+	return p->pcs[i];
+}
+
+//Adds the instructions run so far to the block they belong to
+static void mips_profile_flush(mips_profile* p){
+	if (p->block_length == 0)
+		return;
+	mips_profile_find(p, p->block_start).block_instructions += p->block_length;
+	p->block_length = 0;
+}
+
+//Bytes a load or store moved, the unaligned ones only move the bytes up to the word boundary
+static uint32_t mips_profile_bytes(const mips_trace_record& record){
+	switch (record.op){
+		case mips_op_LB:
+		case mips_op_LBU:
+		case mips_op_SB:
+			return 1;
+		case mips_op_LH:
+		case mips_op_LHU:
+		case mips_op_SH:
+			return 2;
+		case mips_op_LWL:
+			return 4 - (record.mem_address & 3);
+		case mips_op_LWR:
+			return (record.mem_address & 3) + 1;
+		case mips_op_SC:
+			return (record.rd_value != 0) ? 4 : 0;
+		default:
+			return 4;
+	}
+}
+
+mips_error mips_profile_start(mips_cpu_h state){
+	mips_profile_free(state);
+
+	mips_profile* p = new mips_profile;
+	for (unsigned i = 0; i < mips_op_COUNT; ++i)
+		p->ops[i] = 0;
+	p->pcs.assign(1024, mips_profile_pc());
+	p->used = 0;
+	p->instructions = 0;
+	p->taken = 0;
+	p->not_taken = 0;
+	p->loaded = 0;
+	p->stored = 0;
+	p->expected_pc = state->pc;
+	p->block_start = state->pc;
+	p->block_length = 0;
+	p->block_next = true;
+	p->in_delay = false;
+	state->profile = p;
+	state->profiling = true;
+	return mips_Success;
+}
+
+void mips_profile_stop(mips_cpu_h state){
+	state->profiling = false;
+}
+
+void mips_profile_free(mips_cpu_h state){
+	state->profiling = false;
+	delete state->profile;
+	state->profile = 0;
+}
+
+void mips_profile_count(mips_profile* p, const mips_trace_record& record, uint32_t pcN){
+	//Only retired instructions count, a failed one is tried again from the same PC
+	if (record.error != mips_Success)
+		return;
+
+	//The PC was moved from outside (mips_cpu_set_pc), which also starts a block
+	if (record.pc != p->expected_pc)
+		p->block_next = true;
+	p->expected_pc = record.next_pc;
+	if (p->block_next)
+		mips_profile_flush(p);
+
+	mips_profile_pc& entry = mips_profile_find(p, record.pc);
+	if (entry.count == 0){
+		entry.word = record.word;
+		entry.op = record.op;
+	}
+	++entry.count;
+	++p->ops[record.op];
+	++p->instructions;
+
+	if (p->block_next){
+		p->block_start = record.pc;
+		++entry.block_count;
+		p->block_next = false;
+	}
+	++p->block_length;
+	if (p->in_delay){
+		p->in_delay = false;
+		p->block_next = true;
+	}
+
+	unsigned flags = mips_op_table[record.op].flags;
+	if (flags & MIPS_OP_CONTROL){
+		p->in_delay = true;
+		//Jumps always go, branches either go to their target or past their delay slot
+		bool conditional = (record.op != mips_op_J) && (record.op != mips_op_JAL) && (record.op != mips_op_JR) && (record.op != mips_op_JALR);
+		if (conditional && (pcN != record.pc + 8)){
+			++entry.taken;
+			++p->taken;
+		}
+		else if (conditional){
+			++entry.not_taken;
+			++p->not_taken;
+		}
+	}
+	if (flags & MIPS_OP_LOAD)
+		p->loaded += mips_profile_bytes(record);
+	if (flags & MIPS_OP_STORE)
+		p->stored += mips_profile_bytes(record);
+}
+
+//Hottest first, ties in address order so the output does not depend on the table
+static bool mips_profile_hotter(const mips_profile_pc* a, const mips_profile_pc* b){
+	if (a->count != b->count)
+		return a->count > b->count;
+	return a->pc < b->pc;
+}
+static bool mips_profile_hotter_block(const mips_profile_pc* a, const mips_profile_pc* b){
+	if (a->block_instructions != b->block_instructions)
+		return a->block_instructions > b->block_instructions;
+	return a->pc < b->pc;
+}
+
+static bool mips_profile_hotter_op(const pair<uint64_t, unsigned>& a, const pair<uint64_t, unsigned>& b){
+	if (a.first != b.first)
+		return a.first > b.first;
+	return a.second < b.second;
+}
+
+static string mips_profile_instruction(const mips_profile_pc& entry){
+	string instruction;
+	uint32_t data[8];
+	if (mips_decode(entry.word, data) == mips_Success)
+		mips_disassemble(mips_op(entry.op), data, instruction);
+	else
+		mips_disassemble(mips_op_INVALID, data, instruction);
+	return instruction;
+}
+
+static double mips_profile_percent(uint64_t count, uint64_t total){
+	return (total == 0) ? 0.0 : (100.0 * count) / total;
+}
+
+mips_error mips_profile_write(mips_profile* p, FILE* dest, mips_profile_format format){
+	mips_profile_flush(p);
+
+	vector<const mips_profile_pc*> pcs;
+	vector<const mips_profile_pc*> blocks;
+	for (size_t i = 0; i < p->pcs.size(); ++i){
+		if (p->pcs[i].count != 0)
+			pcs.push_back(&p->pcs[i]);
+		if (p->pcs[i].block_count != 0)
+			blocks.push_back(&p->pcs[i]);
+	}
+	sort(pcs.begin(), pcs.end(), mips_profile_hotter);
+	sort(blocks.begin(), blocks.end(), mips_profile_hotter_block);
+	//Opcodes as (count, op), most used first and then in mnemonic order
+	vector<pair<uint64_t, unsigned> > ops;
+	for (unsigned i = 0; i < mips_op_COUNT; ++i)
+		if (p->ops[i] != 0)
+			ops.push_back(make_pair(p->ops[i], i));
+	sort(ops.begin(), ops.end(), mips_profile_hotter_op);
+
+	switch (format){
+		case mips_profile_Report:
+			fprintf(dest, "Profile of %llu instructions\n", (unsigned long long)p->instructions);
+			fprintf(dest, "Branches: %llu taken, %llu not taken\n", (unsigned long long)p->taken, (unsigned long long)p->not_taken);
+			fprintf(dest, "Memory: %llu bytes loaded, %llu bytes stored\n", (unsigned long long)p->loaded, (unsigned long long)p->stored);
+			fprintf(dest, "\nInstructions by opcode:\n");
+			for (size_t i = 0; i < ops.size(); ++i)
+				fprintf(dest, "  %-8s %12llu %7.2f%%\n", mips_op_table[ops[i].second].name, (unsigned long long)ops[i].first, mips_profile_percent(ops[i].first, p->instructions));
+			fprintf(dest, "\nHottest instructions:\n");
+			for (size_t i = 0; (i < pcs.size()) && (i < MIPS_PROFILE_TOP); ++i){
+				fprintf(dest, "  0x%08x %12llu %7.2f%%  %s", pcs[i]->pc, (unsigned long long)pcs[i]->count, mips_profile_percent(pcs[i]->count, p->instructions), mips_profile_instruction(*pcs[i]).c_str());
+				if (pcs[i]->taken + pcs[i]->not_taken != 0)
+					fprintf(dest, "  (taken %llu, not taken %llu)", (unsigned long long)pcs[i]->taken, (unsigned long long)pcs[i]->not_taken);
+				fprintf(dest, "\n");
+			}
+			fprintf(dest, "\nHottest blocks:\n");
+			for (size_t i = 0; (i < blocks.size()) && (i < MIPS_PROFILE_TOP); ++i)
+				fprintf(dest, "  0x%08x %12llu instructions %7.2f%%  entered %llu times\n", blocks[i]->pc, (unsigned long long)blocks[i]->block_instructions, mips_profile_percent(blocks[i]->block_instructions, p->instructions), (unsigned long long)blocks[i]->block_count);
+		break;
+
+		case mips_profile_JSON:
+			fprintf(dest, "{\n  \"instructions\": %llu,\n", (unsigned long long)p->instructions);
+			fprintf(dest, "  \"branches\": {\"taken\": %llu, \"not_taken\": %llu},\n", (unsigned long long)p->taken, (unsigned long long)p->not_taken);
+			fprintf(dest, "  \"memory\": {\"loaded\": %llu, \"stored\": %llu},\n", (unsigned long long)p->loaded, (unsigned long long)p->stored);
+			fprintf(dest, "  \"opcodes\": {");
+			for (size_t i = 0; i < ops.size(); ++i)
+				fprintf(dest, "%s\n    \"%s\": %llu", (i == 0) ? "" : ",", mips_op_table[ops[i].second].name, (unsigned long long)ops[i].first);
+			fprintf(dest, "\n  },\n  \"pcs\": [");
+			for (size_t i = 0; i < pcs.size(); ++i)
+				fprintf(dest, "%s\n    {\"pc\": %u, \"opcode\": \"%s\", \"count\": %llu, \"taken\": %llu, \"not_taken\": %llu}", (i == 0) ? "" : ",", pcs[i]->pc, mips_op_table[pcs[i]->op].name, (unsigned long long)pcs[i]->count, (unsigned long long)pcs[i]->taken, (unsigned long long)pcs[i]->not_taken);
+			fprintf(dest, "\n  ],\n  \"blocks\": [");
+			for (size_t i = 0; i < blocks.size(); ++i)
+				fprintf(dest, "%s\n    {\"pc\": %u, \"entries\": %llu, \"instructions\": %llu}", (i == 0) ? "" : ",", blocks[i]->pc, (unsigned long long)blocks[i]->block_count, (unsigned long long)blocks[i]->block_instructions);
+			fprintf(dest, "\n  ]\n}\n");
+		break;
+
+		case mips_profile_CSV:
+			//One table for everything, the kind column says what a row counts
+			fprintf(dest, "kind,name,pc,count,taken,not_taken,instructions\n");
+			fprintf(dest, "total,instructions,,%llu,%llu,%llu,\n", (unsigned long long)p->instructions, (unsigned long long)p->taken, (unsigned long long)p->not_taken);
+			fprintf(dest, "total,bytes_loaded,,%llu,,,\n", (unsigned long long)p->loaded);
+			fprintf(dest, "total,bytes_stored,,%llu,,,\n", (unsigned long long)p->stored);
+			for (size_t i = 0; i < ops.size(); ++i)
+				fprintf(dest, "opcode,%s,,%llu,,,\n", mips_op_table[ops[i].second].name, (unsigned long long)ops[i].first);
+			for (size_t i = 0; i < pcs.size(); ++i)
+				fprintf(dest, "pc,%s,0x%08x,%llu,%llu,%llu,\n", mips_op_table[pcs[i]->op].name, pcs[i]->pc, (unsigned long long)pcs[i]->count, (unsigned long long)pcs[i]->taken, (unsigned long long)pcs[i]->not_taken);
+			for (size_t i = 0; i < blocks.size(); ++i)
+				fprintf(dest, "block,,0x%08x,%llu,,,%llu\n", blocks[i]->pc, (unsigned long long)blocks[i]->block_count, (unsigned long long)blocks[i]->block_instructions);
+		break;
+
+		default:
+			return mips_ErrorInvalidArgument;
+	}
+	return ferror(dest) ? mips_ErrorFileWriteError : mips_Success;
+}
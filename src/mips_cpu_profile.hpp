@@ -0,0 +1,34 @@
+/*
+PROFILE
+Counts of every retired instruction, kept while profiling is switched on
+
+Counted per handler (the mnemonics of mips_op_table), per PC and per basic
+block, plus the outcome of every conditional branch and the bytes moved by
+loads and stores. A basic block starts at the first instruction run after
+the delay slot of a branch or jump, wherever it went, so the blocks are the
+straight runs of code the program really took. The counts are fed from the
+trace record of each step, which is why profiling makes mips_cpu_run step one
+instruction at a time like the trace does; when it is off nothing is counted
+and nothing is looked at
+*/
+#ifndef mips_cpu_profile_header
+#define mips_cpu_profile_header
+
+#include <stdio.h>
+#include "mips.h"
+
+struct mips_profile;
+
+//Starts a new profile, dropping the counts of any previous one
+mips_error mips_profile_start(mips_cpu_h state);
+//Stops counting, the counts are kept until the next start or the CPU is freed
+void mips_profile_stop(mips_cpu_h state);
+//Releases the profile of the CPU
+void mips_profile_free(mips_cpu_h state);
+
+//Called by the CPU after every step with its completed trace record, pcN is the CPU's after the step
+void mips_profile_count(mips_profile* profile, const mips_trace_record& record, uint32_t pcN);
+//Writes the counts in one of the mips_profile_format formats
+mips_error mips_profile_write(mips_profile* profile, FILE* dest, mips_profile_format format);
+
+#endif
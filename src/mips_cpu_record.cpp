@@ -0,0 +1,360 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "mips.h"
+#include "mips_cpu_impl.hpp"
+#include "mips_cpu_record.hpp"
+
+#define MIPS_RECORD_REGISTER 16
+#define MIPS_RECORD_RESET 32
+#define MIPS_RECORD_CALL 64
+//Longest entry: kind, two varints and a value, or what a call has before its data
+#define MIPS_RECORD_ENTRY (1 + 10 + 5 + 4)
+#define MIPS_RECORD_CALL_ENTRY (1 + 10 + 5 + 5 + 12 + 5 + 5)
+
+static const char sg_record_magic[8] = {'M','I','P','S','R','E','C','1'};
+
+struct mips_record{
+	FILE* file;				//0 for a log kept in memory
+	std::vector<uint8_t> memory;
+	size_t position;		//Next byte of memory read when replaying
+	size_t entry;			//Where the entry read ahead starts in memory
+	bool replaying;
+	bool failed;			//A write failed, reported when the log stops
+	uint64_t count;			//Instructions retired since the log started
+	uint64_t last;			//Count of the previous entry
+	//Entry read ahead when replaying, kind is 0 once the log is used up
+	uint8_t kind;
+	uint64_t at;
+	uint32_t address;		//Or the register index
+	uint32_t value;
+	mips_record_call call;
+};
+
+//WRITE - one entry, stdio buffers them on the way to the file
+static void mips_record_put_varint(uint8_t* buffer, unsigned& n, uint64_t value){
+	while (value >= 0x80){
+		buffer[n++] = uint8_t(value) | 0x80;
+		value >>= 7;
+	}
+	buffer[n++] = uint8_t(value);
+}
+static void mips_record_put(mips_record* r, const uint8_t* bytes, size_t n){
+	if (r->file == 0)
+		r->memory.insert(r->memory.end(), bytes, bytes + n);
+	else if (fwrite(bytes, 1, n, r->file) != n)
+		r->failed = true;
+}
+static void mips_record_write(mips_record* r, uint8_t kind, uint32_t address, uint32_t value){
+	uint8_t buffer[MIPS_RECORD_ENTRY];
+	unsigned n = 0;
+	buffer[n++] = kind;
+	mips_record_put_varint(buffer, n, r->count - r->last);
+	r->last = r->count;
+	unsigned length = kind;
+	if (kind == MIPS_RECORD_REGISTER){
+		buffer[n++] = uint8_t(address);
+		length = 4;
+	} else if (kind == MIPS_RECORD_RESET){
+		length = 0;
+	} else {
+		mips_record_put_varint(buffer, n, address);
+	}
+	for (unsigned b = 0; b < length; ++b)
+		buffer[n++] = uint8_t(value >> (8 * b));
+	mips_record_put(r, buffer, n);
+}
+static void mips_record_write_call(mips_record* r, const mips_record_call& call){
+	uint8_t buffer[MIPS_RECORD_CALL_ENTRY];
+	unsigned n = 0;
+	buffer[n++] = MIPS_RECORD_CALL;
+	mips_record_put_varint(buffer, n, r->count - r->last);
+	r->last = r->count;
+	mips_record_put_varint(buffer, n, call.number);
+	mips_record_put_varint(buffer, n, call.error);
+	const uint32_t registers[3] = {call.v0, call.a0, call.a1};
+	for (unsigned i = 0; i < 3; ++i)
+		for (unsigned b = 0; b < 4; ++b)
+			buffer[n++] = uint8_t(registers[i] >> (8 * b));
+	mips_record_put_varint(buffer, n, call.address);
+	mips_record_put_varint(buffer, n, call.data.size());
+	mips_record_put(r, buffer, n);
+	if (!call.data.empty())
+		mips_record_put(r, &call.data[0], call.data.size());
+}
+
+//READ - the next entry, a log that ends or is cut short just runs out
+static int mips_record_getc(mips_record* r){
+	if (r->file)
+		return fgetc(r->file);
+	return (r->position < r->memory.size()) ? r->memory[r->position++] : EOF;
+}
+static bool mips_record_get(mips_record* r, uint8_t* bytes, size_t length){
+	for (size_t b = 0; b < length; ++b){
+		int c = mips_record_getc(r);
+		if (c == EOF)
+			return false;
+		bytes[b] = uint8_t(c);
+	}
+	return true;
+}
+static bool mips_record_get_varint(mips_record* r, uint64_t& value){
+	value = 0;
+	for (unsigned shift = 0; shift < 64; shift += 7){
+		int c = mips_record_getc(r);
+		if (c == EOF)
+			return false;
+		value |= uint64_t(c & 0x7F) << shift;
+		if ((c & 0x80) == 0)
+			return true;
+	}
+	return false;
+}
+static uint32_t mips_record_word(const uint8_t* bytes){
+	return uint32_t(bytes[0]) | (uint32_t(bytes[1]) << 8) | (uint32_t(bytes[2]) << 16) | (uint32_t(bytes[3]) << 24);
+}
+static bool mips_record_get_call(mips_record* r, mips_record_call& call){
+	uint64_t number = 0, error = 0, address = 0, length = 0;
+	uint8_t registers[12];
+	if (!mips_record_get_varint(r, number) || !mips_record_get_varint(r, error) || !mips_record_get(r, registers, 12))
+		return false;
+	if (!mips_record_get_varint(r, address) || !mips_record_get_varint(r, length))
+		return false;
+	call.number = uint32_t(number);
+	call.error = uint32_t(error);
+	call.v0 = mips_record_word(registers);
+	call.a0 = mips_record_word(registers + 4);
+	call.a1 = mips_record_word(registers + 8);
+	call.address = uint32_t(address);
+	//A byte at a time, so a length the log does not hold just runs out
+	call.data.clear();
+	for (uint64_t i = 0; i < length; ++i){
+		int c = mips_record_getc(r);
+		if (c == EOF)
+			return false;
+		call.data.push_back(uint8_t(c));
+	}
+	return true;
+}
+static void mips_record_next(mips_record* r){
+	r->entry = r->position;
+	int kind = mips_record_getc(r);
+	uint64_t delta = 0, address = 0;
+	unsigned length = 0;
+	bool ok = (kind != EOF) && mips_record_get_varint(r, delta);
+	if (ok && (kind == MIPS_RECORD_REGISTER)){
+		int index = mips_record_getc(r);
+		ok = (index != EOF) && (index <= 32);
+		address = uint32_t(index);
+		length = 4;
+	} else if (ok && ((kind == 1) || (kind == 2) || (kind == 4))){
+		ok = mips_record_get_varint(r, address);
+		length = kind;
+	} else if (ok && (kind == MIPS_RECORD_CALL)){
+		ok = mips_record_get_call(r, r->call);
+	} else if (kind != MIPS_RECORD_RESET){
+		ok = false;
+	}
+	uint8_t bytes[4];
+	ok = ok && mips_record_get(r, bytes, length);
+	if (!ok){
+		r->kind = 0;
+		//A log in memory is always whole, at its end logging goes on
+		if (r->file == 0)
+			r->replaying = false;
+		return;
+	}
+	r->kind = uint8_t(kind);
+	r->at = r->last + delta;
+	r->last = r->at;
+	r->address = uint32_t(address);
+	r->value = 0;
+	for (unsigned b = 0; b < length; ++b)
+		r->value |= uint32_t(bytes[b]) << (8 * b);
+}
+
+mips_error mips_record_start(mips_cpu_h state, FILE* file, bool replay){
+	mips_record_stop(state);
+
+	if (replay){
+		char magic[8];
+		if ((fread(magic, 1, 8, file) != 8) || (memcmp(magic, sg_record_magic, 8) != 0))
+			return mips_ErrorFileReadError;
+	} else if (fwrite(sg_record_magic, 1, 8, file) != 8){
+		return mips_ErrorFileWriteError;
+	}
+
+	mips_record* r = mips_record_create();
+	r->file = file;
+	r->replaying = replay;
+	if (replay)
+		mips_record_next(r);
+	state->record = r;
+	return mips_Success;
+}
+
+mips_error mips_record_stop(mips_cpu_h state){
+	mips_record* r = state->record;
+	if (r == 0)
+		return mips_Success;
+	state->record = 0;
+	bool failed = r->failed || (!r->replaying && (fflush(r->file) != 0));
+	mips_record_free(r);
+	return failed ? mips_ErrorFileWriteError : mips_Success;
+}
+
+mips_record* mips_record_create(){
+	mips_record* r = new mips_record;
+	r->file = 0;
+	r->position = 0;
+	r->entry = 0;
+	r->replaying = false;
+	r->failed = false;
+	r->count = 0;
+	r->last = 0;
+	r->kind = 0;
+	return r;
+}
+
+void mips_record_free(mips_record* r){
+	delete r;
+}
+
+size_t mips_record_tell(mips_record* r){
+	return r->replaying ? r->entry : r->memory.size();
+}
+
+void mips_record_replay_from(mips_record* r, size_t position){
+	r->replaying = true;
+	r->position = position;
+	mips_record_next(r);
+}
+
+void mips_record_resume(mips_record* r){
+	if (!r->replaying)
+		return;
+	r->memory.resize(r->entry);
+	r->replaying = false;
+	r->kind = 0;
+}
+
+void mips_record_step(mips_cpu_h state){
+	mips_record* r = state->record;
+	if (!r->replaying)
+		return;
+	while (((r->kind == MIPS_RECORD_REGISTER) || (r->kind == MIPS_RECORD_RESET)) && (r->at <= r->count)){
+		//Straight into the state, the CPU API would log them again
+		if (r->kind == MIPS_RECORD_RESET){
+			state->pc = 0;
+			state->pcN = 4;
+			state->hi = 0;
+			state->lo = 0;
+			for (unsigned i = 0; i < 32; ++i)
+				state->regs[i] = 0;
+			state->ll_valid = false;
+		} else if (r->address == 32){
+			state->pc = r->value;
+			state->pcN = r->value + 4;
+		} else if (r->address != 0){
+			state->regs[r->address] = r->value;
+		}
+		mips_record_next(r);
+	}
+}
+
+void mips_record_retired(mips_record* r){
+	++r->count;
+}
+
+void mips_record_register(mips_cpu_h state, unsigned index, uint32_t value){
+	if (!state->record->replaying)
+		mips_record_write(state->record, MIPS_RECORD_REGISTER, index, value);
+}
+
+void mips_record_reset(mips_cpu_h state){
+	if (!state->record->replaying)
+		mips_record_write(state->record, MIPS_RECORD_RESET, 0, 0);
+}
+
+//Reads through the memory API as the execute stage would without a log
+static mips_error mips_record_read(mips_cpu_h state, uint32_t address, uint32_t length, uint32_t* value){
+	mips_error err;
+	if (length == 4){
+		err = mips_mem_read32(state->mem, address, value);
+	} else if (length == 2){
+		uint16_t half = 0;
+		err = mips_mem_read16(state->mem, address, &half);
+		*value = half;
+	} else {
+		uint8_t byte = 0;
+		err = mips_mem_read(state->mem, address, 1, &byte);
+		*value = byte;
+	}
+	return err;
+}
+
+//The log a load or call is answered from: the history's while it goes back over a run, else the one being replayed
+static mips_record* mips_record_source(mips_cpu_h state){
+	mips_record* logs[2] = {state->history_log, state->record};
+	for (unsigned i = 0; i < 2; ++i)
+		if (logs[i] && logs[i]->replaying && (logs[i]->kind != 0))
+			return logs[i];
+	return 0;
+}
+
+mips_error mips_record_load(mips_cpu_h state, uint32_t address, uint32_t length, uint32_t* value){
+	unsigned device = 0;
+	if ((mips_mem_is_device(state->mem, address, &device) != mips_Success) || !device)
+		return mips_record_read(state, address, length, value);
+
+	//The run is no longer the one that was recorded: an error for the host's log, the end of the history's
+	mips_record* r = mips_record_source(state);
+	if (r && ((r->kind != length) || (r->at != r->count) || (r->address != address))){
+		if (r->file)
+			return mips_ErrorFileReadError;
+		mips_record_resume(r);
+		r = 0;
+	}
+
+	//Past the end of the logs the devices are read again
+	if (r == 0){
+		mips_error err = mips_record_read(state, address, length, value);
+		if (err != mips_Success)
+			return err;
+	} else {
+		*value = r->value;
+		mips_record_next(r);
+	}
+
+	mips_record* logs[2] = {state->history_log, state->record};
+	for (unsigned i = 0; i < 2; ++i)
+		if (logs[i] && !logs[i]->replaying)
+			mips_record_write(logs[i], uint8_t(length), address, *value);
+	return mips_Success;
+}
+
+bool mips_record_replay_call(mips_cpu_h state, mips_record_call& call, mips_error* err){
+	mips_record* r = mips_record_source(state);
+	if (r == 0)
+		return false;
+	//As for loads, a run that no longer matches is an error for the host's log, the end of the history's
+	if ((r->kind != MIPS_RECORD_CALL) || (r->at != r->count) || (r->call.number != call.number)){
+		if (r->file == 0){
+			mips_record_resume(r);
+			return false;
+		}
+		*err = mips_ErrorFileReadError;
+		return true;
+	}
+	call = r->call;
+	*err = mips_Success;
+	mips_record_next(r);
+	return true;
+}
+
+void mips_record_call_made(mips_cpu_h state, const mips_record_call& call){
+	mips_record* logs[2] = {state->history_log, state->record};
+	for (unsigned i = 0; i < 2; ++i)
+		if (logs[i] && !logs[i]->replaying)
+			mips_record_write_call(logs[i], call);
+}
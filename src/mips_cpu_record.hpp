@@ -0,0 +1,80 @@
+/*
+RECORD
+Log of everything a run took from outside the CPU, so it can be run again exactly
+
+Only three things make a run differ from the last one started in the same
+state: values read from devices (see mips_mem_is_device), registers, the pc
+or a reset changed by the host in between instructions, and what the host
+answers to semihosting calls (see mips_cpu_syscall.hpp). Each is logged with
+the count of instructions retired before it happened. Replaying puts the
+host changes back at the same counts, and answers the device reads and calls
+from the log without reading the devices or making the calls again.
+
+The log is written and read an entry at a time through the stdio buffer, so
+a run of any length only holds one entry. Counts go in as the difference to
+the previous entry, so mostly take a byte:
+
+"MIPSREC1", then entries of
+kind (1, 2 or 4: a read of that many bytes, 16: a register, 32: a reset, 64: a call),
+count difference (varint),
+read: address (varint), value (length bytes, little-endian)
+register: index (a byte, 32 is the pc), value (4 bytes, little-endian)
+call: number and error (varints), $v0, $a0 and $a1 after it (4 bytes each,
+little-endian), then address and length (varints) of the bytes it wrote to
+guest memory, and the bytes
+
+The history keeps a log of its own in memory, with the same entries but no
+magic, so that going back over a run answers the device reads from it (see
+mips_cpu_history.cpp). It is not clocked, its counts stay 0: a replay always
+starts from a checkpoint, and takes the entries in the order they were logged.
+It goes back to logging at its end, or where the run stops matching it
+*/
+#ifndef mips_cpu_record_header
+#define mips_cpu_record_header
+
+#include <stdio.h>
+#include <vector>
+#include "mips.h"
+
+struct mips_record;
+
+//What a semihosting call did to the CPU: the registers a call can set, and the bytes it wrote to guest memory
+struct mips_record_call{
+	uint32_t number;		//$v0 when it was made
+	uint32_t error;			//mips_error it returned
+	uint32_t v0;
+	uint32_t a0;
+	uint32_t a1;
+	uint32_t address;
+	std::vector<uint8_t> data;
+};
+
+//Starts writing a log to file, or replaying the log it holds
+mips_error mips_record_start(mips_cpu_h state, FILE* file, bool replay);
+//Stops recording or replaying, reports a log that could not be written
+mips_error mips_record_stop(mips_cpu_h state);
+
+//A log in memory for the history, written until it is replayed from a position it had
+mips_record* mips_record_create();
+void mips_record_free(mips_record* record);
+//Where the next entry goes or comes from, a replay can later start there
+size_t mips_record_tell(mips_record* record);
+void mips_record_replay_from(mips_record* record, size_t position);
+//Ends a replay, the entries it did not reach are dropped and logging goes on from there
+void mips_record_resume(mips_record* record);
+
+//Called before every step, puts back the host changes logged for it when replaying
+void mips_record_step(mips_cpu_h state);
+//Called after every retired instruction
+void mips_record_retired(mips_record* record);
+//Called when the host sets a register (index 32 is the pc) or resets the CPU
+void mips_record_register(mips_cpu_h state, unsigned index, uint32_t value);
+void mips_record_reset(mips_cpu_h state);
+//Loads that cannot use the TLB, logged or answered from a log when they read a device
+mips_error mips_record_load(mips_cpu_h state, uint32_t address, uint32_t length, uint32_t* value);
+//True when a log answers the call numbered call.number, which then must not be made, err is set if the log does not match
+bool mips_record_replay_call(mips_cpu_h state, mips_record_call& call, mips_error* err);
+//Logs a call that was made
+void mips_record_call_made(mips_cpu_h state, const mips_record_call& call);
+
+#endif
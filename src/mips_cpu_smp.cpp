@@ -0,0 +1,98 @@
+/*
+SMP
+Runs several CPUs that share one memory
+
+With a quantum the CPUs take turns on the calling thread, each running
+up to quantum instructions before the next one goes, always in the order
+of the jobs. Nothing depends on the host, so the same programs give the
+same interleaving (and the same results) on every run
+
+Without a quantum each CPU runs free on its own thread, and the CPUs only
+see each other through the memory, as described in mips_mem.h
+*/
+#include "mips.h"
+
+#include <system_error>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+static mips_error mips_smp_slice(mips_cpu_job& job, uint64_t slice, uint64_t* steps){
+	if (job.use_stop_pc)
+		return mips_cpu_run_until(job.cpu, job.stop_pc, slice, steps);
+	return mips_cpu_run(job.cpu, slice, steps);
+}
+
+static void mips_smp_run_job(mips_cpu_job* job){
+	job->steps = 0;
+	job->result = mips_smp_slice(*job, job->max_steps, &job->steps);
+}
+
+//A job is finished once it failed, reached its stop pc or used up its steps
+static bool mips_smp_finished(const mips_cpu_job& job){
+	if (job.result != mips_Success)
+		return true;
+	if (job.steps >= job.max_steps)
+		return true;
+	if (job.use_stop_pc){
+		uint32_t pc;
+		if ((mips_cpu_get_pc(job.cpu, &pc) == mips_Success) && (pc == job.stop_pc))
+			return true;
+	}
+	return false;
+}
+
+//CPU RUN SMP - runs every job against the shared memory, returns when all of them are finished
+mips_error mips_cpu_run_smp(mips_cpu_job* jobs, unsigned count, unsigned quantum){
+	if ((jobs == 0) && (count != 0))
+		return mips_ErrorInvalidArgument;
+	for (unsigned i = 0; i < count; ++i)
+		if (jobs[i].cpu == 0)
+			return mips_ErrorInvalidHandle;
+
+	if (quantum == 0){
+		vector<thread> workers;
+		unsigned started = 0;
+		try {
+			for (; started + 1 < count; ++started)
+				workers.push_back(thread(mips_smp_run_job, &jobs[started]));
+		} catch (const system_error&){
+			//The CPUs have to run at the same time, so a thread that could not be started is fatal
+			for (unsigned i = 0; i < workers.size(); ++i)
+				workers[i].join();
+			for (unsigned i = started; i < count; ++i)
+				jobs[i].result = mips_InternalError;
+			return mips_InternalError;
+		}
+		if (count != 0)
+			mips_smp_run_job(&jobs[count - 1]);
+		for (unsigned i = 0; i < workers.size(); ++i)
+			workers[i].join();
+		return mips_Success;
+	}
+
+	vector<unsigned> active;
+	for (unsigned i = 0; i < count; ++i){
+		jobs[i].result = mips_Success;
+		jobs[i].steps = 0;
+		if (!mips_smp_finished(jobs[i]))
+			active.push_back(i);
+	}
+	while (!active.empty()){
+		unsigned kept = 0;
+		for (unsigned i = 0; i < active.size(); ++i){
+			mips_cpu_job& job = jobs[active[i]];
+			uint64_t slice = job.max_steps - job.steps;
+			if (slice > quantum)
+				slice = quantum;
+			uint64_t steps = 0;
+			job.result = mips_smp_slice(job, slice, &steps);
+			job.steps += steps;
+			if (!mips_smp_finished(job))
+				active[kept++] = active[i];
+		}
+		active.resize(kept);
+	}
+	return mips_Success;
+}
@@ -0,0 +1,121 @@
+/*
+SNAPSHOT
+Copy of the registers of a CPU together with a snapshot of its memory
+
+The memory does the real work (see mips_mem_snapshot.cpp), so a snapshot
+only costs the pages written since the last one. The file is "MIPSCPU1",
+then pc, pcN, hi, lo and the 32 registers as little-endian words, followed
+by the memory snapshot in its own format
+*/
+#include <stdio.h>
+#include <string.h>
+#include "mips.h"
+#include "mips_cpu_impl.hpp"
+
+struct mips_cpu_snapshot_impl{
+	uint32_t pc;
+	uint32_t pcN;
+	uint32_t hi;
+	uint32_t lo;
+	uint32_t regs[32];
+	mips_mem_snapshot_h mem;
+};
+
+static const char sg_cpu_snapshot_magic[8] = {'M','I','P','S','C','P','U','1'};
+#define MIPS_CPU_SNAPSHOT_WORDS 36
+
+mips_error mips_cpu_snapshot(mips_cpu_h state, mips_cpu_snapshot_h* snapshot){
+	if (state==0)
+		return mips_ErrorInvalidHandle;
+	if (snapshot==0)
+		return mips_ErrorInvalidArgument;
+
+	mips_cpu_snapshot_impl* taken = new mips_cpu_snapshot_impl;
+	mips_error err = mips_mem_snapshot(state->mem, &taken->mem);
+	if (err != mips_Success){
+		delete taken;
+		return err;
+	}
+	taken->pc = state->pc;
+	taken->pcN = state->pcN;
+	taken->hi = state->hi;
+	taken->lo = state->lo;
+	for (unsigned i = 0; i < 32; ++i)
+		taken->regs[i] = state->regs[i];
+	*snapshot = taken;
+	return mips_Success;
+}
+
+mips_error mips_cpu_restore(mips_cpu_h state, mips_cpu_snapshot_h snapshot){
+	if (state==0)
+		return mips_ErrorInvalidHandle;
+	if (snapshot==0)
+		return mips_ErrorInvalidArgument;
+
+	//The memory changes the code generation, which drops the decoded code and the TLB
+	mips_error err = mips_mem_restore(state->mem, snapshot->mem);
+	state->pc = snapshot->pc;
+	state->pcN = snapshot->pcN;
+	state->hi = snapshot->hi;
+	state->lo = snapshot->lo;
+	for (unsigned i = 0; i < 32; ++i)
+		state->regs[i] = snapshot->regs[i];
+	state->ll_valid = false;
+	if (state->history && (err == mips_Success))
+		return mips_history_changed(state);
+	return err;
+}
+
+mips_error mips_cpu_snapshot_save(mips_cpu_snapshot_h snapshot, FILE* dest){
+	if ((snapshot==0) || (dest==0))
+		return mips_ErrorInvalidArgument;
+
+	uint32_t words[MIPS_CPU_SNAPSHOT_WORDS] = {snapshot->pc, snapshot->pcN, snapshot->hi, snapshot->lo};
+	for (unsigned i = 0; i < 32; ++i)
+		words[4 + i] = snapshot->regs[i];
+	uint8_t header[8 + 4 * MIPS_CPU_SNAPSHOT_WORDS];
+	memcpy(header, sg_cpu_snapshot_magic, 8);
+	for (unsigned i = 0; i < MIPS_CPU_SNAPSHOT_WORDS; ++i)
+		for (unsigned b = 0; b < 4; ++b)
+			header[8 + 4 * i + b] = uint8_t(words[i] >> (8 * b));
+	if (fwrite(header, 1, sizeof(header), dest) != sizeof(header))
+		return mips_ErrorFileWriteError;
+	return mips_mem_snapshot_save(snapshot->mem, dest);
+}
+
+mips_error mips_cpu_snapshot_load(FILE* src, mips_cpu_snapshot_h* snapshot){
+	if ((src==0) || (snapshot==0))
+		return mips_ErrorInvalidArgument;
+
+	uint8_t header[8 + 4 * MIPS_CPU_SNAPSHOT_WORDS];
+	if ((fread(header, 1, sizeof(header), src) != sizeof(header)) || (memcmp(header, sg_cpu_snapshot_magic, 8) != 0))
+		return mips_ErrorFileReadError;
+	uint32_t words[MIPS_CPU_SNAPSHOT_WORDS];
+	for (unsigned i = 0; i < MIPS_CPU_SNAPSHOT_WORDS; ++i){
+		const uint8_t* p = header + 8 + 4 * i;
+		words[i] = uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+	}
+
+	mips_cpu_snapshot_impl* loaded = new mips_cpu_snapshot_impl;
+	mips_error err = mips_mem_snapshot_load(src, &loaded->mem);
+	if (err != mips_Success){
+		delete loaded;
+		return err;
+	}
+	loaded->pc = words[0];
+	loaded->pcN = words[1];
+	loaded->hi = words[2];
+	loaded->lo = words[3];
+	for (unsigned i = 0; i < 32; ++i)
+		loaded->regs[i] = words[4 + i];
+	loaded->regs[0] = 0;
+	*snapshot = loaded;
+	return mips_Success;
+}
+
+void mips_cpu_snapshot_free(mips_cpu_snapshot_h snapshot){
+	if (snapshot==0)
+		return;
+	mips_mem_snapshot_free(snapshot->mem);
+	delete snapshot;
+}
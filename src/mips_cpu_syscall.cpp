@@ -0,0 +1,390 @@
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <atomic>
+#include "mips.h"
+#include "mips_cpu_impl.hpp"
+#include "mips_cpu_syscall.hpp"
+
+using namespace std;
+
+//Guest memory is copied in pieces that never cross a page, so only a missing page fails
+#define MIPS_SYSCALL_CHUNK 4096
+//Longest file name a program can open
+#define MIPS_SYSCALL_NAME 1024
+
+#define MIPS_REG_V0 2
+#define MIPS_REG_A0 4
+#define MIPS_REG_A1 5
+#define MIPS_REG_A2 6
+
+struct mips_syscall{
+	uint64_t session;					//Taken from sg_syscall_sessions when it starts
+	FILE* files[MIPS_SYSCALL_FILES];	//0 when the descriptor is not open, 0 to 2 are the host's own
+	char* buffers[MIPS_SYSCALL_FILES];	//stdio buffer of a file the program opened
+	string names[MIPS_SYSCALL_FILES];	//What a file was opened with, so that it can be opened again
+	uint32_t flags[MIPS_SYSCALL_FILES];
+	uint32_t heap;						//Where the break starts
+	uint32_t brk;
+	bool exited;
+	int32_t exit_code;
+};
+
+//Tells checkpoints of one semihosting from those of another
+static atomic<uint64_t> sg_syscall_sessions(0);
+
+//FILES
+static void mips_syscall_flush(mips_syscall* s){
+	for (unsigned fd = 0; fd < MIPS_SYSCALL_FILES; ++fd)
+		if (s->files[fd])
+			fflush(s->files[fd]);
+}
+static FILE* mips_syscall_file(mips_syscall* s, uint32_t fd){
+	return (fd < MIPS_SYSCALL_FILES) ? s->files[fd] : 0;
+}
+//A file opened again, for a checkpoint or a replay, is not emptied a second time
+static FILE* mips_syscall_attach(mips_syscall* s, unsigned fd, const string& name, uint32_t flags, bool again){
+	const char* mode;
+	switch (flags){
+		case 0: mode = "rb"; break;
+		case 1: mode = again ? "r+b" : "wb"; break;
+		case 9: mode = "ab"; break;
+		default:
+		return 0;
+	}
+	FILE* file = fopen(name.c_str(), mode);
+	if (file == 0)
+		return 0;
+	s->buffers[fd] = new char[MIPS_SYSCALL_BUFFER];
+	setvbuf(file, s->buffers[fd], _IOFBF, MIPS_SYSCALL_BUFFER);
+	s->files[fd] = file;
+	s->names[fd] = name;
+	s->flags[fd] = flags;
+	return file;
+}
+static int mips_syscall_detach(mips_syscall* s, unsigned fd){
+	int err = fclose(s->files[fd]);
+	delete [] s->buffers[fd];
+	s->files[fd] = 0;
+	s->buffers[fd] = 0;
+	s->names[fd].clear();
+	return err;
+}
+static int32_t mips_syscall_open(mips_syscall* s, const string& name, uint32_t flags){
+	unsigned fd = 3;
+	while ((fd < MIPS_SYSCALL_FILES) && s->files[fd])
+		++fd;
+	if ((fd == MIPS_SYSCALL_FILES) || (mips_syscall_attach(s, fd, name, flags, false) == 0))
+		return -1;
+	return fd;
+}
+static int32_t mips_syscall_close(mips_syscall* s, uint32_t fd){
+	FILE* file = mips_syscall_file(s, fd);
+	if (file == 0)
+		return -1;
+	//The host's own streams are only flushed and stay open, they outlive the program and print still uses them
+	if (fd < 3)
+		return (fflush(file) == 0) ? 0 : -1;
+	return (mips_syscall_detach(s, fd) == 0) ? 0 : -1;
+}
+
+//TRANSFERS - between a file and guest memory, a chunk at a time
+static uint32_t mips_syscall_chunk(uint32_t address, uint32_t left){
+	uint32_t chunk = MIPS_SYSCALL_CHUNK - (address % MIPS_SYSCALL_CHUNK);
+	return (chunk < left) ? chunk : left;
+}
+static mips_error mips_syscall_write(mips_cpu_h state, FILE* file, uint32_t address, uint32_t length, int32_t* written){
+	uint8_t buffer[MIPS_SYSCALL_CHUNK];
+	*written = 0;
+	while (length > 0){
+		uint32_t chunk = mips_syscall_chunk(address, length);
+		mips_error err = mips_mem_read_block(state->mem, address, chunk, buffer);
+		if (err != mips_Success)
+			return err;
+		size_t done = fwrite(buffer, 1, chunk, file);
+		*written += done;
+		if (done < chunk)
+			break;
+		address += chunk;
+		length -= chunk;
+	}
+	return mips_Success;
+}
+//What was read is kept in data, for the logs
+static mips_error mips_syscall_read(mips_cpu_h state, FILE* file, uint32_t address, uint32_t length, int32_t* read, vector<uint8_t>& data){
+	uint8_t buffer[MIPS_SYSCALL_CHUNK];
+	*read = 0;
+	while (length > 0){
+		uint32_t chunk = mips_syscall_chunk(address, length);
+		size_t done = fread(buffer, 1, chunk, file);
+		mips_error err = mips_mem_write_block(state->mem, address, done, buffer);
+		if (err != mips_Success)
+			return err;
+		data.insert(data.end(), buffer, buffer + done);
+		*read += done;
+		if (done < chunk)
+			break;
+		address += chunk;
+		length -= chunk;
+	}
+	return mips_Success;
+}
+//Bytes of a read put back by a replay
+static mips_error mips_syscall_put(mips_cpu_h state, uint32_t address, const vector<uint8_t>& data){
+	uint32_t done = 0;
+	while (done < data.size()){
+		uint32_t chunk = mips_syscall_chunk(address, data.size() - done);
+		mips_error err = mips_mem_write_block(state->mem, address, chunk, &data[done]);
+		if (err != mips_Success)
+			return err;
+		address += chunk;
+		done += chunk;
+	}
+	return mips_Success;
+}
+//A string ends at its zero, or is cut short at length
+static mips_error mips_syscall_string(mips_cpu_h state, uint32_t address, uint32_t length, string& text){
+	uint8_t buffer[MIPS_SYSCALL_CHUNK];
+	text.clear();
+	while (text.size() < length){
+		uint32_t chunk = mips_syscall_chunk(address, length - text.size());
+		mips_error err = mips_mem_read_block(state->mem, address, chunk, buffer);
+		if (err != mips_Success)
+			return err;
+		for (uint32_t i = 0; i < chunk; ++i){
+			if (buffer[i] == 0)
+				return mips_Success;
+			text.push_back(char(buffer[i]));
+		}
+		address += chunk;
+	}
+	return mips_Success;
+}
+
+mips_error mips_syscall_start(mips_cpu_h state, uint32_t heap, FILE* in, FILE* out){
+	mips_syscall_stop(state);
+
+	mips_syscall* s = new mips_syscall;
+	s->session = ++sg_syscall_sessions;
+	for (unsigned fd = 0; fd < MIPS_SYSCALL_FILES; ++fd){
+		s->files[fd] = 0;
+		s->buffers[fd] = 0;
+		s->flags[fd] = 0;
+	}
+	s->files[0] = in ? in : stdin;
+	s->files[1] = out ? out : stdout;
+	s->files[2] = stderr;
+	s->heap = heap;
+	mips_syscall_reset(s);
+	state->syscall = s;
+	return mips_Success;
+}
+
+void mips_syscall_stop(mips_cpu_h state){
+	mips_syscall* s = state->syscall;
+	if (s==0)
+		return;
+	for (unsigned fd = 0; fd < MIPS_SYSCALL_FILES; ++fd)
+		mips_syscall_close(s, fd);
+	delete s;
+	state->syscall = 0;
+}
+
+void mips_syscall_save(mips_cpu_h state, mips_syscall_state& saved){
+	mips_syscall* s = state->syscall;
+	saved.session = s ? s->session : 0;
+	if (s == 0)
+		return;
+	for (unsigned fd = 3; fd < MIPS_SYSCALL_FILES; ++fd){
+		saved.positions[fd] = s->files[fd] ? ftell(s->files[fd]) : -1;
+		saved.names[fd] = s->names[fd];
+		saved.flags[fd] = s->flags[fd];
+	}
+	saved.brk = s->brk;
+	saved.exited = s->exited;
+	saved.exit_code = s->exit_code;
+}
+
+void mips_syscall_restore(mips_cpu_h state, const mips_syscall_state& saved){
+	mips_syscall* s = state->syscall;
+	if ((s == 0) || (saved.session != s->session))
+		return;
+	//A file that is still open as it was is only moved, the others are closed or opened again
+	for (unsigned fd = 3; fd < MIPS_SYSCALL_FILES; ++fd){
+		bool open = (saved.positions[fd] >= 0);
+		bool same = open && s->files[fd] && (s->names[fd] == saved.names[fd]) && (s->flags[fd] == saved.flags[fd]);
+		if (s->files[fd] && !same)
+			mips_syscall_detach(s, fd);
+		if (open && !same)
+			mips_syscall_attach(s, fd, saved.names[fd], saved.flags[fd], true);
+		if (open && s->files[fd])
+			fseek(s->files[fd], saved.positions[fd], SEEK_SET);
+	}
+	s->brk = saved.brk;
+	s->exited = saved.exited;
+	s->exit_code = saved.exit_code;
+}
+
+void mips_syscall_reset(mips_syscall* s){
+	s->brk = s->heap;
+	s->exited = false;
+	s->exit_code = 0;
+}
+
+bool mips_syscall_exit_code(mips_syscall* s, int32_t* code){
+	if (s->exited)
+		*code = s->exit_code;
+	return s->exited;
+}
+
+//CALL - made through the host, data gets what it read into guest memory
+static mips_error mips_syscall_make(mips_cpu_h state, vector<uint8_t>& data){
+	mips_syscall* s = state->syscall;
+	uint32_t a0 = mips_reg(state, MIPS_REG_A0);
+	uint32_t a1 = mips_reg(state, MIPS_REG_A1);
+	uint32_t a2 = mips_reg(state, MIPS_REG_A2);
+	int32_t result = 0;
+	mips_error err = mips_Success;
+	string text;
+
+	switch (mips_reg(state, MIPS_REG_V0)){
+		case 1:
+			fprintf(s->files[1], "%d", int32_t(a0));
+			return mips_Success;
+		case 4:
+			err = mips_syscall_string(state, a0, UINT32_MAX, text);
+			if (err == mips_Success)
+				fwrite(text.data(), 1, text.size(), s->files[1]);
+			return err;
+		case 11:
+			fputc(int(a0 & 0xFF), s->files[1]);
+			return mips_Success;
+		case 9:
+			//Grows by whole double words so that every allocation stays aligned
+			result = s->brk;
+			s->brk += (int32_t(a0) + 7) & ~7;
+			break;
+		case 10:
+		case 17:
+			s->exited = true;
+			s->exit_code = (mips_reg(state, MIPS_REG_V0) == 17) ? int32_t(a0) : 0;
+			mips_syscall_flush(s);
+			return mips_ExceptionBreak;
+		case 13:
+			err = mips_syscall_string(state, a0, MIPS_SYSCALL_NAME, text);
+			if (err == mips_Success)
+				result = mips_syscall_open(s, text, a1);
+			break;
+		case 14:{
+			FILE* file = mips_syscall_file(s, a0);
+			if (file == 0){
+				result = -1;
+				break;
+			}
+			//Whatever the program wrote before asking for input has to be seen first
+			if (a0 == 0)
+				mips_syscall_flush(s);
+			err = mips_syscall_read(state, file, a1, a2, &result, data);
+			break;
+		}
+		case 15:{
+			FILE* file = mips_syscall_file(s, a0);
+			if (file == 0){
+				result = -1;
+				break;
+			}
+			err = mips_syscall_write(state, file, a1, a2, &result);
+			break;
+		}
+		case 16:
+			result = mips_syscall_close(s, a0);
+			break;
+		case 30:{
+			uint64_t ms = chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+			mips_reg_write(state, MIPS_REG_A0, uint32_t(ms));
+			mips_reg_write(state, MIPS_REG_A1, uint32_t(ms >> 32));
+			return mips_Success;
+		}
+		default:
+		return mips_ErrorNotImplemented;
+	}
+	if (err != mips_Success)
+		return err;
+	return mips_reg_write(state, MIPS_REG_V0, uint32_t(result));
+}
+
+//REPLAY - what a logged call did, without the host: nothing is printed or read again, only opened
+static mips_error mips_syscall_replay(mips_cpu_h state, const mips_record_call& call){
+	mips_syscall* s = state->syscall;
+	uint32_t a0 = mips_reg(state, MIPS_REG_A0);
+	int32_t result = int32_t(call.v0);
+	mips_error err = mips_syscall_put(state, call.address, call.data);
+	if (err != mips_Success)
+		return err;
+
+	switch (call.number){
+		case 9:
+			s->brk += (int32_t(a0) + 7) & ~7;
+			break;
+		case 10:
+		case 17:
+			s->exited = true;
+			s->exit_code = (call.number == 17) ? int32_t(a0) : 0;
+			break;
+		case 13:{
+			//The file the logged run opened, opened again so that the descriptors go on matching it
+			string name;
+			if ((result >= 3) && (result < MIPS_SYSCALL_FILES) && (mips_syscall_string(state, a0, MIPS_SYSCALL_NAME, name) == mips_Success)){
+				if (s->files[result])
+					mips_syscall_detach(s, result);
+				mips_syscall_attach(s, result, name, mips_reg(state, MIPS_REG_A1), true);
+			}
+			break;
+		}
+		case 14:
+		case 15:{
+			//A file the program opened is left where the logged call left it
+			FILE* file = mips_syscall_file(s, a0);
+			if ((a0 >= 3) && file && (result > 0))
+				fseek(file, result, SEEK_CUR);
+			break;
+		}
+		case 16:
+			if ((result == 0) && (a0 >= 3) && (a0 < MIPS_SYSCALL_FILES) && s->files[a0])
+				mips_syscall_detach(s, a0);
+			break;
+	}
+	mips_reg_write(state, MIPS_REG_V0, call.v0);
+	mips_reg_write(state, MIPS_REG_A0, call.a0);
+	mips_reg_write(state, MIPS_REG_A1, call.a1);
+	return mips_error(call.error);
+}
+
+static bool mips_syscall_known(uint32_t number){
+	switch (number){
+		case 1: case 4: case 9: case 10: case 11: case 13:
+		case 14: case 15: case 16: case 17: case 30:
+		return true;
+	}
+	return false;
+}
+
+mips_error mips_syscall_call(mips_cpu_h state){
+	mips_record_call call;
+	call.number = mips_reg(state, MIPS_REG_V0);
+	if (!mips_syscall_known(call.number))
+		return mips_ErrorNotImplemented;
+	mips_error err = mips_Success;
+	if (mips_record_replay_call(state, call, &err))
+		return (err != mips_Success) ? err : mips_syscall_replay(state, call);
+
+	call.address = mips_reg(state, MIPS_REG_A1);
+	err = mips_syscall_make(state, call.data);
+	call.error = err;
+	call.v0 = mips_reg(state, MIPS_REG_V0);
+	call.a0 = mips_reg(state, MIPS_REG_A0);
+	call.a1 = mips_reg(state, MIPS_REG_A1);
+	mips_record_call_made(state, call);
+	return err;
+}
@@ -0,0 +1,75 @@
+/*
+SYSCALL
+Semihosting: SYSCALL asks the host to do I/O for the program, or to end it
+
+The call number is in $v0 and the arguments in $a0-$a2, numbered as in MARS
+and SPIM, results come back in $v0:
+
+ 1 print int ($a0)                 4 print string ($a0)
+ 9 sbrk ($a0 bytes, $v0 old break) 10 exit (code 0)
+11 print char ($a0)               13 open ($a0 name, $a1 flags 0 read, 1 write, 9 append, $v0 fd)
+14 read ($a0 fd, $a1 buffer, $a2 length, $v0 bytes read)
+15 write ($a0 fd, $a1 buffer, $a2 length, $v0 bytes written)
+16 close ($a0 fd)                 17 exit ($a0 code)
+30 time ($a0 low and $a1 high word of milliseconds since 1970)
+
+Failed calls return -1 in $v0. Descriptors 0, 1 and 2 are the host input,
+output and error, closing them only flushes them. Every file goes through a stdio buffer, and guest memory is
+copied a page at a time, so a write of any length is a few block copies and a
+single fwrite. Output is flushed when the program exits, when the input is read
+and when semihosting stops.
+
+Exit and BREAK do not retire: the PC stays on the instruction, and the run
+stops with mips_ExceptionBreak.
+
+What a call does to the CPU is logged by mips_cpu_set_record and by the
+history (see mips_cpu_record.hpp), and a replay takes it from the log without
+the host, so nothing is printed, read or allocated twice; only an open is
+made again, without emptying the file, so the descriptors stay those of the
+logged run. Checkpoints of the history keep the break, the exit, and the
+name, flags and position of the file each descriptor holds rather than the
+file, which is opened again when going back needs it. So a file the program
+closes is closed on the host, however long the history is
+*/
+#ifndef mips_cpu_syscall_header
+#define mips_cpu_syscall_header
+
+#include <stdio.h>
+#include <string>
+#include "mips.h"
+
+//Descriptors a program can have open, including the three standard ones
+#define MIPS_SYSCALL_FILES 32
+//Size of the stdio buffer of each file the program opens
+#define MIPS_SYSCALL_BUFFER (64 * 1024)
+
+struct mips_syscall;
+
+//What a history checkpoint keeps of semihosting, for the descriptors from 3 on
+struct mips_syscall_state{
+	uint64_t session;					//Semihosting it was taken from, 0 when off
+	std::string names[MIPS_SYSCALL_FILES];
+	uint32_t flags[MIPS_SYSCALL_FILES];
+	long positions[MIPS_SYSCALL_FILES];	//-1 for a descriptor that is not open
+	uint32_t brk;
+	bool exited;
+	int32_t exit_code;
+};
+
+//Starts semihosting with the heap break at heap, NULL streams are the host's own
+mips_error mips_syscall_start(mips_cpu_h state, uint32_t heap, FILE* in, FILE* out);
+//Closes the files the program opened and flushes the rest
+void mips_syscall_stop(mips_cpu_h state);
+
+//Does the call asked for by the registers
+mips_error mips_syscall_call(mips_cpu_h state);
+//Called when the CPU is reset, the program has not exited and its heap is empty
+void mips_syscall_reset(mips_syscall* syscall);
+//Exit code of the program, false while it has not exited
+bool mips_syscall_exit_code(mips_syscall* syscall, int32_t* code);
+
+//Saved in a checkpoint, and put back only into the semihosting it was saved from
+void mips_syscall_save(mips_cpu_h state, mips_syscall_state& saved);
+void mips_syscall_restore(mips_cpu_h state, const mips_syscall_state& saved);
+
+#endif
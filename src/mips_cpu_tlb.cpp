@@ -0,0 +1,29 @@
+/*
+TLB
+Maps a guest page through the memory on a miss and remembers the host pointer
+*/
+#include "mips_cpu_tlb.hpp"
+#include "mips_cpu_impl.hpp"
+
+uint8_t* mips_tlb_fill(mips_cpu_h state, uint32_t address, bool write){
+	uint8_t* host;
+	if (mips_mem_map_page(state->mem, address, write ? 1 : 0, &host) != mips_Success)
+		return 0;
+
+	mips_tlb_entry* entry = &state->tlb[(address >> MIPS_TLB_PAGE_BITS) % MIPS_TLB_SIZE];
+	entry->page = address >> MIPS_TLB_PAGE_BITS;
+	entry->host = host;
+	entry->writable = write;
+	return host + (address & ((1 << MIPS_TLB_PAGE_BITS) - 1));
+}
+
+void mips_tlb_invalidate(mips_cpu_h state, uint32_t address){
+	mips_tlb_entry* entry = &state->tlb[(address >> MIPS_TLB_PAGE_BITS) % MIPS_TLB_SIZE];
+	if (entry->page == (address >> MIPS_TLB_PAGE_BITS))
+		entry->page = ~uint32_t(0);
+}
+
+void mips_tlb_flush(mips_cpu_h state){
+	for (unsigned i = 0; i < MIPS_TLB_SIZE; ++i)
+		state->tlb[i].page = ~uint32_t(0);
+}
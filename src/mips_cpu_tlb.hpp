@@ -0,0 +1,35 @@
+/*
+TLB
+Direct mapped cache of guest pages to host pointers, so loads and stores
+to plain memory skip the memory API
+
+A page that cannot be mapped (not plain storage, or holding watched code
+when written) is never cached, the access falls back to the memory API
+Pages mapped for writing are dropped when the CPU starts watching code
+in them, so every store to cached code still goes through the memory
+*/
+#ifndef mips_cpu_tlb_header
+#define mips_cpu_tlb_header
+
+#include "mips.h"
+
+//Guest pages are the pages of the memory API
+#if (1 << 12) != MIPS_MEM_PAGE
+#error MIPS_TLB_PAGE_BITS does not match MIPS_MEM_PAGE
+#endif
+
+#define MIPS_TLB_SIZE 64
+#define MIPS_TLB_PAGE_BITS 12
+
+struct mips_tlb_entry{
+	uint32_t page;   //Guest page number, ~0 when empty
+	uint8_t* host;   //First byte of the page on the host
+	bool writable;   //Host page may be written through
+};
+
+//Slow paths, return 0 when the access has to go through the memory API
+uint8_t* mips_tlb_fill(mips_cpu_h state, uint32_t address, bool write);
+void mips_tlb_invalidate(mips_cpu_h state, uint32_t address);
+void mips_tlb_flush(mips_cpu_h state);
+
+#endif
@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <system_error>
+#include <thread>
+#include "mips.h"
+#include "mips_cpu_decode.hpp"
+#include "mips_cpu_execute.hpp"
+#include "mips_cpu_execute_help.hpp"
+#include "mips_cpu_impl.hpp"
+#include "mips_cpu_trace.hpp"
+
+using namespace std;
+
+struct mips_trace{
+	mips_trace_writer_h writer;
+	mips_trace_record ring[MIPS_TRACE_RING_SIZE];
+	atomic<uint64_t> head;  //Records pushed, only written by the CPU
+	atomic<uint64_t> tail;  //Records written out, only written by the drain thread
+	atomic<bool> stop;
+	thread drain;
+};
+
+//DRAIN - writes out whatever the CPU has pushed, in runs that do not wrap
+static void mips_trace_drain(mips_trace* trace){
+	uint64_t tail = trace->tail.load(memory_order_relaxed);
+	for (;;){
+		uint64_t head = trace->head.load(memory_order_acquire);
+		if (head == tail){
+			if (trace->stop.load(memory_order_acquire) && (trace->head.load(memory_order_acquire) == tail))
+				break;
+			this_thread::sleep_for(chrono::microseconds(100));
+			continue;
+		}
+		uint64_t start = tail % MIPS_TRACE_RING_SIZE;
+		uint64_t count = head - tail;
+		if (count > MIPS_TRACE_RING_SIZE - start)
+			count = MIPS_TRACE_RING_SIZE - start;
+		//A failed write is kept by the writer, which then drops the rest
+		mips_trace_writer_write(trace->writer, &trace->ring[start], count);
+		tail += count;
+		trace->tail.store(tail, memory_order_release);
+	}
+}
+
+mips_error mips_trace_start(mips_cpu_h state, FILE* dest){
+	mips_trace_stop(state);
+
+	mips_trace_writer_h writer;
+	mips_error err = mips_trace_writer_open(dest, state->pc, state->hi, state->lo, state->regs, &writer);
+	if (err != mips_Success)
+		return err;
+
+	mips_trace* trace = new mips_trace;
+	trace->writer = writer;
+	trace->head.store(0);
+	trace->tail.store(0);
+	trace->stop.store(false);
+	try {
+		trace->drain = thread(mips_trace_drain, trace);
+	} catch (const system_error&){
+		mips_trace_writer_close(writer);
+		delete trace;
+		return mips_InternalError;
+	}
+	state->trace = trace;
+	return mips_Success;
+}
+
+mips_error mips_trace_stop(mips_cpu_h state){
+	mips_trace* trace = state->trace;
+	if (trace == 0)
+		return mips_Success;
+	trace->stop.store(true, memory_order_release);
+	trace->drain.join();
+	state->trace = 0;
+	mips_error err = mips_trace_writer_close(trace->writer);
+	delete trace;
+	return err;
+}
+
+void mips_trace_push(mips_trace* trace, const mips_trace_record& record){
+	uint64_t head = trace->head.load(memory_order_relaxed);
+	//Full, nothing is dropped so the CPU waits for the drain thread
+	while (head - trace->tail.load(memory_order_acquire) >= MIPS_TRACE_RING_SIZE)
+		this_thread::yield();
+	trace->ring[head % MIPS_TRACE_RING_SIZE] = record;
+	trace->head.store(head + 1, memory_order_release);
+}
+
+void mips_trace_begin(mips_cpu_h state, const mips_icache_entry* entry, mips_trace_record& record){
+	record.pc = state->pc;
+	record.word = 0;
+	record.op = mips_op_INVALID;
+	record.mem_address = 0;
+	record.mem_data = 0;
+	if (entry == 0)
+		return;
+
+	const uint32_t* d = entry->instruction_data;
+	record.word = entry->word;
+	record.op = entry->op;
+	unsigned flags = mips_op_table[entry->op].flags;
+	if (flags & (MIPS_OP_LOAD | MIPS_OP_STORE))
+		record.mem_address = int32_t(int16_t(d[3])) + state->regs[d[1]];
+	if (flags & MIPS_OP_STORE){
+		record.mem_data = state->regs[d[2]];
+		if (entry->op == mips_op_SB)
+			record.mem_data &= 0xFF;
+		if (entry->op == mips_op_SH)
+			record.mem_data &= 0xFFFF;
+	}
+}
+
+void mips_trace_end(mips_cpu_h state, const mips_icache_entry* entry, mips_error err, mips_trace_record& record){
+	record.next_pc = state->pc;
+	record.error = err;
+	record.rd = 0;
+	if ((entry != 0) && (err == mips_Success))
+		record.rd = mips_trace_destination(entry->op, entry->instruction_data);
+	record.rd_value = state->regs[record.rd];
+	if ((entry != 0) && (mips_op_table[entry->op].flags & MIPS_OP_LOAD))
+		record.mem_data = record.rd_value;
+	record.hi = state->hi;
+	record.lo = state->lo;
+
+	if (state->level != 0)
+		mips_trace_print((state->dest != NULL) ? state->dest : stdout, state->level, record, state->regs);
+	if (state->trace != 0)
+		mips_trace_push(state->trace, record);
+}
+
+uint8_t mips_trace_destination(mips_op op, const uint32_t* d){
+	switch (mips_op_table[op].format){
+		case mips_format_R_DST_S1_S2:
+		case mips_format_R_DST_S2_SHIFT:
+		case mips_format_R_DST_S2_S1:
+		case mips_format_R_DST:
+		case mips_format_R_DST_S1:
+			return d[3];
+		case mips_format_I_DST_S1_IMM:
+		case mips_format_I_DST_IMM:
+			return d[2];
+		case mips_format_I_MEMORY:
+			if ((mips_op_table[op].flags & MIPS_OP_LOAD) || (op == mips_op_SC))
+				return d[2];
+			return 0;
+		default:
+		break;
+	}
+	if ((op == mips_op_JAL) || (op == mips_op_BGEZAL) || (op == mips_op_BLTZAL))
+		return 31;
+	return 0;
+}
+
+//PRINT - the text formats of the debug levels
+void mips_trace_print(FILE* dest, unsigned level, const mips_trace_record& record, const uint32_t* regs){
+	string instruction = "Invalid instruction format";
+	if (record.error == mips_Success){
+		uint32_t data[8];
+		if (mips_decode(record.word, data) == mips_Success)
+			mips_disassemble(mips_op(record.op), data, instruction);
+	}
+
+	switch (level){
+		case 1:
+		case 2:
+			fprintf(dest, "\nExecuted instruction: %s\n", instruction.c_str());
+			fprintf(dest, "Next PC:=%u\n", record.next_pc);
+			if (level == 1)
+				break;
+			fprintf(dest, "HI: %u LO: %u\n", record.hi, record.lo);
+			for (int i = 0; i < 32; ++i){
+				if (i % 4 == 0)
+					fprintf(dest, "\n");
+				fprintf(dest, "R[%i]:= %u\t", i, regs[i]);
+			}
+			fprintf(dest, "\n");
+		break;
+
+		case 3:
+			fprintf(dest, "Executed instruction: %s", instruction.c_str());
+			fprintf(dest, "Next PC:= %i \n", record.next_pc);
+			for (int i = 0; i < 32; ++i){
+				if (i % 4 == 0)
+					fprintf(dest, "\n");
+				fprintf(dest, "R[%i]:= %i \t", i, regs[i]);
+			}
+			fprintf(dest, "\n");
+		break;
+
+		default:
+		break;
+	}
+}
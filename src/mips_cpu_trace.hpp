@@ -0,0 +1,41 @@
+/*
+TRACE
+Binary trace of every executed instruction
+
+Each step fills one mips_trace_record (see mips_trace.h). The debug levels
+print it straight away, and a trace started with mips_cpu_set_trace pushes
+it into a ring owned by the CPU. The CPU is the only producer and a
+background thread the only consumer, which passes the records to a trace
+writer, so the ring needs no lock: the producer publishes head and the
+consumer tail. Encoding and compression happen on the background thread
+*/
+#ifndef mips_cpu_trace_header
+#define mips_cpu_trace_header
+
+#include <string>
+#include "mips.h"
+#include "mips_cpu_icache.hpp"
+
+//Records in the ring of each CPU, a power of two
+#define MIPS_TRACE_RING_SIZE (1 << 16)
+
+struct mips_trace;
+
+//Starts writing records of the CPU to dest, stopping any trace already running
+mips_error mips_trace_start(mips_cpu_h state, FILE* dest);
+//Writes out every record still in the ring, stops the drain thread and finishes the file
+mips_error mips_trace_stop(mips_cpu_h state);
+//Called by the CPU for every record, waits for room when the ring is full
+void mips_trace_push(mips_trace* trace, const mips_trace_record& record);
+
+//Fills in what is known before the instruction runs, entry is 0 if the fetch failed
+void mips_trace_begin(mips_cpu_h state, const mips_icache_entry* entry, mips_trace_record& record);
+//Completes the record after the step, then prints it for the debug level and pushes it to the trace
+void mips_trace_end(mips_cpu_h state, const mips_icache_entry* entry, mips_error err, mips_trace_record& record);
+
+//Register an instruction writes, 0 if it writes none
+uint8_t mips_trace_destination(mips_op op, const uint32_t* instruction_data);
+//Prints a record in the format of a debug level, regs holds the registers after it
+void mips_trace_print(FILE* dest, unsigned level, const mips_trace_record& record, const uint32_t* regs);
+
+#endif
@@ -0,0 +1,73 @@
+/*
+TRACE DECODER
+Prints the records of a trace written by mips_cpu_set_trace in the text
+format of a debug level, with the registers rebuilt by the trace reader
+
+	mips_trace <trace file> [level] [first] [count]
+
+The level is 1, 2 or 3 as for mips_cpu_set_debug_level, 3 by default.
+Printing starts at record first (0 by default), which the index lets the
+reader jump to, and stops after count records (all of them by default).
+Level 0 only prints the number of records in the trace
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include "mips.h"
+#include "mips_cpu_trace.hpp"
+
+int main(int argc, char* argv[]){
+	if ((argc < 2) || (argc > 5)){
+		fprintf(stderr, "Usage: %s <trace file> [level] [first] [count]\n", argv[0]);
+		return 1;
+	}
+	unsigned level = (argc > 2) ? atoi(argv[2]) : 3;
+	uint64_t first = (argc > 3) ? strtoull(argv[3], NULL, 0) : 0;
+	uint64_t count = (argc > 4) ? strtoull(argv[4], NULL, 0) : UINT64_MAX;
+	if (level > 3){
+		fprintf(stderr, "Level must be 0, 1, 2 or 3\n");
+		return 1;
+	}
+
+	FILE* src = fopen(argv[1], "rb");
+	if (src == NULL){
+		fprintf(stderr, "Cannot open %s\n", argv[1]);
+		return 1;
+	}
+	mips_trace_reader_h reader;
+	if (mips_trace_reader_open(src, &reader) != mips_Success){
+		fprintf(stderr, "%s is not a trace\n", argv[1]);
+		fclose(src);
+		return 1;
+	}
+	if (level == 0){
+		printf("%llu records\n", (unsigned long long)mips_trace_reader_get_count(reader));
+		mips_trace_reader_close(reader);
+		fclose(src);
+		return 0;
+	}
+	if (mips_trace_reader_seek(reader, first) != mips_Success){
+		fprintf(stderr, "The trace has %llu records\n", (unsigned long long)mips_trace_reader_get_count(reader));
+		mips_trace_reader_close(reader);
+		fclose(src);
+		return 1;
+	}
+
+	int result = 0;
+	uint32_t regs[32];
+	mips_trace_record record;
+	for (uint64_t i = 0; i < count; ++i){
+		uint32_t got = 0;
+		if (mips_trace_reader_read(reader, &record, 1, &got) != mips_Success){
+			fprintf(stderr, "%s is damaged\n", argv[1]);
+			result = 1;
+			break;
+		}
+		if (got == 0)
+			break;
+		mips_trace_reader_get_registers(reader, regs);
+		mips_trace_print(stdout, level, record, regs);
+	}
+	mips_trace_reader_close(reader);
+	fclose(src);
+	return result;
+}
@@ -0,0 +1,295 @@
+/* This file is an implementation of the functions
+ defined in mips_elf.h. It reads ELF32 big-endian
+ MIPS executables, as produced by mips-linux-gnu-ld
+ (elf32-tradbigmips), into any memory space.
+ 
+ Only the parts needed to run a program are looked
+ at: the program headers (segments to load) and the
+ symbol table (.symtab and its string table).
+ */
+#include "mips_elf.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MIPS_ELF_ET_EXEC 2
+#define MIPS_ELF_PT_LOAD 1
+#define MIPS_ELF_SHT_SYMTAB 2
+#define MIPS_ELF_EM_MIPS 8
+
+struct mips_elf_symbol
+{
+    uint32_t name;      // Offset into names
+    uint32_t value;
+    uint32_t size;
+};
+
+struct mips_elf_impl
+{
+    char *names;        // Copy of the string table of the symbols
+    uint32_t names_length;
+    mips_elf_symbol *symbols;
+    unsigned symbol_count;
+};
+
+// Fields of the file are big-endian, whatever the host is
+static uint32_t mips_elf_u32(const uint8_t *p)
+{
+    return (uint32_t(p[0])<<24) | (uint32_t(p[1])<<16) | (uint32_t(p[2])<<8) | uint32_t(p[3]);
+}
+
+static uint16_t mips_elf_u16(const uint8_t *p)
+{
+    return uint16_t((p[0]<<8) | p[1]);
+}
+
+// Checks that [offset, offset+length) lies inside the file
+static bool mips_elf_in_file(uint32_t size, uint32_t offset, uint32_t length)
+{
+    return (offset <= size) && (length <= size-offset);
+}
+
+static mips_error mips_elf_read_file(const char *fileName, uint8_t **data, uint32_t *size)
+{
+    FILE *src=fopen(fileName, "rb");
+    if(src==0){
+        return mips_ErrorFileReadError;
+    }
+    
+    long length=-1;
+    if(fseek(src, 0, SEEK_END)==0){
+        length=ftell(src);
+    }
+    if((length<0) || (length>0x7FFFFFFF) || (fseek(src, 0, SEEK_SET)!=0)){
+        fclose(src);
+        return mips_ErrorFileReadError;
+    }
+    
+    *data=(uint8_t*)malloc(length ? length : 1);
+    if(*data==0){
+        fclose(src);
+        return mips_InternalError;
+    }
+    if(fread(*data, 1, length, src)!=size_t(length)){
+        free(*data);
+        fclose(src);
+        return mips_ErrorFileReadError;
+    }
+    fclose(src);
+    *size=uint32_t(length);
+    return mips_Success;
+}
+
+static mips_error mips_elf_load_segments(mips_mem_h mem, const uint8_t *data, uint32_t size)
+{
+    uint32_t phoff=mips_elf_u32(data+28);
+    uint16_t phentsize=mips_elf_u16(data+42);
+    uint16_t phnum=mips_elf_u16(data+44);
+    if((phnum>0) && ((phentsize<32) || !mips_elf_in_file(size, phoff, uint32_t(phentsize)*phnum))){
+        return mips_ErrorInvalidArgument;
+    }
+    
+    static const uint8_t zeros[MIPS_MEM_PAGE]={0};
+    for(unsigned i=0; i<phnum; i++){
+        const uint8_t *ph=data+phoff+i*phentsize;
+        if(mips_elf_u32(ph)!=MIPS_ELF_PT_LOAD){
+            continue;
+        }
+        uint32_t offset=mips_elf_u32(ph+4);
+        uint32_t vaddr=mips_elf_u32(ph+8);
+        uint32_t filesz=mips_elf_u32(ph+16);
+        uint32_t memsz=mips_elf_u32(ph+20);
+        if((filesz>memsz) || !mips_elf_in_file(size, offset, filesz)){
+            return mips_ErrorInvalidArgument;
+        }
+        
+        mips_error err=mips_mem_write_block(mem, vaddr, filesz, data+offset);
+        if(err!=mips_Success){
+            return err;
+        }
+        // .bss: the rest of the segment is zero
+        for(uint32_t done=filesz; done<memsz; ){
+            uint32_t chunk=memsz-done;
+            if(chunk>sizeof(zeros)){
+                chunk=sizeof(zeros);
+            }
+            err=mips_mem_write_block(mem, vaddr+done, chunk, zeros);
+            if(err!=mips_Success){
+                return err;
+            }
+            done+=chunk;
+        }
+    }
+    return mips_Success;
+}
+
+static mips_error mips_elf_load_symbols(mips_elf_h elf, const uint8_t *data, uint32_t size)
+{
+    uint32_t shoff=mips_elf_u32(data+32);
+    uint16_t shentsize=mips_elf_u16(data+46);
+    uint16_t shnum=mips_elf_u16(data+48);
+    if((shnum==0) || (shentsize<40) || !mips_elf_in_file(size, shoff, uint32_t(shentsize)*shnum)){
+        return mips_Success; // Stripped, there is nothing to look up
+    }
+    
+    for(unsigned i=0; i<shnum; i++){
+        const uint8_t *sh=data+shoff+i*shentsize;
+        if(mips_elf_u32(sh+4)!=MIPS_ELF_SHT_SYMTAB){
+            continue;
+        }
+        uint32_t offset=mips_elf_u32(sh+16);
+        uint32_t length=mips_elf_u32(sh+20);
+        uint32_t link=mips_elf_u32(sh+24);
+        if(!mips_elf_in_file(size, offset, length) || (link>=shnum)){
+            return mips_ErrorInvalidArgument;
+        }
+        const uint8_t *strtab=data+shoff+link*shentsize;
+        uint32_t names_offset=mips_elf_u32(strtab+16);
+        uint32_t names_length=mips_elf_u32(strtab+20);
+        if(!mips_elf_in_file(size, names_offset, names_length)){
+            return mips_ErrorInvalidArgument;
+        }
+        
+        // Keep a terminated copy of the names, so lookups never run off the end
+        elf->names=(char*)malloc(names_length+1);
+        elf->symbols=(mips_elf_symbol*)malloc((length/16+1)*sizeof(mips_elf_symbol));
+        if((elf->names==0) || (elf->symbols==0)){
+            return mips_InternalError;
+        }
+        memcpy(elf->names, data+names_offset, names_length);
+        elf->names[names_length]=0;
+        elf->names_length=names_length;
+        
+        for(uint32_t s=0; s+16<=length; s+=16){
+            const uint8_t *sym=data+offset+s;
+            uint32_t name=mips_elf_u32(sym);
+            if((name==0) || (name>=names_length)){
+                continue; // Unnamed (section and file entries)
+            }
+            elf->symbols[elf->symbol_count].name=name;
+            elf->symbols[elf->symbol_count].value=mips_elf_u32(sym+4);
+            elf->symbols[elf->symbol_count].size=mips_elf_u32(sym+8);
+            elf->symbol_count++;
+        }
+        return mips_Success;
+    }
+    return mips_Success;
+}
+
+mips_error mips_elf_load(
+                         mips_cpu_h cpu,
+                         mips_mem_h mem,
+                         const char *fileName,
+                         uint32_t stackPointer,
+                         mips_elf_h *elf
+)
+{
+    if((cpu==0) || (mem==0)){
+        return mips_ErrorInvalidHandle;
+    }
+    if(elf){
+        *elf=0;
+    }
+    
+    uint8_t *data;
+    uint32_t size;
+    mips_error err=mips_elf_read_file(fileName, &data, &size);
+    if(err!=mips_Success){
+        return err;
+    }
+    
+    // ELF32 (class 1), big-endian (data 2), executable for MIPS
+    static const uint8_t ident[6]={0x7F, 'E', 'L', 'F', 1, 2};
+    if((size<52) || (memcmp(data, ident, sizeof(ident))!=0) || (mips_elf_u16(data+16)!=MIPS_ELF_ET_EXEC)
+        || (mips_elf_u16(data+18)!=MIPS_ELF_EM_MIPS)){
+        free(data);
+        return mips_ErrorInvalidArgument;
+    }
+    
+    mips_elf_h loaded=(mips_elf_h)calloc(1, sizeof(struct mips_elf_impl));
+    if(loaded==0){
+        free(data);
+        return mips_InternalError;
+    }
+    
+    err=mips_elf_load_segments(mem, data, size);
+    if(err==mips_Success){
+        err=mips_elf_load_symbols(loaded, data, size);
+    }
+    if(err==mips_Success){
+        err=mips_cpu_set_pc(cpu, mips_elf_u32(data+24));
+    }
+    free(data);
+    
+    if(err==mips_Success){
+        uint32_t gp;
+        mips_cpu_set_register(cpu, 29, stackPointer);
+        if(mips_elf_find_symbol(loaded, "_gp", &gp)==mips_Success){
+            mips_cpu_set_register(cpu, 28, gp);
+        }
+    }
+    
+    if((err!=mips_Success) || (elf==0)){
+        mips_elf_free(loaded);
+    }else{
+        *elf=loaded;
+    }
+    return err;
+}
+
+mips_error mips_elf_find_symbol(
+                                mips_elf_h elf,
+                                const char *name,
+                                uint32_t *value
+)
+{
+    if(elf==0){
+        return mips_ErrorInvalidHandle;
+    }
+    
+    for(unsigned i=0; i<elf->symbol_count; i++){
+        if(strcmp(elf->names+elf->symbols[i].name, name)==0){
+            *value=elf->symbols[i].value;
+            return mips_Success;
+        }
+    }
+    return mips_ErrorInvalidArgument;
+}
+
+unsigned mips_elf_get_symbol_count(mips_elf_h elf)
+{
+    return elf ? elf->symbol_count : 0;
+}
+
+mips_error mips_elf_get_symbol(
+                               mips_elf_h elf,
+                               unsigned index,
+                               const char **name,
+                               uint32_t *value,
+                               uint32_t *size
+)
+{
+    if(elf==0){
+        return mips_ErrorInvalidHandle;
+    }
+    if(index>=elf->symbol_count){
+        return mips_ErrorInvalidArgument;
+    }
+    
+    *name=elf->names+elf->symbols[index].name;
+    *value=elf->symbols[index].value;
+    if(size){
+        *size=elf->symbols[index].size;
+    }
+    return mips_Success;
+}
+
+void mips_elf_free(mips_elf_h elf)
+{
+    if(elf){
+        free(elf->names);
+        free(elf->symbols);
+        free(elf);
+    }
+}
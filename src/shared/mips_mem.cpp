@@ -0,0 +1,256 @@
+/* This file is an implementation of the functions
+ defined in mips_mem.h that are common to every kind
+ of memory. It checks the transactions and forwards
+ them to whichever provider created the handle, see
+ mips_mem_provider.hpp.
+ */
+#include "mips_mem_provider.hpp"
+
+static mips_error mips_mem_check(
+                                 mips_mem_h mem,
+                                 uint32_t address,
+                                 uint32_t length
+                                 )
+{
+    if(mem==0){
+        return mips_ErrorInvalidHandle;
+    }
+    
+    if( (length!=1) && (length!=2) && (length!=4) ){
+        return mips_ExceptionInvalidLength;
+    }
+    
+    if(0 != (address % length) ){
+        return mips_ExceptionInvalidAlignment;
+    }
+    return mips_Success;
+}
+
+mips_error mips_mem_read(
+                         mips_mem_h mem,		//!< Handle to target memory
+                         uint32_t address,	//!< Byte address to start transaction at
+                         uint32_t length,	//!< Number of bytes to transfer
+                         uint8_t *dataOut	//!< Receives the target bytes
+)
+{
+    mips_error err=mips_mem_check(mem, address, length);
+    if(err!=mips_Success){
+        return err;
+    }
+    return mem->ops->read(mem, address, length, dataOut);
+}
+
+mips_error mips_mem_write(
+                          mips_mem_h mem,	//! Handle to target memory
+                          uint32_t address,		//! Byte address to start transaction at
+                          uint32_t length,			//! Number of bytes to transfer
+                          const uint8_t *dataIn	//! Receives the target bytes
+)
+{
+    mips_error err=mips_mem_check(mem, address, length);
+    if(err!=mips_Success){
+        return err;
+    }
+    err=mem->ops->write(mem, address, length, dataIn);
+    if(err==mips_Success){
+        mips_mem_mark_dirty(mem, address, length);
+    }
+    return err;
+}
+
+mips_error mips_mem_read32(
+                           mips_mem_h mem,	//! Handle to target memory
+                           uint32_t address,	//! Byte address of the word, multiple of 4
+                           uint32_t *value	//! Receives the word
+)
+{
+    uint32_t raw;
+    mips_error err=mips_mem_read(mem, address, 4, (uint8_t*)&raw);
+    if(err!=mips_Success){
+        return err;
+    }
+    *value=mips_mem_swap32(raw);
+    return mips_Success;
+}
+
+mips_error mips_mem_read16(
+                           mips_mem_h mem,	//! Handle to target memory
+                           uint32_t address,	//! Byte address of the half word, multiple of 2
+                           uint16_t *value	//! Receives the half word
+)
+{
+    uint16_t raw;
+    mips_error err=mips_mem_read(mem, address, 2, (uint8_t*)&raw);
+    if(err!=mips_Success){
+        return err;
+    }
+    *value=mips_mem_swap16(raw);
+    return mips_Success;
+}
+
+mips_error mips_mem_write32(
+                            mips_mem_h mem,	//! Handle to target memory
+                            uint32_t address,	//! Byte address of the word, multiple of 4
+                            uint32_t value	//! Word to store
+)
+{
+    uint32_t raw=mips_mem_swap32(value);
+    return mips_mem_write(mem, address, 4, (const uint8_t*)&raw);
+}
+
+mips_error mips_mem_write16(
+                            mips_mem_h mem,	//! Handle to target memory
+                            uint32_t address,	//! Byte address of the half word, multiple of 2
+                            uint16_t value	//! Half word to store
+)
+{
+    uint16_t raw=mips_mem_swap16(value);
+    return mips_mem_write(mem, address, 2, (const uint8_t*)&raw);
+}
+
+mips_error mips_mem_compare_swap32(
+                                   mips_mem_h mem,	//! Handle to target memory
+                                   uint32_t address,	//! Byte address of the word, multiple of 4
+                                   uint32_t expected,	//! Value the word has to hold
+                                   uint32_t desired,	//! Value to store if it does
+                                   unsigned *swapped	//! Receives 1 if the word was stored, 0 otherwise
+)
+{
+    mips_error err=mips_mem_check(mem, address, 4);
+    if(err!=mips_Success){
+        return err;
+    }
+    err=mem->ops->compare_swap32(mem, address, mips_mem_swap32(expected), mips_mem_swap32(desired), swapped);
+    if((err==mips_Success) && *swapped){
+        mips_mem_mark_dirty(mem, address, 4);
+    }
+    return err;
+}
+
+mips_error mips_mem_read_block(
+                               mips_mem_h mem,	//! Handle to target memory
+                               uint32_t address,	//! Byte address to start at
+                               uint32_t length,	//! Number of bytes to copy
+                               uint8_t *dataOut	//! Receives the bytes
+)
+{
+    if(mem==0){
+        return mips_ErrorInvalidHandle;
+    }
+    return mem->ops->read(mem, address, length, dataOut);
+}
+
+mips_error mips_mem_write_block(
+                                mips_mem_h mem,	//! Handle to target memory
+                                uint32_t address,	//! Byte address to start at
+                                uint32_t length,	//! Number of bytes to copy
+                                const uint8_t *dataIn	//! Bytes to copy
+)
+{
+    if(mem==0){
+        return mips_ErrorInvalidHandle;
+    }
+    mips_error err=mem->ops->write(mem, address, length, dataIn);
+    if(err==mips_Success){
+        mips_mem_mark_dirty(mem, address, length);
+    }
+    return err;
+}
+
+mips_error mips_mem_get_ram(
+                            mips_mem_h mem,	//! Handle to target memory
+                            const uint8_t **data,	//! Receives the first byte of the RAM
+                            uint32_t *length	//! Receives the size of the RAM
+)
+{
+    if(mem==0){
+        return mips_ErrorInvalidHandle;
+    }
+    if(mem->ops->get_ram==0){
+        return mips_ErrorNotImplemented;
+    }
+    return mem->ops->get_ram(mem, data, length);
+}
+
+mips_error mips_mem_map_page(
+                             mips_mem_h mem,	//! Handle to target memory
+                             uint32_t address,	//! Any byte address inside the page
+                             unsigned write,	//! Non-zero if the page will be written
+                             uint8_t **page	//! Receives the first byte of the page
+)
+{
+    if(mem==0){
+        return mips_ErrorInvalidHandle;
+    }
+    mips_error err=mem->ops->map_page(mem, address, write, page);
+    if((err==mips_Success) && write){
+        // Nothing written through the page is seen here, so it counts as written from now on
+        mips_mem_mark_dirty(mem, address, 1);
+    }
+    return err;
+}
+
+mips_error mips_mem_is_device(
+                              mips_mem_h mem,	//! Handle to target memory
+                              uint32_t address,	//! Byte address that is read
+                              unsigned *device	//! Receives non-zero for a device
+)
+{
+    if(mem==0){
+        return mips_ErrorInvalidHandle;
+    }
+    if(device==0){
+        return mips_ErrorInvalidArgument;
+    }
+    *device=0;
+    if(mem->ops->is_device==0){
+        return mips_Success;
+    }
+    return mem->ops->is_device(mem, address, device);
+}
+
+mips_error mips_mem_watch_code(
+                               mips_mem_h mem,	//! Handle to target memory
+                               uint32_t address	//! Byte address of a cached instruction
+)
+{
+    if(mem==0){
+        return mips_ErrorInvalidHandle;
+    }
+    return mem->ops->watch_code(mem, address);
+}
+
+mips_error mips_mem_get_code_generation(
+                                        mips_mem_h mem,	//! Handle to target memory
+                                        uint32_t *generation	//! Where to write the generation to
+)
+{
+    if(mem==0){
+        return mips_ErrorInvalidHandle;
+    }
+    mips_error err=mem->ops->get_code_generation(mem, generation);
+    mips_mem_track *track=__atomic_load_n(&mem->track, __ATOMIC_ACQUIRE);
+    if(track){
+        *generation+=__atomic_load_n(&track->generation_bias, __ATOMIC_SEQ_CST);
+    }
+    return err;
+}
+
+mips_error mips_mem_get_resident_pages(
+                                       mips_mem_h mem,	//! Handle to target memory
+                                       uint32_t *pages	//! Where to write the page count to
+)
+{
+    if(mem==0){
+        return mips_ErrorInvalidHandle;
+    }
+    return mem->ops->get_resident_pages(mem, pages);
+}
+
+void mips_mem_free(mips_mem_h mem)
+{
+    if(mem){
+        mips_mem_track_free(mem);
+        mem->ops->free(mem);
+    }
+}
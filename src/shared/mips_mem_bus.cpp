@@ -0,0 +1,425 @@
+/* This file is an implementation of the bus functions
+ defined in mips_mem.h. A bus is a provider that holds
+ other memories and devices in regions of its address
+ space, and forwards every access to the region it falls
+ in, at the offset into that region.
+
+ The regions are kept sorted by base address and found
+ with a binary search. They start and end on page
+ boundaries, so a page belongs to exactly one region:
+ pages of memory regions are handed out with map_page
+ as the memory behind them hands them out, and the CPU
+ then never comes back to the bus for them.
+ */
+#include "mips_mem_provider.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct mips_mem_bus_region
+{
+    uint32_t base;
+    uint64_t end;               // One past the last address, up to 2^32
+    mips_mem_h target;          // 0 for a device
+    unsigned read_only;
+    mips_mem_device device;
+    uint64_t reads;             // Counted with relaxed atomics, CPUs may share the bus
+    uint64_t writes;
+    uint64_t mapped;
+};
+
+struct mips_mem_bus
+{
+    mips_mem_provider base;
+    mips_mem_bus_region *regions;   // Sorted by base, none overlap
+    uint32_t count;
+};
+
+static mips_mem_bus *mips_mem_as_bus(mips_mem_h mem)
+{
+    return (mips_mem_bus*)mem;
+}
+
+// Returns the region holding address, or 0 if it is in none
+static mips_mem_bus_region *mips_mem_bus_find(mips_mem_bus *bus, uint32_t address)
+{
+    uint32_t low=0, high=bus->count;
+    while(low<high){
+        uint32_t middle=(low+high)/2;
+        if(bus->regions[middle].base<=address){
+            low=middle+1;
+        }else{
+            high=middle;
+        }
+    }
+    if(low==0){
+        return 0;
+    }
+    mips_mem_bus_region *region=&bus->regions[low-1];
+    return (address < region->end) ? region : 0;
+}
+
+static void mips_mem_bus_count(uint64_t *counter)
+{
+    __atomic_add_fetch(counter, 1, __ATOMIC_RELAXED);
+}
+
+// Splits a transaction at the region boundaries, so each part is answered by one region
+static mips_error mips_mem_bus_read(
+                                    mips_mem_h mem,
+                                    uint32_t address,
+                                    uint32_t length,
+                                    uint8_t *dataOut
+                                    )
+{
+    mips_mem_bus *bus=mips_mem_as_bus(mem);
+    while(length>0){
+        mips_mem_bus_region *region=mips_mem_bus_find(bus, address);
+        if(region==0){
+            return mips_ExceptionInvalidAddress;
+        }
+        uint32_t part=(region->end - address < length) ? uint32_t(region->end - address) : length;
+        uint32_t offset=address - region->base;
+        mips_error err;
+        if(region->target){
+            err=mips_mem_read_block(region->target, offset, part, dataOut);
+        }else if(region->device.read){
+            err=region->device.read(region->device.context, offset, part, dataOut);
+        }else{
+            err=mips_ExceptionAccessViolation;
+        }
+        if(err!=mips_Success){
+            return err;
+        }
+        mips_mem_bus_count(&region->reads);
+        address+=part;
+        length-=part;
+        dataOut+=part;
+    }
+    return mips_Success;
+}
+
+static mips_error mips_mem_bus_write(
+                                     mips_mem_h mem,
+                                     uint32_t address,
+                                     uint32_t length,
+                                     const uint8_t *dataIn
+                                     )
+{
+    mips_mem_bus *bus=mips_mem_as_bus(mem);
+    while(length>0){
+        mips_mem_bus_region *region=mips_mem_bus_find(bus, address);
+        if(region==0){
+            return mips_ExceptionInvalidAddress;
+        }
+        uint32_t part=(region->end - address < length) ? uint32_t(region->end - address) : length;
+        uint32_t offset=address - region->base;
+        mips_error err;
+        if(region->target && !region->read_only){
+            err=mips_mem_write_block(region->target, offset, part, dataIn);
+        }else if(!region->target && region->device.write){
+            err=region->device.write(region->device.context, offset, part, dataIn);
+        }else{
+            err=mips_ExceptionAccessViolation;
+        }
+        if(err!=mips_Success){
+            return err;
+        }
+        mips_mem_bus_count(&region->writes);
+        address+=part;
+        length-=part;
+        dataIn+=part;
+    }
+    return mips_Success;
+}
+
+// A device only has reads and writes, so the swap is only atomic for memories
+static mips_error mips_mem_bus_compare_swap32(
+                                              mips_mem_h mem,
+                                              uint32_t address,
+                                              uint32_t expected,
+                                              uint32_t desired,
+                                              unsigned *swapped
+                                              )
+{
+    mips_mem_bus_region *region=mips_mem_bus_find(mips_mem_as_bus(mem), address);
+    if(region==0){
+        return mips_ExceptionInvalidAddress;
+    }
+    if(region->read_only){
+        return mips_ExceptionAccessViolation;
+    }
+    if(region->target){
+        mips_mem_bus_count(&region->writes);
+        return mips_mem_compare_swap32(region->target, address - region->base, mips_mem_swap32(expected), mips_mem_swap32(desired), swapped);
+    }
+
+    uint32_t current;
+    mips_error err=mips_mem_bus_read(mem, address, 4, (uint8_t*)&current);
+    *swapped=0;
+    if((err!=mips_Success) || (current!=expected)){
+        return err;
+    }
+    err=mips_mem_bus_write(mem, address, 4, (const uint8_t*)&desired);
+    *swapped=(err==mips_Success) ? 1 : 0;
+    return err;
+}
+
+static mips_error mips_mem_bus_map_page(
+                                        mips_mem_h mem,
+                                        uint32_t address,
+                                        unsigned write,
+                                        uint8_t **page
+                                        )
+{
+    mips_mem_bus_region *region=mips_mem_bus_find(mips_mem_as_bus(mem), address);
+    if(region==0){
+        return mips_ExceptionInvalidAddress;
+    }
+    if((region->target==0) || (write && region->read_only)){
+        return mips_ErrorNotImplemented; // Every access has to be seen by the bus
+    }
+    mips_error err=mips_mem_map_page(region->target, address - region->base, write, page);
+    if(err==mips_Success){
+        mips_mem_bus_count(&region->mapped);
+    }
+    return err;
+}
+
+static mips_error mips_mem_bus_watch_code(
+                                          mips_mem_h mem,
+                                          uint32_t address
+                                          )
+{
+    mips_mem_bus_region *region=mips_mem_bus_find(mips_mem_as_bus(mem), address);
+    if(region==0){
+        return mips_ExceptionInvalidAddress;
+    }
+    if(region->target==0){
+        return mips_ExceptionAccessViolation; // Code is not run from devices
+    }
+    return mips_mem_watch_code(region->target, address - region->base);
+}
+
+// The sum changes whenever the generation of any of the memories does
+static mips_error mips_mem_bus_get_code_generation(
+                                                   mips_mem_h mem,
+                                                   uint32_t *generation
+                                                   )
+{
+    mips_mem_bus *bus=mips_mem_as_bus(mem);
+    uint32_t sum=0;
+    for(uint32_t i=0; i<bus->count; i++){
+        uint32_t part=0;
+        if(bus->regions[i].target){
+            mips_error err=mips_mem_get_code_generation(bus->regions[i].target, &part);
+            if(err!=mips_Success){
+                return err;
+            }
+        }
+        sum+=part;
+    }
+    *generation=sum;
+    return mips_Success;
+}
+
+static mips_error mips_mem_bus_get_resident_pages(
+                                                  mips_mem_h mem,
+                                                  uint32_t *pages
+                                                  )
+{
+    mips_mem_bus *bus=mips_mem_as_bus(mem);
+    uint32_t sum=0;
+    for(uint32_t i=0; i<bus->count; i++){
+        uint32_t part=0;
+        if(bus->regions[i].target){
+            mips_mem_get_resident_pages(bus->regions[i].target, &part);
+        }
+        sum+=part;
+    }
+    *pages=sum;
+    return mips_Success;
+}
+
+static mips_error mips_mem_bus_is_device(
+                                         mips_mem_h mem,
+                                         uint32_t address,
+                                         unsigned *device
+                                         )
+{
+    mips_mem_bus_region *region=mips_mem_bus_find(mips_mem_as_bus(mem), address);
+    *device=((region!=0) && (region->target==0)) ? 1 : 0;
+    return mips_Success;
+}
+
+struct mips_mem_bus_visit
+{
+    void (*visit)(void *context, uint32_t address);
+    void *context;
+    const mips_mem_bus_region *region;
+};
+
+static void mips_mem_bus_visit_target(void *context, uint32_t address)
+{
+    mips_mem_bus_visit *v=(mips_mem_bus_visit*)context;
+    if(address < v->region->end - v->region->base){
+        v->visit(v->context, v->region->base + address);
+    }
+}
+
+// Devices and ROMs never change by being written, so only the pages of writable memories are reported
+static mips_error mips_mem_bus_each_page(
+                                         mips_mem_h mem,
+                                         void (*visit)(void *context, uint32_t address),
+                                         void *context
+                                         )
+{
+    mips_mem_bus *bus=mips_mem_as_bus(mem);
+    for(uint32_t i=0; i<bus->count; i++){
+        if((bus->regions[i].target==0) || bus->regions[i].read_only){
+            continue;
+        }
+        mips_mem_bus_visit v={visit, context, &bus->regions[i]};
+        mips_error err=bus->regions[i].target->ops->each_page(bus->regions[i].target, mips_mem_bus_visit_target, &v);
+        if(err!=mips_Success){
+            return err;
+        }
+    }
+    return mips_Success;
+}
+
+static void mips_mem_bus_free(mips_mem_h mem)
+{
+    mips_mem_bus *bus=mips_mem_as_bus(mem);
+    free(bus->regions);
+    free(bus);
+}
+
+static const mips_mem_ops mips_mem_bus_ops = {
+    mips_mem_bus_read,
+    mips_mem_bus_write,
+    mips_mem_bus_compare_swap32,
+    mips_mem_bus_map_page,
+    0,  // Not one flat block of storage
+    mips_mem_bus_watch_code,
+    mips_mem_bus_get_code_generation,
+    mips_mem_bus_get_resident_pages,
+    mips_mem_bus_is_device,
+    mips_mem_bus_each_page,
+    mips_mem_bus_free
+};
+
+extern "C" mips_mem_h mips_mem_create_bus()
+{
+    struct mips_mem_bus *mem=(struct mips_mem_bus*)calloc(1, sizeof(struct mips_mem_bus));
+    if(mem==0)
+        return 0;
+
+    mem->base.ops=&mips_mem_bus_ops;
+    mem->base.track=0;
+
+    return &mem->base;
+}
+
+// Inserts a region in order, after checking it is page aligned and overlaps nothing
+static mips_error mips_mem_bus_add(
+                                   mips_mem_h mem,
+                                   const mips_mem_bus_region &region
+                                   )
+{
+    if((mem==0) || (mem->ops!=&mips_mem_bus_ops)){
+        return mips_ErrorInvalidHandle;
+    }
+    mips_mem_bus *bus=mips_mem_as_bus(mem);
+    if((region.end==region.base) || (region.base % MIPS_MEM_PAGE) || (region.end % MIPS_MEM_PAGE)){
+        return mips_ErrorInvalidArgument;
+    }
+    uint32_t at=0;
+    while((at<bus->count) && (bus->regions[at].base<region.base)){
+        at++;
+    }
+    if( ((at>0) && (bus->regions[at-1].end>region.base)) || ((at<bus->count) && (region.end>bus->regions[at].base)) ){
+        return mips_ErrorInvalidArgument;
+    }
+
+    mips_mem_bus_region *grown=(mips_mem_bus_region*)realloc(bus->regions, (bus->count+1)*sizeof(mips_mem_bus_region));
+    if(grown==0){
+        return mips_InternalError;
+    }
+    memmove(grown+at+1, grown+at, (bus->count-at)*sizeof(mips_mem_bus_region));
+    grown[at]=region;
+    bus->regions=grown;
+    bus->count++;
+    return mips_Success;
+}
+
+extern "C" mips_error mips_mem_bus_add_memory(
+                                              mips_mem_h bus,
+                                              uint32_t base,
+                                              uint32_t length,
+                                              mips_mem_h target,
+                                              unsigned readOnly
+                                              )
+{
+    if(target==0){
+        return mips_ErrorInvalidHandle;
+    }
+    mips_mem_bus_region region;
+    memset(&region, 0, sizeof(region));
+    region.base=base;
+    region.end=uint64_t(base)+length;
+    region.target=target;
+    region.read_only=readOnly ? 1 : 0;
+    if(region.end>(uint64_t(1)<<32)){
+        return mips_ErrorInvalidArgument;
+    }
+    return mips_mem_bus_add(bus, region);
+}
+
+extern "C" mips_error mips_mem_bus_add_device(
+                                              mips_mem_h bus,
+                                              uint32_t base,
+                                              uint32_t length,
+                                              const mips_mem_device *device
+                                              )
+{
+    if(device==0){
+        return mips_ErrorInvalidArgument;
+    }
+    mips_mem_bus_region region;
+    memset(&region, 0, sizeof(region));
+    region.base=base;
+    region.end=uint64_t(base)+length;
+    region.device=*device;
+    if(region.end>(uint64_t(1)<<32)){
+        return mips_ErrorInvalidArgument;
+    }
+    return mips_mem_bus_add(bus, region);
+}
+
+extern "C" mips_error mips_mem_bus_get_counters(
+                                                mips_mem_h mem,
+                                                uint32_t address,
+                                                uint64_t *reads,
+                                                uint64_t *writes,
+                                                uint64_t *mapped
+                                                )
+{
+    if((mem==0) || (mem->ops!=&mips_mem_bus_ops)){
+        return mips_ErrorInvalidHandle;
+    }
+    mips_mem_bus_region *region=mips_mem_bus_find(mips_mem_as_bus(mem), address);
+    if(region==0){
+        return mips_ExceptionInvalidAddress;
+    }
+    if(reads){
+        *reads=__atomic_load_n(&region->reads, __ATOMIC_RELAXED);
+    }
+    if(writes){
+        *writes=__atomic_load_n(&region->writes, __ATOMIC_RELAXED);
+    }
+    if(mapped){
+        *mapped=__atomic_load_n(&region->mapped, __ATOMIC_RELAXED);
+    }
+    return mips_Success;
+}
@@ -0,0 +1,119 @@
+/* This file is shared by the memory providers. It describes what a
+ provider has to implement so that the functions defined in mips_mem.h
+ can be forwarded to it, whichever kind of memory is behind the handle.
+ 
+ Every provider starts its own structure with a mips_mem_provider, and
+ fills in ops with functions that can assume the handle is valid. The
+ public functions check the handle and the transaction sizes, and do
+ the big-endian conversions, before calling through ops.
+ */
+#ifndef mips_mem_provider_header
+#define mips_mem_provider_header
+
+#include "mips_mem.h"
+
+#include <stdint.h>
+#include <string.h>
+
+struct mips_mem_ops
+{
+    // Any length and alignment, the provider checks the address range
+    mips_error (*read)(mips_mem_h mem, uint32_t address, uint32_t length, uint8_t *dataOut);
+    mips_error (*write)(mips_mem_h mem, uint32_t address, uint32_t length, const uint8_t *dataIn);
+    // Address is aligned, expected and desired are in memory (big-endian) order
+    mips_error (*compare_swap32)(mips_mem_h mem, uint32_t address, uint32_t expected, uint32_t desired, unsigned *swapped);
+    mips_error (*map_page)(mips_mem_h mem, uint32_t address, unsigned write, uint8_t **page);
+    mips_error (*get_ram)(mips_mem_h mem, const uint8_t **data, uint32_t *length);     // 0 if not a flat RAM
+    mips_error (*watch_code)(mips_mem_h mem, uint32_t address);
+    mips_error (*get_code_generation)(mips_mem_h mem, uint32_t *generation);
+    mips_error (*get_resident_pages)(mips_mem_h mem, uint32_t *pages);
+    mips_error (*is_device)(mips_mem_h mem, uint32_t address, unsigned *device);        // 0 if nothing is a device
+    // Calls visit with the address of every page that holds storage, used once when snapshots start
+    mips_error (*each_page)(mips_mem_h mem, void (*visit)(void *context, uint32_t address), void *context);
+    void (*free)(mips_mem_h mem);
+};
+
+/* Once a snapshot is taken or restored, the memory keeps track of the pages
+ written since, so that the next snapshot or restore only has to look at
+ those. Writes are seen by the public functions in mips_mem.cpp, and a page
+ handed out for writing by map_page is marked when it is handed out. The
+ marks are cleared by the next snapshot or restore, which also changes the
+ code generation, so every CPU has to map its pages (and mark them) again.
+ */
+#define MIPS_MEM_PAGES (uint32_t((uint64_t(1) << 32) / MIPS_MEM_PAGE))
+
+struct mips_mem_track
+{
+    uint64_t dirty[MIPS_MEM_PAGES/64];  // One bit per page written since the last snapshot or restore
+    mips_mem_snapshot_h base;           // What the memory held then, 0 if it was never snapshotted (all zero)
+    uint32_t generation_bias;           // Added to the code generation of the provider
+};
+
+struct mips_mem_provider
+{
+    const mips_mem_ops *ops;
+    mips_mem_track *track;      // 0 until snapshots are used, set by the provider when it is created
+};
+
+// Marks the pages of [address, address+length) as written, if anyone is tracking them
+static inline void mips_mem_mark_dirty(mips_mem_h mem, uint32_t address, uint32_t length)
+{
+    mips_mem_track *track=__atomic_load_n(&mem->track, __ATOMIC_ACQUIRE);
+    if((track==0) || (length==0)){
+        return;
+    }
+    uint64_t end=uint64_t(address)+length-1;
+    uint32_t last=(end > 0xFFFFFFFF) ? (MIPS_MEM_PAGES-1) : uint32_t(end/MIPS_MEM_PAGE);
+    for(uint32_t page=address/MIPS_MEM_PAGE; page<=last; page++){
+        __atomic_fetch_or(&track->dirty[page/64], uint64_t(1) << (page%64), __ATOMIC_RELAXED);
+    }
+}
+
+// Releases what tracking holds, called when the memory is freed (see mips_mem_snapshot.cpp)
+void mips_mem_track_free(mips_mem_h mem);
+
+// MIPS is big-endian, the host running the simulator is little-endian
+#if defined(__GNUC__)
+#define mips_mem_swap32(v) __builtin_bswap32(v)
+#define mips_mem_swap16(v) __builtin_bswap16(v)
+#else
+#define mips_mem_swap32(v) uint32_t(((v)<<24) | (((v)<<8)&0x00FF0000) | (((v)>>8)&0x0000FF00) | ((v)>>24))
+#define mips_mem_swap16(v) uint16_t(((v)<<8) | ((v)>>8))
+#endif
+
+// Several CPUs may share a memory from different threads, so aligned words,
+// half words and bytes are copied with single atomic accesses. Nothing is
+// ordered by these (relaxed), only compare_swap32 is a full barrier
+static inline void mips_mem_copy_out(uint8_t *dataOut, const uint8_t *src, uint32_t length)
+{
+    if((length==4) && ((uintptr_t(src) & 3)==0)){
+        uint32_t v=__atomic_load_n((const uint32_t*)src, __ATOMIC_RELAXED);
+        memcpy(dataOut, &v, 4);
+    }else if((length==2) && ((uintptr_t(src) & 1)==0)){
+        uint16_t v=__atomic_load_n((const uint16_t*)src, __ATOMIC_RELAXED);
+        memcpy(dataOut, &v, 2);
+    }else if(length==1){
+        *dataOut=__atomic_load_n(src, __ATOMIC_RELAXED);
+    }else{
+        memcpy(dataOut, src, length);
+    }
+}
+
+static inline void mips_mem_copy_in(uint8_t *dst, const uint8_t *dataIn, uint32_t length)
+{
+    if((length==4) && ((uintptr_t(dst) & 3)==0)){
+        uint32_t v;
+        memcpy(&v, dataIn, 4);
+        __atomic_store_n((uint32_t*)dst, v, __ATOMIC_RELAXED);
+    }else if((length==2) && ((uintptr_t(dst) & 1)==0)){
+        uint16_t v;
+        memcpy(&v, dataIn, 2);
+        __atomic_store_n((uint16_t*)dst, v, __ATOMIC_RELAXED);
+    }else if(length==1){
+        __atomic_store_n(dst, *dataIn, __ATOMIC_RELAXED);
+    }else{
+        memcpy(dst, dataIn, length);
+    }
+}
+
+#endif
@@ -3,16 +3,302 @@
  linked against something which needs an implementation
  of a RAM device following that memory mapping
  interface.
+ 
+ The storage is either allocated (mips_mem_create_ram)
+ or a private mapping of an image file (mips_mem_create_file),
+ in which case it starts at a chosen address.
  */
-#include "mips_mem.h"
+#include "mips_mem_provider.hpp"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-struct mips_mem_provider
+struct mips_mem_ram
 {
+    mips_mem_provider base;
+    uint32_t origin;            // Address of the first byte of data
     uint32_t length;
     uint8_t *data;
+    bool mapped;                // data comes from mmap rather than malloc
+    uint8_t *code;              // One bit per MIPS_MEM_CODE_LINE, allocated on first watch
+    uint8_t *lent;              // One bit per MIPS_MEM_PAGE handed out for writing, allocated on first use
+    uint32_t code_generation;   // Bumped on every write to a watched line
+};
+
+/* Several CPUs may use the RAM from different threads. The bitmaps and the
+ generation are only changed with atomic operations, and a write always
+ stores its data before looking for watched lines, while a watch marks its
+ line before the CPU reads the instruction. So either the write sees the
+ line watched and bumps the generation, or the CPU reads what was written.
+ */
+
+static mips_mem_ram *mips_mem_as_ram(mips_mem_h mem)
+{
+    return (mips_mem_ram*)mem;
+}
+
+// Returns the bitmap in slot, allocating it with bits bits if it does not exist yet
+static uint8_t *mips_mem_bitmap(uint8_t **slot, uint32_t bits)
+{
+    uint8_t *bitmap=__atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    if(bitmap==0){
+        uint8_t *fresh=(uint8_t*)calloc((bits+7)/8, 1);
+        if(fresh==0){
+            return 0;
+        }
+        if(__atomic_compare_exchange_n(slot, &bitmap, fresh, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+            bitmap=fresh;
+        }else{
+            free(fresh); // Another thread got there first
+        }
+    }
+    return bitmap;
+}
+
+static bool mips_mem_bit_test(const uint8_t *bitmap, uint32_t bit)
+{
+    return (__atomic_load_n(&bitmap[bit/8], __ATOMIC_SEQ_CST) & (1<<(bit%8))) != 0;
+}
+
+// Sets or clears a bit, returns whether it was set before
+static bool mips_mem_bit_set(uint8_t *bitmap, uint32_t bit)
+{
+    return (__atomic_fetch_or(&bitmap[bit/8], uint8_t(1<<(bit%8)), __ATOMIC_SEQ_CST) & (1<<(bit%8))) != 0;
+}
+
+static bool mips_mem_bit_clear(uint8_t *bitmap, uint32_t bit)
+{
+    return (__atomic_fetch_and(&bitmap[bit/8], uint8_t(~(1<<(bit%8))), __ATOMIC_SEQ_CST) & (1<<(bit%8))) != 0;
+}
+
+// Checks that [address, address+length) lies inside the RAM, address is relative to origin
+static bool mips_mem_in_range(mips_mem_ram *ram, uint32_t address, uint32_t length)
+{
+    return (address <= ram->length) && (length <= (ram->length - address));
+}
+
+// Stops watching the lines in [address, address+length) and bumps the generation if any were watched,
+// called after the data has been written
+static void mips_mem_touch_code(mips_mem_ram *ram, uint32_t address, uint32_t length)
+{
+    uint8_t *code=__atomic_load_n(&ram->code, __ATOMIC_ACQUIRE);
+    if((code==0) || (length==0)){
+        return;
+    }
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    uint32_t last=(address+length-1)/MIPS_MEM_CODE_LINE;
+    for(uint32_t line=address/MIPS_MEM_CODE_LINE; line<=last; line++){
+        if(mips_mem_bit_test(code, line) && mips_mem_bit_clear(code, line)){
+            __atomic_add_fetch(&ram->code_generation, 1, __ATOMIC_SEQ_CST);
+        }
+    }
+}
+
+static mips_error mips_mem_ram_read(
+                                    mips_mem_h mem,
+                                    uint32_t address,
+                                    uint32_t length,
+                                    uint8_t *dataOut
+                                    )
+{
+    mips_mem_ram *ram=mips_mem_as_ram(mem);
+    address-=ram->origin;
+    if(!mips_mem_in_range(ram, address, length)){
+        return mips_ExceptionInvalidAddress;
+    }
+    
+    mips_mem_copy_out(dataOut, ram->data+address, length);
+    return mips_Success;
+}
+
+static mips_error mips_mem_ram_write(
+                                     mips_mem_h mem,
+                                     uint32_t address,
+                                     uint32_t length,
+                                     const uint8_t *dataIn
+                                     )
+{
+    mips_mem_ram *ram=mips_mem_as_ram(mem);
+    address-=ram->origin;
+    if(!mips_mem_in_range(ram, address, length)){
+        return mips_ExceptionInvalidAddress;
+    }
+    
+    mips_mem_copy_in(ram->data+address, dataIn, length);
+    mips_mem_touch_code(ram, address, length);
+    return mips_Success;
+}
+
+static mips_error mips_mem_ram_compare_swap32(
+                                              mips_mem_h mem,
+                                              uint32_t address,
+                                              uint32_t expected,
+                                              uint32_t desired,
+                                              unsigned *swapped
+                                              )
+{
+    mips_mem_ram *ram=mips_mem_as_ram(mem);
+    address-=ram->origin;
+    if(!mips_mem_in_range(ram, address, 4)){
+        return mips_ExceptionInvalidAddress;
+    }
+    
+    bool stored=__atomic_compare_exchange_n((uint32_t*)(ram->data+address), &expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    if(stored){
+        mips_mem_touch_code(ram, address, 4);
+    }
+    *swapped=stored ? 1 : 0;
+    return mips_Success;
+}
+
+static mips_error mips_mem_ram_map_page(
+                                        mips_mem_h mem,
+                                        uint32_t address,
+                                        unsigned write,
+                                        uint8_t **page
+                                        )
+{
+    mips_mem_ram *ram=mips_mem_as_ram(mem);
+    address-=ram->origin;
+    if(address >= ram->length){
+        return mips_ExceptionInvalidAddress;
+    }
+    
+    uint32_t start=address - (address % MIPS_MEM_PAGE);
+    if(!mips_mem_in_range(ram, start, MIPS_MEM_PAGE)){
+        return mips_ErrorNotImplemented; // Partial page at the end of the RAM
+    }
+    if(write){
+        // Lend the page before looking for code, so a watch started meanwhile sees it lent
+        uint8_t *lent=mips_mem_bitmap(&ram->lent, (ram->length+MIPS_MEM_PAGE-1)/MIPS_MEM_PAGE);
+        if(lent==0){
+            return mips_InternalError;
+        }
+        mips_mem_bit_set(lent, start/MIPS_MEM_PAGE);
+        
+        uint8_t *code=__atomic_load_n(&ram->code, __ATOMIC_ACQUIRE);
+        if(code){
+            for(uint32_t line=start/MIPS_MEM_CODE_LINE; line<(start+MIPS_MEM_PAGE)/MIPS_MEM_CODE_LINE; line++){
+                if(mips_mem_bit_test(code, line)){
+                    return mips_ErrorNotImplemented; // Writes have to be seen by mips_mem_touch_code
+                }
+            }
+        }
+    }
+    
+    *page=ram->data+start;
+    return mips_Success;
+}
+
+static mips_error mips_mem_ram_get_ram(
+                                       mips_mem_h mem,
+                                       const uint8_t **data,
+                                       uint32_t *length
+                                       )
+{
+    mips_mem_ram *ram=mips_mem_as_ram(mem);
+    if(ram->origin!=0){
+        return mips_ErrorNotImplemented; // data would not start at address 0
+    }
+    *data=ram->data;
+    *length=ram->length;
+    return mips_Success;
+}
+
+static mips_error mips_mem_ram_watch_code(
+                                          mips_mem_h mem,
+                                          uint32_t address
+                                          )
+{
+    mips_mem_ram *ram=mips_mem_as_ram(mem);
+    address-=ram->origin;
+    if(address >= ram->length){
+        return mips_ExceptionInvalidAddress;
+    }
+    
+    uint8_t *code=mips_mem_bitmap(&ram->code, (ram->length+MIPS_MEM_CODE_LINE-1)/MIPS_MEM_CODE_LINE);
+    if(code==0){
+        return mips_InternalError;
+    }
+    
+    if(!mips_mem_bit_set(code, address/MIPS_MEM_CODE_LINE)){
+        // A CPU may be writing this page directly, make every CPU map it again
+        uint8_t *lent=__atomic_load_n(&ram->lent, __ATOMIC_ACQUIRE);
+        if(lent && mips_mem_bit_test(lent, address/MIPS_MEM_PAGE) && mips_mem_bit_clear(lent, address/MIPS_MEM_PAGE)){
+            __atomic_add_fetch(&ram->code_generation, 1, __ATOMIC_SEQ_CST);
+        }
+    }
+    return mips_Success;
+}
+
+static mips_error mips_mem_ram_get_code_generation(
+                                                   mips_mem_h mem,
+                                                   uint32_t *generation
+                                                   )
+{
+    *generation=__atomic_load_n(&mips_mem_as_ram(mem)->code_generation, __ATOMIC_SEQ_CST);
+    return mips_Success;
+}
+
+static mips_error mips_mem_ram_get_resident_pages(
+                                                  mips_mem_h mem,
+                                                  uint32_t *pages
+                                                  )
+{
+    mips_mem_ram *ram=mips_mem_as_ram(mem);
+    *pages=(ram->length/MIPS_MEM_PAGE) + ((ram->length % MIPS_MEM_PAGE) ? 1 : 0);
+    return mips_Success;
+}
+
+static mips_error mips_mem_ram_each_page(
+                                         mips_mem_h mem,
+                                         void (*visit)(void *context, uint32_t address),
+                                         void *context
+                                         )
+{
+    mips_mem_ram *ram=mips_mem_as_ram(mem);
+    for(uint32_t offset=0; offset<ram->length; offset+=MIPS_MEM_PAGE){
+        visit(context, ram->origin+offset);
+        if(ram->length-offset <= MIPS_MEM_PAGE){
+            break; // The next offset would wrap around
+        }
+    }
+    return mips_Success;
+}
+
+static void mips_mem_ram_free(mips_mem_h mem)
+{
+    mips_mem_ram *ram=mips_mem_as_ram(mem);
+    free(ram->code);
+    ram->code=0;
+    free(ram->lent);
+    ram->lent=0;
+    if(ram->mapped){
+        munmap(ram->data, ram->length);
+    }else{
+        free(ram->data);
+    }
+    ram->data=0;
+    free(ram);
+}
+
+static const mips_mem_ops mips_mem_ram_ops = {
+    mips_mem_ram_read,
+    mips_mem_ram_write,
+    mips_mem_ram_compare_swap32,
+    mips_mem_ram_map_page,
+    mips_mem_ram_get_ram,
+    mips_mem_ram_watch_code,
+    mips_mem_ram_get_code_generation,
+    mips_mem_ram_get_resident_pages,
+    0,  // Only storage, never a device
+    mips_mem_ram_each_page,
+    mips_mem_ram_free
 };
 
 extern "C" mips_mem_h mips_mem_create_ram(
@@ -26,90 +312,84 @@ extern "C" mips_mem_h mips_mem_create_ram(
     if(data==0)
         return 0;
     
-    struct mips_mem_provider *mem=(struct mips_mem_provider*)malloc(sizeof(struct mips_mem_provider));
+    struct mips_mem_ram *mem=(struct mips_mem_ram*)malloc(sizeof(struct mips_mem_ram));
     if(mem==0){
         free(data);
         return 0;
     }
     
+    mem->base.ops=&mips_mem_ram_ops;
+    mem->base.track=0;
+    mem->origin=0;
     mem->length=cbMem;
     mem->data=data;
+    mem->mapped=false;
+    mem->code=0;
+    mem->lent=0;
+    mem->code_generation=0;
     
-    return mem;
+    return &mem->base;
 }
 
-static mips_error mips_mem_read_write(
-                                      bool write,
-                                      mips_mem_h mem,
-                                      uint32_t address,
-                                      uint32_t length,
-                                      uint8_t *dataOut
-                                      )
-{
-    if(mem==0){
-        return mips_ErrorInvalidHandle;
+extern "C" mips_mem_h mips_mem_create_file(
+                                           const char *fileName,	//!< Image to map
+                                           uint32_t baseAddress,	//!< Address of the first byte of the image
+                                           uint32_t cbMem	//!< Total number of bytes of ram, 0 for the size of the image
+){
+    if((baseAddress % MIPS_MEM_PAGE) != 0){
+        return 0;
     }
     
-    if( (length!=1) && (length!=2) && (length!=4) ){
-        return mips_ExceptionInvalidLength;
-    }
+    int fd=open(fileName, O_RDONLY);
+    if(fd<0)
+        return 0;
     
-    if(0 != (address % length) ){
-        return mips_ExceptionInvalidAlignment;
+    struct stat info;
+    if((fstat(fd, &info)!=0) || (uint64_t(info.st_size) > cbMem && cbMem!=0) || (info.st_size > 0xFFFFFFFF)){
+        close(fd);
+        return 0;
     }
-    if(((address+length) > mem->length) || (address > (UINT32_MAX - length))){	// A subtle bug here, maybe?
-        return mips_ExceptionInvalidAddress;
+    uint32_t cbFile=uint32_t(info.st_size);
+    if(cbMem==0){
+        cbMem=cbFile;
+    }
+    if((cbMem==0) || (uint64_t(baseAddress)+cbMem > (uint64_t(1) << 32))){
+        close(fd);
+        return 0;
     }
     
-    if(write){
-        for(unsigned i=0; i<length; i++){
-            mem->data[address+i]=dataOut[i];
-        }
-    }else{
-        for(unsigned i=0; i<length; i++){
-            dataOut[i]=mem->data[address+i];
+    // Zero filled space for the whole RAM, with the image mapped over the start of it.
+    // Both are private, so writes never reach the file and untouched pages stay shared
+    void *data=mmap(0, cbMem, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if(data==MAP_FAILED){
+        close(fd);
+        return 0;
+    }
+    if(cbFile>0){
+        void *image=mmap(data, cbFile, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_FIXED, fd, 0);
+        if(image==MAP_FAILED){
+            munmap(data, cbMem);
+            close(fd);
+            return 0;
         }
     }
-    return mips_Success;
-}
-
-mips_error mips_mem_read(
-                         mips_mem_h mem,		//!< Handle to target memory
-                         uint32_t address,	//!< Byte address to start transaction at
-                         uint32_t length,	//!< Number of bytes to transfer
-                         uint8_t *dataOut	//!< Receives the target bytes
-)
-{
-    return mips_mem_read_write(
-                               false,	// we want to read
-                               mem,
-                               address,
-                               length,
-                               dataOut
-                               );
-}
-
-mips_error mips_mem_write(
-                          mips_mem_h mem,	//! Handle to target memory
-                          uint32_t address,		//! Byte address to start transaction at
-                          uint32_t length,			//! Number of bytes to transfer
-                          const uint8_t *dataIn	//! Receives the target bytes
-)
-{
-    return mips_mem_read_write(
-                               true,	// we want to write
-                               mem,
-                               address,
-                               length,
-                               (uint8_t*)dataIn
-                               );
-}
-
-void mips_mem_free(mips_mem_h mem)
-{
-    if(mem){
-        free(mem->data);
-        mem->data=0;
-        free(mem);
+    close(fd);
+    
+    struct mips_mem_ram *mem=(struct mips_mem_ram*)malloc(sizeof(struct mips_mem_ram));
+    if(mem==0){
+        munmap(data, cbMem);
+        return 0;
     }
-}
\ No newline at end of file
+    
+    mem->base.ops=&mips_mem_ram_ops;
+    mem->base.track=0;
+    mem->origin=baseAddress;
+    mem->length=cbMem;
+    mem->data=(uint8_t*)data;
+    mem->mapped=true;
+    mem->code=0;
+    mem->lent=0;
+    mem->code_generation=0;
+    
+    return &mem->base;
+}
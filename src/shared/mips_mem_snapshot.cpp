@@ -0,0 +1,497 @@
+/* This file is an implementation of the snapshot functions
+ defined in mips_mem.h. They work on any provider, through
+ the pages it reports with each_page and the writes seen by
+ mips_mem.cpp (see mips_mem_track in mips_mem_provider.hpp).
+
+ A snapshot is a two level table of pages, like the sparse
+ memory. Pages and second levels are reference counted and
+ never changed once they are shared, so a new snapshot starts
+ as a copy of the top level of the previous one and only
+ replaces the pages that were written since. Pages that are
+ all zero are not stored.
+
+ The file format is the magic "MIPSMEM1", the number of pages,
+ then each page as its number followed by its MIPS_MEM_PAGE
+ bytes. Numbers are little-endian.
+ */
+#include "mips_mem_provider.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MIPS_MEM_SNAPSHOT_LEVEL 1024   // Entries at each level of the table
+
+struct mips_mem_snapshot_page
+{
+    uint32_t refs;
+    uint8_t data[MIPS_MEM_PAGE];
+};
+
+struct mips_mem_snapshot_level
+{
+    uint32_t refs;
+    mips_mem_snapshot_page *pages[MIPS_MEM_SNAPSHOT_LEVEL];
+};
+
+struct mips_mem_snapshot_impl
+{
+    uint32_t refs;
+    mips_mem_snapshot_level *levels[MIPS_MEM_SNAPSHOT_LEVEL];
+};
+
+static const char sg_snapshot_magic[8]={'M','I','P','S','M','E','M','1'};
+
+// References are taken and dropped from any thread, restoring one snapshot into several memories at once is fine
+static void mips_mem_snapshot_ref(uint32_t *refs)
+{
+    __atomic_add_fetch(refs, 1, __ATOMIC_RELAXED);
+}
+
+static bool mips_mem_snapshot_unref(uint32_t *refs)
+{
+    return __atomic_sub_fetch(refs, 1, __ATOMIC_ACQ_REL)==0;
+}
+
+static void mips_mem_snapshot_release_page(mips_mem_snapshot_page *page)
+{
+    if(page && mips_mem_snapshot_unref(&page->refs)){
+        free(page);
+    }
+}
+
+static void mips_mem_snapshot_release_level(mips_mem_snapshot_level *level)
+{
+    if(level && mips_mem_snapshot_unref(&level->refs)){
+        for(unsigned i=0; i<MIPS_MEM_SNAPSHOT_LEVEL; i++){
+            mips_mem_snapshot_release_page(level->pages[i]);
+        }
+        free(level);
+    }
+}
+
+static mips_mem_snapshot_page *mips_mem_snapshot_find(mips_mem_snapshot_h snapshot, uint32_t page)
+{
+    if(snapshot==0){
+        return 0;
+    }
+    mips_mem_snapshot_level *level=snapshot->levels[page/MIPS_MEM_SNAPSHOT_LEVEL];
+    return level ? level->pages[page%MIPS_MEM_SNAPSHOT_LEVEL] : 0;
+}
+
+// Returns the slot of page in a snapshot being built, copying its level first if it is shared
+static mips_mem_snapshot_page **mips_mem_snapshot_slot(mips_mem_snapshot_h snapshot, uint32_t page)
+{
+    mips_mem_snapshot_level **level=&snapshot->levels[page/MIPS_MEM_SNAPSHOT_LEVEL];
+    if(*level==0){
+        *level=(mips_mem_snapshot_level*)calloc(1, sizeof(mips_mem_snapshot_level));
+        if(*level==0){
+            return 0;
+        }
+        (*level)->refs=1;
+    }else if(__atomic_load_n(&(*level)->refs, __ATOMIC_ACQUIRE)!=1){
+        mips_mem_snapshot_level *copy=(mips_mem_snapshot_level*)malloc(sizeof(mips_mem_snapshot_level));
+        if(copy==0){
+            return 0;
+        }
+        copy->refs=1;
+        for(unsigned i=0; i<MIPS_MEM_SNAPSHOT_LEVEL; i++){
+            copy->pages[i]=(*level)->pages[i];
+            if(copy->pages[i]){
+                mips_mem_snapshot_ref(&copy->pages[i]->refs);
+            }
+        }
+        mips_mem_snapshot_release_level(*level);
+        *level=copy;
+    }
+    return &(*level)->pages[page%MIPS_MEM_SNAPSHOT_LEVEL];
+}
+
+// Reads a whole page, the part of a page past the end of a RAM reads as zero
+static void mips_mem_snapshot_read_page(mips_mem_h mem, uint32_t page, uint8_t *data)
+{
+    uint32_t address=page*MIPS_MEM_PAGE;
+    if(mem->ops->read(mem, address, MIPS_MEM_PAGE, data)==mips_Success){
+        return;
+    }
+    memset(data, 0, MIPS_MEM_PAGE);
+    for(uint32_t i=0; i<MIPS_MEM_PAGE; i++){
+        if(mem->ops->read(mem, address+i, 1, data+i)!=mips_Success){
+            break;
+        }
+    }
+}
+
+// Writes a whole page, the part past the end of a RAM has to be zero
+static mips_error mips_mem_snapshot_write_page(mips_mem_h mem, uint32_t page, const uint8_t *data)
+{
+    uint32_t address=page*MIPS_MEM_PAGE;
+    if(mem->ops->write(mem, address, MIPS_MEM_PAGE, data)==mips_Success){
+        return mips_Success;
+    }
+    uint32_t i=0;
+    while((i<MIPS_MEM_PAGE) && (mem->ops->write(mem, address+i, 1, data+i)==mips_Success)){
+        i++;
+    }
+    for(; i<MIPS_MEM_PAGE; i++){
+        if(data[i]!=0){
+            return mips_ExceptionInvalidAddress;
+        }
+    }
+    return mips_Success;
+}
+
+// Reading a device could change it, so its pages are never part of a snapshot
+static bool mips_mem_snapshot_is_device(mips_mem_h mem, uint32_t page)
+{
+    unsigned device=0;
+    return (mem->ops->is_device!=0) && (mem->ops->is_device(mem, page*MIPS_MEM_PAGE, &device)==mips_Success) && device;
+}
+
+static bool mips_mem_snapshot_is_zero(const uint8_t *data)
+{
+    for(uint32_t i=0; i<MIPS_MEM_PAGE; i++){
+        if(data[i]!=0){
+            return false;
+        }
+    }
+    return true;
+}
+
+static void mips_mem_snapshot_mark(void *context, uint32_t address)
+{
+    mips_mem_track *track=(mips_mem_track*)context;
+    uint32_t page=address/MIPS_MEM_PAGE;
+    track->dirty[page/64] |= uint64_t(1) << (page%64);
+}
+
+// Starts tracking the memory, every page it holds counts as written since a snapshot of zeros
+static mips_mem_track *mips_mem_snapshot_track(mips_mem_h mem)
+{
+    if(mem->track){
+        return mem->track;
+    }
+    mips_mem_track *track=(mips_mem_track*)calloc(1, sizeof(mips_mem_track));
+    if(track==0){
+        return 0;
+    }
+    mips_error err=mem->ops->each_page(mem, mips_mem_snapshot_mark, track);
+    if(err!=mips_Success){
+        free(track);
+        return 0;
+    }
+    __atomic_store_n(&mem->track, track, __ATOMIC_RELEASE);
+    return track;
+}
+
+// Calls fn for every page marked in the track and clears the marks
+template<class F>
+static mips_error mips_mem_snapshot_each_dirty(mips_mem_track *track, F &fn)
+{
+    mips_error first=mips_Success;
+    for(uint32_t word=0; word<MIPS_MEM_PAGES/64; word++){
+        uint64_t bits=__atomic_exchange_n(&track->dirty[word], 0, __ATOMIC_RELAXED);
+        while(bits){
+            unsigned bit=__builtin_ctzll(bits);
+            bits&=bits-1;
+            mips_error err=fn(word*64+bit);
+            if((err!=mips_Success) && (first==mips_Success)){
+                first=err;
+            }
+        }
+    }
+    return first;
+}
+
+// CPUs may still hold pages that were handed out for writing, changing the generation makes them map them again
+static void mips_mem_snapshot_remap(mips_mem_track *track)
+{
+    __atomic_add_fetch(&track->generation_bias, 1, __ATOMIC_SEQ_CST);
+}
+
+struct mips_mem_snapshot_take
+{
+    mips_mem_h mem;
+    mips_mem_snapshot_h snapshot;
+    uint8_t data[MIPS_MEM_PAGE];
+
+    mips_error operator()(uint32_t page)
+    {
+        if(mips_mem_snapshot_is_device(mem, page)){
+            return mips_Success;
+        }
+        mips_mem_snapshot_read_page(mem, page, data);
+        mips_mem_snapshot_page *old=mips_mem_snapshot_find(snapshot, page);
+        if(old ? (memcmp(old->data, data, MIPS_MEM_PAGE)==0) : mips_mem_snapshot_is_zero(data)){
+            return mips_Success; // Handed out for writing but not changed
+        }
+
+        mips_mem_snapshot_page **slot=mips_mem_snapshot_slot(snapshot, page);
+        if(slot==0){
+            return mips_InternalError;
+        }
+        mips_mem_snapshot_page *fresh=0;
+        if(!mips_mem_snapshot_is_zero(data)){
+            fresh=(mips_mem_snapshot_page*)malloc(sizeof(mips_mem_snapshot_page));
+            if(fresh==0){
+                return mips_InternalError;
+            }
+            fresh->refs=1;
+            memcpy(fresh->data, data, MIPS_MEM_PAGE);
+        }
+        mips_mem_snapshot_release_page(*slot);
+        *slot=fresh;
+        return mips_Success;
+    }
+};
+
+extern "C" mips_error mips_mem_snapshot(
+                                        mips_mem_h mem,
+                                        mips_mem_snapshot_h *snapshot
+                                        )
+{
+    if(mem==0){
+        return mips_ErrorInvalidHandle;
+    }
+    if(snapshot==0){
+        return mips_ErrorInvalidArgument;
+    }
+    mips_mem_track *track=mips_mem_snapshot_track(mem);
+    if(track==0){
+        return mips_InternalError;
+    }
+
+    // Start from the previous snapshot, sharing all of it
+    mips_mem_snapshot_h fresh=(mips_mem_snapshot_h)calloc(1, sizeof(mips_mem_snapshot_impl));
+    mips_mem_snapshot_take *take=(mips_mem_snapshot_take*)malloc(sizeof(mips_mem_snapshot_take));
+    if((fresh==0) || (take==0)){
+        free(fresh);
+        free(take);
+        return mips_InternalError;
+    }
+    fresh->refs=1;
+    if(track->base){
+        for(unsigned i=0; i<MIPS_MEM_SNAPSHOT_LEVEL; i++){
+            fresh->levels[i]=track->base->levels[i];
+            if(fresh->levels[i]){
+                mips_mem_snapshot_ref(&fresh->levels[i]->refs);
+            }
+        }
+    }
+
+    take->mem=mem;
+    take->snapshot=fresh;
+    mips_error err=mips_mem_snapshot_each_dirty(track, *take);
+    free(take);
+    mips_mem_snapshot_remap(track);
+    if(err!=mips_Success){
+        // Pages may have been skipped, so the next snapshot has to look at everything again
+        mips_mem_snapshot_free(fresh);
+        mips_mem_snapshot_free(track->base);
+        track->base=0;
+        mem->ops->each_page(mem, mips_mem_snapshot_mark, track);
+        return err;
+    }
+
+    mips_mem_snapshot_free(track->base);
+    mips_mem_snapshot_ref(&fresh->refs);
+    track->base=fresh;
+    *snapshot=fresh;
+    return mips_Success;
+}
+
+// Marks the pages that differ between two snapshots, comparing whole levels first
+static void mips_mem_snapshot_diff(mips_mem_track *track, mips_mem_snapshot_h a, mips_mem_snapshot_h b)
+{
+    for(uint32_t i=0; i<MIPS_MEM_SNAPSHOT_LEVEL; i++){
+        mips_mem_snapshot_level *la=a ? a->levels[i] : 0;
+        mips_mem_snapshot_level *lb=b ? b->levels[i] : 0;
+        if(la==lb){
+            continue;
+        }
+        for(uint32_t j=0; j<MIPS_MEM_SNAPSHOT_LEVEL; j++){
+            if((la ? la->pages[j] : 0) != (lb ? lb->pages[j] : 0)){
+                mips_mem_snapshot_mark(track, (i*MIPS_MEM_SNAPSHOT_LEVEL+j)*MIPS_MEM_PAGE);
+            }
+        }
+    }
+}
+
+struct mips_mem_snapshot_put
+{
+    mips_mem_h mem;
+    mips_mem_snapshot_h snapshot;
+    uint8_t data[MIPS_MEM_PAGE];
+    uint8_t zero[MIPS_MEM_PAGE];
+
+    mips_error operator()(uint32_t page)
+    {
+        if(mips_mem_snapshot_is_device(mem, page)){
+            return mips_Success;
+        }
+        mips_mem_snapshot_page *wanted=mips_mem_snapshot_find(snapshot, page);
+        const uint8_t *target=wanted ? wanted->data : zero;
+        // Pages that already hold the right data are left alone, so cached code in them stays valid
+        mips_mem_snapshot_read_page(mem, page, data);
+        if(memcmp(data, target, MIPS_MEM_PAGE)==0){
+            return mips_Success;
+        }
+        return mips_mem_snapshot_write_page(mem, page, target);
+    }
+};
+
+extern "C" mips_error mips_mem_restore(
+                                       mips_mem_h mem,
+                                       mips_mem_snapshot_h snapshot
+                                       )
+{
+    if(mem==0){
+        return mips_ErrorInvalidHandle;
+    }
+    if(snapshot==0){
+        return mips_ErrorInvalidArgument;
+    }
+    mips_mem_track *track=mips_mem_snapshot_track(mem);
+    if(track==0){
+        return mips_InternalError;
+    }
+    mips_mem_snapshot_put *put=(mips_mem_snapshot_put*)calloc(1, sizeof(mips_mem_snapshot_put));
+    if(put==0){
+        return mips_InternalError;
+    }
+
+    // Pages written since the last snapshot or restore, and those where the two snapshots differ
+    mips_mem_snapshot_diff(track, track->base, snapshot);
+    put->mem=mem;
+    put->snapshot=snapshot;
+    mips_error err=mips_mem_snapshot_each_dirty(track, *put);
+    free(put);
+    mips_mem_snapshot_remap(track);
+
+    mips_mem_snapshot_ref(&snapshot->refs);
+    mips_mem_snapshot_free(track->base);
+    track->base=snapshot;
+    if(err!=mips_Success){
+        // Some pages could not be written, look at everything next time
+        mem->ops->each_page(mem, mips_mem_snapshot_mark, track);
+    }
+    return err;
+}
+
+static void mips_mem_snapshot_put32(uint8_t *p, uint32_t v)
+{
+    p[0]=uint8_t(v);
+    p[1]=uint8_t(v>>8);
+    p[2]=uint8_t(v>>16);
+    p[3]=uint8_t(v>>24);
+}
+
+static uint32_t mips_mem_snapshot_get32(const uint8_t *p)
+{
+    return uint32_t(p[0]) | (uint32_t(p[1])<<8) | (uint32_t(p[2])<<16) | (uint32_t(p[3])<<24);
+}
+
+extern "C" mips_error mips_mem_snapshot_save(
+                                             mips_mem_snapshot_h snapshot,
+                                             FILE *dest
+                                             )
+{
+    if((snapshot==0) || (dest==0)){
+        return mips_ErrorInvalidArgument;
+    }
+    uint32_t count=0;
+    for(uint32_t i=0; i<MIPS_MEM_SNAPSHOT_LEVEL; i++){
+        for(uint32_t j=0; snapshot->levels[i] && (j<MIPS_MEM_SNAPSHOT_LEVEL); j++){
+            if(snapshot->levels[i]->pages[j]){
+                count++;
+            }
+        }
+    }
+
+    uint8_t header[12];
+    memcpy(header, sg_snapshot_magic, 8);
+    mips_mem_snapshot_put32(header+8, count);
+    if(fwrite(header, 1, 12, dest)!=12){
+        return mips_ErrorFileWriteError;
+    }
+    for(uint32_t i=0; i<MIPS_MEM_SNAPSHOT_LEVEL; i++){
+        mips_mem_snapshot_level *level=snapshot->levels[i];
+        for(uint32_t j=0; level && (j<MIPS_MEM_SNAPSHOT_LEVEL); j++){
+            if(level->pages[j]==0){
+                continue;
+            }
+            uint8_t number[4];
+            mips_mem_snapshot_put32(number, i*MIPS_MEM_SNAPSHOT_LEVEL+j);
+            if((fwrite(number, 1, 4, dest)!=4) || (fwrite(level->pages[j]->data, 1, MIPS_MEM_PAGE, dest)!=MIPS_MEM_PAGE)){
+                return mips_ErrorFileWriteError;
+            }
+        }
+    }
+    return mips_Success;
+}
+
+extern "C" mips_error mips_mem_snapshot_load(
+                                             FILE *src,
+                                             mips_mem_snapshot_h *snapshot
+                                             )
+{
+    if((src==0) || (snapshot==0)){
+        return mips_ErrorInvalidArgument;
+    }
+    uint8_t header[12];
+    if((fread(header, 1, 12, src)!=12) || (memcmp(header, sg_snapshot_magic, 8)!=0)){
+        return mips_ErrorFileReadError;
+    }
+    uint32_t count=mips_mem_snapshot_get32(header+8);
+
+    mips_mem_snapshot_h loaded=(mips_mem_snapshot_h)calloc(1, sizeof(mips_mem_snapshot_impl));
+    if(loaded==0){
+        return mips_InternalError;
+    }
+    loaded->refs=1;
+    for(uint32_t i=0; i<count; i++){
+        uint8_t number[4];
+        mips_mem_snapshot_page *page=(mips_mem_snapshot_page*)malloc(sizeof(mips_mem_snapshot_page));
+        if(page==0){
+            mips_mem_snapshot_free(loaded);
+            return mips_InternalError;
+        }
+        page->refs=1;
+        if((fread(number, 1, 4, src)!=4) || (fread(page->data, 1, MIPS_MEM_PAGE, src)!=MIPS_MEM_PAGE)){
+            free(page);
+            mips_mem_snapshot_free(loaded);
+            return mips_ErrorFileReadError;
+        }
+        uint32_t at=mips_mem_snapshot_get32(number);
+        mips_mem_snapshot_page **slot=(at<MIPS_MEM_PAGES) ? mips_mem_snapshot_slot(loaded, at) : 0;
+        if(slot==0){
+            free(page);
+            mips_mem_snapshot_free(loaded);
+            return (at<MIPS_MEM_PAGES) ? mips_InternalError : mips_ErrorFileReadError;
+        }
+        mips_mem_snapshot_release_page(*slot); // A page given twice keeps the last copy
+        *slot=page;
+    }
+    *snapshot=loaded;
+    return mips_Success;
+}
+
+extern "C" void mips_mem_snapshot_free(mips_mem_snapshot_h snapshot)
+{
+    if(snapshot && mips_mem_snapshot_unref(&snapshot->refs)){
+        for(unsigned i=0; i<MIPS_MEM_SNAPSHOT_LEVEL; i++){
+            mips_mem_snapshot_release_level(snapshot->levels[i]);
+        }
+        free(snapshot);
+    }
+}
+
+void mips_mem_track_free(mips_mem_h mem)
+{
+    mips_mem_track *track=mem->track;
+    if(track){
+        mips_mem_snapshot_free(track->base);
+        free(track);
+        mem->track=0;
+    }
+}
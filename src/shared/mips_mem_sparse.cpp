@@ -0,0 +1,326 @@
+/* This file is an implementation of the functions
+ defined in mips_mem.h for a memory that covers the
+ whole 4GB address space. Storage is only allocated
+ for pages that have been written (or hold code), all
+ other pages read as zero.
+ 
+ Pages are found through a two level table, so an
+ untouched 4MB region costs a single null pointer.
+ */
+#include "mips_mem_provider.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MIPS_MEM_SPARSE_LEVEL 1024     // Entries at each level of the table
+#define MIPS_MEM_SPARSE_LINES (MIPS_MEM_PAGE/MIPS_MEM_CODE_LINE)
+
+#if MIPS_MEM_SPARSE_LINES > 32
+#error The watched lines of a page do not fit in mips_mem_sparse_page::code
+#endif
+
+struct mips_mem_sparse_page
+{
+    uint8_t data[MIPS_MEM_PAGE];
+    uint32_t code;              // One bit per watched line of the page
+    uint32_t lent;              // Non-zero once handed out for writing
+};
+
+struct mips_mem_sparse
+{
+    mips_mem_provider base;
+    mips_mem_sparse_page **table[MIPS_MEM_SPARSE_LEVEL];
+    uint32_t resident;          // Number of allocated pages
+    uint32_t code_generation;   // Bumped on every write to a watched line
+};
+
+/* Several CPUs may use the memory from different threads. Pages and levels
+ of the table are installed with a compare and swap, and watched lines are
+ handled in the same order as in the RAM (see mips_mem_ram.cpp): data is
+ written before the watched lines are looked at.
+ */
+
+static mips_mem_sparse *mips_mem_as_sparse(mips_mem_h mem)
+{
+    return (mips_mem_sparse*)mem;
+}
+
+// Returns the page holding address, or 0 if it was never allocated
+static mips_mem_sparse_page *mips_mem_sparse_find(mips_mem_sparse *sparse, uint32_t address)
+{
+    uint32_t page=address/MIPS_MEM_PAGE;
+    mips_mem_sparse_page **level=__atomic_load_n(&sparse->table[page/MIPS_MEM_SPARSE_LEVEL], __ATOMIC_ACQUIRE);
+    if(level==0){
+        return 0;
+    }
+    return __atomic_load_n(&level[page%MIPS_MEM_SPARSE_LEVEL], __ATOMIC_ACQUIRE);
+}
+
+// Installs a zeroed block of size bytes in slot unless there is one already, returns what is in slot
+template<class T>
+static T *mips_mem_sparse_install(T **slot, size_t count, size_t size, bool *installed)
+{
+    T *current=__atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    *installed=false;
+    if(current==0){
+        T *fresh=(T*)calloc(count, size);
+        if(fresh==0){
+            return 0;
+        }
+        if(__atomic_compare_exchange_n(slot, &current, fresh, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+            current=fresh;
+            *installed=true;
+        }else{
+            free(fresh); // Another thread got there first
+        }
+    }
+    return current;
+}
+
+// Returns the page holding address, allocating a zero page if needed, or 0 if out of host memory
+static mips_mem_sparse_page *mips_mem_sparse_touch(mips_mem_sparse *sparse, uint32_t address)
+{
+    uint32_t page=address/MIPS_MEM_PAGE;
+    bool installed;
+    mips_mem_sparse_page **level=mips_mem_sparse_install(&sparse->table[page/MIPS_MEM_SPARSE_LEVEL], MIPS_MEM_SPARSE_LEVEL, sizeof(mips_mem_sparse_page*), &installed);
+    if(level==0){
+        return 0;
+    }
+    mips_mem_sparse_page *entry=mips_mem_sparse_install(&level[page%MIPS_MEM_SPARSE_LEVEL], 1, sizeof(mips_mem_sparse_page), &installed);
+    if(installed){
+        __atomic_add_fetch(&sparse->resident, 1, __ATOMIC_RELAXED);
+    }
+    return entry;
+}
+
+// Checks that [address, address+length) does not wrap around the address space
+static bool mips_mem_sparse_in_range(uint32_t address, uint32_t length)
+{
+    return (uint64_t(address) + length) <= (uint64_t(1) << 32);
+}
+
+// Stops watching the lines in [offset, offset+length) of a page, called after the data has been written
+static void mips_mem_sparse_touch_code(mips_mem_sparse *sparse, mips_mem_sparse_page *page, uint32_t offset, uint32_t length)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    uint32_t code=__atomic_load_n(&page->code, __ATOMIC_SEQ_CST);
+    if(code==0){
+        return;
+    }
+    uint32_t last=(offset+length-1)/MIPS_MEM_CODE_LINE;
+    for(uint32_t line=offset/MIPS_MEM_CODE_LINE; line<=last; line++){
+        if((code & (1u<<line)) && (__atomic_fetch_and(&page->code, ~(1u<<line), __ATOMIC_SEQ_CST) & (1u<<line))){
+            __atomic_add_fetch(&sparse->code_generation, 1, __ATOMIC_SEQ_CST);
+        }
+    }
+}
+
+static mips_error mips_mem_sparse_read(
+                                       mips_mem_h mem,
+                                       uint32_t address,
+                                       uint32_t length,
+                                       uint8_t *dataOut
+                                       )
+{
+    mips_mem_sparse *sparse=mips_mem_as_sparse(mem);
+    if(!mips_mem_sparse_in_range(address, length)){
+        return mips_ExceptionInvalidAddress;
+    }
+    
+    while(length>0){
+        uint32_t offset=address % MIPS_MEM_PAGE;
+        uint32_t chunk=MIPS_MEM_PAGE-offset;
+        if(chunk>length){
+            chunk=length;
+        }
+        mips_mem_sparse_page *page=mips_mem_sparse_find(sparse, address);
+        if(page){
+            mips_mem_copy_out(dataOut, page->data+offset, chunk);
+        }else{
+            memset(dataOut, 0, chunk);
+        }
+        address+=chunk;
+        dataOut+=chunk;
+        length-=chunk;
+    }
+    return mips_Success;
+}
+
+static mips_error mips_mem_sparse_write(
+                                        mips_mem_h mem,
+                                        uint32_t address,
+                                        uint32_t length,
+                                        const uint8_t *dataIn
+                                        )
+{
+    mips_mem_sparse *sparse=mips_mem_as_sparse(mem);
+    if(!mips_mem_sparse_in_range(address, length)){
+        return mips_ExceptionInvalidAddress;
+    }
+    
+    while(length>0){
+        uint32_t offset=address % MIPS_MEM_PAGE;
+        uint32_t chunk=MIPS_MEM_PAGE-offset;
+        if(chunk>length){
+            chunk=length;
+        }
+        mips_mem_sparse_page *page=mips_mem_sparse_touch(sparse, address);
+        if(page==0){
+            return mips_InternalError;
+        }
+        mips_mem_copy_in(page->data+offset, dataIn, chunk);
+        mips_mem_sparse_touch_code(sparse, page, offset, chunk);
+        address+=chunk;
+        dataIn+=chunk;
+        length-=chunk;
+    }
+    return mips_Success;
+}
+
+static mips_error mips_mem_sparse_compare_swap32(
+                                                 mips_mem_h mem,
+                                                 uint32_t address,
+                                                 uint32_t expected,
+                                                 uint32_t desired,
+                                                 unsigned *swapped
+                                                 )
+{
+    mips_mem_sparse *sparse=mips_mem_as_sparse(mem);
+    mips_mem_sparse_page *page=mips_mem_sparse_touch(sparse, address);
+    if(page==0){
+        return mips_InternalError;
+    }
+    
+    uint32_t offset=address % MIPS_MEM_PAGE;
+    bool stored=__atomic_compare_exchange_n((uint32_t*)(page->data+offset), &expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    if(stored){
+        mips_mem_sparse_touch_code(sparse, page, offset, 4);
+    }
+    *swapped=stored ? 1 : 0;
+    return mips_Success;
+}
+
+static mips_error mips_mem_sparse_map_page(
+                                           mips_mem_h mem,
+                                           uint32_t address,
+                                           unsigned write,
+                                           uint8_t **page
+                                           )
+{
+    mips_mem_sparse *sparse=mips_mem_as_sparse(mem);
+    // Pages that were never written are left to the transactions, so that reading does not allocate them
+    mips_mem_sparse_page *found=write ? mips_mem_sparse_touch(sparse, address) : mips_mem_sparse_find(sparse, address);
+    if(found==0){
+        return write ? mips_InternalError : mips_ErrorNotImplemented;
+    }
+    if(write){
+        // Lend the page before looking for code, so a watch started meanwhile sees it lent
+        __atomic_store_n(&found->lent, 1, __ATOMIC_SEQ_CST);
+        if(__atomic_load_n(&found->code, __ATOMIC_SEQ_CST)){
+            return mips_ErrorNotImplemented; // Writes have to be seen by the watched lines
+        }
+    }
+    
+    *page=found->data;
+    return mips_Success;
+}
+
+static mips_error mips_mem_sparse_watch_code(
+                                             mips_mem_h mem,
+                                             uint32_t address
+                                             )
+{
+    mips_mem_sparse *sparse=mips_mem_as_sparse(mem);
+    mips_mem_sparse_page *page=mips_mem_sparse_touch(sparse, address);
+    if(page==0){
+        return mips_InternalError;
+    }
+    
+    uint32_t bit=1u<<((address % MIPS_MEM_PAGE)/MIPS_MEM_CODE_LINE);
+    if(!(__atomic_fetch_or(&page->code, bit, __ATOMIC_SEQ_CST) & bit)){
+        // A CPU may be writing this page directly, make every CPU map it again
+        if(__atomic_load_n(&page->lent, __ATOMIC_SEQ_CST) && __atomic_exchange_n(&page->lent, 0, __ATOMIC_SEQ_CST)){
+            __atomic_add_fetch(&sparse->code_generation, 1, __ATOMIC_SEQ_CST);
+        }
+    }
+    return mips_Success;
+}
+
+static mips_error mips_mem_sparse_get_code_generation(
+                                                      mips_mem_h mem,
+                                                      uint32_t *generation
+                                                      )
+{
+    *generation=__atomic_load_n(&mips_mem_as_sparse(mem)->code_generation, __ATOMIC_SEQ_CST);
+    return mips_Success;
+}
+
+static mips_error mips_mem_sparse_get_resident_pages(
+                                                     mips_mem_h mem,
+                                                     uint32_t *pages
+                                                     )
+{
+    *pages=__atomic_load_n(&mips_mem_as_sparse(mem)->resident, __ATOMIC_RELAXED);
+    return mips_Success;
+}
+
+static mips_error mips_mem_sparse_each_page(
+                                            mips_mem_h mem,
+                                            void (*visit)(void *context, uint32_t address),
+                                            void *context
+                                            )
+{
+    mips_mem_sparse *sparse=mips_mem_as_sparse(mem);
+    for(uint32_t i=0; i<MIPS_MEM_SPARSE_LEVEL; i++){
+        mips_mem_sparse_page **level=__atomic_load_n(&sparse->table[i], __ATOMIC_ACQUIRE);
+        if(level==0){
+            continue;
+        }
+        for(uint32_t j=0; j<MIPS_MEM_SPARSE_LEVEL; j++){
+            if(__atomic_load_n(&level[j], __ATOMIC_ACQUIRE)){
+                visit(context, (i*MIPS_MEM_SPARSE_LEVEL+j)*MIPS_MEM_PAGE);
+            }
+        }
+    }
+    return mips_Success;
+}
+
+static void mips_mem_sparse_free(mips_mem_h mem)
+{
+    mips_mem_sparse *sparse=mips_mem_as_sparse(mem);
+    for(unsigned i=0; i<MIPS_MEM_SPARSE_LEVEL; i++){
+        if(sparse->table[i]){
+            for(unsigned j=0; j<MIPS_MEM_SPARSE_LEVEL; j++){
+                free(sparse->table[i][j]);
+            }
+            free(sparse->table[i]);
+        }
+    }
+    free(sparse);
+}
+
+static const mips_mem_ops mips_mem_sparse_ops = {
+    mips_mem_sparse_read,
+    mips_mem_sparse_write,
+    mips_mem_sparse_compare_swap32,
+    mips_mem_sparse_map_page,
+    0,  // Not one flat block of storage
+    mips_mem_sparse_watch_code,
+    mips_mem_sparse_get_code_generation,
+    mips_mem_sparse_get_resident_pages,
+    0,  // Only storage, never a device
+    mips_mem_sparse_each_page,
+    mips_mem_sparse_free
+};
+
+extern "C" mips_mem_h mips_mem_create_sparse()
+{
+    struct mips_mem_sparse *mem=(struct mips_mem_sparse*)calloc(1, sizeof(struct mips_mem_sparse));
+    if(mem==0)
+        return 0;
+    
+    mem->base.ops=&mips_mem_sparse_ops;
+    mem->base.track=0;
+    
+    return &mem->base;
+}
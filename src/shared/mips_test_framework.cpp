@@ -90,6 +90,12 @@ static const instr_info_t sg_instructionsArray[]=
 };
 static const unsigned sg_instructionsCount = sizeof(sg_instructionsArray)/sizeof(sg_instructionsArray[0]);
 
+/* mips_cpu_get_instruction is an extension to the required API, so it is
+   only referenced weakly: a CPU without it links, and is tested against the
+   list above. A CPU that has it adds the instructions it implements beyond
+   that list (BREAK, SYSCALL, LL and SC for this one). */
+#pragma weak mips_cpu_get_instruction
+
 static std::set<std::string> sg_knownInstructions;
 
 
@@ -100,10 +106,16 @@ extern "C" void mips_test_begin_suite()
         exit(1);
     }
     
-    // Build up a list of known instruction names
+    // Build up a list of known instruction names, and those the CPU describes
     for(unsigned i=0; i<sg_instructionsCount; i++){
         sg_knownInstructions.insert(std::string(sg_instructionsArray[i].instruction));
     }
+    if(mips_cpu_get_instruction){
+        const char *mnemonic;
+        for(unsigned i=0; mips_cpu_get_instruction(i, &mnemonic, NULL)==mips_Success; i++){
+            sg_knownInstructions.insert(std::string(mnemonic));
+        }
+    }
     
     sg_started=true;
 }
@@ -0,0 +1,842 @@
+/* This file is an implementation of the functions
+ defined in mips_trace.h.
+
+ File layout (all values little-endian):
+
+    header   "MIPSTRZ1", u32 records per block, key
+    blocks   u32 tag "TBLK", u32 raw size, u32 packed size
+             (0 if stored as is), u32 records, data
+    index    u64 first record, u64 file offset, per block
+    footer   u64 records, u64 index offset, u32 blocks, "MIPSTRZE"
+
+ A key is the state both sides keep while coding records:
+ the expected pc, hi, lo, the 32 registers and the last
+ memory address and data (37 words). Each block starts
+ with the key, so it can be decoded on its own. A record
+ is then a flags byte followed by the fields that differ
+ from what the key predicts, see mips_trace_encode.
+
+ The compression is LZ77 in the style of LZ4: a token
+ byte with the number of literals and the match length,
+ the literals, and a two byte offset back into the output.
+ */
+#include "mips_trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#define MIPS_TRACE_FILE_MAGIC "MIPSTRZ1"
+#define MIPS_TRACE_END_MAGIC "MIPSTRZE"
+#define MIPS_TRACE_BLOCK_TAG 0x4B4C4254
+#define MIPS_TRACE_KEY_WORDS 37
+#define MIPS_TRACE_HEADER_SIZE (8+4+4*MIPS_TRACE_KEY_WORDS)
+#define MIPS_TRACE_BLOCK_HEADER_SIZE 16
+#define MIPS_TRACE_FOOTER_SIZE 28
+// Largest encoded record: flags, three varints, word and op, rd and a varint, four varints
+#define MIPS_TRACE_RECORD_MAX 48
+#define MIPS_TRACE_RAW_MAX (4*MIPS_TRACE_KEY_WORDS + MIPS_TRACE_BLOCK*MIPS_TRACE_RECORD_MAX)
+#define MIPS_TRACE_PACKED_MAX (MIPS_TRACE_RAW_MAX + MIPS_TRACE_RAW_MAX/255 + 16)
+
+// Fields present in an encoded record
+#define MIPS_TRACE_F_PC    0x01    // pc is not the next_pc of the record before
+#define MIPS_TRACE_F_NEXT  0x02    // next_pc is not pc+4
+#define MIPS_TRACE_F_WORD  0x04    // word and op differ from the last ones seen at this pc
+#define MIPS_TRACE_F_RD    0x08    // a register was written
+#define MIPS_TRACE_F_MEM   0x10    // memory was accessed
+#define MIPS_TRACE_F_HILO  0x20    // hi or lo changed
+#define MIPS_TRACE_F_ERROR 0x40    // the step failed
+
+// Instructions are mostly run again and again, so the last word seen at
+// each of a few pcs is remembered rather than stored with every record
+#define MIPS_TRACE_WORDS 256
+
+#define MIPS_TRACE_LZ_HASH_BITS 12
+#define MIPS_TRACE_LZ_MIN 4
+
+struct mips_trace_state
+{
+    uint32_t key[MIPS_TRACE_KEY_WORDS];    // pc, hi, lo, regs[32], mem_address, mem_data
+    uint32_t word_pc[MIPS_TRACE_WORDS];    // Unaligned when empty
+    uint32_t word[MIPS_TRACE_WORDS];
+    uint8_t word_op[MIPS_TRACE_WORDS];
+};
+
+#define MIPS_TRACE_PC 0
+#define MIPS_TRACE_HI 1
+#define MIPS_TRACE_LO 2
+#define MIPS_TRACE_REGS 3
+#define MIPS_TRACE_MEM_ADDRESS 35
+#define MIPS_TRACE_MEM_DATA 36
+
+struct mips_trace_index
+{
+    uint64_t first;     // Number of the first record of the block
+    uint64_t offset;    // Position of the block in the file
+};
+
+struct mips_trace_writer_impl
+{
+    FILE *dest;
+    mips_error error;               // First error, everything after it is dropped
+    mips_trace_state state;
+    uint8_t *raw;                   // Block being filled
+    uint32_t raw_used;
+    uint8_t *packed;
+    uint32_t block_records;
+    uint64_t records;
+    mips_trace_index *index;
+    uint32_t blocks;
+    uint32_t index_capacity;
+};
+
+struct mips_trace_reader_impl
+{
+    FILE *src;
+    uint32_t start[MIPS_TRACE_KEY_WORDS];  // Key from the file header
+    mips_trace_index *index;
+    uint32_t blocks;
+    uint64_t records;
+    mips_trace_state state;
+    uint8_t *raw;                   // Block being read
+    uint8_t *packed;
+    uint32_t raw_used;
+    uint32_t raw_pos;
+    uint32_t block;                 // Block in raw, blocks if none
+    uint64_t position;              // Number of the next record
+};
+
+static void mips_trace_put32(uint8_t *p, uint32_t v)
+{
+    p[0]=uint8_t(v); p[1]=uint8_t(v>>8); p[2]=uint8_t(v>>16); p[3]=uint8_t(v>>24);
+}
+
+static uint32_t mips_trace_get32(const uint8_t *p)
+{
+    return uint32_t(p[0]) | (uint32_t(p[1])<<8) | (uint32_t(p[2])<<16) | (uint32_t(p[3])<<24);
+}
+
+static void mips_trace_put64(uint8_t *p, uint64_t v)
+{
+    mips_trace_put32(p, uint32_t(v));
+    mips_trace_put32(p+4, uint32_t(v>>32));
+}
+
+static uint64_t mips_trace_get64(const uint8_t *p)
+{
+    return uint64_t(mips_trace_get32(p)) | (uint64_t(mips_trace_get32(p+4))<<32);
+}
+
+// Small differences either way become small unsigned numbers
+static uint32_t mips_trace_zigzag(uint32_t delta)
+{
+    return (delta<<1) ^ uint32_t(int32_t(delta)>>31);
+}
+
+static uint32_t mips_trace_unzigzag(uint32_t value)
+{
+    return (value>>1) ^ (0u-(value&1));
+}
+
+static uint8_t *mips_trace_put_varint(uint8_t *out, uint32_t value)
+{
+    while(value>=0x80){
+        *out++=uint8_t(value|0x80);
+        value>>=7;
+    }
+    *out++=uint8_t(value);
+    return out;
+}
+
+// Bounds checked reading of a decompressed block
+struct mips_trace_cursor
+{
+    const uint8_t *p;
+    const uint8_t *end;
+    bool ok;
+};
+
+static uint8_t mips_trace_get_byte(mips_trace_cursor &c)
+{
+    if(c.p>=c.end){
+        c.ok=false;
+        return 0;
+    }
+    return *c.p++;
+}
+
+static uint32_t mips_trace_get_varint(mips_trace_cursor &c)
+{
+    uint32_t value=0;
+    for(unsigned shift=0; shift<35; shift+=7){
+        uint8_t b=mips_trace_get_byte(c);
+        value|=uint32_t(b&0x7F)<<shift;
+        if((b&0x80)==0)
+            return value;
+    }
+    c.ok=false;
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////
+// LZ77
+
+static uint32_t mips_trace_lz_read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static uint8_t *mips_trace_lz_put_length(uint8_t *out, uint32_t length)
+{
+    while(length>=255){
+        *out++=255;
+        length-=255;
+    }
+    *out++=uint8_t(length);
+    return out;
+}
+
+static uint8_t *mips_trace_lz_put_sequence(uint8_t *out, const uint8_t *literals, uint32_t count, uint32_t offset, uint32_t match)
+{
+    uint8_t *token=out++;
+    *token=uint8_t((count<15 ? count : 15)<<4);
+    if(count>=15)
+        out=mips_trace_lz_put_length(out, count-15);
+    memcpy(out, literals, count);
+    out+=count;
+    if(match==0)
+        return out;
+
+    match-=MIPS_TRACE_LZ_MIN;
+    *token|=uint8_t(match<15 ? match : 15);
+    *out++=uint8_t(offset);
+    *out++=uint8_t(offset>>8);
+    if(match>=15)
+        out=mips_trace_lz_put_length(out, match-15);
+    return out;
+}
+
+// dst must hold length+length/255+16 bytes, returns the packed size
+static uint32_t mips_trace_lz_compress(const uint8_t *src, uint32_t length, uint8_t *dst)
+{
+    int32_t table[1<<MIPS_TRACE_LZ_HASH_BITS];
+    for(unsigned i=0; i<(1u<<MIPS_TRACE_LZ_HASH_BITS); i++){
+        table[i]=-1;
+    }
+
+    uint8_t *out=dst;
+    uint32_t ip=0, anchor=0;
+    while(ip+MIPS_TRACE_LZ_MIN<=length){
+        uint32_t v=mips_trace_lz_read32(src+ip);
+        uint32_t h=(v*2654435761u)>>(32-MIPS_TRACE_LZ_HASH_BITS);
+        int32_t ref=table[h];
+        table[h]=int32_t(ip);
+        if((ref<0) || (ip-uint32_t(ref)>65535) || (mips_trace_lz_read32(src+ref)!=v)){
+            ip++;
+            continue;
+        }
+
+        uint32_t match=MIPS_TRACE_LZ_MIN;
+        while((ip+match<length) && (src[ref+match]==src[ip+match])){
+            match++;
+        }
+        out=mips_trace_lz_put_sequence(out, src+anchor, ip-anchor, ip-uint32_t(ref), match);
+        ip+=match;
+        anchor=ip;
+    }
+    out=mips_trace_lz_put_sequence(out, src+anchor, length-anchor, 0, 0);
+    return uint32_t(out-dst);
+}
+
+static bool mips_trace_lz_get_length(const uint8_t *src, uint32_t packed, uint32_t *ip, uint32_t *length)
+{
+    uint8_t b;
+    do{
+        if(*ip>=packed)
+            return false;
+        b=src[(*ip)++];
+        *length+=b;
+    }while(b==255);
+    return true;
+}
+
+static bool mips_trace_lz_decompress(const uint8_t *src, uint32_t packed, uint8_t *dst, uint32_t length)
+{
+    uint32_t ip=0, op=0;
+    while(ip<packed){
+        uint8_t token=src[ip++];
+
+        uint32_t count=token>>4;
+        if((count==15) && !mips_trace_lz_get_length(src, packed, &ip, &count))
+            return false;
+        if((count>packed-ip) || (count>length-op))
+            return false;
+        memcpy(dst+op, src+ip, count);
+        ip+=count;
+        op+=count;
+        if(ip==packed)
+            break;
+
+        if(packed-ip<2)
+            return false;
+        uint32_t offset=uint32_t(src[ip]) | (uint32_t(src[ip+1])<<8);
+        ip+=2;
+        uint32_t match=token&15;
+        if((match==15) && !mips_trace_lz_get_length(src, packed, &ip, &match))
+            return false;
+        match+=MIPS_TRACE_LZ_MIN;
+        if((offset==0) || (offset>op) || (match>length-op))
+            return false;
+        // Byte by byte, the match may overlap what it is copying
+        for(uint32_t i=0; i<match; i++){
+            dst[op+i]=dst[op-offset+i];
+        }
+        op+=match;
+    }
+    return op==length;
+}
+
+//////////////////////////////////////////////////////////////////
+// Records
+
+static void mips_trace_state_begin_block(mips_trace_state *state)
+{
+    for(unsigned i=0; i<MIPS_TRACE_WORDS; i++){
+        state->word_pc[i]=1;
+    }
+}
+
+static uint8_t *mips_trace_encode(mips_trace_state *state, const mips_trace_record *r, uint8_t *out)
+{
+    uint32_t *key=state->key;
+    uint8_t *flags=out++;
+    *flags=0;
+
+    if(r->pc!=key[MIPS_TRACE_PC]){
+        *flags|=MIPS_TRACE_F_PC;
+        out=mips_trace_put_varint(out, mips_trace_zigzag(r->pc-key[MIPS_TRACE_PC]));
+    }
+    if(r->next_pc!=r->pc+4){
+        *flags|=MIPS_TRACE_F_NEXT;
+        out=mips_trace_put_varint(out, mips_trace_zigzag(r->next_pc-(r->pc+4)));
+    }
+    unsigned slot=(r->pc>>2)%MIPS_TRACE_WORDS;
+    if((state->word_pc[slot]!=r->pc) || (state->word[slot]!=r->word) || (state->word_op[slot]!=r->op)){
+        *flags|=MIPS_TRACE_F_WORD;
+        mips_trace_put32(out, r->word);
+        out[4]=r->op;
+        out+=5;
+        state->word_pc[slot]=r->pc;
+        state->word[slot]=r->word;
+        state->word_op[slot]=r->op;
+    }
+    unsigned rd=r->rd%32;
+    if(rd!=0){
+        *flags|=MIPS_TRACE_F_RD;
+        *out++=uint8_t(rd);
+        out=mips_trace_put_varint(out, mips_trace_zigzag(r->rd_value-key[MIPS_TRACE_REGS+rd]));
+        key[MIPS_TRACE_REGS+rd]=r->rd_value;
+    }
+    if((r->mem_address!=0) || (r->mem_data!=0)){
+        *flags|=MIPS_TRACE_F_MEM;
+        out=mips_trace_put_varint(out, mips_trace_zigzag(r->mem_address-key[MIPS_TRACE_MEM_ADDRESS]));
+        out=mips_trace_put_varint(out, mips_trace_zigzag(r->mem_data-key[MIPS_TRACE_MEM_DATA]));
+        key[MIPS_TRACE_MEM_ADDRESS]=r->mem_address;
+        key[MIPS_TRACE_MEM_DATA]=r->mem_data;
+    }
+    if((r->hi!=key[MIPS_TRACE_HI]) || (r->lo!=key[MIPS_TRACE_LO])){
+        *flags|=MIPS_TRACE_F_HILO;
+        out=mips_trace_put_varint(out, mips_trace_zigzag(r->hi-key[MIPS_TRACE_HI]));
+        out=mips_trace_put_varint(out, mips_trace_zigzag(r->lo-key[MIPS_TRACE_LO]));
+        key[MIPS_TRACE_HI]=r->hi;
+        key[MIPS_TRACE_LO]=r->lo;
+    }
+    if(r->error!=0){
+        *flags|=MIPS_TRACE_F_ERROR;
+        out=mips_trace_put_varint(out, r->error);
+    }
+    key[MIPS_TRACE_PC]=r->next_pc;
+    return out;
+}
+
+static bool mips_trace_decode(mips_trace_state *state, mips_trace_cursor &c, mips_trace_record *r)
+{
+    uint32_t *key=state->key;
+    uint8_t flags=mips_trace_get_byte(c);
+
+    r->pc=key[MIPS_TRACE_PC];
+    if(flags&MIPS_TRACE_F_PC){
+        r->pc+=mips_trace_unzigzag(mips_trace_get_varint(c));
+    }
+    r->next_pc=r->pc+4;
+    if(flags&MIPS_TRACE_F_NEXT){
+        r->next_pc+=mips_trace_unzigzag(mips_trace_get_varint(c));
+    }
+    unsigned slot=(r->pc>>2)%MIPS_TRACE_WORDS;
+    if(flags&MIPS_TRACE_F_WORD){
+        uint32_t word=0;
+        for(unsigned i=0; i<4; i++){
+            word|=uint32_t(mips_trace_get_byte(c))<<(8*i);
+        }
+        state->word_pc[slot]=r->pc;
+        state->word[slot]=word;
+        state->word_op[slot]=mips_trace_get_byte(c);
+    }else if(state->word_pc[slot]!=r->pc){
+        c.ok=false;
+    }
+    r->word=state->word[slot];
+    r->op=state->word_op[slot];
+    r->rd=0;
+    r->rd_value=0;
+    if(flags&MIPS_TRACE_F_RD){
+        unsigned rd=mips_trace_get_byte(c)%32;
+        key[MIPS_TRACE_REGS+rd]+=mips_trace_unzigzag(mips_trace_get_varint(c));
+        key[MIPS_TRACE_REGS]=0;
+        r->rd=uint8_t(rd);
+        r->rd_value=key[MIPS_TRACE_REGS+rd];
+    }
+    r->mem_address=0;
+    r->mem_data=0;
+    if(flags&MIPS_TRACE_F_MEM){
+        key[MIPS_TRACE_MEM_ADDRESS]+=mips_trace_unzigzag(mips_trace_get_varint(c));
+        key[MIPS_TRACE_MEM_DATA]+=mips_trace_unzigzag(mips_trace_get_varint(c));
+        r->mem_address=key[MIPS_TRACE_MEM_ADDRESS];
+        r->mem_data=key[MIPS_TRACE_MEM_DATA];
+    }
+    if(flags&MIPS_TRACE_F_HILO){
+        key[MIPS_TRACE_HI]+=mips_trace_unzigzag(mips_trace_get_varint(c));
+        key[MIPS_TRACE_LO]+=mips_trace_unzigzag(mips_trace_get_varint(c));
+    }
+    r->hi=key[MIPS_TRACE_HI];
+    r->lo=key[MIPS_TRACE_LO];
+    r->error=0;
+    if(flags&MIPS_TRACE_F_ERROR){
+        r->error=uint16_t(mips_trace_get_varint(c));
+    }
+    key[MIPS_TRACE_PC]=r->next_pc;
+    return c.ok;
+}
+
+//////////////////////////////////////////////////////////////////
+// Writer
+
+static mips_error mips_trace_write_bytes(mips_trace_writer_impl *writer, const void *data, size_t length)
+{
+    if((writer->error==mips_Success) && (fwrite(data, 1, length, writer->dest)!=length)){
+        writer->error=mips_ErrorFileWriteError;
+    }
+    return writer->error;
+}
+
+static mips_error mips_trace_writer_flush(mips_trace_writer_impl *writer)
+{
+    if(writer->block_records==0)
+        return writer->error;
+    if(writer->error!=mips_Success)
+        return writer->error;
+
+    if(writer->blocks==writer->index_capacity){
+        uint32_t capacity=writer->index_capacity ? 2*writer->index_capacity : 64;
+        mips_trace_index *index=(mips_trace_index*)realloc(writer->index, capacity*sizeof(mips_trace_index));
+        if(index==0){
+            writer->error=mips_ErrorFileWriteError;
+            return writer->error;
+        }
+        writer->index=index;
+        writer->index_capacity=capacity;
+    }
+    off_t offset=ftello(writer->dest);
+    if(offset<0){
+        writer->error=mips_ErrorFileWriteError;
+        return writer->error;
+    }
+    writer->index[writer->blocks].first=writer->records-writer->block_records;
+    writer->index[writer->blocks].offset=uint64_t(offset);
+    writer->blocks++;
+
+    uint32_t packed=mips_trace_lz_compress(writer->raw, writer->raw_used, writer->packed);
+    bool stored=(packed>=writer->raw_used);
+    uint8_t header[MIPS_TRACE_BLOCK_HEADER_SIZE];
+    mips_trace_put32(header, MIPS_TRACE_BLOCK_TAG);
+    mips_trace_put32(header+4, writer->raw_used);
+    mips_trace_put32(header+8, stored ? 0 : packed);
+    mips_trace_put32(header+12, writer->block_records);
+    mips_trace_write_bytes(writer, header, sizeof(header));
+    if(stored){
+        mips_trace_write_bytes(writer, writer->raw, writer->raw_used);
+    }else{
+        mips_trace_write_bytes(writer, writer->packed, packed);
+    }
+
+    writer->raw_used=0;
+    writer->block_records=0;
+    return writer->error;
+}
+
+mips_error mips_trace_writer_open(FILE *dest, uint32_t pc, uint32_t hi, uint32_t lo, const uint32_t *regs, mips_trace_writer_h *writer)
+{
+    if((dest==0) || (regs==0) || (writer==0))
+        return mips_ErrorInvalidArgument;
+
+    mips_trace_writer_impl *w=(mips_trace_writer_impl*)malloc(sizeof(mips_trace_writer_impl));
+    if(w==0)
+        return mips_ErrorFileWriteError;
+    w->raw=(uint8_t*)malloc(MIPS_TRACE_RAW_MAX);
+    w->packed=(uint8_t*)malloc(MIPS_TRACE_PACKED_MAX);
+    if((w->raw==0) || (w->packed==0)){
+        free(w->raw);
+        free(w->packed);
+        free(w);
+        return mips_ErrorFileWriteError;
+    }
+    w->dest=dest;
+    w->error=mips_Success;
+    w->raw_used=0;
+    w->block_records=0;
+    w->records=0;
+    w->index=0;
+    w->blocks=0;
+    w->index_capacity=0;
+
+    uint32_t *key=w->state.key;
+    key[MIPS_TRACE_PC]=pc;
+    key[MIPS_TRACE_HI]=hi;
+    key[MIPS_TRACE_LO]=lo;
+    for(unsigned i=0; i<32; i++){
+        key[MIPS_TRACE_REGS+i]=regs[i];
+    }
+    key[MIPS_TRACE_REGS]=0;
+    key[MIPS_TRACE_MEM_ADDRESS]=0;
+    key[MIPS_TRACE_MEM_DATA]=0;
+
+    uint8_t header[MIPS_TRACE_HEADER_SIZE];
+    memcpy(header, MIPS_TRACE_FILE_MAGIC, 8);
+    mips_trace_put32(header+8, MIPS_TRACE_BLOCK);
+    for(unsigned i=0; i<MIPS_TRACE_KEY_WORDS; i++){
+        mips_trace_put32(header+12+4*i, key[i]);
+    }
+    mips_error err=mips_trace_write_bytes(w, header, sizeof(header));
+    if(err!=mips_Success){
+        free(w->raw);
+        free(w->packed);
+        free(w);
+        return err;
+    }
+
+    *writer=w;
+    return mips_Success;
+}
+
+mips_error mips_trace_writer_write(mips_trace_writer_h writer, const mips_trace_record *records, uint32_t count)
+{
+    if((writer==0) || ((records==0) && (count!=0)))
+        return mips_ErrorInvalidArgument;
+
+    for(uint32_t i=0; (i<count) && (writer->error==mips_Success); i++){
+        if(writer->block_records==0){
+            for(unsigned k=0; k<MIPS_TRACE_KEY_WORDS; k++){
+                mips_trace_put32(writer->raw+4*k, writer->state.key[k]);
+            }
+            writer->raw_used=4*MIPS_TRACE_KEY_WORDS;
+            mips_trace_state_begin_block(&writer->state);
+        }
+        uint8_t *end=mips_trace_encode(&writer->state, &records[i], writer->raw+writer->raw_used);
+        writer->raw_used=uint32_t(end-writer->raw);
+        writer->block_records++;
+        writer->records++;
+        if(writer->block_records==MIPS_TRACE_BLOCK){
+            mips_trace_writer_flush(writer);
+        }
+    }
+    return writer->error;
+}
+
+mips_error mips_trace_writer_close(mips_trace_writer_h writer)
+{
+    if(writer==0)
+        return mips_ErrorInvalidArgument;
+
+    mips_trace_writer_flush(writer);
+    off_t offset=ftello(writer->dest);
+    if(offset<0)
+        writer->error=mips_ErrorFileWriteError;
+    for(uint32_t i=0; (i<writer->blocks) && (writer->error==mips_Success); i++){
+        uint8_t entry[16];
+        mips_trace_put64(entry, writer->index[i].first);
+        mips_trace_put64(entry+8, writer->index[i].offset);
+        mips_trace_write_bytes(writer, entry, sizeof(entry));
+    }
+    uint8_t footer[MIPS_TRACE_FOOTER_SIZE];
+    mips_trace_put64(footer, writer->records);
+    mips_trace_put64(footer+8, uint64_t(offset));
+    mips_trace_put32(footer+16, writer->blocks);
+    memcpy(footer+20, MIPS_TRACE_END_MAGIC, 8);
+    mips_trace_write_bytes(writer, footer, sizeof(footer));
+    if((writer->error==mips_Success) && (fflush(writer->dest)!=0))
+        writer->error=mips_ErrorFileWriteError;
+
+    mips_error err=writer->error;
+    free(writer->index);
+    free(writer->raw);
+    free(writer->packed);
+    free(writer);
+    return err;
+}
+
+//////////////////////////////////////////////////////////////////
+// Reader
+
+static bool mips_trace_read_at(FILE *src, uint64_t offset, void *data, size_t length)
+{
+    if(fseeko(src, off_t(offset), SEEK_SET)!=0)
+        return false;
+    return fread(data, 1, length, src)==length;
+}
+
+static bool mips_trace_reader_add_block(mips_trace_reader_impl *reader, uint32_t *capacity, uint64_t first, uint64_t offset)
+{
+    if(reader->blocks==*capacity){
+        *capacity=*capacity ? 2**capacity : 64;
+        mips_trace_index *index=(mips_trace_index*)realloc(reader->index, *capacity*sizeof(mips_trace_index));
+        if(index==0)
+            return false;
+        reader->index=index;
+    }
+    reader->index[reader->blocks].first=first;
+    reader->index[reader->blocks].offset=offset;
+    reader->blocks++;
+    return true;
+}
+
+// Reads a block header, checking that it is one and that the block fits in the file
+static bool mips_trace_read_block_header(FILE *src, uint64_t offset, uint64_t end, uint32_t *raw, uint32_t *packed, uint32_t *count)
+{
+    uint8_t header[MIPS_TRACE_BLOCK_HEADER_SIZE];
+    if((offset+MIPS_TRACE_BLOCK_HEADER_SIZE>end) || !mips_trace_read_at(src, offset, header, sizeof(header)))
+        return false;
+    *raw=mips_trace_get32(header+4);
+    *packed=mips_trace_get32(header+8);
+    *count=mips_trace_get32(header+12);
+    uint32_t stored=*packed ? *packed : *raw;
+    return (mips_trace_get32(header)==MIPS_TRACE_BLOCK_TAG)
+        && (*raw<=MIPS_TRACE_RAW_MAX) && (*packed<=MIPS_TRACE_PACKED_MAX)
+        && (*count>0) && (*count<=MIPS_TRACE_BLOCK)
+        && (offset+MIPS_TRACE_BLOCK_HEADER_SIZE+stored<=end);
+}
+
+// Uses the index at the end of the file, or walks the blocks if there is none
+static bool mips_trace_reader_load_index(mips_trace_reader_impl *reader, uint64_t first_block, uint64_t end)
+{
+    uint32_t capacity=0;
+    uint8_t footer[MIPS_TRACE_FOOTER_SIZE];
+    if((end>=first_block+MIPS_TRACE_FOOTER_SIZE)
+        && mips_trace_read_at(reader->src, end-MIPS_TRACE_FOOTER_SIZE, footer, sizeof(footer))
+        && (memcmp(footer+20, MIPS_TRACE_END_MAGIC, 8)==0)){
+        uint64_t records=mips_trace_get64(footer);
+        uint64_t offset=mips_trace_get64(footer+8);
+        uint32_t blocks=mips_trace_get32(footer+16);
+        if((offset>=first_block) && (offset+16*uint64_t(blocks)+MIPS_TRACE_FOOTER_SIZE==end)){
+            bool ok=true;
+            for(uint32_t i=0; (i<blocks) && ok; i++){
+                uint8_t entry[16];
+                ok=mips_trace_read_at(reader->src, offset+16*uint64_t(i), entry, sizeof(entry))
+                    && mips_trace_reader_add_block(reader, &capacity, mips_trace_get64(entry), mips_trace_get64(entry+8));
+            }
+            if(ok){
+                reader->records=records;
+                return true;
+            }
+            reader->blocks=0;
+        }
+    }
+
+    uint64_t offset=first_block;
+    uint64_t records=0;
+    uint32_t raw, packed, count;
+    while(mips_trace_read_block_header(reader->src, offset, end, &raw, &packed, &count)){
+        if(!mips_trace_reader_add_block(reader, &capacity, records, offset))
+            return false;
+        records+=count;
+        offset+=MIPS_TRACE_BLOCK_HEADER_SIZE+(packed ? packed : raw);
+    }
+    reader->records=records;
+    return true;
+}
+
+mips_error mips_trace_reader_open(FILE *src, mips_trace_reader_h *reader)
+{
+    if((src==0) || (reader==0))
+        return mips_ErrorInvalidArgument;
+
+    off_t start=ftello(src);
+    uint8_t header[MIPS_TRACE_HEADER_SIZE];
+    if((start<0) || (fread(header, 1, sizeof(header), src)!=sizeof(header)))
+        return mips_ErrorFileReadError;
+    if((memcmp(header, MIPS_TRACE_FILE_MAGIC, 8)!=0) || (mips_trace_get32(header+8)!=MIPS_TRACE_BLOCK))
+        return mips_ErrorFileReadError;
+    if(fseeko(src, 0, SEEK_END)!=0)
+        return mips_ErrorFileReadError;
+    off_t end=ftello(src);
+    if(end<0)
+        return mips_ErrorFileReadError;
+
+    mips_trace_reader_impl *r=(mips_trace_reader_impl*)malloc(sizeof(mips_trace_reader_impl));
+    if(r==0)
+        return mips_ErrorFileReadError;
+    r->src=src;
+    r->index=0;
+    r->blocks=0;
+    r->records=0;
+    r->raw=(uint8_t*)malloc(MIPS_TRACE_RAW_MAX);
+    r->packed=(uint8_t*)malloc(MIPS_TRACE_PACKED_MAX);
+    r->block=0;
+    r->position=0;
+    for(unsigned i=0; i<MIPS_TRACE_KEY_WORDS; i++){
+        r->start[i]=mips_trace_get32(header+12+4*i);
+    }
+    if((r->raw==0) || (r->packed==0) || !mips_trace_reader_load_index(r, uint64_t(start)+MIPS_TRACE_HEADER_SIZE, uint64_t(end))){
+        mips_trace_reader_close(r);
+        return mips_ErrorFileReadError;
+    }
+    r->block=r->blocks;
+
+    mips_error err=mips_trace_reader_seek(r, 0);
+    if(err!=mips_Success){
+        mips_trace_reader_close(r);
+        return err;
+    }
+    *reader=r;
+    return mips_Success;
+}
+
+uint64_t mips_trace_reader_get_count(mips_trace_reader_h reader)
+{
+    return reader ? reader->records : 0;
+}
+
+static mips_error mips_trace_reader_load_block(mips_trace_reader_impl *reader, uint32_t block)
+{
+    reader->block=reader->blocks;
+    uint32_t raw, packed, count;
+    uint64_t offset=reader->index[block].offset;
+    if(!mips_trace_read_block_header(reader->src, offset, UINT64_MAX, &raw, &packed, &count))
+        return mips_ErrorFileReadError;
+    if(raw<4*MIPS_TRACE_KEY_WORDS)
+        return mips_ErrorFileReadError;
+
+    offset+=MIPS_TRACE_BLOCK_HEADER_SIZE;
+    if(packed==0){
+        if(!mips_trace_read_at(reader->src, offset, reader->raw, raw))
+            return mips_ErrorFileReadError;
+    }else{
+        if(!mips_trace_read_at(reader->src, offset, reader->packed, packed))
+            return mips_ErrorFileReadError;
+        if(!mips_trace_lz_decompress(reader->packed, packed, reader->raw, raw))
+            return mips_ErrorFileReadError;
+    }
+
+    for(unsigned i=0; i<MIPS_TRACE_KEY_WORDS; i++){
+        reader->state.key[i]=mips_trace_get32(reader->raw+4*i);
+    }
+    mips_trace_state_begin_block(&reader->state);
+    reader->raw_used=raw;
+    reader->raw_pos=4*MIPS_TRACE_KEY_WORDS;
+    reader->block=block;
+    reader->position=reader->index[block].first;
+    return mips_Success;
+}
+
+// Number of records in a block, from the index
+static uint64_t mips_trace_reader_block_end(mips_trace_reader_impl *reader, uint32_t block)
+{
+    return (block+1<reader->blocks) ? reader->index[block+1].first : reader->records;
+}
+
+mips_error mips_trace_reader_seek(mips_trace_reader_h reader, uint64_t index)
+{
+    if(reader==0)
+        return mips_ErrorInvalidHandle;
+    if(index>reader->records)
+        return mips_ErrorInvalidArgument;
+
+    if(reader->blocks==0){
+        memcpy(reader->state.key, reader->start, sizeof(reader->start));
+        reader->block=0;
+        reader->position=0;
+        return mips_Success;
+    }
+
+    // Last block starting at or before index
+    uint32_t low=0, high=reader->blocks;
+    while(high-low>1){
+        uint32_t mid=(low+high)/2;
+        if(reader->index[mid].first<=index){
+            low=mid;
+        }else{
+            high=mid;
+        }
+    }
+    if((reader->block!=low) || (reader->position>index)){
+        mips_error err=mips_trace_reader_load_block(reader, low);
+        if(err!=mips_Success)
+            return err;
+    }
+
+    mips_trace_record skipped;
+    while(reader->position<index){
+        uint32_t got;
+        mips_error err=mips_trace_reader_read(reader, &skipped, 1, &got);
+        if(err!=mips_Success)
+            return err;
+        if(got==0)
+            return mips_ErrorFileReadError;
+    }
+    return mips_Success;
+}
+
+mips_error mips_trace_reader_read(mips_trace_reader_h reader, mips_trace_record *records, uint32_t count, uint32_t *got)
+{
+    if((reader==0) || (got==0) || ((records==0) && (count!=0)))
+        return mips_ErrorInvalidArgument;
+
+    *got=0;
+    while((*got<count) && (reader->position<reader->records)){
+        if((reader->block>=reader->blocks) || (reader->position>=mips_trace_reader_block_end(reader, reader->block))){
+            uint32_t next=(reader->block>=reader->blocks) ? 0 : reader->block+1;
+            mips_error err=mips_trace_reader_load_block(reader, next);
+            if(err!=mips_Success)
+                return err;
+        }
+        mips_trace_cursor c={reader->raw+reader->raw_pos, reader->raw+reader->raw_used, true};
+        if(!mips_trace_decode(&reader->state, c, &records[*got])){
+            reader->block=reader->blocks;
+            return mips_ErrorFileReadError;
+        }
+        reader->raw_pos=uint32_t(c.p-reader->raw);
+        reader->position++;
+        (*got)++;
+    }
+    return mips_Success;
+}
+
+mips_error mips_trace_reader_get_registers(mips_trace_reader_h reader, uint32_t *regs)
+{
+    if((reader==0) || (regs==0))
+        return mips_ErrorInvalidArgument;
+    for(unsigned i=0; i<32; i++){
+        regs[i]=reader->state.key[MIPS_TRACE_REGS+i];
+    }
+    return mips_Success;
+}
+
+void mips_trace_reader_close(mips_trace_reader_h reader)
+{
+    if(reader==0)
+        return;
+    free(reader->index);
+    free(reader->raw);
+    free(reader->packed);
+    free(reader);
+}
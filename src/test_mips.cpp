@@ -19,9 +19,26 @@ The tests in "mips_cpu_instructions.txt" are organized:
 #include <vector>
 #include <string>
 #include <sstream>
+#include <new>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
 
 using namespace std;
 
+//Counts every heap allocation made by the test bench and the CPU, on any thread
+static atomic<unsigned long> allocation_count(0);
+void* operator new(size_t size){
+  ++allocation_count;
+  void* p = malloc(size ? size : 1);
+  if (p == 0)
+    throw bad_alloc();
+  return p;
+}
+void operator delete(void* p) noexcept{
+  free(p);
+}
+
 //Struct to hold and parse the test parameters included in the file
 struct test{
   uint32_t instruction_code;
@@ -84,6 +101,13 @@ void print_registers(const uint32_t *array){
   }
   cout<<endl;
 }
+//Stores a big-endian value into a buffer, used to build test images
+void put_be(vector<uint8_t>& buffer, uint32_t offset, uint32_t value, unsigned bytes){
+  if (buffer.size() < offset + bytes)
+    buffer.resize(offset + bytes, 0);
+  for (unsigned i = 0; i < bytes; ++i)
+    buffer[offset + i] = uint8_t(value >> (8 * (bytes - 1 - i)));
+}
 //Load the registers from the CPU
 void load_registers(uint32_t* array, mips_cpu_h cpu){
   for (size_t i = 0; i < 32; i++) {
@@ -93,6 +117,72 @@ void load_registers(uint32_t* array, mips_cpu_h cpu){
     delete reg;
   }
 }
+//Device for the bus test: the word at 0 counts up on every read, the word at 4 keeps the last write
+struct test_device{
+  uint32_t next;
+  uint32_t written;
+  unsigned reads;
+};
+mips_error test_device_read(void* context, uint32_t offset, uint32_t length, uint8_t* dataOut){
+  test_device* device = (test_device*)context;
+  if ((offset != 0) || (length != 4))
+    return mips_ExceptionInvalidAddress;
+  uint32_t value = device->next++;
+  ++device->reads;
+  for (unsigned i = 0; i < 4; ++i)
+    dataOut[i] = uint8_t(value >> (8 * (3 - i)));
+  return mips_Success;
+}
+mips_error test_device_write(void* context, uint32_t offset, uint32_t length, const uint8_t* dataIn){
+  test_device* device = (test_device*)context;
+  if ((offset != 4) || (length != 4))
+    return mips_ExceptionInvalidAddress;
+  device->written = (uint32_t(dataIn[0]) << 24) | (uint32_t(dataIn[1]) << 16) | (uint32_t(dataIn[2]) << 8) | dataIn[3];
+  return mips_Success;
+}
+
+//Loop used to compare the ways of running code: it stores and loads back in every iteration,
+//and rewrites one of its own instructions halfway (addiu r11, r11, 100 becomes addiu r11, r11, 1)
+static const uint32_t sg_loop[16] = {
+  0x00A12821, 0x00013080, 0x00C43021, 0xACC50000, //addu r5, r5, r1 ; sll r6, r1, 2 ; addu r6, r6, r4 ; sw r5, 0(r6)
+  0x8CC70000, 0x01074026, 0x382D0032, 0x2DAD0001, //lw r7, 0(r6) ; xor r8, r8, r7 ; xori r13, r1, 50 ; sltiu r13, r13, 1
+  0x000D7340, 0x01EE5023, 0xAD490000, 0x256B0064, //sll r14, r13, 13 ; subu r10, r15, r14 ; sw r9, 0(r10) ; addiu r11, r11, 100
+  0x24210001, 0x1422FFF2, 0x24630002, 0xFC000000  //addiu r1, r1, 1 ; bne r1, r2, loop ; addiu r3, r3, 2 ; invalid
+};
+//Bytes from the start of the loop up to the word it stores over the loop before it reaches 50
+#define LOOP_MEMORY 0x2040
+
+//Runs sg_loop on a new CPU until the invalid instruction, mode 0 steps, 1 runs blocks, 2 runs blocks with the JIT
+//regs gets R0-R31 and then the PC, data the memory from the loop on
+static mips_error run_loop(unsigned mode, uint32_t* regs, uint8_t* data, uint64_t* steps){
+  mips_mem_h mem = mips_mem_create_ram(0x4000);
+  for (unsigned i = 0; i < 16; ++i){
+    uint8_t word[4] = {uint8_t(sg_loop[i] >> 24), uint8_t(sg_loop[i] >> 16), uint8_t(sg_loop[i] >> 8), uint8_t(sg_loop[i])};
+    mips_mem_write(mem, 0x1000 + 4 * i, 4, word);
+  }
+  mips_cpu_h cpu = mips_cpu_create(mem);
+  mips_cpu_set_pc(cpu, 0x1000);
+  mips_cpu_set_register(cpu, 2, 100);
+  mips_cpu_set_register(cpu, 4, 0x2000);
+  mips_cpu_set_register(cpu, 9, 0x256B0001);
+  mips_cpu_set_register(cpu, 15, 0x302C);
+  mips_cpu_set_jit(cpu, mode == 2);
+  mips_error err = mips_Success;
+  *steps = 0;
+  if (mode == 0){
+    while ((err = mips_cpu_step(cpu)) == mips_Success)
+      ++*steps;
+  } else {
+    err = mips_cpu_run(cpu, 100000, steps);
+  }
+  load_registers(regs, cpu);
+  mips_cpu_get_pc(cpu, &regs[32]);
+  for (unsigned i = 0; i < LOOP_MEMORY; i += 4)
+    mips_mem_read(mem, 0x1000 + i, 4, data + i);
+  mips_cpu_free(cpu);
+  mips_mem_free(mem);
+  return err;
+}
 
 int main(){
   mips_test_begin_suite();
@@ -161,6 +251,1198 @@ int main(){
   else
     mips_test_end_test(testId, false, "Registers are non-zero");
   delete v;
+  //ENDTEST
+
+  //Test #6 Overwriting an instruction that has already been executed
+  testId = mips_test_begin_test("<INTERNAL>");
+  {
+    uint8_t addu[4] = {0x00, 0x43, 0x08, 0x21};
+    uint8_t subu[4] = {0x00, 0x43, 0x08, 0x23};
+    uint32_t got = 0;
+    mips_cpu_set_register(cpu, 2, 10);
+    mips_cpu_set_register(cpu, 3, 3);
+    mips_mem_write(mem, 0, 4, addu);
+    mips_cpu_step(cpu);
+    mips_mem_write(mem, 0, 4, subu);
+    mips_cpu_set_pc(cpu, 0);
+    mips_cpu_step(cpu);
+    mips_cpu_get_register(cpu, 1, &got);
+    if (got == 7)
+      mips_test_end_test(testId, true, "Modified instruction executed");
+    else
+      mips_test_end_test(testId, false, "Stale instruction executed");
+    mips_cpu_reset(cpu);
+  }
+  //ENDTEST
+
+  //Test #7 Blocks run a loop like single steps, including the instruction it rewrites
+  testId = mips_test_begin_test("<INTERNAL>");
+  {
+    uint32_t stepped[33], blocks[33];
+    uint8_t stepped_data[LOOP_MEMORY], blocks_data[LOOP_MEMORY];
+    uint64_t stepped_steps = 0, blocks_steps = 0;
+    mips_error stepped_err = run_loop(0, stepped, stepped_data, &stepped_steps);
+    mips_error blocks_err = run_loop(1, blocks, blocks_data, &blocks_steps);
+    bool ok = (stepped_err == mips_ExceptionInvalidInstruction) && (stepped_steps == 1500) && (stepped[32] == 0x103C) && (stepped[11] == 5050);
+    ok = ok && (blocks_err == stepped_err) && (blocks_steps == stepped_steps) &&
+      !memcmp(blocks, stepped, sizeof(stepped)) && !memcmp(blocks_data, stepped_data, LOOP_MEMORY);
+    if (ok)
+      mips_test_end_test(testId, true, "Blocks ran the loop like single steps");
+    else
+      mips_test_end_test(testId, false, "Blocks and single steps differ");
+  }
+  //ENDTEST
+  //Test #8 Native code runs the loop like the interpreted blocks, and leaves its block when the loop rewrites it
+  testId = mips_test_begin_test("<INTERNAL>");
+  {
+    uint32_t blocks[33], native[33];
+    uint8_t blocks_data[LOOP_MEMORY], native_data[LOOP_MEMORY];
+    uint64_t blocks_steps = 0, native_steps = 0;
+    mips_error blocks_err = run_loop(1, blocks, blocks_data, &blocks_steps);
+    mips_error native_err = run_loop(2, native, native_data, &native_steps);
+    bool ok = (blocks_err == mips_ExceptionInvalidInstruction) && (blocks_steps == 1500) && (blocks[11] == 5050);
+    ok = ok && (native_err == blocks_err) && (native_steps == blocks_steps) &&
+      !memcmp(native, blocks, sizeof(blocks)) && !memcmp(native_data, blocks_data, LOOP_MEMORY);
+    if (ok)
+      mips_test_end_test(testId, true, "JIT ran the loop like the interpreter");
+    else
+      mips_test_end_test(testId, false, "JIT and interpreter differ");
+  }
+  //ENDTEST
+
+  //Test #9 Running several instructions at once
+  testId = mips_test_begin_test("<INTERNAL>");
+  {
+    //addiu r1, r0, 5 ; addiu r1, r1, 1 ; addiu r1, r1, 1
+    uint8_t program[12] = {0x24, 0x01, 0x00, 0x05, 0x24, 0x21, 0x00, 0x01, 0x24, 0x21, 0x00, 0x01};
+    uint64_t steps_first = 0, steps_second = 0;
+    uint32_t got = 0, pc = 0;
+    for (int i = 0; i < 3; ++i)
+      mips_mem_write(mem, 0x800 + 4*i, 4, program + 4*i);
+    mips_cpu_set_pc(cpu, 0x800);
+    mips_error err_first = mips_cpu_run(cpu, 1, &steps_first);
+    mips_error err_second = mips_cpu_run_until(cpu, 0x808, 100, &steps_second);
+    mips_cpu_get_register(cpu, 1, &got);
+    mips_cpu_get_pc(cpu, &pc);
+    if ((err_first == mips_Success) && (err_second == mips_Success) && (steps_first == 1) && (steps_second == 1) && (got == 6) && (pc == 0x808))
+      mips_test_end_test(testId, true, "Run stopped at budget and at stop PC");
+    else
+      mips_test_end_test(testId, false, "Run did not stop where expected");
+    mips_cpu_reset(cpu);
+  }
+  //ENDTEST
+
+  //Test #10 Stepping does not allocate once the code has been seen
+  testId = mips_test_begin_test("<INTERNAL>");
+  {
+    //loop: addiu r1, r1, 1 ; beq r0, r0, loop ; nop
+    uint8_t program[12] = {0x24, 0x21, 0x00, 0x01, 0x10, 0x00, 0xFF, 0xFE, 0x00, 0x00, 0x00, 0x00};
+    uint64_t steps = 0;
+    for (int i = 0; i < 3; ++i)
+      mips_mem_write(mem, 0x900 + 4*i, 4, program + 4*i);
+    mips_cpu_set_pc(cpu, 0x900);
+    for (int i = 0; i < 30; ++i)
+      mips_cpu_step(cpu);
+    mips_cpu_run(cpu, 30, &steps);
+    unsigned long before = allocation_count;
+    for (int i = 0; i < 3000; ++i)
+      mips_cpu_step(cpu);
+    mips_cpu_run(cpu, 3000, &steps);
+    unsigned long allocations = allocation_count - before;
+    if (allocations == 0)
+      mips_test_end_test(testId, true, "No allocations per step");
+    else
+      mips_test_end_test(testId, false, "Step allocated memory");
+    mips_cpu_reset(cpu);
+  }
+  //ENDTEST
+
+  //Test #11 Word and block access agree with the big-endian byte layout
+  testId = mips_test_begin_test("<INTERNAL>");
+  {
+    uint8_t bytes[4] = {0, 0, 0, 0};
+    uint8_t patch[3] = {0xAA, 0xBB, 0xCC};
+    uint16_t half = 0;
+    uint32_t word = 0;
+    mips_mem_write32(mem, 0xA00, 0x12345678);
+    mips_mem_read_block(mem, 0xA00, 4, bytes);
+    mips_mem_read16(mem, 0xA02, &half);
+    bool ok = (bytes[0] == 0x12) && (bytes[1] == 0x34) && (bytes[2] == 0x56) && (bytes[3] == 0x78) && (half == 0x5678);
+    mips_mem_write_block(mem, 0xA01, 3, patch);
+    mips_mem_read32(mem, 0xA00, &word);
+    ok = ok && (word == 0x12AABBCC);
+    ok = ok && (mips_mem_read32(mem, 0xA02, &word) == mips_ExceptionInvalidAlignment);
+    ok = ok && (mips_mem_write_block(mem, 4094, 4, bytes) == mips_ExceptionInvalidAddress);
+    if (ok)
+      mips_test_end_test(testId, true, "Word and block access consistent");
+    else
+      mips_test_end_test(testId, false, "Word and block access inconsistent");
+  }
+  //ENDTEST
+
+  //Test #12 Code written through a page the CPU already stored to
+  testId = mips_test_begin_test("<INTERNAL>");
+  {
+    mips_mem_h mem2 = mips_mem_create_ram(8192);
+    mips_cpu_h cpu2 = mips_cpu_create(mem2);
+    //sw r2, 0x1000(r0) ; sw r4, 0x1000(r0)
+    uint8_t program[8] = {0xAC, 0x02, 0x10, 0x00, 0xAC, 0x04, 0x10, 0x00};
+    uint32_t got = 0;
+    mips_mem_write_block(mem2, 0, 8, program);
+    mips_cpu_set_register(cpu2, 2, 0x00430821); //addu r1, r2, r3
+    mips_cpu_set_register(cpu2, 3, 3);
+    mips_cpu_set_register(cpu2, 4, 0x00430823); //subu r1, r2, r3
+    mips_cpu_step(cpu2);
+    mips_cpu_set_pc(cpu2, 0x1000);
+    mips_cpu_step(cpu2);
+    mips_cpu_set_pc(cpu2, 4);
+    mips_cpu_step(cpu2);
+    mips_cpu_set_pc(cpu2, 0x1000);
+    mips_cpu_step(cpu2);
+    mips_cpu_get_register(cpu2, 1, &got);
+    if (got == 0x00430821 - 3)
+      mips_test_end_test(testId, true, "Store to a mapped page changed the code");
+    else
+      mips_test_end_test(testId, false, "Store to a mapped page missed the code");
+    mips_cpu_free(cpu2);
+    mips_mem_free(mem2);
+  }
+  //ENDTEST
+
+  //Test #13 Sparse memory only holds the pages that were touched
+  testId = mips_test_begin_test("<INTERNAL>");
+  {
+    mips_mem_h mem2 = mips_mem_create_sparse();
+    mips_cpu_h cpu2 = mips_cpu_create(mem2);
+    //sw r2, -4(r29) ; lw r1, -4(r29)
+    uint8_t program[8] = {0xAF, 0xA2, 0xFF, 0xFC, 0x8F, 0xA1, 0xFF, 0xFC};
+    uint32_t got = 0, untouched = 1, pages = 0;
+    mips_mem_write_block(mem2, 0x40000000, 8, program);
+    mips_cpu_set_pc(cpu2, 0x40000000);
+    mips_cpu_set_register(cpu2, 2, 0xCAFEF00D);
+    mips_cpu_set_register(cpu2, 29, 0x7FFFFFF0);
+    mips_cpu_step(cpu2);
+    mips_cpu_step(cpu2);
+    mips_cpu_get_register(cpu2, 1, &got);
+    mips_mem_read32(mem2, 0xC0000000, &untouched);
+    mips_mem_get_resident_pages(mem2, &pages);
+    if ((got == 0xCAFEF00D) && (untouched == 0) && (pages == 2))
+      mips_test_end_test(testId, true, "Two pages resident");
+    else
+      mips_test_end_test(testId, false, "Unexpected resident pages");
+    mips_cpu_free(cpu2);
+    mips_mem_free(mem2);
+  }
+  //ENDTEST
+
+  //Test #14 RAM mapped from an image file
+  testId = mips_test_begin_test("<INTERNAL>");
+  {
+    //addiu r1, r0, 42
+    uint8_t image[4] = {0x24, 0x01, 0x00, 0x2A};
+    uint8_t check[4] = {0, 0, 0, 0};
+    FILE* file = fopen("mips_mem_file_test.bin", "wb");
+    fwrite(image, 1, 4, file);
+    fclose(file);
+    mips_mem_h mem2 = mips_mem_create_file("mips_mem_file_test.bin", 0x10000, 0x2000);
+    mips_cpu_h cpu2 = mips_cpu_create(mem2);
+    uint32_t got = 0, tail = 1;
+    mips_cpu_set_pc(cpu2, 0x10000);
+    mips_cpu_step(cpu2);
+    mips_cpu_get_register(cpu2, 1, &got);
+    mips_mem_read32(mem2, 0x11FFC, &tail);
+    bool ok = (got == 42) && (tail == 0);
+    ok = ok && (mips_mem_read32(mem2, 0xFFFC, &tail) == mips_ExceptionInvalidAddress);
+    ok = ok && (mips_mem_read32(mem2, 0x12000, &tail) == mips_ExceptionInvalidAddress);
+    ok = ok && (mips_mem_write32(mem2, 0x10000, 0) == mips_Success);
+    mips_cpu_free(cpu2);
+    mips_mem_free(mem2);
+    file = fopen("mips_mem_file_test.bin", "rb");
+    ok = ok && (fread(check, 1, 4, file) == 4) && (check[3] == 0x2A);
+    fclose(file);
+    remove("mips_mem_file_test.bin");
+    if (ok)
+      mips_test_end_test(testId, true, "Image mapped and left unchanged");
+    else
+      mips_test_end_test(testId, false, "Image mapping error");
+  }
+  //ENDTEST
+
+  //Test #15 Loading an ELF executable with .bss and symbols
+  testId = mips_test_begin_test("<INTERNAL>");
+  {
+    vector<uint8_t> elf;
+    //ELF header: ELF32, big-endian, executable, MIPS
+    put_be(elf, 0, 0x7F454C46, 4); put_be(elf, 4, 0x01020100, 4);
+    put_be(elf, 16, 2, 2); put_be(elf, 18, 8, 2); put_be(elf, 20, 1, 4);
+    put_be(elf, 24, 0x400, 4); put_be(elf, 28, 52, 4); put_be(elf, 32, 152, 4);
+    put_be(elf, 40, 52, 2); put_be(elf, 42, 32, 2); put_be(elf, 44, 1, 2);
+    put_be(elf, 46, 40, 2); put_be(elf, 48, 3, 2); put_be(elf, 50, 2, 2);
+    //PT_LOAD: 8 bytes of code at 0x400, 0x20 bytes in memory
+    put_be(elf, 52, 1, 4); put_be(elf, 56, 84, 4); put_be(elf, 60, 0x400, 4);
+    put_be(elf, 68, 8, 4); put_be(elf, 72, 0x20, 4);
+    put_be(elf, 84, 0x24010007, 4); put_be(elf, 88, 0, 4); //addiu r1, r0, 7 ; nop
+    //String table and symbol table (null, _gp, main)
+    const char names[] = "\0_gp\0main";
+    for (unsigned i = 0; i < sizeof(names); ++i)
+      put_be(elf, 92 + i, uint8_t(names[i]), 1);
+    put_be(elf, 120, 1, 4); put_be(elf, 124, 0x8000, 4);
+    put_be(elf, 136, 5, 4); put_be(elf, 140, 0x400, 4); put_be(elf, 144, 8, 4);
+    //Section headers: null, .symtab, .strtab
+    put_be(elf, 196, 2, 4); put_be(elf, 208, 104, 4); put_be(elf, 212, 48, 4); put_be(elf, 216, 2, 4);
+    put_be(elf, 236, 3, 4); put_be(elf, 248, 92, 4); put_be(elf, 252, 11, 4);
+    put_be(elf, 271, 0, 1);
+
+    FILE* file = fopen("mips_elf_test", "wb");
+    fwrite(&elf[0], 1, elf.size(), file);
+    fclose(file);
+
+    mips_mem_h mem2 = mips_mem_create_ram(4096);
+    mips_cpu_h cpu2 = mips_cpu_create(mem2);
+    mips_elf_h loaded = 0;
+    uint32_t pc = 0, sp = 0, gp = 0, bss = 1, main_addr = 0, got = 0;
+    mips_mem_write32(mem2, 0x40C, 0xFFFFFFFF);
+    mips_error err_load = mips_elf_load(cpu2, mem2, "mips_elf_test", 0x1000, &loaded);
+    mips_cpu_get_pc(cpu2, &pc);
+    mips_cpu_get_register(cpu2, 29, &sp);
+    mips_cpu_get_register(cpu2, 28, &gp);
+    mips_mem_read32(mem2, 0x40C, &bss);
+    mips_elf_find_symbol(loaded, "main", &main_addr);
+    mips_cpu_step(cpu2);
+    mips_cpu_get_register(cpu2, 1, &got);
+    bool ok = (err_load == mips_Success) && (pc == 0x400) && (sp == 0x1000) && (gp == 0x8000) && (bss == 0);
+    ok = ok && (main_addr == 0x400) && (mips_elf_get_symbol_count(loaded) == 2) && (got == 7);
+    ok = ok && (mips_elf_load(cpu2, mem2, "mips_cpu_instructions.txt", 0x1000, NULL) == mips_ErrorInvalidArgument);
+    ok = ok && (mips_elf_load(cpu2, mem2, "no_such_file", 0x1000, NULL) == mips_ErrorFileReadError);
+    put_be(elf, 16, 1, 2); //A relocatable object is not an executable
+    file = fopen("mips_elf_test", "wb");
+    fwrite(&elf[0], 1, elf.size(), file);
+    fclose(file);
+    ok = ok && (mips_elf_load(cpu2, mem2, "mips_elf_test", 0x1000, NULL) == mips_ErrorInvalidArgument);
+    mips_elf_free(loaded);
+    mips_cpu_free(cpu2);
+    mips_mem_free(mem2);
+    remove("mips_elf_test");
+    if (ok)
+      mips_test_end_test(testId, true, "Executable loaded");
+    else
+      mips_test_end_test(testId, false, "Executable load error");
+  }
+  //ENDTEST
+
+  //Test #16 Running independent CPUs on several threads
+  testId = mips_test_begin_test("<INTERNAL>");
+  {
+    //loop: addiu r1, r1, 1 ; bne r1, r2, loop ; nop
+    uint8_t program[12] = {0x24, 0x21, 0x00, 0x01, 0x14, 0x22, 0xFF, 0xFE, 0x00, 0x00, 0x00, 0x00};
+    const unsigned count = 12;
+    vector<mips_cpu_job> jobs(count);
+    vector<mips_mem_h> mems(count);
+    for (unsigned i = 0; i < count; ++i){
+      mems[i] = mips_mem_create_sparse();
+      jobs[i].cpu = mips_cpu_create(mems[i]);
+      mips_mem_write_block(mems[i], 0, 12, program);
+      mips_cpu_set_register(jobs[i].cpu, 2, 1000 * (i + 1));
+      jobs[i].max_steps = 1000000;
+      jobs[i].use_stop_pc = 1;
+      jobs[i].stop_pc = 12;
+    }
+    bool ok = (mips_cpu_run_batch(&jobs[0], count, 3) == mips_Success);
+    for (unsigned i = 0; i < count; ++i){
+      uint32_t got = 0;
+      mips_cpu_get_register(jobs[i].cpu, 1, &got);
+      ok = ok && (jobs[i].result == mips_Success) && (got == 1000 * (i + 1)) && (jobs[i].steps == 3000 * (i + 1));
+      mips_cpu_free(jobs[i].cpu);
+      mips_mem_free(mems[i]);
+    }
+    if (ok)
+      mips_test_end_test(testId, true, "Every job ran to its stop PC");
+    else
+      mips_test_end_test(testId, false, "Batch results wrong");
+  }
+  //ENDTEST
+
+  //Test #17 CPUs sharing a counter through LL/SC, taking turns and on threads
+  testId = mips_test_begin_test("<INTERNAL>");
+  {
+    //loop: ll r1, 0(r4) ; addiu r1, r1, 1 ; sc r1, 0(r4) ; beq r1, r0, loop ; nop
+    //      addiu r3, r3, -1 ; bne r3, r0, loop ; nop
+    const uint32_t program[8] = {0xC0810000, 0x24210001, 0xE0810000, 0x1020FFFC,
+                                 0x00000000, 0x2463FFFF, 0x1460FFF9, 0x00000000};
+    const unsigned count = 4;
+    const uint32_t iterations = 5000;
+    bool ok = true;
+    for (unsigned quantum = 0; quantum <= 5; quantum += 5){
+      mips_mem_h shared = mips_mem_create_ram(0x2000);
+      for (unsigned i = 0; i < 8; ++i)
+        mips_mem_write32(shared, i * 4, program[i]);
+      mips_mem_write32(shared, 0x1000, 0); //The RAM starts uninitialised
+      vector<mips_cpu_job> jobs(count);
+      for (unsigned i = 0; i < count; ++i){
+        jobs[i].cpu = mips_cpu_create(shared);
+        mips_cpu_set_register(jobs[i].cpu, 3, iterations);
+        mips_cpu_set_register(jobs[i].cpu, 4, 0x1000);
+        jobs[i].max_steps = 100000000;
+        jobs[i].use_stop_pc = 1;
+        jobs[i].stop_pc = 32;
+      }
+      ok = ok && (mips_cpu_run_smp(&jobs[0], count, quantum) == mips_Success);
+      uint64_t steps = 0;
+      for (unsigned i = 0; i < count; ++i){
+        uint32_t pc = 0;
+        mips_cpu_get_pc(jobs[i].cpu, &pc);
+        ok = ok && (jobs[i].result == mips_Success) && (pc == 32);
+        steps += jobs[i].steps;
+        mips_cpu_free(jobs[i].cpu);
+      }
+      uint32_t counter = 0;
+      mips_mem_read32(shared, 0x1000, &counter);
+      ok = ok && (counter == count * iterations);
+      //A turn of 5 instructions always ends between some LL and its SC, so some SC must have failed
+      if (quantum != 0)
+        ok = ok && (steps > uint64_t(count) * iterations * 8);
+      mips_mem_free(shared);
+    }
+    if (ok)
+      mips_test_end_test(testId, true, "No increment was lost");
+    else
+      mips_test_end_test(testId, false, "Shared counter wrong");
+  }
+  //ENDTEST
+
+  //Test #18 One CPU rewriting the code another CPU is running
+  testId = mips_test_begin_test("<INTERNAL>");
+  {
+    mips_mem_h shared = mips_mem_create_sparse();
+    //Runner, spins at 0x200 until r1 equals r7: ori r1, r0, 1 ; bne r1, r7, -2 ; nop
+    mips_mem_write32(shared, 0x200, 0x34010001);
+    mips_mem_write32(shared, 0x204, 0x1427FFFE);
+    mips_mem_write32(shared, 0x208, 0x00000000);
+    //Writer, first writes the runner's page so it holds it directly, waits, then patches the ori:
+    //sw r5, 0(r4) ; loop: addiu r6, r6, -1 ; bne r6, r0, loop ; nop ; sw r5, 0(r8)
+    mips_mem_write32(shared, 0x1000, 0xAC850000);
+    mips_mem_write32(shared, 0x1004, 0x24C6FFFF);
+    mips_mem_write32(shared, 0x1008, 0x14C0FFFE);
+    mips_mem_write32(shared, 0x100C, 0x00000000);
+    mips_mem_write32(shared, 0x1010, 0xAD050000);
+
+    mips_cpu_job jobs[2];
+    jobs[0].cpu = mips_cpu_create(shared);
+    mips_cpu_set_pc(jobs[0].cpu, 0x1000);
+    mips_cpu_set_register(jobs[0].cpu, 4, 0x300);
+    mips_cpu_set_register(jobs[0].cpu, 5, 0x34010002); //ori r1, r0, 2
+    mips_cpu_set_register(jobs[0].cpu, 6, 50);
+    mips_cpu_set_register(jobs[0].cpu, 8, 0x200);
+    jobs[0].max_steps = 1000;
+    jobs[0].use_stop_pc = 1;
+    jobs[0].stop_pc = 0x1014;
+    jobs[1].cpu = mips_cpu_create(shared);
+    mips_cpu_set_jit(jobs[1].cpu, 1);
+    mips_cpu_set_pc(jobs[1].cpu, 0x200);
+    mips_cpu_set_register(jobs[1].cpu, 7, 2);
+    jobs[1].max_steps = 100000;
+    jobs[1].use_stop_pc = 1;
+    jobs[1].stop_pc = 0x20C;
+
+    bool ok = (mips_cpu_run_smp(jobs, 2, 16) == mips_Success);
+    uint32_t pc = 0, got = 0;
+    mips_cpu_get_pc(jobs[1].cpu, &pc);
+    mips_cpu_get_register(jobs[1].cpu, 1, &got);
+    ok = ok && (jobs[0].result == mips_Success) && (jobs[1].result == mips_Success) && (pc == 0x20C) && (got == 2);
+    mips_cpu_free(jobs[0].cpu);
+    mips_cpu_free(jobs[1].cpu);
+    mips_mem_free(shared);
+    if (ok)
+      mips_test_end_test(testId, true, "Runner saw the new code");
+    else
+      mips_test_end_test(testId, false, "Runner kept the old code");
+  }
+  //ENDTEST
+
+  //Test #19 Binary trace of a run, read back from the middle through the index
+  testId = mips_test_begin_test("<INTERNAL>");
+  {
+    //loop: addiu r1, r1, 1 ; beq r0, r0, loop ; nop
+    uint8_t program[12] = {0x24, 0x21, 0x00, 0x01, 0x10, 0x00, 0xFF, 0xFE, 0x00, 0x00, 0x00, 0x00};
+    mips_mem_write_block(mem, 0xB00, 12, program);
+    mips_cpu_reset(cpu);
+    mips_cpu_set_pc(cpu, 0xB00);
+    FILE* trace = tmpfile();
+    uint64_t steps = 0;
+    bool ok = (trace != NULL) && (mips_cpu_set_trace(cpu, trace) == mips_Success);
+    ok = ok && (mips_cpu_run(cpu, 300000, &steps) == mips_Success) && (steps == 300000);
+    ok = ok && (mips_cpu_set_trace(cpu, NULL) == mips_Success);
+    if (trace != NULL){
+      //A loop this regular packs into much less than a byte per instruction
+      ok = ok && (ftell(trace) < 300000 / 8);
+      rewind(trace);
+      mips_trace_reader_h reader = 0;
+      mips_trace_record records[2];
+      uint32_t regs[32] = {0};
+      uint32_t got = 0;
+      ok = ok && (mips_trace_reader_open(trace, &reader) == mips_Success);
+      ok = ok && (mips_trace_reader_get_count(reader) == 300000);
+      //Record 3n is the addiu that sets r1 to n+1, the branch after it writes nothing
+      ok = ok && (mips_trace_reader_seek(reader, 54321) == mips_Success);
+      ok = ok && (mips_trace_reader_read(reader, records, 2, &got) == mips_Success) && (got == 2);
+      ok = ok && (records[0].pc == 0xB00) && (records[0].word == 0x24210001) && (records[0].rd == 1) && (records[0].rd_value == 18108);
+      ok = ok && (records[1].pc == 0xB04) && (records[1].next_pc == 0xB08) && (records[1].rd == 0);
+      ok = ok && (mips_trace_reader_get_registers(reader, regs) == mips_Success) && (regs[1] == 18108);
+      ok = ok && (mips_trace_reader_seek(reader, 299999) == mips_Success);
+      ok = ok && (mips_trace_reader_read(reader, records, 2, &got) == mips_Success) && (got == 1) && (records[0].pc == 0xB08);
+      mips_trace_reader_close(reader);
+      fclose(trace);
+    }
+    if (ok)
+      mips_test_end_test(testId, true, "Trace read back from the middle");
+    else
+      mips_test_end_test(testId, false, "Trace wrong");
+    mips_cpu_reset(cpu);
+  }
+  //ENDTEST
+
+  //Test #20 Profile of a loop, per opcode, PC and block
+  testId = mips_test_begin_test("<INTERNAL>");
+  {
+    //addiu r1, r0, 10 ; loop: addiu r1, r1, -1 ; bne r1, r0, loop ; sw r1, 0xD00(r0) ; lw r2, 0xD00(r0)
+    uint8_t program[20] = {0x24, 0x01, 0x00, 0x0A, 0x24, 0x21, 0xFF, 0xFF, 0x14, 0x20, 0xFF, 0xFE,
+                           0xAC, 0x01, 0x0D, 0x00, 0x8C, 0x02, 0x0D, 0x00};
+    mips_mem_write_block(mem, 0xC00, 20, program);
+    mips_cpu_reset(cpu);
+    mips_cpu_set_pc(cpu, 0xC00);
+    uint64_t steps = 0;
+    bool ok = (mips_cpu_write_profile(cpu, stdout, mips_profile_Report) == mips_ErrorInvalidArgument);
+    ok = ok && (mips_cpu_set_profile(cpu, 1) == mips_Success);
+    ok = ok && (mips_cpu_run_until(cpu, 0xC14, 1000, &steps) == mips_Success) && (steps == 32);
+    ok = ok && (mips_cpu_set_profile(cpu, 0) == mips_Success);
+    //Nothing more is counted once the profile is stopped
+    mips_cpu_set_pc(cpu, 0xC10);
+    ok = ok && (mips_cpu_step(cpu) == mips_Success);
+
+    FILE* dump = tmpfile();
+    string csv, json;
+    if (dump != NULL){
+      ok = ok && (mips_cpu_write_profile(cpu, dump, mips_profile_CSV) == mips_Success);
+      rewind(dump);
+      for (int c = fgetc(dump); c != EOF; c = fgetc(dump))
+        csv += char(c);
+      fclose(dump);
+    }
+    dump = tmpfile();
+    if (dump != NULL){
+      ok = ok && (mips_cpu_write_profile(cpu, dump, mips_profile_JSON) == mips_Success);
+      rewind(dump);
+      for (int c = fgetc(dump); c != EOF; c = fgetc(dump))
+        json += char(c);
+      fclose(dump);
+    }
+    //The first block runs once up to the delay slot, the loop body is entered again nine times
+    ok = ok && (csv.find("total,instructions,,32,9,1,\n") != string::npos);
+    ok = ok && (csv.find("total,bytes_loaded,,4,,,\n") != string::npos);
+    ok = ok && (csv.find("total,bytes_stored,,40,,,\n") != string::npos);
+    ok = ok && (csv.find("opcode,ADDIU,,11,,,\n") != string::npos);
+    ok = ok && (csv.find("pc,BNE,0x00000c08,10,9,1,\n") != string::npos);
+    ok = ok && (csv.find("block,,0x00000c00,1,,,4\n") != string::npos);
+    ok = ok && (csv.find("block,,0x00000c04,9,,,27\n") != string::npos);
+    ok = ok && (csv.find("block,,0x00000c10,1,,,1\n") != string::npos);
+    ok = ok && (json.find("\"LW\": 1") != string::npos) && (json.find("\"taken\": 9, \"not_taken\": 1}") != string::npos);
+    if (ok)
+      mips_test_end_test(testId, true, "Profile counts match the loop");
+    else
+      mips_test_end_test(testId, false, "Profile counts wrong");
+    mips_cpu_reset(cpu);
+  }
+  //ENDTEST
+
+  //Test #21 Snapshot of a run, restored in place and from a file into a new CPU
+  testId = mips_test_begin_test("<INTERNAL>");
+  {
+    mips_mem_h mem2 = mips_mem_create_ram(0x10000);
+    //loop: lw r2, 0x2000(r0) ; addiu r2, r2, 1 ; sw r2, 0x2000(r0) ; addiu r1, r1, 1 ; beq r0, r0, loop ; nop
+    uint32_t program[6] = {0x8C022000, 0x24420001, 0xAC022000, 0x24210001, 0x1000FFFB, 0x00000000};
+    for (uint32_t address = 0; address < 0x10000; address += 4)
+      mips_mem_write32(mem2, address, 0);
+    for (unsigned i = 0; i < 6; ++i)
+      mips_mem_write32(mem2, 0x1000 + 4 * i, program[i]);
+    mips_cpu_h cpu2 = mips_cpu_create(mem2);
+    //Native code stores straight into the page, which the snapshot still has to see
+    mips_cpu_set_jit(cpu2, 1);
+    mips_cpu_set_pc(cpu2, 0x1000);
+
+    uint64_t steps = 0;
+    uint32_t counter = 0, r1 = 0, pc = 0;
+    mips_cpu_snapshot_h snapshot = 0, loaded = 0;
+    bool ok = (mips_cpu_run(cpu2, 600, &steps) == mips_Success);
+    ok = ok && (mips_cpu_snapshot(cpu2, &snapshot) == mips_Success);
+    ok = ok && (mips_cpu_run(cpu2, 600, &steps) == mips_Success);
+    mips_mem_read32(mem2, 0x2000, &counter);
+    ok = ok && (counter == 200);
+    for (unsigned round = 0; round < 2; ++round){
+      ok = ok && (mips_cpu_restore(cpu2, snapshot) == mips_Success);
+      mips_mem_read32(mem2, 0x2000, &counter);
+      mips_cpu_get_register(cpu2, 1, &r1);
+      mips_cpu_get_pc(cpu2, &pc);
+      ok = ok && (counter == 100) && (r1 == 100) && (pc == 0x1000);
+      ok = ok && (mips_cpu_run(cpu2, 600, &steps) == mips_Success);
+      mips_mem_read32(mem2, 0x2000, &counter);
+      ok = ok && (counter == 200);
+    }
+
+    //The file holds the code page and the counter page, restored into memory that starts full of rubbish
+    FILE* file = tmpfile();
+    mips_mem_h mem3 = mips_mem_create_ram(0x10000);
+    for (uint32_t address = 0; address < 0x10000; address += 4)
+      mips_mem_write32(mem3, address, 0xDEADBEEF);
+    mips_cpu_h cpu3 = mips_cpu_create(mem3);
+    if (file != NULL){
+      ok = ok && (mips_cpu_snapshot_save(snapshot, file) == mips_Success);
+      rewind(file);
+      ok = ok && (mips_cpu_snapshot_load(file, &loaded) == mips_Success);
+      fclose(file);
+    }
+    ok = ok && (loaded != 0) && (mips_cpu_restore(cpu3, loaded) == mips_Success);
+    uint32_t rubbish = 1;
+    mips_mem_read32(mem3, 0x8000, &rubbish);
+    mips_cpu_get_register(cpu3, 1, &r1);
+    ok = ok && (rubbish == 0) && (r1 == 100);
+    ok = ok && (mips_cpu_run(cpu3, 600, &steps) == mips_Success);
+    mips_mem_read32(mem3, 0x2000, &counter);
+    ok = ok && (counter == 200);
+
+    mips_cpu_snapshot_free(snapshot);
+    mips_cpu_snapshot_free(loaded);
+    mips_cpu_free(cpu2);
+    mips_cpu_free(cpu3);
+    mips_mem_free(mem2);
+    mips_mem_free(mem3);
+    if (ok)
+      mips_test_end_test(testId, true, "Run continued the same way from the snapshot");
+    else
+      mips_test_end_test(testId, false, "Snapshot restore wrong");
+  }
+  //ENDTEST
+
+  //Test #22 Stepping back through a run, and running forward again the same way
+  testId = mips_test_begin_test("<INTERNAL>");
+  {
+    mips_mem_h mem2 = mips_mem_create_ram(0x10000);
+    //loop: lw r2, 0x2000(r0) ; addiu r2, r2, 1 ; sw r2, 0x2000(r0) ; addiu r1, r1, 1 ; beq r0, r0, loop ; nop
+    uint32_t program[6] = {0x8C022000, 0x24420001, 0xAC022000, 0x24210001, 0x1000FFFB, 0x00000000};
+    for (uint32_t address = 0; address < 0x10000; address += 4)
+      mips_mem_write32(mem2, address, 0);
+    for (unsigned i = 0; i < 6; ++i)
+      mips_mem_write32(mem2, 0x1000 + 4 * i, program[i]);
+    mips_cpu_h cpu2 = mips_cpu_create(mem2);
+    mips_cpu_set_jit(cpu2, 1);
+    mips_cpu_set_pc(cpu2, 0x1000);
+
+    //An interval this short makes the history thin its checkpoints out several times
+    uint64_t steps = 0, back = 0;
+    uint32_t counter = 0, r1 = 0, r2 = 0, pc = 0, r5 = 0;
+    bool ok = (mips_cpu_set_history(cpu2, 5) == mips_Success);
+    ok = ok && (mips_cpu_run(cpu2, 1000, &steps) == mips_Success) && (steps == 1000);
+    uint32_t end_counter = 0, end_r1 = 0, end_pc = 0;
+    mips_mem_read32(mem2, 0x2000, &end_counter);
+    mips_cpu_get_register(cpu2, 1, &end_r1);
+    mips_cpu_get_pc(cpu2, &end_pc);
+
+    ok = ok && (mips_cpu_step_back(cpu2, 400) == mips_Success);
+    mips_mem_read32(mem2, 0x2000, &counter);
+    mips_cpu_get_register(cpu2, 1, &r1);
+    mips_cpu_get_pc(cpu2, &pc);
+    ok = ok && (counter == 100) && (r1 == 100) && (pc == 0x1000);
+
+    //Back to the addiu r1 of the previous iteration, after its sw
+    ok = ok && (mips_cpu_run_back_to(cpu2, 0x100C, &back) == mips_Success) && (back == 3);
+    mips_mem_read32(mem2, 0x2000, &counter);
+    mips_cpu_get_register(cpu2, 1, &r1);
+    mips_cpu_get_register(cpu2, 2, &r2);
+    ok = ok && (counter == 100) && (r1 == 99) && (r2 == 100);
+
+    //Never there, and further back than the start, both leave the CPU alone
+    ok = ok && (mips_cpu_run_back_to(cpu2, 0x3000, &back) == mips_ErrorInvalidArgument);
+    ok = ok && (mips_cpu_step_back(cpu2, 1000) == mips_ErrorInvalidArgument);
+    mips_cpu_get_pc(cpu2, &pc);
+    ok = ok && (pc == 0x100C);
+
+    ok = ok && (mips_cpu_run(cpu2, 403, &steps) == mips_Success);
+    mips_mem_read32(mem2, 0x2000, &counter);
+    mips_cpu_get_register(cpu2, 1, &r1);
+    mips_cpu_get_pc(cpu2, &pc);
+    ok = ok && (counter == end_counter) && (r1 == end_r1) && (pc == end_pc);
+
+    //A register set by the host is still set after going back over it
+    ok = ok && (mips_cpu_set_register(cpu2, 5, 77) == mips_Success);
+    ok = ok && (mips_cpu_run(cpu2, 10, &steps) == mips_Success);
+    ok = ok && (mips_cpu_step_back(cpu2, 5) == mips_Success);
+    mips_cpu_get_register(cpu2, 5, &r5);
+    ok = ok && (r5 == 77);
+
+    ok = ok && (mips_cpu_set_history(cpu2, 0) == mips_Success);
+    ok = ok && (mips_cpu_step_back(cpu2, 1) == mips_ErrorInvalidArgument);
+    mips_cpu_free(cpu2);
+    mips_mem_free(mem2);
+    if (ok)
+      mips_test_end_test(testId, true, "Went back and came forward the same way");
+    else
+      mips_test_end_test(testId, false, "Stepping back wrong");
+  }
+  //ENDTEST
+
+  //Test #23 Register writes of the host recorded, and replayed at the same instruction counts
+  testId = mips_test_begin_test("<INTERNAL>");
+  {
+    mips_mem_h mem2 = mips_mem_create_ram(0x10000);
+    //loop: addu r1, r1, r5 ; lw r2, 0x2000(r0) ; beq r0, r0, loop ; nop
+    uint32_t program[4] = {0x00250821, 0x8C022000, 0x1000FFFD, 0x00000000};
+    for (unsigned i = 0; i < 4; ++i)
+      mips_mem_write32(mem2, 0x1000 + 4 * i, program[i]);
+    mips_cpu_h cpu2 = mips_cpu_create(mem2);
+    mips_cpu_set_pc(cpu2, 0x1000);
+
+    FILE* file = tmpfile();
+    uint64_t steps = 0;
+    uint32_t r1 = 0, r5 = 0;
+    bool ok = (file != NULL) && (mips_cpu_set_record(cpu2, file) == mips_Success);
+    ok = ok && (mips_cpu_set_register(cpu2, 5, 3) == mips_Success);
+    ok = ok && (mips_cpu_run(cpu2, 40, &steps) == mips_Success);
+    ok = ok && (mips_cpu_set_register(cpu2, 5, 7) == mips_Success);
+    ok = ok && (mips_cpu_run(cpu2, 40, &steps) == mips_Success);
+    ok = ok && (mips_cpu_set_record(cpu2, NULL) == mips_Success);
+    mips_cpu_get_register(cpu2, 1, &r1);
+    ok = ok && (r1 == 100);
+    //The header and two register entries, the loads from RAM are not logged
+    ok = ok && (file != NULL) && (ftell(file) == 8 + 2 * 7);
+
+    mips_cpu_h cpu3 = mips_cpu_create(mem2);
+    mips_cpu_set_pc(cpu3, 0x1000);
+    if (file != NULL)
+      rewind(file);
+    ok = ok && (mips_cpu_set_replay(cpu3, file) == mips_Success);
+    ok = ok && (mips_cpu_run(cpu3, 40, &steps) == mips_Success);
+    mips_cpu_get_register(cpu3, 1, &r1);
+    mips_cpu_get_register(cpu3, 5, &r5);
+    ok = ok && (r1 == 30) && (r5 == 3);
+    ok = ok && (mips_cpu_run(cpu3, 40, &steps) == mips_Success);
+    ok = ok && (mips_cpu_set_replay(cpu3, NULL) == mips_Success);
+    mips_cpu_get_register(cpu3, 1, &r1);
+    mips_cpu_get_register(cpu3, 5, &r5);
+    ok = ok && (r1 == 100) && (r5 == 7);
+
+    if (file != NULL)
+      fclose(file);
+    mips_cpu_free(cpu2);
+    mips_cpu_free(cpu3);
+    mips_mem_free(mem2);
+    if (ok)
+      mips_test_end_test(testId, true, "Replay made the same changes at the same points");
+    else
+      mips_test_end_test(testId, false, "Record or replay wrong");
+  }
+  //ENDTEST
+
+  //Test #24 Bus with RAM, a ROM and a device, and a recorded run replayed without the device
+  testId = mips_test_begin_test("<INTERNAL>");
+  {
+    mips_mem_h ram = mips_mem_create_ram(0x10000);
+    mips_mem_h rom = mips_mem_create_ram(MIPS_MEM_PAGE);
+    mips_mem_write32(rom, 0, 0x12345678);
+    test_device device = {1, 0, 0};
+    mips_mem_device callbacks = {&device, test_device_read, test_device_write};
+    mips_mem_h bus = mips_mem_create_bus();
+    bool ok = (mips_mem_bus_add_memory(bus, 0, 0x10000, ram, 0) == mips_Success);
+    ok = ok && (mips_mem_bus_add_device(bus, 0xFFFF0000, MIPS_MEM_PAGE, &callbacks) == mips_Success);
+    ok = ok && (mips_mem_bus_add_memory(bus, 0x1FC00000, MIPS_MEM_PAGE, rom, 1) == mips_Success);
+    //Overlapping and unaligned regions are refused
+    ok = ok && (mips_mem_bus_add_memory(bus, 0x8000, 0x10000, ram, 0) == mips_ErrorInvalidArgument);
+    ok = ok && (mips_mem_bus_add_memory(bus, 0x20000, 100, ram, 0) == mips_ErrorInvalidArgument);
+
+    uint32_t value = 0;
+    unsigned is_device = 0;
+    ok = ok && (mips_mem_read32(bus, 0x1FC00000, &value) == mips_Success) && (value == 0x12345678);
+    ok = ok && (mips_mem_write32(bus, 0x1FC00000, 0) == mips_ExceptionAccessViolation);
+    ok = ok && (mips_mem_read32(bus, 0x40000000, &value) == mips_ExceptionInvalidAddress);
+    ok = ok && (mips_mem_is_device(bus, 0xFFFF0004, &is_device) == mips_Success) && is_device;
+    ok = ok && (mips_mem_is_device(bus, 0x1000, &is_device) == mips_Success) && !is_device;
+
+    //lui r3, 0xFFFF ; loop: lw r2, 0(r3) ; addu r1, r1, r2 ; sw r1, 4(r3) ; beq r0, r0, loop ; nop
+    uint32_t program[6] = {0x3C03FFFF, 0x8C620000, 0x00220821, 0xAC610004, 0x1000FFFC, 0x00000000};
+    for (unsigned i = 0; i < 6; ++i)
+      mips_mem_write32(bus, 0x1000 + 4 * i, program[i]);
+    mips_cpu_h cpu2 = mips_cpu_create(bus);
+    mips_cpu_set_jit(cpu2, 1);
+    mips_cpu_set_pc(cpu2, 0x1000);
+    FILE* file = tmpfile();
+    uint64_t steps = 0, reads = 0, writes = 0, mapped = 0;
+    uint32_t r1 = 0;
+    ok = ok && (file != NULL) && (mips_cpu_set_record(cpu2, file) == mips_Success);
+    ok = ok && (mips_cpu_run(cpu2, 51, &steps) == mips_Success);
+    ok = ok && (mips_cpu_set_record(cpu2, NULL) == mips_Success);
+    mips_cpu_get_register(cpu2, 1, &r1);
+    ok = ok && (r1 == 55) && (device.written == 55) && (device.reads == 10);
+    ok = ok && (mips_mem_bus_get_counters(bus, 0xFFFF0000, &reads, &writes, &mapped) == mips_Success);
+    ok = ok && (reads == 10) && (writes == 10) && (mapped == 0);
+
+    //Pages of RAM are handed out so the CPU can skip the bus, those of the device never are
+    uint8_t* page = 0;
+    ok = ok && (mips_mem_map_page(bus, 0x2000, 1, &page) == mips_Success);
+    ok = ok && (mips_mem_map_page(bus, 0xFFFF0000, 0, &page) == mips_ErrorNotImplemented);
+    ok = ok && (mips_mem_bus_get_counters(bus, 0x2000, &reads, &writes, &mapped) == mips_Success) && (mapped == 1);
+
+    //Snapshots leave the device alone
+    mips_cpu_snapshot_h snapshot = 0;
+    ok = ok && (mips_cpu_run(cpu2, 5, &steps) == mips_Success);
+    ok = ok && (mips_cpu_snapshot(cpu2, &snapshot) == mips_Success) && (device.reads == 11);
+    mips_cpu_snapshot_free(snapshot);
+
+    //The device now gives other values, the replay gets the recorded ones without reading it
+    mips_cpu_h cpu3 = mips_cpu_create(bus);
+    mips_cpu_set_pc(cpu3, 0x1000);
+    device.next = 1000;
+    if (file != NULL)
+      rewind(file);
+    ok = ok && (mips_cpu_set_replay(cpu3, file) == mips_Success);
+    ok = ok && (mips_cpu_run(cpu3, 51, &steps) == mips_Success);
+    ok = ok && (mips_cpu_set_replay(cpu3, NULL) == mips_Success);
+    mips_cpu_get_register(cpu3, 1, &r1);
+    ok = ok && (r1 == 55) && (device.reads == 11);
+
+    if (file != NULL)
+      fclose(file);
+    mips_cpu_free(cpu2);
+    mips_cpu_free(cpu3);
+    mips_mem_free(bus);
+    mips_mem_free(ram);
+    mips_mem_free(rom);
+    if (ok)
+      mips_test_end_test(testId, true, "Regions answered, device reads replayed from the log");
+    else
+      mips_test_end_test(testId, false, "Bus wrong");
+  }
+  //ENDTEST
+
+  //Test #25 Semihosting: write, sbrk, read and exit with a code, then BREAK without semihosting
+  testId = mips_test_begin_test("<INTERNAL>");
+  {
+    mips_mem_h mem2 = mips_mem_create_ram(0x10000);
+    uint8_t zeros[0x4000] = {0};
+    mips_mem_write_block(mem2, 0, sizeof(zeros), zeros);
+    mips_mem_write_block(mem2, 0x2000, 6, (const uint8_t*)"hello\n");
+    uint32_t program[] = {
+      0x2402000F, 0x24040001, 0x24052000, 0x24060006, 0x0000000C, //write(1, 0x2000, 6)
+      0x24020009, 0x24040005, 0x0000000C, 0x00408021,             //s0 = sbrk(5)
+      0x24020009, 0x0000000C, 0x00408821,                         //s1 = sbrk(5)
+      0x2402000E, 0x24040000, 0x24053000, 0x24060008, 0x0000000C, 0x00409021, //s2 = read(0, 0x3000, 8)
+      0x24020011, 0x24040007, 0x0000000C,                         //exit(7)
+      0x0000000D                                                  //break
+    };
+    const unsigned length = sizeof(program) / sizeof(program[0]);
+    for (unsigned i = 0; i < length; ++i)
+      mips_mem_write32(mem2, 0x1000 + 4 * i, program[i]);
+    mips_cpu_h cpu2 = mips_cpu_create(mem2);
+    mips_cpu_set_pc(cpu2, 0x1000);
+
+    FILE* in = tmpfile();
+    FILE* out = tmpfile();
+    if (in != NULL){
+      fputs("abcd", in);
+      rewind(in);
+    }
+    uint64_t steps = 0;
+    int32_t code = 0;
+    uint32_t pc = 0, s0 = 0, s1 = 0, s2 = 0, word = 0;
+    char text[16] = {0};
+    bool ok = (in != NULL) && (out != NULL);
+    ok = ok && (mips_cpu_get_exit_code(cpu2, &code) == mips_ErrorInvalidArgument);
+    ok = ok && (mips_cpu_set_semihosting(cpu2, 1, 0x8000, in, out) == mips_Success);
+    ok = ok && (mips_cpu_run(cpu2, 1000, &steps) == mips_ExceptionBreak);
+    ok = ok && (steps == length - 2);
+    mips_cpu_get_pc(cpu2, &pc);
+    mips_cpu_get_register(cpu2, 16, &s0);
+    mips_cpu_get_register(cpu2, 17, &s1);
+    mips_cpu_get_register(cpu2, 18, &s2);
+    mips_mem_read32(mem2, 0x3000, &word);
+    ok = ok && (pc == 0x1000 + 4 * (length - 2));
+    ok = ok && (mips_cpu_get_exit_code(cpu2, &code) == mips_Success) && (code == 7);
+    ok = ok && (s0 == 0x8000) && (s1 == 0x8008) && (s2 == 4) && (word == 0x61626364);
+    //Exit flushed the output
+    if (out != NULL){
+      rewind(out);
+      ok = ok && (fread(text, 1, sizeof(text), out) == 6) && (strcmp(text, "hello\n") == 0);
+    }
+
+    //The CPU starts over, and BREAK stops it with no exit code once semihosting is off
+    ok = ok && (mips_cpu_reset(cpu2) == mips_Success);
+    ok = ok && (mips_cpu_get_exit_code(cpu2, &code) == mips_ErrorInvalidArgument);
+    ok = ok && (mips_cpu_set_semihosting(cpu2, 0, 0, NULL, NULL) == mips_Success);
+    mips_cpu_set_pc(cpu2, 0x1000 + 4 * (length - 1));
+    ok = ok && (mips_cpu_step(cpu2) == mips_ExceptionBreak);
+    mips_cpu_get_pc(cpu2, &pc);
+    ok = ok && (pc == 0x1000 + 4 * (length - 1));
+    ok = ok && (mips_cpu_get_exit_code(cpu2, &code) == mips_ErrorInvalidArgument);
+
+    if (in != NULL)
+      fclose(in);
+    if (out != NULL)
+      fclose(out);
+    mips_cpu_free(cpu2);
+    mips_mem_free(mem2);
+    if (ok)
+      mips_test_end_test(testId, true, "Program wrote, allocated, read and exited through the host");
+    else
+      mips_test_end_test(testId, false, "Semihosting wrong");
+  }
+  //ENDTEST
+
+  //Test #26 Branches advance like other instructions: a loop runs the same stepped, in blocks and compiled,
+  //and a BREAK in a delay slot stops there
+  testId = mips_test_begin_test("<INTERNAL>");
+  {
+    mips_mem_h mem2 = mips_mem_create_ram(0x10000);
+    //loop: addiu r1, r1, 1 ; bne r1, r2, loop ; addiu r3, r3, 2 ; beq r0, r0, 0x2000 ; break ; nop
+    uint32_t program[6] = {0x24210001, 0x1422FFFE, 0x24630002, 0x100003FC, 0x0000000D, 0x00000000};
+    for (unsigned i = 0; i < 6; ++i)
+      mips_mem_write32(mem2, 0x1000 + 4 * i, program[i]);
+    bool ok = true;
+    for (unsigned mode = 0; mode < 3; ++mode){
+      mips_cpu_h cpu2 = mips_cpu_create(mem2);
+      mips_cpu_set_pc(cpu2, 0x1000);
+      mips_cpu_set_register(cpu2, 2, 100);
+      mips_cpu_set_jit(cpu2, mode == 2);
+      uint64_t steps = 0;
+      mips_error err = mips_Success;
+      if (mode == 0){
+        while ((err = mips_cpu_step(cpu2)) == mips_Success)
+          ++steps;
+      } else {
+        err = mips_cpu_run(cpu2, 1000, &steps);
+      }
+      uint32_t pc = 0, r1 = 0, r3 = 0;
+      mips_cpu_get_pc(cpu2, &pc);
+      mips_cpu_get_register(cpu2, 1, &r1);
+      mips_cpu_get_register(cpu2, 3, &r3);
+      ok = ok && (err == mips_ExceptionBreak) && (steps == 301) && (pc == 0x1010) && (r1 == 100) && (r3 == 200);
+      //Still in the delay slot, so stepping again stops again
+      ok = ok && (mips_cpu_step(cpu2) == mips_ExceptionBreak);
+      mips_cpu_get_pc(cpu2, &pc);
+      ok = ok && (pc == 0x1010);
+      mips_cpu_free(cpu2);
+    }
+    mips_mem_free(mem2);
+    if (ok)
+      mips_test_end_test(testId, true, "Branches and delay slots ran alike in every mode");
+    else
+      mips_test_end_test(testId, false, "Branch or delay slot wrong");
+  }
+  //ENDTEST
+
+  //Test #27 The CPU reports its instructions, and an encoding with a field that has to be zero set is rejected
+  testId = mips_test_begin_test("<INTERNAL>");
+  {
+    bool ok = true;
+    const char *mnemonic = 0, *description = 0;
+    unsigned count = 0;
+    bool addu = false, syscall = false;
+    while (mips_cpu_get_instruction(count, &mnemonic, &description) == mips_Success){
+      addu = addu || !strcmp(mnemonic, "ADDU");
+      syscall = syscall || !strcmp(mnemonic, "SYSCALL");
+      ok = ok && (description != 0) && strcmp(mnemonic, "INVALID");
+      ++count;
+    }
+    ok = ok && addu && syscall && (count == 57);
+
+    mips_mem_h mem2 = mips_mem_create_ram(0x10000);
+    //sll with rs, mfhi with rt, lui with rs, bgtz with rt, REGIMM rt 2, opcode 0x3F, addu with a shift amount
+    uint32_t invalid[7] = {0x00221900, 0x00021810, 0x3C231234, 0x1C220004, 0x04220004, 0xFC000000, 0x00221861};
+    //addu r3, r1, r2 ; syscall with its code field set
+    uint32_t valid[2] = {0x00221821, 0x03FFFFCC};
+    mips_error expected[2] = {mips_Success, mips_ExceptionBreak};
+    for (unsigned i = 0; i < 9; ++i){
+      mips_mem_write32(mem2, 0x1000, (i < 7) ? invalid[i] : valid[i - 7]);
+      mips_cpu_h cpu2 = mips_cpu_create(mem2);
+      mips_cpu_set_pc(cpu2, 0x1000);
+      mips_cpu_set_register(cpu2, 1, 5);
+      mips_cpu_set_register(cpu2, 2, 7);
+      mips_error err2 = mips_cpu_step(cpu2);
+      ok = ok && (err2 == ((i < 7) ? mips_ExceptionInvalidInstruction : expected[i - 7]));
+      uint32_t r3 = 0;
+      mips_cpu_get_register(cpu2, 3, &r3);
+      ok = ok && (r3 == ((i == 7) ? 12u : 0u));
+      mips_cpu_free(cpu2);
+    }
+    mips_mem_free(mem2);
+    if (ok)
+      mips_test_end_test(testId, true, "Instruction list and encoding checks agree with the table");
+    else
+      mips_test_end_test(testId, false, "Instruction list or encoding check wrong");
+  }
+  //ENDTEST
+
+  //Test #28 Stepping back over device reads, and forward again, takes them from the history and not the device
+  testId = mips_test_begin_test("<INTERNAL>");
+  {
+    mips_mem_h ram = mips_mem_create_ram(0x10000);
+    test_device device = {1, 0, 0};
+    mips_mem_device callbacks = {&device, test_device_read, test_device_write};
+    mips_mem_h bus = mips_mem_create_bus();
+    bool ok = (mips_mem_bus_add_memory(bus, 0, 0x10000, ram, 0) == mips_Success);
+    ok = ok && (mips_mem_bus_add_device(bus, 0xFFFF0000, MIPS_MEM_PAGE, &callbacks) == mips_Success);
+    //lui r3, 0xFFFF ; loop: lw r2, 0(r3) ; addu r1, r1, r2 ; beq r0, r0, loop ; nop
+    uint32_t program[5] = {0x3C03FFFF, 0x8C620000, 0x00220821, 0x1000FFFD, 0x00000000};
+    for (unsigned i = 0; i < 5; ++i)
+      mips_mem_write32(bus, 0x1000 + 4 * i, program[i]);
+    mips_cpu_h cpu2 = mips_cpu_create(bus);
+    mips_cpu_set_jit(cpu2, 1);
+    mips_cpu_set_pc(cpu2, 0x1000);
+
+    uint64_t steps = 0, back = 0;
+    uint32_t r1 = 0;
+    ok = ok && (mips_cpu_set_history(cpu2, 8) == mips_Success);
+    ok = ok && (mips_cpu_run(cpu2, 201, &steps) == mips_Success);
+    mips_cpu_get_register(cpu2, 1, &r1);
+    ok = ok && (r1 == 1275) && (device.reads == 50);
+
+    //Back to 25 reads, then to the read before, and the device was not read again
+    ok = ok && (mips_cpu_step_back(cpu2, 100) == mips_Success);
+    mips_cpu_get_register(cpu2, 1, &r1);
+    ok = ok && (r1 == 325) && (device.reads == 50);
+    ok = ok && (mips_cpu_run_back_to(cpu2, 0x1004, &back) == mips_Success) && (back == 4);
+    mips_cpu_get_register(cpu2, 1, &r1);
+    ok = ok && (r1 == 300) && (device.reads == 50);
+
+    //Running forward again is the same run, the reads still come from the history
+    ok = ok && (mips_cpu_run(cpu2, 104, &steps) == mips_Success);
+    mips_cpu_get_register(cpu2, 1, &r1);
+    ok = ok && (r1 == 1275) && (device.reads == 50);
+
+    //A change by the host drops the reads that were ahead, the next ones come from the device
+    ok = ok && (mips_cpu_step_back(cpu2, 4) == mips_Success);
+    ok = ok && (mips_cpu_set_register(cpu2, 5, 1) == mips_Success);
+    ok = ok && (mips_cpu_run(cpu2, 4, &steps) == mips_Success);
+    mips_cpu_get_register(cpu2, 1, &r1);
+    ok = ok && (r1 == 1225 + 51) && (device.reads == 51);
+    ok = ok && (mips_cpu_step_back(cpu2, 4) == mips_Success);
+    mips_cpu_get_register(cpu2, 1, &r1);
+    ok = ok && (r1 == 1225) && (device.reads == 51);
+    ok = ok && (mips_cpu_run(cpu2, 4, &steps) == mips_Success);
+    mips_cpu_get_register(cpu2, 1, &r1);
+    ok = ok && (r1 == 1225 + 51) && (device.reads == 51);
+
+    mips_cpu_free(cpu2);
+    mips_mem_free(bus);
+    mips_mem_free(ram);
+    if (ok)
+      mips_test_end_test(testId, true, "Device reads came back from the history");
+    else
+      mips_test_end_test(testId, false, "Device read again when stepping back");
+  }
+  //ENDTEST
+
+  //Test #29 Semihosting calls are not made again going back and forward, or replaying a recorded run
+  testId = mips_test_begin_test("<INTERNAL>");
+  {
+    const char* name = "test_mips_semihosting.tmp";
+    mips_mem_h mem2 = mips_mem_create_ram(0x10000);
+    uint8_t zeros[0x4000] = {0};
+    mips_mem_write_block(mem2, 0, sizeof(zeros), zeros);
+    mips_mem_write_block(mem2, 0x2000, 6, (const uint8_t*)"hello\n");
+    mips_mem_write_block(mem2, 0x2020, 2, (const uint8_t*)"xy");
+    mips_mem_write_block(mem2, 0x2040, strlen(name) + 1, (const uint8_t*)name);
+    uint32_t program[] = {
+      0x2402000F, 0x24040001, 0x24052000, 0x24060006, 0x0000000C, //write(1, 0x2000, 6)
+      0x24020009, 0x24040005, 0x0000000C, 0x00408021,             //s0 = sbrk(5)
+      0x24020009, 0x0000000C, 0x00408821,                         //s1 = sbrk(5)
+      0x2402000E, 0x24040000, 0x24053000, 0x24060004, 0x0000000C, 0x00409021, //s2 = read(0, 0x3000, 4)
+      0x2402000F, 0x24040001, 0x24053000, 0x24060004, 0x0000000C, //write(1, 0x3000, 4)
+      0x2402000D, 0x24042040, 0x24050001, 0x0000000C, 0x00409821, //s3 = open(name, 1)
+      0x2402000F, 0x02602021, 0x24052020, 0x24060002, 0x0000000C, //write(s3, 0x2020, 2)
+      0x24020010, 0x02602021, 0x0000000C, 0x0040A021,             //s4 = close(s3)
+      0x24020011, 0x24040007, 0x0000000C                          //exit(7)
+    };
+    const unsigned length = sizeof(program) / sizeof(program[0]);
+    for (unsigned i = 0; i < length; ++i)
+      mips_mem_write32(mem2, 0x1000 + 4 * i, program[i]);
+    mips_cpu_snapshot_h start = 0;
+    mips_cpu_h cpu2 = mips_cpu_create(mem2);
+    mips_cpu_set_pc(cpu2, 0x1000);
+    mips_cpu_snapshot(cpu2, &start);
+
+    FILE* in = tmpfile();
+    FILE* out = tmpfile();
+    FILE* log = tmpfile();
+    if (in != NULL){
+      fputs("abcdefgh", in);
+      rewind(in);
+    }
+    uint64_t steps = 0;
+    int32_t code = 0;
+    uint32_t s0 = 0, s1 = 0, s2 = 0, s3 = 0, s4 = 0, word = 0;
+    bool ok = (in != NULL) && (out != NULL) && (log != NULL);
+    ok = ok && (mips_cpu_set_semihosting(cpu2, 1, 0x8000, in, out) == mips_Success);
+    ok = ok && (mips_cpu_set_history(cpu2, 4) == mips_Success);
+    ok = ok && (mips_cpu_set_record(cpu2, log) == mips_Success);
+    ok = ok && (mips_cpu_run(cpu2, 1000, &steps) == mips_ExceptionBreak) && (steps == length - 1);
+    ok = ok && (mips_cpu_set_record(cpu2, NULL) == mips_Success);
+    ok = ok && (ftell(out) == 10) && (ftell(in) == 4);
+
+    //Back to the start, and forward again: nothing printed or read twice, the same results
+    ok = ok && (mips_cpu_step_back(cpu2, steps) == mips_Success);
+    ok = ok && (mips_cpu_get_exit_code(cpu2, &code) == mips_ErrorInvalidArgument);
+    ok = ok && (mips_cpu_run(cpu2, 1000, &steps) == mips_ExceptionBreak) && (steps == length - 1);
+    mips_cpu_get_register(cpu2, 16, &s0);
+    mips_cpu_get_register(cpu2, 17, &s1);
+    mips_cpu_get_register(cpu2, 18, &s2);
+    mips_cpu_get_register(cpu2, 19, &s3);
+    mips_cpu_get_register(cpu2, 20, &s4);
+    mips_mem_read32(mem2, 0x3000, &word);
+    ok = ok && (s0 == 0x8000) && (s1 == 0x8008) && (s2 == 4) && (s3 == 3) && (s4 == 0) && (word == 0x61626364);
+    ok = ok && (mips_cpu_get_exit_code(cpu2, &code) == mips_Success) && (code == 7);
+    ok = ok && (ftell(out) == 10) && (ftell(in) == 4);
+
+    //Back before the close, and a change by the host: the file is open again, and is closed for real
+    ok = ok && (mips_cpu_step_back(cpu2, 6) == mips_Success);
+    ok = ok && (mips_cpu_set_register(cpu2, 20, 99) == mips_Success);
+    ok = ok && (mips_cpu_run(cpu2, 1000, &steps) == mips_ExceptionBreak) && (steps == 6);
+    mips_cpu_get_register(cpu2, 20, &s4);
+    ok = ok && (s4 == 0);
+
+    //Back after the first sbrk: the break is put back, and the program reads on from the input
+    ok = ok && (mips_cpu_step_back(cpu2, length - 1 - 9) == mips_Success);
+    ok = ok && (mips_cpu_set_register(cpu2, 17, 0) == mips_Success);
+    ok = ok && (mips_cpu_run(cpu2, 1000, &steps) == mips_ExceptionBreak);
+    mips_cpu_get_register(cpu2, 17, &s1);
+    mips_mem_read32(mem2, 0x3000, &word);
+    ok = ok && (s1 == 0x8008) && (word == 0x65666768) && (ftell(out) == 14) && (ftell(in) == 8);
+    ok = ok && (mips_cpu_set_history(cpu2, 0) == mips_Success);
+    ok = ok && (mips_cpu_set_semihosting(cpu2, 0, 0, NULL, NULL) == mips_Success);
+    FILE* file = fopen(name, "rb");
+    char text[8] = {0};
+    ok = ok && (file != NULL) && (fread(text, 1, sizeof(text), file) == 2) && (strcmp(text, "xy") == 0);
+    if (file != NULL)
+      fclose(file);
+
+    //The recorded run replayed with no input: the same results, and nothing printed
+    mips_cpu_h cpu3 = mips_cpu_create(mem2);
+    FILE* in3 = tmpfile();
+    FILE* out3 = tmpfile();
+    mips_mem_write32(mem2, 0x3000, 0);
+    if (log != NULL)
+      rewind(log);
+    ok = ok && (in3 != NULL) && (out3 != NULL);
+    ok = ok && (mips_cpu_restore(cpu3, start) == mips_Success);
+    ok = ok && (mips_cpu_set_semihosting(cpu3, 1, 0x8000, in3, out3) == mips_Success);
+    ok = ok && (mips_cpu_set_replay(cpu3, log) == mips_Success);
+    ok = ok && (mips_cpu_run(cpu3, 1000, &steps) == mips_ExceptionBreak) && (steps == length - 1);
+    mips_cpu_get_register(cpu3, 18, &s2);
+    mips_cpu_get_register(cpu3, 19, &s3);
+    mips_mem_read32(mem2, 0x3000, &word);
+    ok = ok && (s2 == 4) && (s3 == 3) && (word == 0x61626364) && (ftell(out3) == 0);
+    ok = ok && (mips_cpu_get_exit_code(cpu3, &code) == mips_Success) && (code == 7);
+
+    remove(name);
+    if (in != NULL)
+      fclose(in);
+    if (out != NULL)
+      fclose(out);
+    if (log != NULL)
+      fclose(log);
+    if (in3 != NULL)
+      fclose(in3);
+    if (out3 != NULL)
+      fclose(out3);
+    mips_cpu_snapshot_free(start);
+    mips_cpu_free(cpu2);
+    mips_cpu_free(cpu3);
+    mips_mem_free(mem2);
+    if (ok)
+      mips_test_end_test(testId, true, "Calls came back from the logs, break and files put back");
+    else
+      mips_test_end_test(testId, false, "Semihosting call made again");
+  }
+  //ENDTEST
+
+  //Test #30 Closing the host's output only flushes it, printing afterwards still works
+  testId = mips_test_begin_test("<INTERNAL>");
+  {
+    mips_mem_h mem2 = mips_mem_create_ram(0x10000);
+    uint32_t program[] = {
+      0x24020010, 0x24040001, 0x0000000C, 0x00408021, //s0 = close(1)
+      0x24020001, 0x2404002A, 0x0000000C,             //print int 42
+      0x2402000B, 0x24040021, 0x0000000C,             //print char '!'
+      0x2402000A, 0x0000000C                          //exit
+    };
+    const unsigned length = sizeof(program) / sizeof(program[0]);
+    for (unsigned i = 0; i < length; ++i)
+      mips_mem_write32(mem2, 0x1000 + 4 * i, program[i]);
+    mips_cpu_h cpu2 = mips_cpu_create(mem2);
+    mips_cpu_set_pc(cpu2, 0x1000);
+
+    FILE* out = tmpfile();
+    uint64_t steps = 0;
+    uint32_t s0 = 1;
+    char text[8] = {0};
+    bool ok = (out != NULL);
+    ok = ok && (mips_cpu_set_semihosting(cpu2, 1, 0x8000, NULL, out) == mips_Success);
+    ok = ok && (mips_cpu_run(cpu2, 100, &steps) == mips_ExceptionBreak) && (steps == length - 1);
+    mips_cpu_get_register(cpu2, 16, &s0);
+    ok = ok && (s0 == 0);
+    if (out != NULL){
+      rewind(out);
+      ok = ok && (fread(text, 1, sizeof(text), out) == 3) && (strcmp(text, "42!") == 0);
+      fclose(out);
+    }
+    mips_cpu_free(cpu2);
+    mips_mem_free(mem2);
+    if (ok)
+      mips_test_end_test(testId, true, "Output kept after the program closed it");
+    else
+      mips_test_end_test(testId, false, "Printing after closing the output wrong");
+  }
+  //ENDTEST
+
+  //Test #31 Files closed while a history is on are closed on the host, and opened again going back
+  testId = mips_test_begin_test("<INTERNAL>");
+  {
+    const char* name = "test_mips_semihosting.tmp";
+    mips_mem_h mem2 = mips_mem_create_ram(0x10000);
+    mips_mem_write_block(mem2, 0x2040, strlen(name) + 1, (const uint8_t*)name);
+    uint32_t program[] = {
+      0x241507D0,                                                 //s5 = 2000
+      0x2402000D, 0x24042040, 0x24050001, 0x0000000C, 0x00409821, //s3 = open(name, 1)
+      0x00402021, 0x24020010, 0x0000000C,                         //close(s3)
+      0x26B5FFFF, 0x16A0FFF6, 0x00000000,                         //while (--s5)
+      0x24020011, 0x24040007, 0x0000000C                          //exit(7)
+    };
+    const unsigned length = sizeof(program) / sizeof(program[0]);
+    for (unsigned i = 0; i < length; ++i)
+      mips_mem_write32(mem2, 0x1000 + 4 * i, program[i]);
+    mips_cpu_h cpu2 = mips_cpu_create(mem2);
+    mips_cpu_set_pc(cpu2, 0x1000);
+
+    uint64_t steps = 0;
+    int32_t code = 0;
+    uint32_t s3 = 0;
+    bool ok = (mips_cpu_set_semihosting(cpu2, 1, 0x8000, NULL, NULL) == mips_Success);
+    ok = ok && (mips_cpu_set_history(cpu2, 16) == mips_Success);
+    ok = ok && (mips_cpu_run(cpu2, 100000, &steps) == mips_ExceptionBreak) && (steps == 1 + 2000 * 11 + 2);
+    mips_cpu_get_register(cpu2, 19, &s3);
+    ok = ok && (s3 == 3) && (mips_cpu_get_exit_code(cpu2, &code) == mips_Success) && (code == 7);
+
+    //Back between the open and the close, then on with a change: the file is open again to be closed
+    ok = ok && (mips_cpu_step_back(cpu2, 2 + 11 * 500 + 6) == mips_Success);
+    ok = ok && (mips_cpu_set_register(cpu2, 19, 0) == mips_Success);
+    ok = ok && (mips_cpu_run(cpu2, 100000, &steps) == mips_ExceptionBreak) && (steps == 2 + 11 * 500 + 6);
+    mips_cpu_get_register(cpu2, 19, &s3);
+    ok = ok && (s3 == 3) && (mips_cpu_get_exit_code(cpu2, &code) == mips_Success) && (code == 7);
+    mips_cpu_free(cpu2);
+    mips_mem_free(mem2);
+    remove(name);
+    if (ok)
+      mips_test_end_test(testId, true, "Files opened and closed in a loop with a history");
+    else
+      mips_test_end_test(testId, false, "Files opened and closed in a loop with a history wrong");
+  }
+  //ENDTEST
 
   //////////TEST SUITE//////////////////
   //ALWAYS R1(result), R2, R3(operands)